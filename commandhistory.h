@@ -0,0 +1,263 @@
+#ifndef COMMANDHISTORY_H
+#define COMMANDHISTORY_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QList>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QString>
+#include <algorithm>
+#include <memory>
+#include <numeric>
+
+#include "threadpool.h"
+
+// Terminal command history shared by every tab and every running instance.
+// It is an append-only file in the app data directory, read in the
+// background at startup and topped up with whatever other instances have
+// appended since. Entries sit in one UTF-8 buffer laid out like the file; a
+// text-sorted index of distinct commands (each pointing at its newest entry)
+// answers prefix queries, and reverse search scans the buffer backwards
+class CommandHistory {
+public:
+    static constexpr qsizetype MaxEntries = 100000;
+
+    CommandHistory(const QString &fileName = defaultFileName()) : fileName(fileName) {
+        loading = runInPool<std::shared_ptr<Entries>>([fileName](QPromise<std::shared_ptr<Entries>> &promise) {
+            promise.addResult(load(fileName));
+        });
+    }
+
+    static QString defaultFileName() {
+        return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/terminal_history";
+    }
+
+    qsizetype size() {
+        return data().starts.size();
+    }
+
+    QString at(qsizetype index) {
+        return QString::fromUtf8(data().entry(index));
+    }
+
+    // Skips a repeat of the newest entry. The line is written with one
+    // O_APPEND write, so concurrent instances do not interleave
+    void append(const QString &command) {
+        QByteArray line = command.toUtf8();
+        line.replace('\n', ' ');
+        if (line.isEmpty() || (entries && size() > 0 && entries->entry(size() - 1) == line)) {
+            return;
+        }
+        QDir().mkpath(QFileInfo(fileName).absolutePath());
+        QFile file(fileName);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            file.write(line + '\n');
+        }
+        if (entries) {
+            refresh();
+        }
+    }
+
+    // Reads what other instances appended; a shorter file means one of them
+    // compacted it, so it is read again from the start
+    void refresh() {
+        Entries &current = data();
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+        const qint64 size = file.size();
+        if (size < current.fileBytes) {
+            entries = load(fileName);
+            return;
+        }
+        if (size > current.fileBytes && file.seek(current.fileBytes)) {
+            current.fileBytes += current.appendLines(file.read(size - current.fileBytes), true);
+        }
+    }
+
+    // Newest distinct command older than entry `before` starting with prefix
+    qsizetype previousWithPrefix(const QString &prefix, qsizetype before) {
+        QElapsedTimer timer;
+        timer.start();
+        const QByteArray key = prefix.toUtf8();
+        const Entries &current = data();
+        const auto [first, last] = current.prefixRange(key);
+        qsizetype best = -1;
+        for (auto it = first; it != last; ++it) {
+            if (qsizetype(*it) < before && qsizetype(*it) > best)
+                best = *it;
+        }
+        lookupNsecs = timer.nsecsElapsed();
+        return best;
+    }
+
+    // Oldest distinct command newer than entry `after` starting with prefix
+    qsizetype nextWithPrefix(const QString &prefix, qsizetype after) {
+        QElapsedTimer timer;
+        timer.start();
+        const QByteArray key = prefix.toUtf8();
+        const Entries &current = data();
+        const auto [first, last] = current.prefixRange(key);
+        qsizetype best = -1;
+        for (auto it = first; it != last; ++it) {
+            if (qsizetype(*it) > after && (best < 0 || qsizetype(*it) < best))
+                best = *it;
+        }
+        lookupNsecs = timer.nsecsElapsed();
+        return best;
+    }
+
+    // Newest entry older than `before` containing needle (Ctrl-R)
+    qsizetype searchBackward(const QString &needle, qsizetype before) {
+        QElapsedTimer timer;
+        timer.start();
+        const QByteArray key = needle.toUtf8();
+        const Entries &current = data();
+        qsizetype found = -1;
+        before = qMin(before, current.starts.size());
+        if (!key.isEmpty() && before > 0) {
+            // Entries never contain '\n', so a match cannot span two of them
+            const QByteArrayView text = QByteArrayView(current.text).first(current.entryEnd(before - 1));
+            const qsizetype position = text.lastIndexOf(key);
+            if (position >= 0) {
+                found = std::upper_bound(current.starts.begin(), current.starts.end(), quint32(position))
+                        - current.starts.begin() - 1;
+            }
+        }
+        lookupNsecs = timer.nsecsElapsed();
+        return found;
+    }
+
+    QString statistics() {
+        const Entries &current = data();
+        return QString("history: %1 entries, %2 distinct, %3 KB; last lookup %4 us")
+            .arg(current.starts.size())
+            .arg(current.distinct.size())
+            .arg(current.text.size() / 1024)
+            .arg(lookupNsecs / 1000.0, 0, 'f', 1);
+    }
+
+private:
+    struct Entries {
+        QByteArray text;          // Every entry followed by '\n', as in the file
+        QList<quint32> starts;    // Offset of each entry in text
+        QList<quint32> distinct;  // Newest entry of each distinct command, sorted by text
+        qint64 fileBytes = 0;     // Bytes of the file that text reflects
+
+        QByteArrayView entry(qsizetype index) const {
+            return QByteArrayView(text).sliced(starts[index], entryEnd(index) - starts[index]);
+        }
+
+        qsizetype entryEnd(qsizetype index) const {
+            return (index + 1 < starts.size() ? qsizetype(starts[index + 1]) : text.size()) - 1;
+        }
+
+        // Distinct commands starting with key are a contiguous run
+        std::pair<QList<quint32>::const_iterator, QList<quint32>::const_iterator> prefixRange(QByteArrayView key) const {
+            const auto first = std::lower_bound(distinct.begin(), distinct.end(), key,
+                                                [this](quint32 index, QByteArrayView value) {
+                return entry(index) < value;
+            });
+            const auto last = std::partition_point(first, distinct.end(), [this, key](quint32 index) {
+                return entry(index).startsWith(key);
+            });
+            return {first, last};
+        }
+
+        // Appends the complete lines in bytes and returns how many bytes they
+        // took; a line still being written by another instance waits
+        qsizetype appendLines(QByteArrayView bytes, bool updateIndex) {
+            qsizetype consumed = 0;
+            for (qsizetype newline; (newline = bytes.indexOf('\n', consumed)) >= 0; consumed = newline + 1) {
+                const QByteArrayView line = bytes.sliced(consumed, newline - consumed);
+                if (line.isEmpty()) {
+                    continue;
+                }
+                starts.append(quint32(text.size()));
+                text.append(line);
+                text.append('\n');
+                if (updateIndex) {
+                    index(starts.size() - 1);
+                }
+            }
+            return consumed;
+        }
+
+        void index(qsizetype newest) {
+            const QByteArrayView key = entry(newest);
+            const auto it = std::lower_bound(distinct.begin(), distinct.end(), key,
+                                             [this](quint32 index, QByteArrayView value) {
+                return entry(index) < value;
+            });
+            if (it != distinct.end() && entry(*it) == key) {
+                distinct[it - distinct.begin()] = quint32(newest);
+            } else {
+                distinct.insert(it - distinct.begin(), quint32(newest));
+            }
+        }
+
+        // Stable sort keeps equal commands oldest first, so the last of each
+        // run is the newest
+        void buildIndex() {
+            QList<quint32> all(starts.size());
+            std::iota(all.begin(), all.end(), 0u);
+            std::stable_sort(all.begin(), all.end(), [this](quint32 a, quint32 b) {
+                return entry(a) < entry(b);
+            });
+            distinct.clear();
+            for (qsizetype i = 0; i < all.size(); ++i) {
+                if (i + 1 == all.size() || entry(all[i]) != entry(all[i + 1]))
+                    distinct.append(all[i]);
+            }
+        }
+    };
+
+    // Runs on the pool at startup. A file past twice the limit is cut back
+    // to the newest MaxEntries lines
+    static std::shared_ptr<Entries> load(const QString &fileName) {
+        auto entries = std::make_shared<Entries>();
+        QFile file(fileName);
+        if (file.open(QIODevice::ReadOnly)) {
+            entries->fileBytes = entries->appendLines(file.readAll(), false);
+        }
+        if (entries->starts.size() > 2 * MaxEntries) {
+            const qsizetype firstKept = entries->starts[entries->starts.size() - MaxEntries];
+            QSaveFile compacted(fileName);
+            if (compacted.open(QIODevice::WriteOnly)) {
+                compacted.write(entries->text.constData() + firstKept, entries->text.size() - firstKept);
+                if (compacted.commit()) {
+                    entries->text.remove(0, firstKept);
+                    entries->starts.remove(0, entries->starts.size() - MaxEntries);
+                    for (quint32 &start : entries->starts)
+                        start -= quint32(firstKept);
+                    entries->fileBytes = entries->text.size();
+                }
+            }
+        }
+        entries->buildIndex();
+        return entries;
+    }
+
+    // The first use waits for the background load if it is still running
+    Entries &data() {
+        if (!entries) {
+            entries = loading.result();
+            refresh();
+        }
+        return *entries;
+    }
+
+    QString fileName;
+    QFuture<std::shared_ptr<Entries>> loading;
+    std::shared_ptr<Entries> entries;
+    qint64 lookupNsecs = 0;
+};
+
+#endif // COMMANDHISTORY_H
@@ -0,0 +1,48 @@
+#ifndef COMPLETIONTEXT_H
+#define COMPLETIONTEXT_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QCryptographicHash>
+#include <QString>
+#include <QStringView>
+
+// Text handling for inline completions, apart from the editor: what a
+// request is remembered under, and how a model's reply is trimmed down to
+// the text to insert at the cursor
+struct CompletionText {
+    // Same text around the cursor, same suggestion
+    static QByteArray key(const QString &prefix, const QString &suffix) {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(prefix.toUtf8());
+        hash.addData(QByteArrayView("\0", 1));
+        hash.addData(suffix.toUtf8());
+        return hash.result();
+    }
+
+    // Strips code fences, trailing whitespace and a repeat of linePrefix,
+    // the cursor's line up to the cursor
+    static QString clean(QString completion, const QString &linePrefix) {
+        if (completion.startsWith("```")) {
+            completion.remove(0, completion.indexOf('\n') + 1);
+            const qsizetype fence = completion.lastIndexOf("```");
+            if (fence >= 0)
+                completion.truncate(fence);
+        }
+        while (!completion.isEmpty() && completion.back().isSpace())
+            completion.chop(1);
+        const QString trimmed = linePrefix.trimmed();
+        if (!trimmed.isEmpty() && completion.trimmed().startsWith(trimmed)) {
+            completion = completion.mid(completion.indexOf(trimmed) + trimmed.size());
+        }
+        return completion;
+    }
+
+    // True when typed, entered after the first consumed characters of
+    // suggestion, is what the suggestion says next
+    static bool continues(QStringView suggestion, qsizetype consumed, QStringView typed) {
+        return suggestion.mid(consumed).startsWith(typed);
+    }
+};
+
+#endif // COMPLETIONTEXT_H
@@ -0,0 +1,419 @@
+#ifndef CPPLEXER_H
+#define CPPLEXER_H
+
+#include <QChar>
+#include <QStringView>
+
+// Token classes produced by CppLexer; CodeHighlighter keeps one format per kind.
+// Brackets carry no format and are reported for BracketIndex
+enum class TokenKind : quint8 {
+    Keyword,
+    Type,
+    Function,
+    Comment,
+    String,
+    Number,
+    Preprocessor,
+    Bracket,
+    Count
+};
+
+// Compile-time keyword table. Identifiers are hashed on their length and boundary
+// characters into an open-addressed table, so a lookup costs one or two probes
+namespace CppKeywords {
+    constexpr const char *words[] = {
+        "alignas", "alignof", "auto", "bool", "break", "case", "catch", "char",
+        "char16_t", "char32_t", "char8_t", "class", "const", "consteval", "constexpr",
+        "constinit", "const_cast", "continue", "decltype", "default", "delete", "do",
+        "double", "dynamic_cast", "else", "emit", "enum", "explicit", "export", "extern",
+        "false", "final", "float", "for", "friend", "goto", "if", "inline", "int", "long",
+        "mutable", "namespace", "new", "noexcept", "nullptr", "operator", "override",
+        "private", "protected", "public", "register", "reinterpret_cast", "return",
+        "short", "signals", "signed", "sizeof", "slots", "static", "static_assert",
+        "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
+        "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
+        "virtual", "void", "volatile", "wchar_t", "while"
+    };
+
+    constexpr int WordCount = int(sizeof(words) / sizeof(words[0]));
+    constexpr int MaxLength = 16;
+    constexpr unsigned TableSize = 512;
+
+    constexpr int length(const char *word) {
+        int n = 0;
+        while (word[n])
+            ++n;
+        return n;
+    }
+
+    constexpr unsigned hash(int length, unsigned first, unsigned second, unsigned last) {
+        return (unsigned(length) * 31u + first * 7u + second * 3u + last) & (TableSize - 1);
+    }
+
+    struct Table {
+        quint8 slots[TableSize] = {};
+    };
+
+    constexpr Table buildTable() {
+        Table table;
+        for (int i = 0; i < WordCount; ++i) {
+            const char *word = words[i];
+            const int n = length(word);
+            unsigned slot = hash(n, quint8(word[0]), quint8(word[1]), quint8(word[n - 1]));
+            while (table.slots[slot] != 0)
+                slot = (slot + 1) & (TableSize - 1);
+            table.slots[slot] = quint8(i + 1);
+        }
+        return table;
+    }
+
+    constexpr Table table = buildTable();
+
+    inline bool contains(QStringView word) {
+        const int n = int(word.size());
+        if (n < 2 || n > MaxLength)
+            return false;
+
+        const char16_t first = word[0].unicode();
+        const char16_t second = word[1].unicode();
+        const char16_t last = word[n - 1].unicode();
+        if (first > 0x7f || second > 0x7f || last > 0x7f)
+            return false;
+
+        for (unsigned slot = hash(n, first, second, last); table.slots[slot] != 0;
+             slot = (slot + 1) & (TableSize - 1)) {
+            const char *candidate = words[table.slots[slot] - 1];
+            int i = 0;
+            while (i < n && candidate[i] && char16_t(candidate[i]) == word[i].unicode())
+                ++i;
+            if (i == n && candidate[i] == '\0')
+                return true;
+        }
+        return false;
+    }
+}
+
+// Single-pass C++ lexer. Each line is scanned once; everything that can span lines
+// (block comments, raw strings, backslash-continued directives, strings and line
+// comments) is carried in the integer state handed from block to block
+class CppLexer {
+public:
+    enum State {
+        Normal = 0,
+        BlockComment = 1,
+        LineComment = 2,
+        StringLiteral = 3,
+        RawString = 4,
+        Directive = 5
+    };
+
+    static constexpr int KindMask = 0x0f;
+    // Set while inside a directive, so a block comment that ends mid-directive
+    // resumes preprocessor colouring
+    static constexpr int DirectiveFlag = 0x10;
+    // Raw strings keep a hash of their delimiter in the upper bits
+    static constexpr int DelimiterShift = 8;
+    static constexpr int DelimiterMask = 0x3fffff;
+
+    // Lexes one line starting in `state`, calling emit(start, length, kind) for every
+    // token worth colouring, and returns the state at the end of the line
+    template <typename Emit>
+    static int lex(QStringView text, int state, Emit &&emit) {
+        const int n = int(text.size());
+        int i = 0;
+        bool inDirective = (state & DirectiveFlag) != 0;
+        int directiveStart = inDirective ? 0 : -1;
+
+        auto flushDirective = [&](int end) {
+            if (directiveStart >= 0 && end > directiveStart)
+                emit(directiveStart, end - directiveStart, TokenKind::Preprocessor);
+            directiveStart = -1;
+        };
+
+        switch (state & KindMask) {
+        case BlockComment: {
+            const int end = findCommentEnd(text, 0);
+            if (end < 0) {
+                emit(0, n, TokenKind::Comment);
+                return state;
+            }
+            emit(0, end, TokenKind::Comment);
+            i = end;
+            directiveStart = inDirective ? i : -1;
+            break;
+        }
+        case LineComment:
+            emit(0, n, TokenKind::Comment);
+            return endsWithBackslash(text) ? (LineComment | (state & DirectiveFlag)) : Normal;
+        case StringLiteral: {
+            const int end = findQuoteEnd(text, 0, u'"');
+            if (end < 0) {
+                emit(0, n, TokenKind::String);
+                return endsWithBackslash(text) ? StringLiteral : Normal;
+            }
+            emit(0, end, TokenKind::String);
+            i = end;
+            break;
+        }
+        case RawString: {
+            const int end = findRawStringEnd(text, 0, (state >> DelimiterShift) & DelimiterMask);
+            if (end < 0) {
+                emit(0, n, TokenKind::String);
+                return state;
+            }
+            emit(0, end, TokenKind::String);
+            i = end;
+            break;
+        }
+        case Directive:
+            inDirective = true;
+            directiveStart = 0;
+            break;
+        default:
+            break;
+        }
+
+        bool lineStart = !inDirective;
+        while (i < n) {
+            const QChar ch = text[i];
+            const char16_t c = ch.unicode();
+
+            if (ch.isSpace()) {
+                ++i;
+                continue;
+            }
+
+            // Literals in a directive body keep its colour, but neither their
+            // brackets nor a "//" inside them count (#define URL "http://x")
+            if (inDirective && (c == u'"' || (c == u'\'' && !isDigitSeparator(text, i)))) {
+                const int end = findQuoteEnd(text, i + 1, c);
+                i = end < 0 ? n : end;
+                continue;
+            }
+
+            if (c == u'/' && i + 1 < n && text[i + 1].unicode() == u'/') {
+                flushDirective(i);
+                emit(i, n - i, TokenKind::Comment);
+                if (endsWithBackslash(text))
+                    return LineComment | (inDirective ? DirectiveFlag : 0);
+                return Normal;
+            }
+
+            if (c == u'/' && i + 1 < n && text[i + 1].unicode() == u'*') {
+                flushDirective(i);
+                const int end = findCommentEnd(text, i + 2);
+                if (end < 0) {
+                    emit(i, n - i, TokenKind::Comment);
+                    return BlockComment | (inDirective ? DirectiveFlag : 0);
+                }
+                emit(i, end - i, TokenKind::Comment);
+                i = end;
+                if (inDirective)
+                    directiveStart = i;
+                continue;
+            }
+
+            if (inDirective) {
+                // Directive bodies are coloured as a whole; only comments break them
+                // up, and brackets outside literals are reported
+                if (isBracket(c))
+                    emit(i, 1, TokenKind::Bracket);
+                ++i;
+                continue;
+            }
+
+            if (c == u'#' && lineStart) {
+                inDirective = true;
+                directiveStart = i++;
+                continue;
+            }
+            lineStart = false;
+
+            if (isIdentifierStart(c)) {
+                const int start = i;
+                while (i < n && isIdentifierChar(text[i].unicode()))
+                    ++i;
+                const QStringView word = text.mid(start, i - start);
+                const char16_t next = i < n ? text[i].unicode() : u'\0';
+
+                if (next == u'"' && isRawStringPrefix(word)) {
+                    const int end = lexRawString(text, start, i, emit);
+                    if (end < 0)
+                        return RawString | (rawDelimiterHash(text, i + 1) << DelimiterShift);
+                    i = end;
+                } else if ((next == u'"' || next == u'\'') && isStringPrefix(word)) {
+                    const int end = findQuoteEnd(text, i + 1, next);
+                    if (end < 0) {
+                        emit(start, n - start, TokenKind::String);
+                        return (next == u'"' && endsWithBackslash(text)) ? StringLiteral : Normal;
+                    }
+                    emit(start, end - start, TokenKind::String);
+                    i = end;
+                } else if (CppKeywords::contains(word)) {
+                    emit(start, i - start, TokenKind::Keyword);
+                } else if (next == u':' && i + 1 < n && text[i + 1].unicode() == u':') {
+                    emit(start, i - start, TokenKind::Type);
+                } else if (next == u'(') {
+                    emit(start, i - start, TokenKind::Function);
+                } else if (isQtClassName(word) || (start >= 2 && text[start - 1].unicode() == u':'
+                                                   && text[start - 2].unicode() == u':')) {
+                    emit(start, i - start, TokenKind::Type);
+                }
+                continue;
+            }
+
+            if (isDigit(c) || (c == u'.' && i + 1 < n && isDigit(text[i + 1].unicode()))) {
+                const int start = i++;
+                while (i < n) {
+                    const char16_t d = text[i].unicode();
+                    if ((d == u'+' || d == u'-') && isExponent(text[i - 1].unicode())) {
+                        ++i;
+                    } else if (isIdentifierChar(d) || d == u'.' || d == u'\'') {
+                        ++i;
+                    } else {
+                        break;
+                    }
+                }
+                emit(start, i - start, TokenKind::Number);
+                continue;
+            }
+
+            if (c == u'"' || c == u'\'') {
+                const int end = findQuoteEnd(text, i + 1, c);
+                if (end < 0) {
+                    emit(i, n - i, TokenKind::String);
+                    return (c == u'"' && endsWithBackslash(text)) ? StringLiteral : Normal;
+                }
+                emit(i, end - i, TokenKind::String);
+                i = end;
+                continue;
+            }
+
+            if (isBracket(c))
+                emit(i, 1, TokenKind::Bracket);
+            ++i;
+        }
+
+        if (inDirective) {
+            flushDirective(n);
+            if (endsWithBackslash(text))
+                return Directive | DirectiveFlag;
+        }
+        return Normal;
+    }
+
+private:
+    static bool isDigit(char16_t c) { return c >= u'0' && c <= u'9'; }
+
+    static bool isBracket(char16_t c) {
+        return c == u'(' || c == u')' || c == u'{' || c == u'}' || c == u'[' || c == u']';
+    }
+
+    static bool isIdentifierStart(char16_t c) {
+        return (c >= u'a' && c <= u'z') || (c >= u'A' && c <= u'Z') || c == u'_';
+    }
+
+    static bool isIdentifierChar(char16_t c) { return isIdentifierStart(c) || isDigit(c); }
+
+    static bool isExponent(char16_t c) {
+        return c == u'e' || c == u'E' || c == u'p' || c == u'P';
+    }
+
+    // A quote between digits of a number such as 1'000 does not open a literal
+    static bool isDigitSeparator(QStringView text, int i) {
+        if (i + 1 >= int(text.size()) || !isIdentifierChar(text[i + 1].unicode()))
+            return false;
+        int start = i;
+        while (start > 0 && (isIdentifierChar(text[start - 1].unicode()) || text[start - 1].unicode() == u'\''))
+            --start;
+        return start < i && isDigit(text[start].unicode());
+    }
+
+    static bool endsWithBackslash(QStringView text) {
+        return !text.isEmpty() && text.back().unicode() == u'\\';
+    }
+
+    static bool isQtClassName(QStringView word) {
+        if (word.size() < 2 || word[0].unicode() != u'Q')
+            return false;
+        for (QChar c : word) {
+            if (!((c.unicode() >= u'a' && c.unicode() <= u'z') || (c.unicode() >= u'A' && c.unicode() <= u'Z')))
+                return false;
+        }
+        return true;
+    }
+
+    static bool isStringPrefix(QStringView word) {
+        return word == u"L" || word == u"u" || word == u"U" || word == u"u8";
+    }
+
+    static bool isRawStringPrefix(QStringView word) {
+        return word == u"R" || word == u"LR" || word == u"uR" || word == u"UR" || word == u"u8R";
+    }
+
+    // Returns the index just past the closing "*/", or -1
+    static int findCommentEnd(QStringView text, int from) {
+        const int end = int(text.indexOf(u"*/", from));
+        return end < 0 ? -1 : end + 2;
+    }
+
+    // Returns the index just past the closing quote, or -1 if the line ends first
+    static int findQuoteEnd(QStringView text, int from, char16_t quote) {
+        const int n = int(text.size());
+        for (int i = from; i < n; ++i) {
+            const char16_t c = text[i].unicode();
+            if (c == u'\\')
+                ++i;
+            else if (c == quote)
+                return i + 1;
+        }
+        return -1;
+    }
+
+    static int hashDelimiter(QStringView delimiter) {
+        quint32 h = 2166136261u;
+        for (QChar c : delimiter)
+            h = (h ^ c.unicode()) * 16777619u;
+        return int(h & DelimiterMask);
+    }
+
+    // Hash of the delimiter of a raw string whose opening quote is at quote - 1
+    static int rawDelimiterHash(QStringView text, int from) {
+        const int paren = int(text.indexOf(u'(', from));
+        return hashDelimiter(text.mid(from, paren - from));
+    }
+
+    // Finds ")delim\"" for a delimiter known only by its hash; returns the index past it
+    static int findRawStringEnd(QStringView text, int from, int delimiterHash) {
+        const int n = int(text.size());
+        for (int i = int(text.indexOf(u')', from)); i >= 0; i = int(text.indexOf(u')', i + 1))) {
+            for (int j = i + 1; j < n && j - i - 1 <= 16; ++j) {
+                if (text[j].unicode() == u'"') {
+                    if (hashDelimiter(text.mid(i + 1, j - i - 1)) == delimiterHash)
+                        return j + 1;
+                    break;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Lexes R"delim(...)delim" starting at `start` (prefix) with the quote at `quote`.
+    // Returns the index past the literal, or -1 if it continues on the next line
+    template <typename Emit>
+    static int lexRawString(QStringView text, int start, int quote, Emit &&emit) {
+        const int n = int(text.size());
+        const int paren = int(text.indexOf(u'(', quote + 1));
+        if (paren < 0 || paren - quote - 1 > 16) {
+            // Not a valid raw string opener; colour it like an ordinary literal
+            const int end = findQuoteEnd(text, quote + 1, u'"');
+            emit(start, (end < 0 ? n : end) - start, TokenKind::String);
+            return end < 0 ? n : end;
+        }
+        const int end = findRawStringEnd(text, paren + 1, hashDelimiter(text.mid(quote + 1, paren - quote - 1)));
+        emit(start, (end < 0 ? n : end) - start, TokenKind::String);
+        return end;
+    }
+};
+
+#endif // CPPLEXER_H
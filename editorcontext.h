@@ -0,0 +1,235 @@
+#ifndef EDITORCONTEXT_H
+#define EDITORCONTEXT_H
+
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <utility>
+
+// Packs what the editor is looking at into a prompt preamble under a token
+// budget: the selection, the function around the cursor and then the file in
+// ChunkLines-line chunks, nearest to the cursor first. Serialised chunks are
+// cached under a hash of their first block's position and their blocks'
+// revisions and lengths, so only chunks touched since the last request, or
+// moved by an edit above them, are copied out of the document again
+class EditorContextBuilder {
+public:
+    static constexpr int ChunkLines = 32;
+    static constexpr int DefaultTokenBudget = 8000;
+
+    // What the editor shows. document is null while there is nothing to
+    // send (a file still loading, or one in the large-file viewer); the
+    // function lines are -1 when the cursor is not inside one
+    struct Source {
+        const QTextDocument *document = nullptr;
+        QTextCursor cursor;
+        QString fileName;
+        int functionFirst = -1;
+        int functionLast = -1;
+    };
+
+    struct Stats {
+        qint64 buildNsecs = 0;
+        int tokens = 0;
+        int chunksReused = 0;
+        int chunksSerialized = 0;
+        int cachedChunks = 0;
+    };
+
+    // Roughly four characters per token for code and English alike
+    static int estimateTokens(qsizetype chars) {
+        return int(chars / 4) + 1;
+    }
+
+    // Returns an empty string when there is nothing to send. summary lists
+    // what was included, for the chat transcript
+    QString build(const Source &source, int tokenBudget, QString *summary) {
+        QElapsedTimer timer;
+        timer.start();
+        stats = Stats();
+        summary->clear();
+        if (!source.document || source.document->isEmpty()) {
+            return QString();
+        }
+        if (source.fileName != fileName) {
+            fileName = source.fileName;
+            chunks.clear();
+        }
+
+        const QTextDocument *document = source.document;
+        const QTextCursor &cursor = source.cursor;
+        const int cursorLine = cursor.blockNumber();
+        const QString name = fileName.isEmpty() ? QString("untitled") : QFileInfo(fileName).fileName();
+        QStringList parts;
+        QStringList included;
+        int remaining = tokenBudget;
+
+        // Selection first, then the enclosing function, each at most half of
+        // what is left
+        if (cursor.hasSelection()) {
+            const int selectionFirst = document->findBlock(cursor.selectionStart()).blockNumber();
+            const int selectionLast = document->findBlock(cursor.selectionEnd()).blockNumber();
+            QString text = cursor.selectedText().replace(QChar::ParagraphSeparator, '\n');
+            text.truncate(remaining * 2);
+            parts.append(section(QString("Selected in %1, lines %2-%3").arg(name).arg(selectionFirst + 1).arg(selectionLast + 1), text));
+            remaining -= estimateTokens(text.size());
+            included.append("selection");
+        }
+
+        int functionFirst = -1;
+        int functionLast = -1;
+        if (source.functionFirst >= 0) {
+            const QString text = linesAround(document, source.functionFirst, source.functionLast, cursorLine,
+                                             remaining * 2, &functionFirst, &functionLast);
+            parts.append(section(QString("Function around the cursor in %1, lines %2-%3")
+                                     .arg(name).arg(functionFirst + 1).arg(functionLast + 1), text));
+            remaining -= estimateTokens(text.size());
+            included.append("function");
+        }
+
+        // Fill the rest with chunks spreading out from the cursor, skipping
+        // any already covered by the function
+        QHash<size_t, Chunk> used;
+        QMap<int, QString> picked;
+        const int chunkCount = (document->blockCount() + ChunkLines - 1) / ChunkLines;
+        const int home = cursorLine / ChunkLines;
+        bool full = false;
+        for (int step = 0; !full && (home - step >= 0 || home + step < chunkCount); ++step) {
+            for (const int index : {home - step, home + step}) {
+                if (index < 0 || index >= chunkCount || picked.contains(index))
+                    continue;
+                const int first = index * ChunkLines;
+                const int last = qMin(first + ChunkLines, document->blockCount()) - 1;
+                if (functionFirst >= 0 && first >= functionFirst && last <= functionLast)
+                    continue;
+                const auto [key, chunk] = serialize(document, first, last);
+                if (chunk.tokens > remaining) {
+                    full = true;
+                    break;
+                }
+                used.insert(key, chunk);
+                picked.insert(index, chunk.text);
+                remaining -= chunk.tokens;
+            }
+        }
+        // Adjacent chunks read as one excerpt
+        for (auto it = picked.cbegin(); it != picked.cend();) {
+            const int first = it.key() * ChunkLines;
+            QString text;
+            int next = it.key();
+            for (; it != picked.cend() && it.key() == next; ++it, ++next)
+                text += it.value();
+            const int last = qMin(next * ChunkLines, document->blockCount()) - 1;
+            parts.append(section(QString("%1, lines %2-%3").arg(name).arg(first + 1).arg(last + 1), text));
+        }
+        if (!picked.isEmpty()) {
+            included.append(QString("%1 chunk%2").arg(picked.size()).arg(picked.size() == 1 ? "" : "s"));
+        }
+
+        chunks = std::move(used);
+        stats.tokens = tokenBudget - remaining;
+        stats.cachedChunks = int(chunks.size());
+        stats.buildNsecs = timer.nsecsElapsed();
+        if (parts.isEmpty()) {
+            return QString();
+        }
+        *summary = QString("%1, ~%2 tokens").arg(included.join(", ")).arg(stats.tokens);
+        return "Context from the code editor:\n\n" + parts.join("\n\n");
+    }
+
+    // Counters of the last build
+    const Stats &lastStats() const {
+        return stats;
+    }
+
+    QString statistics() const {
+        return QString("context: %1 tokens in %2 us; chunks %3 reused, %4 serialised, %5 cached")
+            .arg(stats.tokens)
+            .arg(stats.buildNsecs / 1000.0, 0, 'f', 1)
+            .arg(stats.chunksReused)
+            .arg(stats.chunksSerialized)
+            .arg(stats.cachedChunks);
+    }
+
+private:
+    struct Chunk {
+        QString text;
+        int tokens = 0;
+    };
+
+    static QString section(const QString &title, const QString &text) {
+        return title + ":\n```\n" + text + (text.endsWith('\n') ? "" : "\n") + "```";
+    }
+
+    // Lines first..last, from the cache when none of their blocks changed
+    std::pair<size_t, Chunk> serialize(const QTextDocument *document, int first, int last) {
+        QTextBlock block = document->findBlockByNumber(first);
+        size_t key = qHash(block.position());
+        for (QTextBlock b = block; b.isValid() && b.blockNumber() <= last; b = b.next())
+            key = qHashMulti(key, b.revision(), b.length());
+
+        const auto cached = chunks.constFind(key);
+        if (cached != chunks.constEnd()) {
+            ++stats.chunksReused;
+            return {key, *cached};
+        }
+        Chunk chunk;
+        for (; block.isValid() && block.blockNumber() <= last; block = block.next()) {
+            chunk.text += block.text();
+            chunk.text += '\n';
+        }
+        chunk.tokens = estimateTokens(chunk.text.size());
+        chunks.insert(key, chunk);
+        ++stats.chunksSerialized;
+        return {key, chunk};
+    }
+
+    // Lines first..last, or as many as fit in maxChars centred on line center
+    static QString linesAround(const QTextDocument *document, int first, int last, int center, int maxChars,
+                               int *shownFirst, int *shownLast) {
+        int top = qBound(first, center, last);
+        int bottom = top;
+        qsizetype chars = document->findBlockByNumber(top).length();
+        for (bool grew = true; grew;) {
+            grew = false;
+            if (top > first) {
+                const int length = document->findBlockByNumber(top - 1).length();
+                if (chars + length <= maxChars) {
+                    --top;
+                    chars += length;
+                    grew = true;
+                }
+            }
+            if (bottom < last) {
+                const int length = document->findBlockByNumber(bottom + 1).length();
+                if (chars + length <= maxChars) {
+                    ++bottom;
+                    chars += length;
+                    grew = true;
+                }
+            }
+        }
+        QString text;
+        text.reserve(chars);
+        for (QTextBlock block = document->findBlockByNumber(top); block.isValid() && block.blockNumber() <= bottom;
+             block = block.next()) {
+            text += block.text();
+            text += '\n';
+        }
+        *shownFirst = top;
+        *shownLast = bottom;
+        return text;
+    }
+
+    QString fileName;
+    QHash<size_t, Chunk> chunks;
+    Stats stats;
+};
+
+#endif // EDITORCONTEXT_H
@@ -0,0 +1,693 @@
+#ifndef GEMINICLIENT_H
+#define GEMINICLIENT_H
+
+// The Gemini API client shared by the chat panel and inline completion, kept
+// apart from the widgets so tests can run it against a local stub server
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QObject>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+#include <QUrl>
+#include <array>
+#include <cmath>
+#include <optional>
+
+// Incremental server-sent events decoder. Bytes arrive in whatever pieces
+// the network hands over; complete events come out as their joined data
+// lines. Event names, ids, retry hints and comments are not used by the
+// Gemini stream and are skipped
+class SseParser {
+public:
+    QList<QByteArray> feed(QByteArrayView bytes) {
+        buffer.append(bytes);
+        QList<QByteArray> events;
+        qsizetype start = 0;
+        for (qsizetype newline; (newline = buffer.indexOf('\n', start)) >= 0; start = newline + 1) {
+            QByteArrayView line = QByteArrayView(buffer).sliced(start, newline - start);
+            if (line.endsWith('\r')) {
+                line.chop(1);
+            }
+            if (line.isEmpty()) {
+                if (hasData) {
+                    events.append(data);
+                }
+                data.clear();
+                hasData = false;
+            } else if (line.startsWith("data:")) {
+                line = line.sliced(5);
+                if (line.startsWith(' ')) {
+                    line = line.sliced(1);
+                }
+                if (hasData) {
+                    data.append('\n');
+                }
+                data.append(line);
+                hasData = true;
+            }
+        }
+        buffer.remove(0, start);
+        return events;
+    }
+
+    // A stream that closes without the final blank line still delivers its
+    // last event
+    QList<QByteArray> finish() {
+        QList<QByteArray> events = feed("\n\n");
+        reset();
+        return events;
+    }
+
+    void reset() {
+        buffer.clear();
+        data.clear();
+        hasData = false;
+    }
+
+private:
+    QByteArray buffer;  // Unterminated tail of the last chunk
+    QByteArray data;
+    bool hasData = false;
+};
+
+// Latency distribution in power-of-two millisecond buckets: bucket i counts
+// samples under 2^i ms and the last one everything slower. Percentiles are
+// read off bucket bounds, which is as precise as a diagnostics view needs
+class LatencyHistogram {
+public:
+    static constexpr int Buckets = 18;
+
+    void add(qint64 ms) {
+        int bucket = 0;
+        while (bucket + 1 < Buckets && (qint64(1) << bucket) <= ms)
+            ++bucket;
+        ++counts[bucket];
+        ++total;
+        sum += ms;
+        maximum = qMax(maximum, ms);
+    }
+
+    qint64 count() const {
+        return total;
+    }
+
+    // Upper bound of the bucket holding the p-th fraction of samples
+    qint64 percentile(double p) const {
+        const qint64 target = qMax<qint64>(1, qint64(std::ceil(total * p)));
+        qint64 seen = 0;
+        for (int i = 0; i < Buckets; ++i) {
+            seen += counts[i];
+            if (seen >= target)
+                return qMin(qint64(1) << i, maximum);
+        }
+        return maximum;
+    }
+
+    QString format() const {
+        if (total == 0) {
+            return "no samples";
+        }
+        return QString("n=%1 mean %2 ms, p50 <%3 ms, p95 <%4 ms, max %5 ms")
+            .arg(total)
+            .arg(sum / total)
+            .arg(percentile(0.5))
+            .arg(percentile(0.95))
+            .arg(maximum);
+    }
+
+private:
+    std::array<qint64, Buckets> counts{};
+    qint64 total = 0;
+    qint64 sum = 0;
+    qint64 maximum = 0;
+};
+
+// Content-addressed store of complete Gemini answers. The key is a SHA-256
+// of the endpoint, the model and the request body with its JSON
+// canonicalised and its prompt text trimmed, so a prompt resent with stray
+// whitespace still hits but one sent to another server does not.
+// Recent answers sit in an LRU QCache; every answer is also written to a
+// small compressed file under the cache directory, so hits survive a
+// restart. Entries older than the TTL count as misses and are deleted
+class ResponseCache {
+public:
+    static constexpr int DefaultTtlHours = 24;
+    static constexpr int MemoryBytes = 8 << 20;
+
+    struct Counters {
+        qint64 memoryHits = 0;
+        qint64 diskHits = 0;
+        qint64 misses = 0;
+        qint64 stores = 0;
+        qint64 expired = 0;
+    };
+
+    ResponseCache(const QString &directory = defaultDirectory()) : directory(directory) {
+        memory.setMaxCost(MemoryBytes);
+        setTtlHours(QSettings("MyDevApp", "GeminiAPI").value("cacheTtlHours", DefaultTtlHours).toInt());
+    }
+
+    static QString defaultDirectory() {
+        return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/gemini";
+    }
+
+    // Zero turns the cache off
+    void setTtlHours(int hours) {
+        setTtlMs(qint64(hours) * 3600 * 1000);
+    }
+
+    void setTtlMs(qint64 ms) {
+        ttlMs = ms;
+        if (ttlMs > 0) {
+            prune();
+        }
+    }
+
+    int ttlHours() const {
+        return int(ttlMs / (3600 * 1000));
+    }
+
+    bool isEnabled() const {
+        return ttlMs > 0;
+    }
+
+    // endpoint is the client's normalised API base
+    static QByteArray key(const QString &endpoint, const QString &model, const QJsonObject &body) {
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        hash.addData(endpoint.toUtf8());
+        hash.addData(QByteArrayView("\0", 1));
+        hash.addData(model.toUtf8());
+        hash.addData(QByteArrayView("\0", 1));
+        hash.addData(QJsonDocument(normalized(body).toObject()).toJson(QJsonDocument::Compact));
+        return hash.result().toHex();
+    }
+
+    bool lookup(const QByteArray &key, QString *text) {
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        if (Entry *entry = memory.object(key)) {
+            if (now - entry->storedAt < ttlMs) {
+                ++counts.memoryHits;
+                *text = entry->text;
+                return true;
+            }
+            memory.remove(key);
+            QFile::remove(path(key));
+            ++counts.expired;
+        } else if (std::optional<Entry> stored = read(key)) {
+            if (now - stored->storedAt < ttlMs) {
+                ++counts.diskHits;
+                *text = stored->text;
+                memory.insert(key, new Entry(*stored), int(qMin<qsizetype>(stored->text.size() * 2, MemoryBytes)));
+                return true;
+            }
+            QFile::remove(path(key));
+            ++counts.expired;
+        }
+        ++counts.misses;
+        return false;
+    }
+
+    void store(const QByteArray &key, const QString &text) {
+        Entry entry{text, QDateTime::currentMSecsSinceEpoch()};
+        QDir().mkpath(QFileInfo(path(key)).absolutePath());
+        QSaveFile file(path(key));
+        if (file.open(QIODevice::WriteOnly)) {
+            QDataStream stream(&file);
+            stream << Magic << entry.storedAt << qCompress(text.toUtf8());
+            file.commit();
+        }
+        memory.insert(key, new Entry(entry), int(qMin<qsizetype>(text.size() * 2, MemoryBytes)));
+        ++counts.stores;
+    }
+
+    const Counters &counters() const {
+        return counts;
+    }
+
+    QString statistics() const {
+        const qint64 hits = counts.memoryHits + counts.diskHits;
+        const qint64 lookups = hits + counts.misses;
+        return QString("cache: %1 hits (%2 memory, %3 disk), %4 misses, %5% hit rate\n"
+                       "cache: %6 stored, %7 expired, %8 in memory, TTL %9 h")
+            .arg(hits)
+            .arg(counts.memoryHits)
+            .arg(counts.diskHits)
+            .arg(counts.misses)
+            .arg(lookups > 0 ? 100 * hits / lookups : 0)
+            .arg(counts.stores)
+            .arg(counts.expired)
+            .arg(memory.count())
+            .arg(ttlHours());
+    }
+
+private:
+    static constexpr quint32 Magic = 0x47524331;  // "GRC1"
+
+    struct Entry {
+        QString text;
+        qint64 storedAt = 0;
+    };
+
+    // Object keys are already sorted by QJsonObject; prompt text is trimmed
+    // and its line endings unified
+    static QJsonValue normalized(const QJsonValue &value) {
+        if (value.isObject()) {
+            QJsonObject object = value.toObject();
+            for (auto it = object.begin(); it != object.end(); ++it) {
+                if (it.key() == "text" && it.value().isString()) {
+                    *it = it.value().toString().replace("\r\n", "\n").trimmed();
+                } else {
+                    *it = normalized(it.value());
+                }
+            }
+            return object;
+        }
+        if (value.isArray()) {
+            QJsonArray array = value.toArray();
+            for (auto it = array.begin(); it != array.end(); ++it)
+                *it = normalized(*it);
+            return array;
+        }
+        return value;
+    }
+
+    // Files fan out over 256 directories by the first byte of the key
+    QString path(const QByteArray &key) const {
+        return directory + '/' + QString::fromLatin1(key.first(2)) + '/' + QString::fromLatin1(key);
+    }
+
+    std::optional<Entry> read(const QByteArray &key) const {
+        QFile file(path(key));
+        if (!file.open(QIODevice::ReadOnly)) {
+            return std::nullopt;
+        }
+        QDataStream stream(&file);
+        quint32 magic = 0;
+        Entry entry;
+        QByteArray compressed;
+        stream >> magic >> entry.storedAt >> compressed;
+        if (magic != Magic || stream.status() != QDataStream::Ok) {
+            return std::nullopt;
+        }
+        entry.text = QString::fromUtf8(qUncompress(compressed));
+        return entry;
+    }
+
+    // Deletes expired files on the pool; a file's mtime is when it was stored
+    void prune() {
+        const QString root = directory;
+        const qint64 ttl = ttlMs;
+        QThreadPool::globalInstance()->start([root, ttl]() {
+            const QDateTime cutoff = QDateTime::currentDateTimeUtc().addMSecs(-ttl);
+            QDirIterator it(root, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                it.next();
+                if (it.fileInfo().lastModified().toUTC() < cutoff)
+                    QFile::remove(it.filePath());
+            }
+        });
+    }
+
+    QString directory;
+    QCache<QByteArray, Entry> memory;
+    qint64 ttlMs = 0;
+    Counters counts;
+};
+
+// Every Gemini request goes through the one QNetworkAccessManager owned
+// here, so TLS sessions and HTTP/2 connections are reused by the chat and
+// by completions alike. Requests run concurrently and are named by an id
+// that cancel() takes and every signal carries. A request that fails with
+// 429, a 5xx, a timeout or a dropped connection before any text was
+// delivered is sent again after an exponential, jittered backoff, or after
+// the server's Retry-After when it gives one. Answers to requests seen
+// before come from the ResponseCache without touching the network
+class GeminiClient : public QObject {
+    Q_OBJECT
+public:
+    static constexpr const char *DefaultEndpoint = "https://generativelanguage.googleapis.com/v1";
+    static constexpr int MaxAttempts = 4;
+    static constexpr int DefaultTimeoutMs = 30000;
+
+    GeminiClient(QObject *parent = nullptr) : QObject(parent) {}
+
+    QString endpoint() const {
+        return endpointBase;
+    }
+
+    // An empty base means the public API. The connection is opened ahead of
+    // the first request so it does not pay for DNS and the TLS handshake
+    void setEndpoint(const QString &base) {
+        QString normalized = base.trimmed().isEmpty() ? QString(DefaultEndpoint) : base.trimmed();
+        while (normalized.endsWith('/'))
+            normalized.chop(1);
+        if (normalized != endpointBase) {
+            endpointBase = normalized;
+            warmUp();
+        }
+    }
+
+    void setApiKey(const QString &key) {
+        if (key != apiKey) {
+            apiKey = key;
+            warmUp();
+        }
+    }
+
+    bool hasApiKey() const {
+        return !apiKey.isEmpty();
+    }
+
+    // Longest silence allowed on a connection; a stream that keeps
+    // delivering may run longer than this
+    void setTimeout(int ms) {
+        timeoutMs = ms;
+    }
+
+    // Starts a request and returns its id. Streaming requests deliver text
+    // per server-sent event, the others once when the reply is complete
+    quint64 generate(const QString &model, const QJsonObject &body, bool stream = true) {
+        const quint64 id = ++lastId;
+        Request &request = requests[id];
+        ++counters.requests;
+        if (cache.isEnabled()) {
+            request.cacheKey = ResponseCache::key(endpointBase, model, body);
+            QString text;
+            if (cache.lookup(request.cacheKey, &text)) {
+                // Delivered once the caller has the id
+                QTimer::singleShot(0, this, [this, id, text]() {
+                    if (!requests.contains(id))
+                        return;
+                    emit textReceived(id, text);
+                    if (requests.remove(id))
+                        emit finished(id, QString());
+                });
+                return id;
+            }
+        }
+        request.model = model;
+        request.body = QJsonDocument(body).toJson(QJsonDocument::Compact);
+        request.stream = stream;
+        request.started.start();
+        send(id);
+        return id;
+    }
+
+    // Drops the request, in flight or waiting to retry; no signal follows
+    void cancel(quint64 id) {
+        const auto it = requests.find(id);
+        if (it == requests.end()) {
+            return;
+        }
+        if (QNetworkReply *reply = it->reply) {
+            reply->disconnect(this);
+            reply->abort();
+            reply->deleteLater();
+        }
+        requests.erase(it);
+        ++counters.cancelled;
+    }
+
+    bool isActive(quint64 id) const {
+        return requests.contains(id);
+    }
+
+    ResponseCache &responseCache() {
+        return cache;
+    }
+
+    QString statistics() const {
+        return QString("in flight: %1\nrequests: %2 (%3 retries, %4 failed, %5 cancelled)\n"
+                       "new connections: %6\nconnect: %7\nfirst byte: %8\ntotal: %9")
+            .arg(requests.size())
+            .arg(counters.requests)
+            .arg(counters.retries)
+            .arg(counters.failed)
+            .arg(counters.cancelled)
+            .arg(counters.connections)
+            .arg(connectLatency.format())
+            .arg(firstByteLatency.format())
+            .arg(totalLatency.format())
+            + '\n' + cache.statistics();
+    }
+
+signals:
+    void textReceived(quint64 id, const QString &text);
+    void retrying(quint64 id, int attempt, int delayMs);
+    // error is empty when the request succeeded
+    void finished(quint64 id, const QString &error);
+
+private:
+    struct Request {
+        QString model;
+        QByteArray body;
+        bool stream = true;
+        int attempt = 1;
+        QNetworkReply *reply = nullptr;
+        SseParser sse;
+        QByteArray raw;           // Error body, or the whole reply when not streaming
+        QString error;            // Error reported inside a successful stream
+        bool delivered = false;   // Text went out, so a retry would repeat it
+        QString text;             // Everything delivered, for the cache
+        QByteArray cacheKey;      // Empty while the cache is off
+        bool firstByte = false;
+        QElapsedTimer started;    // Across all attempts
+        QElapsedTimer attemptStarted;
+    };
+
+    struct Counters {
+        qint64 requests = 0;
+        qint64 retries = 0;
+        qint64 failed = 0;
+        qint64 cancelled = 0;
+        qint64 connections = 0;
+    };
+
+    void warmUp() {
+        if (apiKey.isEmpty()) {
+            return;
+        }
+        const QUrl url(endpointBase);
+        if (url.scheme() == "https") {
+            network.connectToHostEncrypted(url.host(), quint16(url.port(443)));
+        } else if (url.scheme() == "http") {
+            network.connectToHost(url.host(), quint16(url.port(80)));
+        }
+    }
+
+    void send(quint64 id) {
+        const auto it = requests.find(id);
+        if (it == requests.end()) {
+            return;
+        }
+        Request &request = *it;
+        QUrl url(endpointBase + "/models/" + request.model
+                 + (request.stream ? ":streamGenerateContent" : ":generateContent"));
+        if (request.stream) {
+            url.setQuery("alt=sse");
+        }
+
+        QNetworkRequest networkRequest(url);
+        networkRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+        networkRequest.setRawHeader("x-goog-api-key", apiKey.toUtf8());
+        if (request.stream) {
+            networkRequest.setRawHeader("Accept", "text/event-stream");
+        }
+        networkRequest.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+        networkRequest.setTransferTimeout(timeoutMs);
+
+        request.sse.reset();
+        request.raw.clear();
+        request.error.clear();
+        request.firstByte = false;
+        request.attemptStarted.start();
+        QNetworkReply *reply = network.post(networkRequest, request.body);
+        request.reply = reply;
+
+        // A reused connection goes straight to sending the request
+        connect(reply, &QNetworkReply::socketStartedConnecting, this, [this]() {
+            ++counters.connections;
+        });
+        connect(reply, &QNetworkReply::requestSent, this, [this, id]() {
+            const auto it = requests.find(id);
+            if (it != requests.end())
+                connectLatency.add(it->attemptStarted.elapsed());
+        });
+        connect(reply, &QNetworkReply::readyRead, this, [this, id]() {
+            read(id);
+        });
+        connect(reply, &QNetworkReply::finished, this, [this, id]() {
+            complete(id);
+        });
+    }
+
+    static int httpStatus(QNetworkReply *reply) {
+        return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    }
+
+    // Returns false when a receiver cancelled the request meanwhile
+    bool read(quint64 id) {
+        const auto it = requests.find(id);
+        if (it == requests.end()) {
+            return false;
+        }
+        Request &request = *it;
+        const QByteArray bytes = request.reply->readAll();
+        if (!request.firstByte && !bytes.isEmpty()) {
+            request.firstByte = true;
+            firstByteLatency.add(request.attemptStarted.elapsed());
+        }
+        if (!request.stream || httpStatus(request.reply) >= 300) {
+            request.raw.append(bytes);
+            return true;
+        }
+        return deliver(id, request.sse.feed(bytes));
+    }
+
+    // Emits the text of each GenerateContentResponse in events
+    bool deliver(quint64 id, const QList<QByteArray> &events) {
+        for (const QByteArray &event : events) {
+            auto it = requests.find(id);
+            if (it == requests.end()) {
+                return false;
+            }
+            const QJsonObject response = QJsonDocument::fromJson(event).object();
+            if (response.contains("error")) {
+                it->error = "API Error: " + response["error"].toObject()["message"].toString();
+                continue;
+            }
+            QString text;
+            const QJsonArray candidates = response["candidates"].toArray();
+            if (!candidates.isEmpty()) {
+                const QJsonArray parts = candidates.first().toObject()["content"].toObject()["parts"].toArray();
+                for (const QJsonValue &part : parts)
+                    text += part.toObject()["text"].toString();
+            }
+            if (!text.isEmpty()) {
+                it->delivered = true;
+                it->text += text;
+                emit textReceived(id, text);
+            }
+        }
+        return requests.contains(id);
+    }
+
+    void complete(quint64 id) {
+        if (!read(id)) {
+            return;
+        }
+        Request &request = requests[id];
+        QNetworkReply *reply = request.reply;
+        request.reply = nullptr;
+        reply->deleteLater();
+
+        const int status = httpStatus(reply);
+        const QNetworkReply::NetworkError error = reply->error();
+        if (error == QNetworkReply::NoError) {
+            const QList<QByteArray> events = request.stream ? request.sse.finish() : QList<QByteArray>{request.raw};
+            if (!deliver(id, events)) {
+                return;
+            }
+            const Request &done = requests[id];
+            if (done.error.isEmpty() && !done.cacheKey.isEmpty() && !done.text.isEmpty()) {
+                cache.store(done.cacheKey, done.text);
+            }
+            finish(id, done.error);
+            return;
+        }
+
+        const bool transient = status == 429 || status >= 500
+                               || (status == 0 && (error == QNetworkReply::TimeoutError
+                                                   || error == QNetworkReply::OperationCanceledError
+                                                   || error == QNetworkReply::RemoteHostClosedError
+                                                   || error == QNetworkReply::TemporaryNetworkFailureError
+                                                   || error == QNetworkReply::ConnectionRefusedError));
+        if (transient && !request.delivered && request.attempt < MaxAttempts) {
+            int delay = retryAfter(reply);
+            if (delay < 0) {
+                const int base = qMin(500 << (request.attempt - 1), 16000);
+                delay = base / 2 + int(QRandomGenerator::global()->bounded(base / 2 + 1));
+            }
+            ++request.attempt;
+            ++counters.retries;
+            QTimer::singleShot(delay, this, [this, id]() {
+                send(id);
+            });
+            emit retrying(id, request.attempt, delay);
+            return;
+        }
+
+        const QJsonObject apiError = QJsonDocument::fromJson(request.raw).object().value("error").toObject();
+        if (apiError.contains("message")) {
+            finish(id, "API Error: " + apiError["message"].toString());
+        } else if (error == QNetworkReply::OperationCanceledError) {
+            finish(id, "Error: no response within " + QString::number(timeoutMs / 1000) + " s");
+        } else {
+            finish(id, "Error: " + reply->errorString());
+        }
+    }
+
+    // Retry-After in seconds or as an HTTP date, capped at a minute
+    static int retryAfter(QNetworkReply *reply) {
+        const QByteArray value = reply->rawHeader("Retry-After").trimmed();
+        if (value.isEmpty()) {
+            return -1;
+        }
+        bool ok;
+        qint64 ms = value.toLongLong(&ok) * 1000;
+        if (!ok) {
+            const QDateTime when = QDateTime::fromString(QString::fromLatin1(value), Qt::RFC2822Date);
+            if (!when.isValid()) {
+                return -1;
+            }
+            ms = QDateTime::currentDateTimeUtc().msecsTo(when);
+        }
+        return int(qBound<qint64>(0, ms, 60000));
+    }
+
+    void finish(quint64 id, const QString &error) {
+        totalLatency.add(requests[id].started.elapsed());
+        if (!error.isEmpty()) {
+            ++counters.failed;
+        }
+        requests.remove(id);
+        emit finished(id, error);
+    }
+
+    QNetworkAccessManager network;
+    QString endpointBase = DefaultEndpoint;
+    QString apiKey;
+    int timeoutMs = DefaultTimeoutMs;
+    quint64 lastId = 0;
+    QHash<quint64, Request> requests;
+    ResponseCache cache;
+    Counters counters;
+    LatencyHistogram connectLatency;
+    LatencyHistogram firstByteLatency;
+    LatencyHistogram totalLatency;
+};
+
+#endif // GEMINICLIENT_H
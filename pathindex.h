@@ -0,0 +1,141 @@
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+#include <QString>
+
+// Flat index of project-relative paths for quick open. Paths are stored back
+// to back as UTF-8 in one buffer, with a 64-bit mask of the characters each
+// path contains so most paths are rejected by one AND before any scoring
+struct PathIndex {
+    QByteArray data;        // Paths, each followed by '\0'
+    QList<quint32> offsets;
+    QList<quint64> masks;
+
+    static quint64 charBit(uchar c) {
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c >= 'a' && c <= 'z')
+            return quint64(1) << (c - 'a');
+        if (c >= '0' && c <= '9')
+            return quint64(1) << (26 + c - '0');
+        switch (c) {
+        case '.': return quint64(1) << 36;
+        case '_': return quint64(1) << 37;
+        case '-': return quint64(1) << 38;
+        case '/': return quint64(1) << 39;
+        default: return quint64(1) << 40;
+        }
+    }
+
+    static quint64 maskOf(QByteArrayView text) {
+        quint64 mask = 0;
+        for (char c : text)
+            mask |= charBit(uchar(c));
+        return mask;
+    }
+
+    qsizetype size() const {
+        return offsets.size();
+    }
+
+    QByteArrayView path(qsizetype i) const {
+        const qsizetype end = i + 1 < offsets.size() ? offsets[i + 1] : data.size();
+        return QByteArrayView(data.constData() + offsets[i], end - offsets[i] - 1);
+    }
+
+    void append(QByteArrayView path) {
+        offsets.append(quint32(data.size()));
+        masks.append(maskOf(path));
+        data.append(path);
+        data.append('\0');
+    }
+
+    void append(const PathIndex &other) {
+        const quint32 base = quint32(data.size());
+        data.append(other.data);
+        for (quint32 offset : other.offsets)
+            offsets.append(base + offset);
+        masks.append(other.masks);
+    }
+};
+
+// Files added and removed since the last full index build
+struct PathDelta {
+    PathIndex added;
+    QList<QByteArray> removed;  // Paths, or directory prefixes ending in '/'
+
+    bool isRemoved(QByteArrayView path) const {
+        for (const QByteArray &entry : removed) {
+            if (entry.endsWith('/') ? path.startsWith(entry) : path == entry)
+                return true;
+        }
+        return false;
+    }
+};
+
+// A quick open query, lowercased. Whitespace only separates the words people
+// type ("main cpp"), so it is dropped: the words are matched in order as one
+// subsequence, and a path needs no space to match
+struct PathQuery {
+    QByteArray text;
+    quint64 mask = 0;
+
+    PathQuery() = default;
+
+    explicit PathQuery(const QString &query) {
+        text = query.toLower().toUtf8();
+        text.removeIf([](char c) { return c == ' ' || c == '\t'; });
+        mask = PathIndex::maskOf(text);
+    }
+
+    bool accepts(quint64 pathMask) const {
+        return (pathMask & mask) == mask;
+    }
+
+    static bool isSeparator(char c) {
+        return c == '/' || c == '_' || c == '-' || c == '.' || c == ' ';
+    }
+
+    static char fold(char c) {
+        return c >= 'A' && c <= 'Z' ? char(c + 'a' - 'A') : c;
+    }
+
+    // Greedy subsequence match from `from`, rewarding runs, word starts and
+    // hits in the file name; -1 when the query does not fit
+    static int matchFrom(QByteArrayView path, qsizetype from, qsizetype nameStart, QByteArrayView query) {
+        int score = 0;
+        qsizetype previous = -2;
+        qsizetype i = from;
+        for (char q : query) {
+            while (i < path.size() && fold(path[i]) != q)
+                ++i;
+            if (i == path.size())
+                return -1;
+            score += 1;
+            if (i == previous + 1)
+                score += 5;
+            if (i == 0 || isSeparator(path[i - 1]) ||
+                (path[i] >= 'A' && path[i] <= 'Z' && path[i - 1] >= 'a' && path[i - 1] <= 'z'))
+                score += 8;
+            if (i >= nameStart)
+                score += 2;
+            previous = i;
+            ++i;
+        }
+        return score;
+    }
+
+    // Higher is better; -1 when path does not match
+    int score(QByteArrayView path) const {
+        const qsizetype nameStart = path.lastIndexOf('/') + 1;
+        const int inName = matchFrom(path, nameStart, nameStart, text);
+        const int score = inName >= 0 ? inName + 20 : matchFrom(path, 0, nameStart, text);
+        return score < 0 ? -1 : score * 16 - int(qMin<qsizetype>(path.size(), 255));
+    }
+
+};
+
+#endif // PATHINDEX_H
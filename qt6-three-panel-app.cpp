@@ -48,543 +48,7479 @@
 #include <QPalette>
 #include <QColor>
 #include <QShortcut>
+#include <QStringView>
+#include <algorithm>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QTextBlock>
+#include <QTextLayout>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QPromise>
+#include <QThreadPool>
+#include <QThread>
+#include <memory>
+#include <atomic>
+#include <QFile>
+#include <QMutex>
+#include <QQueue>
+#include <QSemaphore>
+#include <QStringDecoder>
+#include <QByteArrayView>
+#include <QProgressBar>
+#include <QAbstractScrollArea>
+#include <QPainter>
+#include <QInputDialog>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDir>
+#include <QDirIterator>
+#include <QHash>
+#include <QAbstractItemModel>
+#include <QTreeView>
+#include <functional>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QDialog>
+#include <QKeyEvent>
+#include <QWaitCondition>
+#include <QCheckBox>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QBitArray>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <pty.h>
+#define HAVE_FORKPTY
+#elif defined(Q_OS_MACOS)
+#include <util.h>
+#define HAVE_FORKPTY
+#endif
+#include <QProcessEnvironment>
+#include <QVarLengthArray>
+#include <QLocale>
+#include <QTabBar>
+#include <QMouseEvent>
+#include <array>
+#include <vector>
+#include <QStringEncoder>
+#include <QtAlgorithms>
+#include <climits>
+#include <cstring>
+#include <numeric>
+#include <cmath>
+#include <QRandomGenerator>
+#include <QCache>
+#include <QDataStream>
+#include <QSpinBox>
+#include <QMap>
+#include <QAbstractListModel>
+#include <QItemSelectionModel>
+#include <QStyledItemDelegate>
+#include <QAbstractTextDocumentLayout>
+#include <optional>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "commandhistory.h"
+#include "completiontext.h"
+#include "cpplexer.h"
+#include "editorcontext.h"
+#include "geminiclient.h"
+#include "pathindex.h"
+#include "requiredliteral.h"
+#include "rowheights.h"
+#include "threadpool.h"
+
+// Token spans for every line of one document revision, packed into a single
+// allocation: line N owns spans[lineStarts[N] .. lineStarts[N + 1])
+struct TokenSnapshot {
+    struct Span {
+        quint32 start;
+        quint32 lengthAndKind;
+
+        int length() const { return int(lengthAndKind >> 4); }
+        TokenKind kind() const { return TokenKind(lengthAndKind & 0x0f); }
+    };
+
+    int revision = -1;
+    quint64 serial = 0;
+    QList<Span> spans;
+    QList<int> lineStarts;
+    QList<int> lineStates;
+
+    int lineCount() const { return int(lineStates.size()); }
+
+    // Lexes a plain-text copy of the document; safe to call from any thread
+    static TokenSnapshot tokenize(const QString &text, int revision, quint64 serial,
+                                  QPromise<TokenSnapshot> &promise) {
+        TokenSnapshot snapshot;
+        snapshot.revision = revision;
+        snapshot.serial = serial;
+
+        const QStringView view(text);
+        int state = CppLexer::Normal;
+        qsizetype lineStart = 0;
+        while (lineStart <= view.size()) {
+            if ((snapshot.lineStates.size() & 1023) == 0 && promise.isCanceled())
+                return TokenSnapshot();
+
+            qsizetype lineEnd = view.indexOf(u'\n', lineStart);
+            if (lineEnd < 0)
+                lineEnd = view.size();
+
+            snapshot.lineStarts.append(int(snapshot.spans.size()));
+            state = CppLexer::lex(view.mid(lineStart, lineEnd - lineStart), state,
+                                  [&snapshot](int start, int length, TokenKind kind) {
+                if (kind != TokenKind::Bracket)
+                    snapshot.spans.append({quint32(start), (quint32(length) << 4) | quint32(kind)});
+            });
+            snapshot.lineStates.append(state);
+            lineStart = lineEnd + 1;
+        }
+        snapshot.lineStarts.append(int(snapshot.spans.size()));
+        return snapshot;
+    }
+};
 
+// Highlights the visible blocks synchronously and the rest of the document in
+// short slices from the event loop. Blocks outside both keep their previous
+// formats and state until a slice reaches them, so loading or editing a large
+// file never lexes more than a screenful on the spot.
+//
+// With background tokenizing on, lexing moves to a worker thread that works on a
+// snapshot of the text; slices then only copy ready-made spans into the blocks,
+// and only when the snapshot still matches the document revision
 class CodeHighlighter : public QSyntaxHighlighter {
 public:
     CodeHighlighter(QTextDocument *parent = nullptr) : QSyntaxHighlighter(parent) {
-        HighlightingRule rule;
-
-        // Keywords
+        QTextCharFormat keywordFormat;
         keywordFormat.setForeground(QColor("#569CD6"));
         keywordFormat.setFontWeight(QFont::Bold);
-        QStringList keywordPatterns = {
-            "\\bclass\\b", "\\bconst\\b", "\\benum\\b", "\\bexplicit\\b",
-            "\\bfriend\\b", "\\binline\\b", "\\bnamespace\\b", "\\boperator\\b",
-            "\\bprivate\\b", "\\bprotected\\b", "\\bpublic\\b", "\\bsignals\\b",
-            "\\bslots\\b", "\\bstatic\\b", "\\btemplate\\b", "\\btypedef\\b",
-            "\\btypename\\b", "\\bunion\\b", "\\bvirtual\\b", "\\bvolatile\\b",
-            "\\bbreak\\b", "\\bcase\\b", "\\bcatch\\b", "\\bcontinue\\b",
-            "\\bdefault\\b", "\\bdelete\\b", "\\bdo\\b", "\\belse\\b",
-            "\\bfor\\b", "\\bif\\b", "\\bnew\\b", "\\breturn\\b",
-            "\\bswitch\\b", "\\bthrow\\b", "\\btry\\b", "\\bwhile\\b",
-            "\\bauto\\b", "\\bbool\\b", "\\bchar\\b", "\\bdouble\\b",
-            "\\bfloat\\b", "\\bint\\b", "\\blong\\b", "\\bshort\\b",
-            "\\bsigned\\b", "\\bstruct\\b", "\\bunsigned\\b", "\\bvoid\\b",
-            "\\binclude\\b", "\\bdefine\\b", "\\bifdef\\b", "\\bifndef\\b",
-            "\\bendif\\b", "\\bundef\\b", "\\bpragma\\b"
-        };
+        formats[int(TokenKind::Keyword)] = keywordFormat;
+
+        formats[int(TokenKind::Type)].setForeground(QColor("#4EC9B0"));
+        formats[int(TokenKind::Function)].setForeground(QColor("#DCDCAA"));
+        formats[int(TokenKind::Comment)].setForeground(QColor("#6A9955"));
+        formats[int(TokenKind::String)].setForeground(QColor("#CE9178"));
+        formats[int(TokenKind::Number)].setForeground(QColor("#B5CEA8"));
+        formats[int(TokenKind::Preprocessor)].setForeground(QColor("#BD63C5"));
+
+        sliceTimer.setSingleShot(true);
+        connect(&sliceTimer, &QTimer::timeout, this, &CodeHighlighter::highlightSlice);
+
+        // Connected after QSyntaxHighlighter's own handler, so the edit has
+        // already been re-highlighted (up to the gate) when this runs
+        if (parent) {
+            blockCount = parent->blockCount();
+            connect(parent, &QTextDocument::contentsChange, this, &CodeHighlighter::onContentsChange);
+        }
+
+        tokenizeTimer.setSingleShot(true);
+        connect(&tokenizeTimer, &QTimer::timeout, this, &CodeHighlighter::startTokenizing);
+        connect(&tokenizeWatcher, &QFutureWatcher<TokenSnapshot>::finished,
+                this, &CodeHighlighter::onTokenizingFinished);
+    }
+
+    ~CodeHighlighter() {
+        tokenizeWatcher.future().cancel();
+    }
+
+    void setBackgroundTokenizing(bool enabled) {
+        if (enabled == backgroundTokenizing)
+            return;
+        backgroundTokenizing = enabled;
+        snapshot = TokenSnapshot();
+        if (enabled) {
+            tokenizeTimer.start(0);
+        } else {
+            tokenizeTimer.stop();
+            tokenizeWatcher.future().cancel();
+            if (!dirtyBlocks.isEmpty())
+                sliceTimer.start(0);
+        }
+    }
+
+    bool isBackgroundTokenizing() const { return backgroundTokenizing; }
 
-        for (const QString &pattern : keywordPatterns) {
-            rule.pattern = QRegularExpression(pattern);
-            rule.format = keywordFormat;
-            highlightingRules.append(rule);
-        }
-
-        // Class names
-        classFormat.setForeground(QColor("#4EC9B0"));
-        rule.pattern = QRegularExpression("\\b[A-Za-z0-9_]+::[A-Za-z0-9_]+\\b");
-        rule.format = classFormat;
-        highlightingRules.append(rule);
-
-        rule.pattern = QRegularExpression("\\bQ[A-Za-z]+\\b");
-        rule.format = classFormat;
-        highlightingRules.append(rule);
-
-        // Function calls
-        functionFormat.setForeground(QColor("#DCDCAA"));
-        rule.pattern = QRegularExpression("\\b[A-Za-z0-9_]+(?=\\()");
-        rule.format = functionFormat;
-        highlightingRules.append(rule);
-
-        // Single line comments
-        singleLineCommentFormat.setForeground(QColor("#6A9955"));
-        rule.pattern = QRegularExpression("//[^\n]*");
-        rule.format = singleLineCommentFormat;
-        highlightingRules.append(rule);
-
-        // Quotations
-        quotationFormat.setForeground(QColor("#CE9178"));
-        rule.pattern = QRegularExpression("\".*\"");
-        rule.format = quotationFormat;
-        highlightingRules.append(rule);
-
-        // Numbers
-        numberFormat.setForeground(QColor("#B5CEA8"));
-        rule.pattern = QRegularExpression("\\b[0-9]+\\b");
-        rule.format = numberFormat;
-        highlightingRules.append(rule);
-
-        // Preprocessor
-        preprocessorFormat.setForeground(QColor("#BD63C5"));
-        rule.pattern = QRegularExpression("#[^\n]*");
-        rule.format = preprocessorFormat;
-        highlightingRules.append(rule);
+    // Blocks currently on screen; these are always highlighted immediately
+    void setVisibleBlocks(int first, int last) {
+        if (first == visibleFirst && last == visibleLast)
+            return;
+        visibleFirst = first;
+        visibleLast = last;
+        if (!dirtyBlocks.isEmpty() && dirtyBlocks.first() <= visibleLast)
+            sliceTimer.start(0);
     }
 
 protected:
     void highlightBlock(const QString &text) override {
-        for (const HighlightingRule &rule : highlightingRules) {
-            QRegularExpressionMatchIterator matchIterator = rule.pattern.globalMatch(text);
-            while (matchIterator.hasNext()) {
-                QRegularExpressionMatch match = matchIterator.next();
-                setFormat(match.capturedStart(), match.capturedLength(), rule.format);
-            }
+        const int number = currentBlock().blockNumber();
+        const bool visible = number >= visibleFirst && number <= visibleLast;
+        bool useSnapshot = false;
+        bool inRange = visible || number < sliceEnd;
+        if (inRange && backgroundTokenizing) {
+            // Without a current snapshot only the block that was just edited is
+            // lexed here, so typing stays cheap however large the file is
+            // Calls outside our own passes come from edits, whose text the
+            // snapshot cannot have seen yet
+            useSnapshot = inHighlightPass && snapshotIsCurrent() && number < snapshot.lineCount();
+            if (!useSnapshot && (inHighlightPass || inlineBlocksLeft == 0))
+                inRange = false;
+            else if (!useSnapshot)
+                --inlineBlocksLeft;
         }
 
-        setCurrentBlockState(0);
-        
-        int startIndex = 0;
-        if (previousBlockState() != 1)
-            startIndex = text.indexOf("/*");
-        
-        while (startIndex >= 0) {
-            QRegularExpressionMatch match = QRegularExpression("\\*/").match(text, startIndex);
-            int endIndex = match.capturedStart();
-            int commentLength;
-            
-            if (endIndex == -1) {
-                setCurrentBlockState(1);
-                commentLength = text.length() - startIndex;
-            } else {
-                commentLength = endIndex - startIndex + match.capturedLength();
+        if (!inRange) {
+            // Outside this pass: keep what the block had and let a later slice
+            // pick up from here
+            const QList<QTextLayout::FormatRange> previous = currentBlock().layout()->formats();
+            for (const QTextLayout::FormatRange &range : previous)
+                setFormat(range.start, range.length, range.format);
+            setCurrentBlockState(currentBlockState());
+            newDirtyBlocks.append(number);
+            return;
+        }
+
+        if (useSnapshot) {
+            const int end = snapshot.lineStarts[number + 1];
+            for (int i = snapshot.lineStarts[number]; i < end; ++i) {
+                const TokenSnapshot::Span &span = snapshot.spans[i];
+                setFormat(int(span.start), span.length(), formats[int(span.kind())]);
             }
-            
-            setFormat(startIndex, commentLength, singleLineCommentFormat);
-            startIndex = text.indexOf("/*", startIndex + commentLength);
+            setCurrentBlockState(snapshot.lineStates[number]);
+            lastHighlighted = number;
+            return;
         }
+
+        int state = previousBlockState();
+        if (state < 0)
+            state = CppLexer::Normal;
+
+        state = CppLexer::lex(text, state, [this](int start, int length, TokenKind kind) {
+            if (kind != TokenKind::Bracket)
+                setFormat(start, length, formats[int(kind)]);
+        });
+        setCurrentBlockState(state);
+        lastHighlighted = number;
     }
 
 private:
-    struct HighlightingRule {
-        QRegularExpression pattern;
-        QTextCharFormat format;
-    };
+    static constexpr int SliceBudgetMs = 8;
+    static constexpr int SliceBlocks = 256;
+    static constexpr int EditDelayMs = 30;
+    static constexpr int TokenizeDelayMs = 50;
 
-    QVector<HighlightingRule> highlightingRules;
+    bool snapshotIsCurrent() const {
+        return snapshot.serial == contentsSerial && snapshot.revision == document()->revision();
+    }
 
-    QTextCharFormat keywordFormat;
-    QTextCharFormat classFormat;
-    QTextCharFormat functionFormat;
-    QTextCharFormat singleLineCommentFormat;
-    QTextCharFormat quotationFormat;
-    QTextCharFormat numberFormat;
-    QTextCharFormat preprocessorFormat;
-};
+    void startTokenizing() {
+        tokenizeWatcher.future().cancel();
+        const QString text = document()->toPlainText();
+        const int revision = document()->revision();
+        const quint64 serial = contentsSerial;
+        tokenizeWatcher.setFuture(runInPool<TokenSnapshot>([text, revision, serial](QPromise<TokenSnapshot> &promise) {
+            promise.addResult(TokenSnapshot::tokenize(text, revision, serial, promise));
+        }));
+    }
 
-// Enhanced code editor with line numbers and syntax highlighting
-class CodeEditor : public QPlainTextEdit {
-    Q_OBJECT
-public:
-    CodeEditor(QWidget *parent = nullptr) : QPlainTextEdit(parent) {
-        lineNumberArea = new LineNumberArea(this);
-        
-        connect(this, &CodeEditor::blockCountChanged, this, &CodeEditor::updateLineNumberAreaWidth);
-        connect(this, &CodeEditor::updateRequest, this, &CodeEditor::updateLineNumberArea);
-        connect(this, &CodeEditor::cursorPositionChanged, this, &CodeEditor::highlightCurrentLine);
-        
-        updateLineNumberAreaWidth(0);
-        highlightCurrentLine();
+    void onTokenizingFinished() {
+        const QFuture<TokenSnapshot> future = tokenizeWatcher.future();
+        if (!backgroundTokenizing || future.isCanceled() || future.resultCount() == 0)
+            return;
 
-        // Set monospace font
-        QFont font("Cascadia Code", 10);
-        if (!QFontInfo(font).fixedPitch()) {
-            font.setFamily("Consolas");
-            if (!QFontInfo(font).fixedPitch()) {
-                font.setFamily("Courier New");
+        TokenSnapshot result = future.result();
+        if (result.serial != contentsSerial || result.revision != document()->revision())
+            return;  // The text moved on; a newer job is already scheduled
+
+        snapshot = std::move(result);
+        if (!dirtyBlocks.isEmpty())
+            sliceTimer.start(0);
+    }
+
+    void onContentsChange(int from, int charsRemoved, int charsAdded) {
+        Q_UNUSED(charsRemoved);
+        Q_UNUSED(charsAdded);
+        if (inHighlightPass)
+            return;
+
+        ++contentsSerial;
+        inlineBlocksLeft = 1;
+        if (backgroundTokenizing) {
+            tokenizeWatcher.future().cancel();
+            tokenizeTimer.start(TokenizeDelayMs);
+        }
+
+        // Shift pending restart points past the edit by the change in block count
+        const int editBlock = document()->findBlock(from).blockNumber();
+        const int delta = document()->blockCount() - blockCount;
+        blockCount = document()->blockCount();
+        if (delta != 0) {
+            for (int &number : dirtyBlocks) {
+                if (number > editBlock)
+                    number = qMax(editBlock, number + delta);
             }
         }
-        font.setFixedPitch(true);
-        this->setFont(font);
 
-        // Set tab width
-        QFontMetrics metrics(font);
-        this->setTabStopDistance(4 * metrics.horizontalAdvance(' '));
+        mergeDirtyBlocks();
+        if (!dirtyBlocks.isEmpty())
+            sliceTimer.start(EditDelayMs);
+    }
 
-        // Setup syntax highlighter
-        highlighter = new CodeHighlighter(this->document());
-        
-        // Set dark theme colors
-        QPalette p = palette();
-        p.setColor(QPalette::Base, QColor("#1E1E1E"));
-        p.setColor(QPalette::Text, QColor("#D4D4D4"));
-        setPalette(p);
-        
-        // Line wrapping
-        setLineWrapMode(QPlainTextEdit::NoWrap);
-        
-        // Enable auto-indentation
-        connect(this, &CodeEditor::textChanged, this, &CodeEditor::handleTextChanged);
-        
-        // Set bracket matching
-        bracketMatchingEnabled = true;
-        bracketPos = -1;
-        bracketLength = 0;
+    void highlightSlice() {
+        // In background mode slices wait for the worker's snapshot
+        if (backgroundTokenizing && !snapshotIsCurrent())
+            return;
+
+        QElapsedTimer timer;
+        timer.start();
+
+        // Visible blocks first, so what is on screen is right as soon as possible
+        if (!dirtyBlocks.isEmpty() && dirtyBlocks.first() <= visibleLast) {
+            lastHighlighted = -1;
+            QTextBlock block = document()->findBlockByNumber(qMax(visibleFirst, dirtyBlocks.first()));
+            while (block.isValid() && block.blockNumber() <= visibleLast) {
+                if (block.blockNumber() > lastHighlighted)
+                    rehighlightInPass(block);
+                block = block.next();
+            }
+        }
+
+        while (!dirtyBlocks.isEmpty() && timer.elapsed() < SliceBudgetMs) {
+            const int number = dirtyBlocks.takeFirst();
+            const QTextBlock block = document()->findBlockByNumber(number);
+            if (!block.isValid()) {
+                dirtyBlocks.clear();
+                break;
+            }
+
+            sliceEnd = number + SliceBlocks;
+            rehighlightInPass(block);
+            sliceEnd = -1;
+
+            // The pass ran until the block states converged or it hit the slice
+            // end; restart points it walked over are done
+            while (!dirtyBlocks.isEmpty() && dirtyBlocks.first() <= lastHighlighted)
+                dirtyBlocks.removeFirst();
+        }
+
+        if (!dirtyBlocks.isEmpty())
+            sliceTimer.start(0);
     }
 
-    int lineNumberAreaWidth() {
-        int digits = 1;
-        int max = qMax(1, blockCount());
-        while (max >= 10) {
-            max /= 10;
-            ++digits;
+    void rehighlightInPass(const QTextBlock &block) {
+        inHighlightPass = true;
+        rehighlightBlock(block);
+        inHighlightPass = false;
+        mergeDirtyBlocks();
+    }
+
+    void mergeDirtyBlocks() {
+        for (int number : std::as_const(newDirtyBlocks)) {
+            auto it = std::lower_bound(dirtyBlocks.begin(), dirtyBlocks.end(), number);
+            if (it == dirtyBlocks.end() || *it != number)
+                dirtyBlocks.insert(it, number);
         }
+        newDirtyBlocks.clear();
+    }
 
-        int space = 20 + fontMetrics().horizontalAdvance(QLatin1Char('9')) * digits;
-        return space;
+    QTextCharFormat formats[int(TokenKind::Count)];
+
+    QTimer sliceTimer;
+    // Sorted block numbers from which highlighting still has to be resumed
+    QList<int> dirtyBlocks;
+    QList<int> newDirtyBlocks;
+    int visibleFirst = 0;
+    int visibleLast = -1;
+    int sliceEnd = -1;
+    int lastHighlighted = -1;
+    int blockCount = 0;
+    bool inHighlightPass = false;
+
+    QTimer tokenizeTimer;
+    QFutureWatcher<TokenSnapshot> tokenizeWatcher;
+    TokenSnapshot snapshot;
+    quint64 contentsSerial = 0;
+    int inlineBlocksLeft = 1;
+    bool backgroundTokenizing = false;
+};
+
+// Brackets of one block that sit outside strings and comments, plus per-type
+// summaries that let a search step over the whole block at once
+class BracketBlockData : public QTextBlockUserData {
+public:
+    struct Bracket {
+        int position;
+        quint8 type;
+        bool open;
+    };
+
+    QList<Bracket> brackets;
+    // Lexer state the block was scanned with; a change means it must be rescanned
+    int lexState = -1;
+    bool valid = false;
+    // Running sum of opens minus closes per type, and its lowest point scanning
+    // forwards and backwards
+    int net[3] = {};
+    int minPrefix[3] = {};
+    int minSuffix[3] = {};
+};
+
+// Answers "which bracket matches this one" without copying the document.
+// Bracket positions live on each block and are rebuilt lazily: edits only
+// invalidate the blocks they touch, and a block is rescanned when the
+// highlighter's state flowing into it changes (e.g. a comment was opened above)
+class BracketIndex : public QObject {
+public:
+    BracketIndex(QTextDocument *document, QObject *parent = nullptr)
+        : QObject(parent), document(document) {
+        connect(document, &QTextDocument::contentsChange, this, &BracketIndex::onContentsChange);
     }
-    
-    void toggleWordWrap() {
-        if (lineWrapMode() == QPlainTextEdit::NoWrap) {
-            setLineWrapMode(QPlainTextEdit::WidgetWidth);
+
+    // Position of the bracket matching the one at `position`, or -1
+    int findMatch(int position) const {
+        QTextBlock block = document->findBlock(position);
+        if (!block.isValid())
+            return -1;
+
+        const BracketBlockData *data = ensure(block);
+        const int offset = position - block.position();
+        auto it = std::lower_bound(data->brackets.cbegin(), data->brackets.cend(), offset,
+                                   [](const BracketBlockData::Bracket &b, int pos) { return b.position < pos; });
+        if (it == data->brackets.cend() || it->position != offset)
+            return -1;
+
+        const int type = it->type;
+        int count = 1;
+        if (it->open) {
+            for (++it; it != data->brackets.cend(); ++it) {
+                if (it->type == type && (count += it->open ? 1 : -1) == 0)
+                    return block.position() + it->position;
+            }
+            for (block = block.next(); block.isValid(); block = block.next()) {
+                data = ensure(block);
+                if (count + data->minPrefix[type] > 0) {
+                    count += data->net[type];
+                    continue;
+                }
+                for (const BracketBlockData::Bracket &b : data->brackets) {
+                    if (b.type == type && (count += b.open ? 1 : -1) == 0)
+                        return block.position() + b.position;
+                }
+            }
         } else {
-            setLineWrapMode(QPlainTextEdit::NoWrap);
+            while (it != data->brackets.cbegin()) {
+                --it;
+                if (it->type == type && (count += it->open ? -1 : 1) == 0)
+                    return block.position() + it->position;
+            }
+            for (block = block.previous(); block.isValid(); block = block.previous()) {
+                data = ensure(block);
+                if (count + data->minSuffix[type] > 0) {
+                    count -= data->net[type];
+                    continue;
+                }
+                for (auto b = data->brackets.crbegin(); b != data->brackets.crend(); ++b) {
+                    if (b->type == type && (count += b->open ? -1 : 1) == 0)
+                        return block.position() + b->position;
+                }
+            }
         }
+        return -1;
     }
-    
-    void changeEditorFont() {
-        bool ok;
-        QFont font = QFontDialog::getFont(&ok, this->font(), this);
-        if (ok) {
-            this->setFont(font);
-            // Update tab stop distance for the new font
-            QFontMetrics metrics(font);
-            this->setTabStopDistance(4 * metrics.horizontalAdvance(' '));
+
+    // Position of the innermost bracket of `type` (0 parentheses, 1 braces,
+    // 2 square) still open at `position`, or -1 at top level
+    int enclosingOpen(int position, int type) const {
+        QTextBlock block = document->findBlock(position);
+        if (!block.isValid())
+            return -1;
+
+        const BracketBlockData *data = ensure(block);
+        const int offset = position - block.position();
+        int count = 1;
+        for (auto b = data->brackets.crbegin(); b != data->brackets.crend(); ++b) {
+            if (b->position < offset && b->type == type && (count += b->open ? -1 : 1) == 0)
+                return block.position() + b->position;
         }
-    }
-    
-    void toggleBracketMatching() {
-        bracketMatchingEnabled = !bracketMatchingEnabled;
-        highlightCurrentLine(); // Update to show/hide current bracket matching
-    }
-    
-    bool save(const QString &fileName) {
-        QFile file(fileName);
-        if (file.open(QFile::WriteOnly | QFile::Text)) {
-            QTextStream out(&file);
-            out << toPlainText();
-            file.close();
-            document()->setModified(false);
-            return true;
+        for (block = block.previous(); block.isValid(); block = block.previous()) {
+            data = ensure(block);
+            if (count + data->minSuffix[type] > 0) {
+                count -= data->net[type];
+                continue;
+            }
+            for (auto b = data->brackets.crbegin(); b != data->brackets.crend(); ++b) {
+                if (b->type == type && (count += b->open ? -1 : 1) == 0)
+                    return block.position() + b->position;
+            }
         }
-        return false;
+        return -1;
     }
-    
-    bool load(const QString &fileName) {
-        QFile file(fileName);
-        if (file.open(QFile::ReadOnly | QFile::Text)) {
-            setPlainText(file.readAll());
-            file.close();
-            document()->setModified(false);
-            return true;
+
+private:
+    void onContentsChange(int from, int charsRemoved, int charsAdded) {
+        Q_UNUSED(charsRemoved);
+        QTextBlock block = document->findBlock(from);
+        const QTextBlock last = document->findBlock(from + charsAdded);
+        while (block.isValid()) {
+            if (auto *data = static_cast<BracketBlockData *>(block.userData()))
+                data->valid = false;
+            if (block == last)
+                break;
+            block = block.next();
         }
-        return false;
     }
 
-protected:
-    void resizeEvent(QResizeEvent *event) override {
-        QPlainTextEdit::resizeEvent(event);
-        
-        QRect cr = contentsRect();
-        lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), lineNumberAreaWidth(), cr.height()));
+    static int incomingState(const QTextBlock &block) {
+        const int state = block.previous().isValid() ? block.previous().userState() : -1;
+        return state < 0 ? int(CppLexer::Normal) : state;
     }
-    
-    void keyPressEvent(QKeyEvent *event) override {
-        if (event->key() == Qt::Key_Tab) {
-            // Insert spaces instead of tab character
-            QTextCursor cursor = textCursor();
-            cursor.insertText("    ");
-            event->accept();
-        } else if (event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter) {
-            // Auto-indentation
-            QTextCursor cursor = textCursor();
-            QString currentLine = cursor.block().text();
-            
-            // Find leading whitespace
-            int indentSize = 0;
-            while (indentSize < currentLine.length() && currentLine.at(indentSize).isSpace()) {
-                indentSize++;
+
+    static const BracketBlockData *ensure(QTextBlock block) {
+        auto *data = static_cast<BracketBlockData *>(block.userData());
+        const int state = incomingState(block);
+        if (data && data->valid && data->lexState == state)
+            return data;
+
+        if (!data) {
+            data = new BracketBlockData;
+            block.setUserData(data);
+        }
+
+        data->brackets.clear();
+        const QString text = block.text();
+        CppLexer::lex(text, state, [&text, data](int start, int, TokenKind kind) {
+            if (kind != TokenKind::Bracket)
+                return;
+            const char16_t c = text[start].unicode();
+            const quint8 type = (c == u'(' || c == u')') ? 0 : (c == u'{' || c == u'}') ? 1 : 2;
+            data->brackets.append({start, type, c == u'(' || c == u'{' || c == u'['});
+        });
+
+        for (int type = 0; type < 3; ++type) {
+            int sum = 0;
+            int lowest = 0;
+            for (const BracketBlockData::Bracket &b : std::as_const(data->brackets)) {
+                if (b.type == type) {
+                    sum += b.open ? 1 : -1;
+                    lowest = qMin(lowest, sum);
+                }
             }
-            
-            // Default indent
-            QString indent = currentLine.left(indentSize);
-            
-            // Check for conditions that would increase indentation (like ending with '{')
-            if (currentLine.trimmed().endsWith("{") || 
-                currentLine.trimmed().endsWith(":")) {
-                indent += "    ";
+            data->net[type] = sum;
+            data->minPrefix[type] = lowest;
+
+            sum = 0;
+            lowest = 0;
+            for (auto b = data->brackets.crbegin(); b != data->brackets.crend(); ++b) {
+                if (b->type == type) {
+                    sum += b->open ? -1 : 1;
+                    lowest = qMin(lowest, sum);
+                }
             }
-            
-            QPlainTextEdit::keyPressEvent(event);
-            cursor = textCursor();
-            cursor.insertText(indent);
-        } else {
-            QPlainTextEdit::keyPressEvent(event);
-        }
-        
-        // Update bracket matching
-        if (bracketMatchingEnabled) {
-            matchBrackets();
+            data->minSuffix[type] = lowest;
         }
-    }
 
-private slots:
-    void updateLineNumberAreaWidth(int newBlockCount) {
-        setViewportMargins(lineNumberAreaWidth(), 0, 0, 0);
+        data->lexState = state;
+        data->valid = true;
+        return data;
     }
 
-    void updateLineNumberArea(const QRect &rect, int dy) {
-        if (dy)
-            lineNumberArea->scroll(0, dy);
-        else
-            lineNumberArea->update(0, rect.y(), lineNumberArea->width(), rect.height());
+    QTextDocument *document;
+};
 
-        if (rect.contains(viewport()->rect()))
-            updateLineNumberAreaWidth(0);
-    }
-    
-    void highlightCurrentLine() {
-        QList<QTextEdit::ExtraSelection> extraSelections;
+// Outcome of a background save, produced on the worker
+struct SaveResult {
+    bool ok = false;
+    qint64 bytes = 0;
+    qint64 msecs = 0;
+    QString error;
 
-        // Highlight current line
-        if (!isReadOnly()) {
-            QTextEdit::ExtraSelection selection;
-            QColor lineColor = QColor("#2D2D30").lighter(120);
-            selection.format.setBackground(lineColor);
-            selection.format.setProperty(QTextFormat::FullWidthSelection, true);
-            selection.cursor = textCursor();
-            selection.cursor.clearSelection();
-            extraSelections.append(selection);
+    // Runs on the worker: encodes the snapshot in slices and writes it through
+    // QSaveFile, so the target is only replaced once everything is on disk
+    static SaveResult write(const QString &fileName, const QString &text, QPromise<SaveResult> &promise) {
+        static constexpr qsizetype SliceChars = 1024 * 1024;
+
+        SaveResult result;
+        QElapsedTimer timer;
+        timer.start();
+
+        QSaveFile file(fileName);
+        if (!file.open(QFile::WriteOnly | QFile::Text)) {
+            result.error = file.errorString();
+            return result;
         }
-        
-        // Add bracket matching highlighting if enabled
-        if (bracketMatchingEnabled && bracketPos != -1) {
-            QTextEdit::ExtraSelection selection;
-            selection.format.setBackground(QColor("#664B0082"));
-            selection.format.setForeground(Qt::white);
-            selection.cursor = textCursor();
-            selection.cursor.setPosition(bracketPos);
-            selection.cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, bracketLength);
-            extraSelections.append(selection);
+
+        QStringEncoder encoder(QStringEncoder::Utf8);
+        const QStringView view(text);
+        for (qsizetype offset = 0; offset < view.size(); offset += SliceChars) {
+            if (promise.isCanceled()) {
+                file.cancelWriting();
+                result.error = "Save cancelled";
+                return result;
+            }
+            const QByteArray bytes = encoder.encode(view.mid(offset, SliceChars));
+            if (file.write(bytes) != bytes.size()) {
+                result.error = file.errorString();
+                file.cancelWriting();
+                return result;
+            }
+            result.bytes += bytes.size();
         }
-        
-        setExtraSelections(extraSelections);
-    }
-    
-    void handleTextChanged() {
-        // Perform any needed actions when text changes
-        if (bracketMatchingEnabled) {
-            matchBrackets();
+
+        result.ok = file.commit();
+        if (!result.ok) {
+            result.error = file.errorString();
         }
+        result.msecs = timer.elapsed();
+        return result;
     }
-    
-    void matchBrackets() {
-        bracketPos = -1;
-        bracketLength = 0;
-        
-        QTextCursor cursor = textCursor();
-        int position = cursor.position();
-        
-        if (position == 0) {
-            highlightCurrentLine();
+};
+
+// Shared between CodeEditor and the worker streaming a file into it. The worker
+// decodes one chunk at a time and may run at most LoadQueueDepth chunks ahead of
+// the GUI, so memory stays at the document plus a couple of chunks
+struct FileLoadJob {
+    static constexpr qint64 ChunkBytes = 512 * 1024;
+    static constexpr int QueueDepth = 2;
+
+    QMutex mutex;
+    QQueue<QString> chunks;
+    QSemaphore freeSlots{QueueDepth};
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> failed{false};
+    std::atomic<qint64> bytesRead{0};
+    qint64 size = 0;
+
+    // Runs on the worker: maps the file, decodes it chunk by chunk (cutting at
+    // line ends where a chunk has one) and queues the text. A chunk ending in
+    // '\r' keeps it back for the next one, so a CRLF pair split between two
+    // chunks is still folded into one line break
+    static void run(const QString &fileName, const std::shared_ptr<FileLoadJob> &job,
+                    QPromise<int> &promise) {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly)) {
+            job->failed = true;
             return;
         }
-        
-        // Check character before cursor
-        cursor.setPosition(position - 1);
-        QString text = toPlainText();
-        QChar ch = text.at(position - 1);
-        
-        if (ch == '(' || ch == '{' || ch == '[') {
-            // Find matching closing bracket
-            QChar openBracket = ch;
-            QChar closeBracket;
-            if (ch == '(') closeBracket = ')';
-            else if (ch == '{') closeBracket = '}';
-            else closeBracket = ']';
-            
-            int count = 1;
-            for (int i = position; i < text.length(); i++) {
-                if (text.at(i) == openBracket) count++;
-                else if (text.at(i) == closeBracket) count--;
-                
-                if (count == 0) {
-                    bracketPos = i;
-                    bracketLength = 1;
-                    break;
-                }
+
+        const qint64 size = file.size();
+        // Sequential or special files cannot be mapped; read those in chunks
+        const uchar *mapped = size > 0 ? file.map(0, size) : nullptr;
+        QStringDecoder decoder(QStringDecoder::Utf8);
+        qint64 offset = 0;
+        int index = 0;
+        bool carriageReturn = false;
+
+        auto queue = [&](QString text) {
+            job->freeSlots.acquire();
+            if (job->cancelled)
+                return false;
+            {
+                QMutexLocker locker(&job->mutex);
+                job->chunks.enqueue(std::move(text));
             }
-        } else if (ch == ')' || ch == '}' || ch == ']') {
-            // Find matching opening bracket
-            QChar closeBracket = ch;
-            QChar openBracket;
-            if (ch == ')') openBracket = '(';
-            else if (ch == '}') openBracket = '{';
-            else openBracket = '[';
-            
-            int count = 1;
-            for (int i = position - 2; i >= 0; i--) {
-                if (text.at(i) == closeBracket) count++;
-                else if (text.at(i) == openBracket) count--;
-                
-                if (count == 0) {
-                    bracketPos = i;
-                    bracketLength = 1;
+            job->bytesRead = offset;
+            promise.addResult(index, index);
+            ++index;
+            return true;
+        };
+
+        while (!job->cancelled) {
+            QByteArray buffer;
+            QByteArrayView bytes;
+            if (mapped) {
+                if (offset >= size)
                     break;
+                qint64 end = qMin(size, offset + ChunkBytes);
+                if (end < size) {
+                    const qsizetype newline = QByteArrayView(mapped + offset, end - offset).lastIndexOf('\n');
+                    if (newline >= 0)
+                        end = offset + newline + 1;
                 }
+                bytes = QByteArrayView(mapped + offset, end - offset);
+            } else {
+                buffer = file.read(ChunkBytes);
+                if (buffer.isEmpty())
+                    break;
+                bytes = buffer;
             }
+            offset += bytes.size();
+
+            QString text = decoder.decode(bytes);
+            if (carriageReturn)
+                text.prepend(u'\r');
+            carriageReturn = text.endsWith(u'\r');
+            if (carriageReturn)
+                text.chop(1);
+            text.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+            if (!queue(std::move(text)))
+                break;
         }
-        
-        highlightCurrentLine();
+        // A lone '\r' at the very end of the file
+        if (carriageReturn && !job->cancelled)
+            queue(QStringLiteral("\r"));
+
+        if (mapped)
+            file.unmap(const_cast<uchar *>(mapped));
     }
+};
 
-    void lineNumberAreaPaintEvent(QPaintEvent *event) {
-        QPainter painter(lineNumberArea);
-        painter.fillRect(event->rect(), QColor("#1E1E1E"));
+// Counts newlines in `data`, which starts at file offset `base`, continuing from
+// `lineCount` lines already seen. record(offset) receives the start offset of every
+// line whose number is a multiple of `every`. Scans 64 bytes per step with SSE2
+template <typename Record>
+qint64 scanNewlines(const char *data, qint64 size, qint64 base, qint64 lineCount, int every, Record &&record) {
+    qint64 i = 0;
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 64 <= size; i += 64) {
+        const char *p = data + i;
+        auto mask16 = [&](int offset) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + offset));
+            return quint64(quint16(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline))));
+        };
+        quint64 mask = mask16(0) | (mask16(16) << 16) | (mask16(32) << 32) | (mask16(48) << 48);
+        const int count = qPopulationCount(mask);
+        if (lineCount % every + count < every) {
+            lineCount += count;
+            continue;
+        }
+        while (mask) {
+            const int bit = int(qCountTrailingZeroBits(mask));
+            mask &= mask - 1;
+            if (++lineCount % every == 0)
+                record(base + i + bit + 1);
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (data[i] == '\n' && ++lineCount % every == 0)
+            record(base + i + 1);
+    }
+    return lineCount;
+}
 
-        QTextBlock block = firstVisibleBlock();
-        int blockNumber = block.blockNumber();
-        int top = qRound(blockBoundingGeometry(block).translated(contentOffset()).top());
-        int bottom = top + qRound(blockBoundingRect(block).height());
+// Sparse line index shared between LargeFileView and its indexing worker: the
+// start offset of every CheckpointLines-th line, so a 2 GB file needs a few MB
+struct LineIndex {
+    static constexpr int CheckpointLines = 64;
+    static constexpr qint64 ReadBytes = 4 * 1024 * 1024;
 
-        while (block.isValid() && top <= event->rect().bottom()) {
-            if (block.isVisible() && bottom >= event->rect().top()) {
-                QString number = QString::number(blockNumber + 1);
-                painter.setPen(QColor("#858585"));
-                painter.drawText(0, top, lineNumberArea->width() - 5, fontMetrics().height(),
-                                 Qt::AlignRight, number);
+    QMutex mutex;
+    QList<qint64> checkpoints;
+    qint64 lineCount = 1;
+    qint64 bytesScanned = 0;
+    std::atomic<bool> cancelled{false};
+
+    // Runs on the worker. Reads through QFile rather than the mapping so pages
+    // touched by the scan are not charged to the process
+    static void build(const QString &fileName, const std::shared_ptr<LineIndex> &index, QPromise<int> &promise) {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly))
+            return;
+
+        QByteArray buffer(ReadBytes, Qt::Uninitialized);
+        QList<qint64> found;
+        qint64 offset = 0;
+        qint64 lines = 0;
+        int batch = 0;
+        while (!index->cancelled) {
+            const qint64 n = file.read(buffer.data(), buffer.size());
+            if (n <= 0)
+                break;
+
+            lines = scanNewlines(buffer.constData(), n, offset, lines, CheckpointLines,
+                                 [&found](qint64 lineStart) { found.append(lineStart); });
+            offset += n;
+            {
+                QMutexLocker locker(&index->mutex);
+                index->checkpoints.append(found);
+                index->lineCount = lines + 1;
+                index->bytesScanned = offset;
             }
+            found.clear();
+            promise.addResult(batch, batch);
+            ++batch;
+        }
+    }
+};
 
-            block = block.next();
-            top = bottom;
-            bottom = top + qRound(blockBoundingRect(block).height());
-            ++blockNumber;
+// Read-only view of a file too large for a QTextDocument. The file is memory
+// mapped and only the lines on screen are decoded and painted; a sparse line
+// index built in the background makes scrolling and goto-line cheap anywhere
+class LargeFileView : public QAbstractScrollArea {
+    Q_OBJECT
+public:
+    LargeFileView(QWidget *parent = nullptr) : QAbstractScrollArea(parent) {
+        QFont font("Cascadia Code", 10);
+        if (!QFontInfo(font).fixedPitch()) {
+            font.setFamily("Consolas");
+            if (!QFontInfo(font).fixedPitch()) {
+                font.setFamily("Courier New");
+            }
+        }
+        font.setFixedPitch(true);
+        setFont(font);
+
+        QPalette p = palette();
+        p.setColor(QPalette::Base, QColor("#1E1E1E"));
+        p.setColor(QPalette::Text, QColor("#D4D4D4"));
+        setPalette(p);
+        setFocusPolicy(Qt::StrongFocus);
+
+        connect(&indexWatcher, &QFutureWatcher<int>::resultReadyAt, this, &LargeFileView::onIndexProgress);
+        connect(&indexWatcher, &QFutureWatcher<int>::finished, this, &LargeFileView::indexingFinished);
+        connect(&searchWatcher, &QFutureWatcher<qint64>::finished, this, &LargeFileView::onSearchFinished);
+    }
+
+    ~LargeFileView() {
+        closeFile();
+    }
+
+    bool open(const QString &fileName) {
+        closeFile();
+
+        file.setFileName(fileName);
+        if (!file.open(QFile::ReadOnly)) {
+            return false;
+        }
+        fileSize = file.size();
+        mapped = fileSize > 0 ? file.map(0, fileSize) : nullptr;
+        if (fileSize > 0 && !mapped) {
+            file.close();
+            return false;
+        }
+
+        index = std::make_shared<LineIndex>();
+        index->checkpoints.append(0);
+        const std::shared_ptr<LineIndex> job = index;
+        indexWatcher.setFuture(runInPool<int>([fileName, job](QPromise<int> &promise) {
+            LineIndex::build(fileName, job, promise);
+        }));
+
+        highlightedLine = -1;
+        matchOffset = -1;
+        pendingMatch = -1;
+        maxLineChars = 0;
+        updateScrollBars();
+        verticalScrollBar()->setValue(0);
+        horizontalScrollBar()->setValue(0);
+        viewport()->update();
+        return true;
+    }
+
+    void closeFile() {
+        if (index) {
+            index->cancelled = true;
+            indexWatcher.cancel();
+            index.reset();
+        }
+        searchWatcher.cancel();
+        pendingMatch = -1;
+        if (mapped) {
+            file.unmap(mapped);
+            mapped = nullptr;
+        }
+        file.close();
+        fileSize = 0;
+    }
+
+    qint64 lineCount() const {
+        if (!index) {
+            return 0;
+        }
+        QMutexLocker locker(&index->mutex);
+        return index->lineCount;
+    }
+
+    // Scrolls so that `line` (1-based) is at the top and marks it
+    void goToLine(qint64 line) {
+        highlightedLine = qBound<qint64>(0, line - 1, lineCount() - 1);
+        matchOffset = -1;
+        pendingMatch = -1;
+        verticalScrollBar()->setValue(int(qMin<qint64>(highlightedLine, INT_MAX)));
+        viewport()->update();
+    }
+
+    // Searches forward in the background from just past the last match, or
+    // from the marked line or the top of the view, wrapping around to the
+    // start of the file once like CodeEditor::findText
+    void find(const QString &text) {
+        if (!index || text.isEmpty()) {
+            return;
+        }
+
+        const qint64 last = pendingMatch >= 0 ? pendingMatch : matchOffset;
+        qint64 from = last + 1;
+        if (last < 0) {
+            from = lineStart(highlightedLine >= 0 ? highlightedLine + 1 : verticalScrollBar()->value());
+        }
+        pendingMatch = -1;
+        if (from < 0) {
+            // Past the indexed lines; start over from the top
+            from = 0;
+        }
+
+        const QString fileName = file.fileName();
+        const QByteArray needle = text.toUtf8();
+        const qint64 size = fileSize;
+        searchWatcher.cancel();
+        searchWatcher.setFuture(runInPool<qint64>([fileName, needle, from, size](QPromise<qint64> &promise) {
+            qint64 match = searchFile(fileName, needle, from, size, promise);
+            if (match < 0 && from > 0) {
+                match = searchFile(fileName, needle, 0, from, promise);
+            }
+            promise.addResult(match);
+        }));
+    }
+
+signals:
+    void indexingProgress(qint64 bytesScanned, qint64 totalBytes);
+    void indexingFinished();
+    void searchFinished(bool found);
+
+protected:
+    void paintEvent(QPaintEvent *event) override {
+        Q_UNUSED(event);
+        QPainter painter(viewport());
+        painter.fillRect(viewport()->rect(), palette().color(QPalette::Base));
+        if (!index) {
+            return;
+        }
+
+        const QFontMetrics metrics(font());
+        const int lineHeight = metrics.height();
+        const int gutter = gutterWidth();
+        const int charWidth = metrics.horizontalAdvance(QLatin1Char(' '));
+        const qint64 first = verticalScrollBar()->value();
+        const int rows = viewport()->height() / lineHeight + 1;
+        const int xOffset = horizontalScrollBar()->value() * charWidth;
+
+        painter.fillRect(0, 0, gutter, viewport()->height(), QColor("#1E1E1E"));
+
+        qint64 offset = lineStart(first);
+        for (int row = 0; row < rows && offset >= 0 && offset <= fileSize; ++row) {
+            const qint64 line = first + row;
+            const int y = row * lineHeight;
+            qint64 end = lineEnd(offset);
+
+            if (line == highlightedLine) {
+                painter.fillRect(gutter, y, viewport()->width() - gutter, lineHeight, QColor("#2D2D30").lighter(120));
+            }
+
+            painter.setPen(QColor("#858585"));
+            painter.drawText(0, y, gutter - 5, lineHeight, Qt::AlignRight, QString::number(line + 1));
+
+            qint64 length = qMin<qint64>(end - offset, MaxLineBytes);
+            if (length > 0 && mapped[offset + length - 1] == '\r') {
+                --length;
+            }
+            const QString text = QString::fromUtf8(reinterpret_cast<const char *>(mapped + offset), length);
+            maxLineChars = qMax(maxLineChars, int(text.size()));
+
+            painter.setClipRect(gutter, y, viewport()->width() - gutter, lineHeight);
+            painter.setPen(palette().color(QPalette::Text));
+            painter.drawText(gutter + 5 - xOffset, y, INT_MAX / 2, lineHeight, Qt::AlignLeft | Qt::TextExpandTabs, text);
+            painter.setClipping(false);
+
+            if (end >= fileSize) {
+                break;
+            }
+            offset = end + 1;
+        }
+
+        if (horizontalScrollBar()->maximum() < maxLineChars) {
+            updateScrollBars();
+        }
+    }
+
+    void resizeEvent(QResizeEvent *event) override {
+        QAbstractScrollArea::resizeEvent(event);
+        updateScrollBars();
+    }
+
+private slots:
+    void onIndexProgress() {
+        if (!index) {
+            return;
+        }
+        qint64 scanned;
+        {
+            QMutexLocker locker(&index->mutex);
+            scanned = index->bytesScanned;
         }
+        updateScrollBars();
+        viewport()->update();
+        showPendingMatch();
+        emit indexingProgress(scanned, fileSize);
+    }
+
+    void onSearchFinished() {
+        const QFuture<qint64> future = searchWatcher.future();
+        pendingMatch = (!future.isCanceled() && future.resultCount() > 0) ? future.result() : -1;
+        const bool found = pendingMatch >= 0;
+        showPendingMatch();
+        emit searchFinished(found);
     }
 
 private:
-    class LineNumberArea : public QWidget {
-    public:
-        LineNumberArea(CodeEditor *editor) : QWidget(editor), codeEditor(editor) {}
+    static constexpr qint64 MaxLineBytes = 16 * 1024;
 
-        QSize sizeHint() const override {
-            return QSize(codeEditor->lineNumberAreaWidth(), 0);
+    int gutterWidth() const {
+        const int digits = QString::number(qMax<qint64>(1, lineCount())).size();
+        return 20 + QFontMetrics(font()).horizontalAdvance(QLatin1Char('9')) * digits;
+    }
+
+    void updateScrollBars() {
+        const int lineHeight = QFontMetrics(font()).height();
+        const int rows = qMax(1, viewport()->height() / lineHeight);
+        verticalScrollBar()->setRange(0, int(qMin<qint64>(INT_MAX, qMax<qint64>(0, lineCount() - rows))));
+        verticalScrollBar()->setPageStep(rows);
+        horizontalScrollBar()->setRange(0, maxLineChars);
+        horizontalScrollBar()->setPageStep(viewport()->width() / qMax(1, QFontMetrics(font()).horizontalAdvance(QLatin1Char(' '))));
+    }
+
+    // Offset of the first byte of `line` (0-based), or -1 if not indexed yet
+    qint64 lineStart(qint64 line) const {
+        if (!index || line < 0) {
+            return -1;
+        }
+        qint64 offset;
+        {
+            QMutexLocker locker(&index->mutex);
+            const qint64 checkpoint = line / LineIndex::CheckpointLines;
+            if (checkpoint >= index->checkpoints.size()) {
+                return -1;
+            }
+            offset = index->checkpoints[checkpoint];
+        }
+        for (qint64 skip = line % LineIndex::CheckpointLines; skip > 0; --skip) {
+            offset = lineEnd(offset);
+            if (offset >= fileSize) {
+                return -1;
+            }
+            ++offset;
         }
+        return offset;
+    }
 
-    protected:
-        void paintEvent(QPaintEvent *event) override {
-            codeEditor->lineNumberAreaPaintEvent(event);
+    // Offset of the newline ending the line that starts at `offset`, or fileSize
+    qint64 lineEnd(qint64 offset) const {
+        if (offset >= fileSize) {
+            return fileSize;
         }
+        const void *newline = memchr(mapped + offset, '\n', size_t(fileSize - offset));
+        return newline ? static_cast<const uchar *>(newline) - mapped : fileSize;
+    }
 
-    private:
-        CodeEditor *codeEditor;
-    };
+    // A match found past the lines indexed so far stays pending, and the
+    // view where it is, until the indexer has counted the lines before it;
+    // lineForOffset then walks less than a checkpoint's worth of lines
+    void showPendingMatch() {
+        if (pendingMatch < 0 || !index) {
+            return;
+        }
+        {
+            QMutexLocker locker(&index->mutex);
+            if (index->bytesScanned < pendingMatch) {
+                return;
+            }
+        }
+        const qint64 match = pendingMatch;
+        goToLine(lineForOffset(match) + 1);
+        matchOffset = match;
+    }
 
-    LineNumberArea *lineNumberArea;
-    CodeHighlighter *highlighter;
-    bool bracketMatchingEnabled;
-    int bracketPos;
-    int bracketLength;
+    // Line of the byte at target; the index must already cover target
+    qint64 lineForOffset(qint64 target) const {
+        qint64 line;
+        qint64 offset;
+        {
+            QMutexLocker locker(&index->mutex);
+            auto it = std::upper_bound(index->checkpoints.cbegin(), index->checkpoints.cend(), target);
+            const qint64 checkpoint = (it - index->checkpoints.cbegin()) - 1;
+            line = checkpoint * LineIndex::CheckpointLines;
+            offset = index->checkpoints[checkpoint];
+        }
+        for (;;) {
+            const qint64 end = lineEnd(offset);
+            if (end >= target || end >= fileSize) {
+                return line;
+            }
+            offset = end + 1;
+            ++line;
+        }
+    }
+
+    // Runs on the worker: returns the offset of the first match starting in
+    // [from, to); a match may run past `to`
+    static qint64 searchFile(const QString &fileName, const QByteArray &needle, qint64 from, qint64 to,
+                             QPromise<qint64> &promise) {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly) || !file.seek(from)) {
+            return -1;
+        }
+
+        // Keep the last needle.size() - 1 bytes so matches across reads are found
+        QByteArray window;
+        qint64 windowStart = from;
+        while (!promise.isCanceled() && windowStart < to) {
+            const QByteArray chunk = file.read(LineIndex::ReadBytes);
+            if (chunk.isEmpty()) {
+                break;
+            }
+            window += chunk;
+            const qsizetype hit = QByteArrayView(window).indexOf(needle);
+            if (hit >= 0) {
+                return windowStart + hit < to ? windowStart + hit : -1;
+            }
+            const qsizetype keep = qMin<qsizetype>(window.size(), needle.size() - 1);
+            windowStart += window.size() - keep;
+            window = window.right(keep);
+        }
+        return -1;
+    }
+
+    QFile file;
+    uchar *mapped = nullptr;
+    qint64 fileSize = 0;
+    std::shared_ptr<LineIndex> index;
+    QFutureWatcher<int> indexWatcher;
+    QFutureWatcher<qint64> searchWatcher;
+    qint64 highlightedLine = -1;
+    qint64 matchOffset = -1;  // Start of the match highlightedLine was marked for
+    qint64 pendingMatch = -1;  // Match waiting for the index to reach it
+    int maxLineChars = 0;
 };
 
-// File tree widget to display project structure
-class ProjectTreeWidget : public QTreeWidget {
+// Enhanced code editor with line numbers and syntax highlighting
+class CodeEditor : public QPlainTextEdit {
     Q_OBJECT
 public:
-    ProjectTreeWidget(QWidget *parent = nullptr) : QTreeWidget(parent) {
-        setHeaderLabel("Project Files");
-        setColumnCount(1);
-        setSortingEnabled(true);
-        
-        // Set style
-        setStyleSheet("QTreeWidget { background-color: #252526; color: #D4D4D4; border: none; }");
-        
-        // Add sample project structure
-        addSampleProjectStructure();
-        
-        // Connect signals
-        connect(this, &QTreeWidget::itemDoubleClicked, this, &ProjectTreeWidget::onItemDoubleClicked);
-    }
-    
-    void addSampleProjectStructure() {
-        // Root item
-        QTreeWidgetItem *projectRoot = new QTreeWidgetItem(this);
-        projectRoot->setText(0, "Project");
-        projectRoot->setIcon(0, style()->standardIcon(QStyle::SP_DirIcon));
-        projectRoot->setExpanded(true);
-        
-        // Source directory
-        QTreeWidgetItem *srcDir = new QTreeWidgetItem(projectRoot);
-        srcDir->setText(0, "src");
-        srcDir->setIcon(0, style()->standardIcon(QStyle::SP_DirIcon));
-        srcDir->setExpanded(true);
-        
-        // Source files
-        QTreeWidgetItem *mainCpp = new QTreeWidgetItem(srcDir);
-        mainCpp->setText(0, "main.cpp");
-        mainCpp->setIcon(0, style()->standardIcon(QStyle::SP_FileIcon));
-        
-        QTreeWidgetItem *appCpp = new QTreeWidgetItem(srcDir);
-        appCpp->setText(0, "application.cpp");
-        appCpp->setIcon(0, style()->standardIcon(QStyle::SP_FileIcon));
+    CodeEditor(QWidget *parent = nullptr) : QPlainTextEdit(parent) {
+        lineNumberArea = new LineNumberArea(this);
+
+        // Setup syntax highlighter
+        highlighter = new CodeHighlighter(this->document());
         
-        QTreeWidgetItem *appH = new QTreeWidgetItem(srcDir);
-        appH->setText(0, "application.h");
-        appH->setIcon(0, style()->standardIcon(QStyle::SP_FileIcon));
+        connect(this, &CodeEditor::blockCountChanged, this, &CodeEditor::updateLineNumberAreaWidth);
+        connect(this, &CodeEditor::updateRequest, this, &CodeEditor::updateLineNumberArea);
+        connect(this, &CodeEditor::cursorPositionChanged, this, &CodeEditor::highlightCurrentLine);
         
-        // Include directory
-        QTreeWidgetItem *includeDir = new QTreeWidgetItem(projectRoot);
-        includeDir->setText(0, "include");
-        includeDir->setIcon(0, style()->standardIcon(QStyle::SP_DirIcon));
+        updateLineNumberAreaWidth(0);
+        highlightCurrentLine();
+
+        // Set monospace font
+        QFont font("Cascadia Code", 10);
+        if (!QFontInfo(font).fixedPitch()) {
+            font.setFamily("Consolas");
+            if (!QFontInfo(font).fixedPitch()) {
+                font.setFamily("Courier New");
+            }
+        }
+        font.setFixedPitch(true);
+        this->setFont(font);
+
+        // Set tab width
+        QFontMetrics metrics(font);
+        this->setTabStopDistance(4 * metrics.horizontalAdvance(' '));
+
+        // Set dark theme colors
+        QPalette p = palette();
+        p.setColor(QPalette::Base, QColor("#1E1E1E"));
+        p.setColor(QPalette::Text, QColor("#D4D4D4"));
+        setPalette(p);
         
-        // Build directory
-        QTreeWidgetItem *buildDir = new QTreeWidgetItem(projectRoot);
-        buildDir->setText(0, "build");
-        buildDir->setIcon(0, style()->standardIcon(QStyle::SP_DirIcon));
+        // Line wrapping
+        setLineWrapMode(QPlainTextEdit::NoWrap);
         
-        // Config files
-        QTreeWidgetItem *cmakeFile = new QTreeWidgetItem(projectRoot);
-        cmakeFile->setText(0, "CMakeLists.txt");
-        cmakeFile->setIcon(0, style()->standardIcon(QStyle::SP_FileIcon));
+        // Enable auto-indentation
+        connect(this, &CodeEditor::textChanged, this, &CodeEditor::handleTextChanged);
         
-        QTreeWidgetItem *readmeFile = new QTreeWidgetItem(projectRoot);
-        readmeFile->setText(0, "README.md");
-        readmeFile->setIcon(0, style()->standardIcon(QStyle::SP_FileIcon));
-    }
+        // Set bracket matching
+        bracketIndex = new BracketIndex(this->document(), this);
+        bracketMatchingEnabled = true;
+        bracketPos = -1;
+        bracketLength = 0;
+
+        // Streaming file loads
+        connect(&loadWatcher, &QFutureWatcher<int>::resultReadyAt, this, &CodeEditor::appendLoadedChunks);
+        connect(&loadWatcher, &QFutureWatcher<int>::finished, this, &CodeEditor::finishLoad);
+
+        // Background saves
+        saveRevision = -1;
+        connect(&saveWatcher, &QFutureWatcher<SaveResult>::finished, this, &CodeEditor::finishSave);
+    }
+
+    ~CodeEditor() {
+        cancelLoad();
+    }
+
+    int lineNumberAreaWidth() {
+        int digits = 1;
+        int max = qMax(1, blockCount());
+        while (max >= 10) {
+            max /= 10;
+            ++digits;
+        }
+
+        int space = 20 + fontMetrics().horizontalAdvance(QLatin1Char('9')) * digits;
+        return space;
+    }
+    
+    void toggleWordWrap() {
+        if (lineWrapMode() == QPlainTextEdit::NoWrap) {
+            setLineWrapMode(QPlainTextEdit::WidgetWidth);
+        } else {
+            setLineWrapMode(QPlainTextEdit::NoWrap);
+        }
+    }
+    
+    void changeEditorFont() {
+        bool ok;
+        QFont font = QFontDialog::getFont(&ok, this->font(), this);
+        if (ok) {
+            this->setFont(font);
+            // Update tab stop distance for the new font
+            QFontMetrics metrics(font);
+            this->setTabStopDistance(4 * metrics.horizontalAdvance(' '));
+        }
+    }
+    
+    void toggleBackgroundHighlighting() {
+        highlighter->setBackgroundTokenizing(!highlighter->isBackgroundTokenizing());
+    }
+
+    void toggleBracketMatching() {
+        bracketMatchingEnabled = !bracketMatchingEnabled;
+        highlightCurrentLine(); // Update to show/hide current bracket matching
+    }
+    
+    // Starts saving a snapshot of the document on a worker and returns
+    // immediately, so editing can continue; saveFinished() reports the result.
+    // A save already in progress is cancelled, and this one is queued until
+    // that worker has returned: it may be past its last cancellation check and
+    // commit anyway, and the newer snapshot has to be the one that lands last
+    bool save(const QString &fileName) {
+        if (isViewingLargeFile() || isLoading()) {
+            return false;
+        }
+
+        currentFileName = fileName;
+        pendingSave = PendingSave{fileName, toPlainText(), document()->revision()};
+        if (saveWatcher.isRunning()) {
+            saveWatcher.cancel();
+        } else {
+            startPendingSave();
+        }
+        return true;
+    }
+
+    bool isSaving() const {
+        return saveWatcher.isRunning() || pendingSave.has_value();
+    }
+
+    // Starts streaming the file into the editor: a worker maps and decodes it,
+    // and chunks are appended from the event loop as they arrive. Returns false
+    // if the file cannot be opened; completion is reported by loadFinished()
+    bool load(const QString &fileName) {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly)) {
+            return false;
+        }
+        const qint64 size = file.size();
+        file.close();
+
+        cancelLoad();
+        currentFileName = fileName;
+        if (size >= largeFileThreshold()) {
+            return openInViewer(fileName);
+        }
+        closeViewer();
+        clear();
+        document()->setUndoRedoEnabled(false);
+        setReadOnly(true);
+
+        loadJob = std::make_shared<FileLoadJob>();
+        loadJob->size = size;
+        const std::shared_ptr<FileLoadJob> job = loadJob;
+        loadWatcher.setFuture(runInPool<int>([fileName, job](QPromise<int> &promise) {
+            FileLoadJob::run(fileName, job, promise);
+        }));
+        emit loadProgress(0, size);
+        return true;
+    }
+
+    bool isLoading() const {
+        return loadJob != nullptr;
+    }
+
+    // File last loaded or saved, empty for a new buffer
+    QString fileName() const {
+        return currentFileName;
+    }
+
+    // What the chat packs as context: nothing while a file loads or sits in
+    // the large-file viewer
+    EditorContextBuilder::Source contextSource() const {
+        EditorContextBuilder::Source source;
+        if (isLoading() || isViewingLargeFile())
+            return source;
+        source.document = document();
+        source.cursor = textCursor();
+        source.fileName = currentFileName;
+        enclosingFunction(source.cursor.position(), &source.functionFirst, &source.functionLast);
+        return source;
+    }
+
+    // Suggested text painted after the cursor, greyed out, until the cursor
+    // moves away from where it was offered. Tab inserts it, Escape drops it
+    void setGhostText(const QString &text) {
+        ghostText = text;
+        ghostPosition = textCursor().position();
+        viewport()->update();
+    }
+
+    bool hasGhostText() const {
+        return !ghostText.isEmpty() && textCursor().position() == ghostPosition;
+    }
+
+    void clearGhostText() {
+        if (!ghostText.isEmpty()) {
+            ghostText.clear();
+            viewport()->update();
+        }
+    }
+
+    // True while a file above the large-file threshold is shown read-only
+    bool isViewingLargeFile() const {
+        return viewer && !viewer->isHidden();
+    }
+
+    // Files at least this large open in the read-only viewer instead of the document
+    static qint64 largeFileThreshold() {
+        QSettings settings("MyDevApp", "Editor");
+        return settings.value("largeFileThreshold", qint64(64) * 1024 * 1024).toLongLong();
+    }
+
+    void goToLine(int line) {
+        if (isViewingLargeFile()) {
+            viewer->goToLine(line);
+            return;
+        }
+        QTextCursor cursor(document()->findBlockByNumber(qMax(0, line - 1)));
+        setTextCursor(cursor);
+        centerCursor();
+        setFocus();
+    }
+
+    void findText(const QString &text) {
+        if (isViewingLargeFile()) {
+            viewer->find(text);
+            return;
+        }
+        if (!find(text)) {
+            // Wrap around to the top once
+            QTextCursor cursor = textCursor();
+            moveCursor(QTextCursor::Start);
+            if (!find(text)) {
+                setTextCursor(cursor);
+            }
+        }
+    }
+
+signals:
+    void loadProgress(qint64 bytesRead, qint64 totalBytes);
+    void loadFinished(bool ok);
+    void saveFinished(bool ok, qint64 bytes, qint64 msecs, const QString &error);
+    void ghostTextAccepted();
+    void ghostTextDismissed();
+
+protected:
+    // Only the first line of a suggestion is drawn in place; the rest is
+    // announced by a line count
+    void paintEvent(QPaintEvent *event) override {
+        QPlainTextEdit::paintEvent(event);
+        if (!hasGhostText()) {
+            return;
+        }
+        const QRect cursorArea = cursorRect();
+        const qsizetype newline = ghostText.indexOf('\n');
+        QString shown = ghostText.left(newline);
+        if (newline >= 0) {
+            shown += QString("  (+%1 lines, Tab to accept)").arg(ghostText.count('\n'));
+        }
+        QPainter painter(viewport());
+        QFont font = this->font();
+        font.setItalic(true);
+        painter.setFont(font);
+        painter.setPen(QColor("#6A6A6A"));
+        painter.drawText(QPoint(cursorArea.right() + 1, cursorArea.top() + fontMetrics().ascent()), shown);
+    }
+
+    void focusOutEvent(QFocusEvent *event) override {
+        if (hasGhostText()) {
+            clearGhostText();
+            emit ghostTextDismissed();
+        }
+        QPlainTextEdit::focusOutEvent(event);
+    }
+
+    void resizeEvent(QResizeEvent *event) override {
+        QPlainTextEdit::resizeEvent(event);
+        
+        QRect cr = contentsRect();
+        lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), lineNumberAreaWidth(), cr.height()));
+        updateVisibleBlocks();
+
+        if (viewer) {
+            viewer->setGeometry(rect());
+        }
+    }
+    
+    void keyPressEvent(QKeyEvent *event) override {
+        if (event->key() == Qt::Key_Tab && event->modifiers() == Qt::NoModifier && hasGhostText()) {
+            // Announced first, so the insertion is not taken for typing
+            const QString text = ghostText;
+            ghostText.clear();
+            emit ghostTextAccepted();
+            textCursor().insertText(text);
+            event->accept();
+        } else if (event->key() == Qt::Key_Escape && hasGhostText()) {
+            clearGhostText();
+            emit ghostTextDismissed();
+            event->accept();
+        } else if (event->key() == Qt::Key_Tab) {
+            // Insert spaces instead of tab character
+            QTextCursor cursor = textCursor();
+            cursor.insertText("    ");
+            event->accept();
+        } else if (event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter) {
+            // Auto-indentation
+            QTextCursor cursor = textCursor();
+            QString currentLine = cursor.block().text();
+            
+            // Find leading whitespace
+            int indentSize = 0;
+            while (indentSize < currentLine.length() && currentLine.at(indentSize).isSpace()) {
+                indentSize++;
+            }
+            
+            // Default indent
+            QString indent = currentLine.left(indentSize);
+            
+            // Check for conditions that would increase indentation (like ending with '{')
+            if (currentLine.trimmed().endsWith("{") || 
+                currentLine.trimmed().endsWith(":")) {
+                indent += "    ";
+            }
+            
+            QPlainTextEdit::keyPressEvent(event);
+            cursor = textCursor();
+            cursor.insertText(indent);
+        } else {
+            QPlainTextEdit::keyPressEvent(event);
+        }
+        
+        // Update bracket matching
+        if (bracketMatchingEnabled) {
+            matchBrackets();
+        }
+    }
+
+private slots:
+    void updateLineNumberAreaWidth(int newBlockCount) {
+        setViewportMargins(lineNumberAreaWidth(), 0, 0, 0);
+    }
+
+    void updateLineNumberArea(const QRect &rect, int dy) {
+        if (dy)
+            lineNumberArea->scroll(0, dy);
+        else
+            lineNumberArea->update(0, rect.y(), lineNumberArea->width(), rect.height());
+
+        if (rect.contains(viewport()->rect()))
+            updateLineNumberAreaWidth(0);
+
+        updateVisibleBlocks();
+    }
+
+    void updateVisibleBlocks() {
+        // With wrapping off every block is one line, so this is exact; with
+        // wrapping on it over-estimates, which only highlights a little early
+        const int first = firstVisibleBlock().blockNumber();
+        const int lines = viewport()->height() / qMax(1, fontMetrics().height());
+        highlighter->setVisibleBlocks(first, first + lines + 1);
+    }
+    
+    void highlightCurrentLine() {
+        QList<QTextEdit::ExtraSelection> extraSelections;
+
+        // Highlight current line
+        if (!isReadOnly()) {
+            QTextEdit::ExtraSelection selection;
+            QColor lineColor = QColor("#2D2D30").lighter(120);
+            selection.format.setBackground(lineColor);
+            selection.format.setProperty(QTextFormat::FullWidthSelection, true);
+            selection.cursor = textCursor();
+            selection.cursor.clearSelection();
+            extraSelections.append(selection);
+        }
+        
+        // Add bracket matching highlighting if enabled
+        if (bracketMatchingEnabled && bracketPos != -1) {
+            QTextEdit::ExtraSelection selection;
+            selection.format.setBackground(QColor("#664B0082"));
+            selection.format.setForeground(Qt::white);
+            selection.cursor = textCursor();
+            selection.cursor.setPosition(bracketPos);
+            selection.cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor, bracketLength);
+            extraSelections.append(selection);
+        }
+        
+        setExtraSelections(extraSelections);
+    }
+    
+    void handleTextChanged() {
+        // Perform any needed actions when text changes
+        if (bracketMatchingEnabled) {
+            matchBrackets();
+        }
+    }
+    
+    void matchBrackets() {
+        bracketPos = -1;
+        bracketLength = 0;
+        
+        // Check character before cursor
+        const int position = textCursor().position();
+        if (position > 0) {
+            const int match = bracketIndex->findMatch(position - 1);
+            if (match >= 0) {
+                bracketPos = match;
+                bracketLength = 1;
+            }
+        }
+        
+        highlightCurrentLine();
+    }
+
+    void appendLoadedChunks() {
+        if (!loadJob) {
+            return;
+        }
+
+        QTextCursor cursor(document());
+        cursor.movePosition(QTextCursor::End);
+        for (;;) {
+            QString chunk;
+            {
+                QMutexLocker locker(&loadJob->mutex);
+                if (loadJob->chunks.isEmpty())
+                    break;
+                chunk = loadJob->chunks.dequeue();
+            }
+            cursor.insertText(chunk);
+            loadJob->freeSlots.release();
+        }
+        emit loadProgress(loadJob->bytesRead, loadJob->size);
+    }
+
+    void finishLoad() {
+        if (!loadJob) {
+            return;
+        }
+
+        appendLoadedChunks();
+        const bool ok = !loadJob->failed && !loadJob->cancelled;
+        loadJob.reset();
+
+        document()->setUndoRedoEnabled(true);
+        document()->setModified(false);
+        setReadOnly(false);
+        moveCursor(QTextCursor::Start);
+        emit loadFinished(ok);
+    }
+
+    void startPendingSave() {
+        const PendingSave next = std::move(*pendingSave);
+        pendingSave.reset();
+        saveRevision = next.revision;
+        saveWatcher.setFuture(runInPool<SaveResult>([fileName = next.fileName, text = next.text](QPromise<SaveResult> &promise) {
+            promise.addResult(SaveResult::write(fileName, text, promise));
+        }));
+    }
+
+    void finishSave() {
+        // A newer save was waiting for this one; it supersedes the result
+        if (pendingSave) {
+            startPendingSave();
+            return;
+        }
+
+        const QFuture<SaveResult> future = saveWatcher.future();
+        if (future.isCanceled() || future.resultCount() == 0) {
+            return;
+        }
+
+        const SaveResult result = future.result();
+        // Edits made while the save ran are not on disk yet
+        if (result.ok && document()->revision() == saveRevision) {
+            document()->setModified(false);
+        }
+        emit saveFinished(result.ok, result.bytes, result.msecs, result.error);
+    }
+
+    bool openInViewer(const QString &fileName) {
+        if (!viewer) {
+            viewer = new LargeFileView(this);
+            connect(viewer, &LargeFileView::indexingProgress, this, &CodeEditor::loadProgress);
+            connect(viewer, &LargeFileView::indexingFinished, this, [this]() {
+                emit loadFinished(true);
+            });
+        }
+
+        clear();
+        setReadOnly(true);
+        if (!viewer->open(fileName)) {
+            closeViewer();
+            return false;
+        }
+        viewer->setGeometry(rect());
+        viewer->show();
+        viewer->raise();
+        viewer->setFocus();
+        emit loadProgress(0, QFileInfo(fileName).size());
+        return true;
+    }
+
+    void closeViewer() {
+        if (!viewer) {
+            return;
+        }
+        viewer->closeFile();
+        viewer->hide();
+        setReadOnly(false);
+    }
+
+    void cancelLoad() {
+        if (!loadJob) {
+            return;
+        }
+
+        // Wake the worker if it is waiting for a free slot so it can see the flag
+        loadJob->cancelled = true;
+        loadJob->freeSlots.release(FileLoadJob::QueueDepth);
+        loadWatcher.cancel();
+        loadJob.reset();
+        document()->setUndoRedoEnabled(true);
+        setReadOnly(false);
+    }
+
+    void lineNumberAreaPaintEvent(QPaintEvent *event) {
+        QPainter painter(lineNumberArea);
+        painter.fillRect(event->rect(), QColor("#1E1E1E"));
+
+        QTextBlock block = firstVisibleBlock();
+        int blockNumber = block.blockNumber();
+        int top = qRound(blockBoundingGeometry(block).translated(contentOffset()).top());
+        int bottom = top + qRound(blockBoundingRect(block).height());
+
+        while (block.isValid() && top <= event->rect().bottom()) {
+            if (block.isVisible() && bottom >= event->rect().top()) {
+                QString number = QString::number(blockNumber + 1);
+                painter.setPen(QColor("#858585"));
+                painter.drawText(0, top, lineNumberArea->width() - 5, fontMetrics().height(),
+                                 Qt::AlignRight, number);
+            }
+
+            block = block.next();
+            top = bottom;
+            bottom = top + qRound(blockBoundingRect(block).height());
+            ++blockNumber;
+        }
+    }
+
+private:
+    // The outermost brace around position that opens a function body, i.e.
+    // follows a parameter list; lambdas and control statements inside it are
+    // looked through. The range starts at the signature's first line
+    bool enclosingFunction(int position, int *first, int *last) const {
+        static const QRegularExpression signature(
+            R"(\)\s*(?:const|volatile|override|final|noexcept|mutable|&|&&|->\s*[\w:<>,*&\s]+|\s)*$)");
+        static const QRegularExpression control(R"(^\s*(?:\}\s*)?(?:if|else|for|while|switch|catch)\b)");
+
+        const QTextDocument *document = this->document();
+        int found = -1;
+        for (int brace = bracketIndex->enclosingOpen(position, 1); brace >= 0;
+             brace = bracketIndex->enclosingOpen(brace, 1)) {
+            const QTextBlock block = document->findBlock(brace);
+            QString before = block.text().left(brace - block.position()).trimmed();
+            if (before.isEmpty() && block.previous().isValid())
+                before = block.previous().text().trimmed();
+            if (signature.match(before).hasMatch() && !control.match(before).hasMatch())
+                found = brace;
+        }
+        if (found < 0) {
+            return false;
+        }
+
+        QTextBlock start = document->findBlock(found);
+        for (int i = 0; i < 6 && start.previous().isValid(); ++i) {
+            const QString text = start.previous().text().trimmed();
+            if (text.isEmpty() || text.endsWith(';') || text.endsWith('{') || text.endsWith('}'))
+                break;
+            start = start.previous();
+        }
+        const int end = bracketIndex->findMatch(found);
+        *first = start.blockNumber();
+        *last = end >= 0 ? document->findBlock(end).blockNumber() : document->blockCount() - 1;
+        return true;
+    }
+
+    class LineNumberArea : public QWidget {
+    public:
+        LineNumberArea(CodeEditor *editor) : QWidget(editor), codeEditor(editor) {}
+
+        QSize sizeHint() const override {
+            return QSize(codeEditor->lineNumberAreaWidth(), 0);
+        }
+
+    protected:
+        void paintEvent(QPaintEvent *event) override {
+            codeEditor->lineNumberAreaPaintEvent(event);
+        }
+
+    private:
+        CodeEditor *codeEditor;
+    };
+
+    LineNumberArea *lineNumberArea;
+    CodeHighlighter *highlighter;
+    BracketIndex *bracketIndex;
+    bool bracketMatchingEnabled;
+    int bracketPos;
+    int bracketLength;
+    std::shared_ptr<FileLoadJob> loadJob;
+    QFutureWatcher<int> loadWatcher;
+    LargeFileView *viewer = nullptr;
+    struct PendingSave {
+        QString fileName;
+        QString text;
+        int revision = -1;
+    };
+
+    QFutureWatcher<SaveResult> saveWatcher;
+    int saveRevision;
+    std::optional<PendingSave> pendingSave;
+    QString currentFileName;
+    QString ghostText;
+    int ghostPosition = -1;
+};
+
+// One directory entry as listed by a DirectoryLister worker
+struct DirEntry {
+    QString name;
+    bool isDir = false;
+};
+
+// Lists a directory on a worker thread and reports it, sorted, in batches
+struct DirectoryLister {
+    static constexpr int BatchSize = 2000;
+
+    // Directories first, then case-insensitive; names differing only in case
+    // fall back to an exact comparison so the order is strict
+    static bool lessThan(const DirEntry &a, const DirEntry &b) {
+        if (a.isDir != b.isDir)
+            return a.isDir;
+        const int order = a.name.compare(b.name, Qt::CaseInsensitive);
+        return order != 0 ? order < 0 : a.name < b.name;
+    }
+
+    static void run(const QString &path, QPromise<QList<DirEntry>> &promise) {
+        QList<DirEntry> entries;
+        QDirIterator it(path, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+        while (it.hasNext()) {
+            if ((entries.size() & 1023) == 0 && promise.isCanceled())
+                return;
+            it.next();
+            const QFileInfo info = it.fileInfo();
+            entries.append({info.fileName(), info.isDir()});
+        }
+
+        std::sort(entries.begin(), entries.end(), lessThan);
+        for (qsizetype i = 0; i < entries.size() && !promise.isCanceled(); i += BatchSize)
+            promise.addResult(entries.mid(i, BatchSize));
+    }
+};
+
+// Net effect of a burst of filesystem events on one directory
+struct DirChanges {
+    QList<DirEntry> added;
+    QStringList removed;
+    QList<QPair<QString, QString>> renamed;
+    QStringList modified;  // Existing files written in place
+    bool rescan = false;
+};
+
+// Watches listed directories through inotify. Events are coalesced per
+// (directory, name) into their final state and flushed after a short quiet
+// period; a directory with too many changes in one burst, or any queue
+// overflow, is reported as a rescan instead. Directories that cannot get a
+// watch (ENOSPC, or no inotify on this platform) are rescanned periodically
+class DirectoryWatcher : public QObject {
+    Q_OBJECT
+public:
+    struct Counters {
+        qint64 received = 0;
+        qint64 coalesced = 0;
+        qint64 rescans = 0;
+        qint64 watches = 0;
+        qint64 polled = 0;
+    };
+
+    DirectoryWatcher(QObject *parent = nullptr) : QObject(parent) {
+        flushTimer.setSingleShot(true);
+        connect(&flushTimer, &QTimer::timeout, this, &DirectoryWatcher::flush);
+        pollTimer.setInterval(PollIntervalMs);
+        connect(&pollTimer, &QTimer::timeout, this, &DirectoryWatcher::pollDirectories);
+
+#ifdef Q_OS_LINUX
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd >= 0) {
+            notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+            connect(notifier, &QSocketNotifier::activated, this, &DirectoryWatcher::readEvents);
+        }
+#endif
+    }
+
+    ~DirectoryWatcher() {
+#ifdef Q_OS_LINUX
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+    }
+
+    void addPath(const QString &path) {
+        if (watchedPaths.contains(path) || polledPaths.contains(path)) {
+            return;
+        }
+#ifdef Q_OS_LINUX
+        if (fd >= 0) {
+            const int wd = inotify_add_watch(fd, QFile::encodeName(path).constData(),
+                                             IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                             IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+            if (wd >= 0) {
+                watches.insert(wd, path);
+                watchedPaths.insert(path, wd);
+                counts.watches = watches.size();
+                return;
+            }
+            if (errno != ENOSPC) {
+                return;
+            }
+        }
+#endif
+        // Out of watches: fall back to polling this directory
+        polledPaths.insert(path);
+        counts.polled = polledPaths.size();
+        if (!pollTimer.isActive()) {
+            pollTimer.start();
+        }
+    }
+
+    // Drops the watches on path and everything below it
+    void removePath(const QString &path) {
+        const QString prefix = path + '/';
+        for (auto it = watchedPaths.begin(); it != watchedPaths.end();) {
+            if (it.key() == path || it.key().startsWith(prefix)) {
+#ifdef Q_OS_LINUX
+                inotify_rm_watch(fd, it.value());
+#endif
+                watches.remove(it.value());
+                it = watchedPaths.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        polledPaths.removeIf([&](const QString &polled) {
+            return polled == path || polled.startsWith(prefix);
+        });
+        counts.watches = watches.size();
+        counts.polled = polledPaths.size();
+    }
+
+    void clear() {
+        for (auto it = watchedPaths.cbegin(); it != watchedPaths.cend(); ++it) {
+#ifdef Q_OS_LINUX
+            inotify_rm_watch(fd, it.value());
+#endif
+        }
+        watches.clear();
+        watchedPaths.clear();
+        polledPaths.clear();
+        pending.clear();
+        moveCookies.clear();
+        pollTimer.stop();
+        counts.watches = 0;
+        counts.polled = 0;
+    }
+
+    const Counters &counters() const {
+        return counts;
+    }
+
+signals:
+    void directoryChanged(const QString &path, const DirChanges &changes);
+
+private:
+    struct PendingEntry {
+        bool exists;
+        bool isDir;
+    };
+
+    struct PendingDir {
+        QHash<QString, PendingEntry> entries;
+        QList<QPair<QString, QString>> renames;
+        QSet<QString> written;
+        bool rescan = false;
+    };
+
+    static constexpr int QuietMs = 100;
+    static constexpr int MaxDelayMs = 500;
+    static constexpr int StormEntries = 256;
+    static constexpr int PollIntervalMs = 5000;
+
+    void record(const QString &dir, const QString &name, bool exists, bool isDir) {
+        PendingDir &dirChanges = pending[dir];
+        if (dirChanges.rescan) {
+            ++counts.coalesced;
+            return;
+        }
+        auto it = dirChanges.entries.find(name);
+        if (it != dirChanges.entries.end()) {
+            ++counts.coalesced;
+            *it = {exists, isDir};
+        } else {
+            dirChanges.entries.insert(name, {exists, isDir});
+        }
+        checkStorm(dirChanges);
+    }
+
+    void recordWrite(const QString &dir, const QString &name) {
+        PendingDir &dirChanges = pending[dir];
+        if (dirChanges.rescan || dirChanges.written.contains(name)) {
+            ++counts.coalesced;
+            return;
+        }
+        dirChanges.written.insert(name);
+        checkStorm(dirChanges);
+    }
+
+    void checkStorm(PendingDir &dirChanges) {
+        if (dirChanges.entries.size() + dirChanges.written.size() > StormEntries) {
+            // Cheaper to re-list the directory than to replay the storm
+            counts.coalesced += dirChanges.entries.size() + dirChanges.written.size();
+            dirChanges.entries.clear();
+            dirChanges.renames.clear();
+            dirChanges.written.clear();
+            dirChanges.rescan = true;
+        }
+    }
+
+    void scheduleFlush() {
+        // Debounce, but never hold changes back for longer than MaxDelayMs
+        if (!pendingSince.isValid()) {
+            pendingSince.start();
+        }
+        flushTimer.start(qBound<qint64>(0, MaxDelayMs - pendingSince.elapsed(), QuietMs));
+    }
+
+    // Keeps watches valid when a watched directory is renamed inside the tree
+    void renameWatches(const QString &from, const QString &to) {
+        const QString prefix = from + '/';
+        QList<QPair<QString, int>> moved;
+        for (auto it = watchedPaths.begin(); it != watchedPaths.end();) {
+            if (it.key() == from || it.key().startsWith(prefix)) {
+                moved.append({to + it.key().mid(from.size()), it.value()});
+                it = watchedPaths.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (const auto &[path, wd] : std::as_const(moved)) {
+            watchedPaths.insert(path, wd);
+            watches.insert(wd, path);
+        }
+    }
+
+#ifdef Q_OS_LINUX
+    void readEvents() {
+        alignas(inotify_event) char buffer[64 * 1024];
+        for (;;) {
+            const ssize_t length = ::read(fd, buffer, sizeof(buffer));
+            if (length <= 0) {
+                break;
+            }
+            for (ssize_t offset = 0; offset < length;) {
+                const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                ++counts.received;
+                handleEvent(*event);
+            }
+        }
+        if (!pending.isEmpty()) {
+            scheduleFlush();
+        }
+    }
+
+    void handleEvent(const inotify_event &event) {
+        if (event.mask & IN_Q_OVERFLOW) {
+            // Events were dropped; only a rescan of everything is trustworthy
+            for (auto it = watchedPaths.cbegin(); it != watchedPaths.cend(); ++it) {
+                pending[it.key()].rescan = true;
+            }
+            return;
+        }
+
+        const QString dir = watches.value(event.wd);
+        if (dir.isEmpty()) {
+            return;
+        }
+        if (event.mask & IN_IGNORED) {
+            watchedPaths.remove(dir);
+            watches.remove(event.wd);
+            counts.watches = watches.size();
+            return;
+        }
+        if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+            // Reported to the model through the parent directory's watch
+            return;
+        }
+
+        const QString name = QFile::decodeName(event.name);
+        const bool isDir = event.mask & IN_ISDIR;
+        if (event.mask & IN_MOVED_FROM) {
+            record(dir, name, false, isDir);
+            moveCookies.insert(event.cookie, {dir, name});
+        } else if (event.mask & IN_MOVED_TO) {
+            record(dir, name, true, isDir);
+            const auto from = moveCookies.take(event.cookie);
+            if (from.first.isEmpty()) {
+                return;
+            }
+            if (isDir) {
+                renameWatches(from.first + '/' + from.second, dir + '/' + name);
+            }
+            if (from.first == dir && !pending[dir].rescan) {
+                pending[dir].renames.append({from.second, name});
+            }
+        } else if (event.mask & IN_CREATE) {
+            record(dir, name, true, isDir);
+        } else if (event.mask & IN_DELETE) {
+            record(dir, name, false, isDir);
+        } else if (event.mask & IN_CLOSE_WRITE) {
+            recordWrite(dir, name);
+        }
+    }
+#else
+    void readEvents() {}
+#endif
+
+    void flush() {
+        pendingSince.invalidate();
+
+        // A directory moved out of the tree never gets its IN_MOVED_TO
+        for (auto it = moveCookies.cbegin(); it != moveCookies.cend(); ++it) {
+            removePath(it.value().first + '/' + it.value().second);
+        }
+        moveCookies.clear();
+
+        const QHash<QString, PendingDir> changes = std::exchange(pending, {});
+        for (auto it = changes.cbegin(); it != changes.cend(); ++it) {
+            PendingDir dirChanges = it.value();
+            DirChanges out;
+            if (dirChanges.rescan) {
+                ++counts.rescans;
+                out.rescan = true;
+                emit directoryChanged(it.key(), out);
+                continue;
+            }
+            for (const auto &[from, to] : std::as_const(dirChanges.renames)) {
+                // Only a rename whose two ends survived coalescing stays a rename
+                const auto source = dirChanges.entries.constFind(from);
+                const auto target = dirChanges.entries.constFind(to);
+                if (source != dirChanges.entries.cend() && target != dirChanges.entries.cend() &&
+                    !source->exists && target->exists) {
+                    out.renamed.append({from, to});
+                    dirChanges.entries.remove(from);
+                    dirChanges.entries.remove(to);
+                }
+            }
+            for (auto entry = dirChanges.entries.cbegin(); entry != dirChanges.entries.cend(); ++entry) {
+                if (entry->exists) {
+                    out.added.append({entry.key(), entry->isDir});
+                } else {
+                    out.removed.append(entry.key());
+                }
+            }
+            for (const QString &name : std::as_const(dirChanges.written)) {
+                // A file created in the same burst is already reported as added
+                if (!dirChanges.entries.contains(name)) {
+                    out.modified.append(name);
+                }
+            }
+            emit directoryChanged(it.key(), out);
+        }
+    }
+
+    void pollDirectories() {
+        for (const QString &path : std::as_const(polledPaths)) {
+            ++counts.rescans;
+            DirChanges out;
+            out.rescan = true;
+            emit directoryChanged(path, out);
+        }
+    }
+
+    int fd = -1;
+    QSocketNotifier *notifier = nullptr;
+    QHash<int, QString> watches;
+    QHash<QString, int> watchedPaths;
+    QSet<QString> polledPaths;
+    QHash<QString, PendingDir> pending;
+    QHash<quint32, QPair<QString, QString>> moveCookies;
+    QElapsedTimer pendingSince;
+    QTimer flushTimer;
+    QTimer pollTimer;
+    Counters counts;
+};
+
+// Filesystem tree model over a compact node table. Every node is 16 bytes in one
+// array; names are interned (node_modules trees repeat the same few file names
+// endlessly) and each directory keeps a sorted list of child ids. Directories are
+// listed by a worker on fetchMore and their rows are inserted in timed batches.
+// Listed directories are watched and kept current with row-level updates
+class ProjectModel : public QAbstractItemModel {
+public:
+    static constexpr quint32 NoNode = 0xffffffffu;
+
+    enum Flags : quint8 {
+        IsDir = 1,
+        Listed = 2,
+        Listing = 4,
+        Stale = 8,  // Changed while its listing was in flight
+        Free = 0x80
+    };
+
+    struct Node {
+        quint32 parent;
+        quint32 name;
+        quint32 children;  // Index into childLists for directories, NoNode otherwise
+        quint8 flags;
+    };
+
+    struct Stats {
+        qint64 nodes = 0;
+        qint64 directories = 0;
+        qint64 uniqueNames = 0;
+        qint64 bytes = 0;
+        qint64 appliedChanges = 0;
+    };
+
+    ProjectModel(QObject *parent = nullptr) : QAbstractItemModel(parent) {
+        insertTimer.setSingleShot(true);
+        connect(&insertTimer, &QTimer::timeout, this, &ProjectModel::insertPendingBatches);
+        connect(&dirWatcher, &DirectoryWatcher::directoryChanged, this, &ProjectModel::applyChanges);
+    }
+
+    ~ProjectModel() {
+        cancelListings();
+    }
+
+    void setRootPath(const QString &path) {
+        beginResetModel();
+        cancelListings();
+        dirWatcher.clear();
+        nodes.clear();
+        childLists.clear();
+        freeNodes.clear();
+        freeChildLists.clear();
+        names.clear();
+        nameIds.clear();
+
+        const QFileInfo info(path);
+        rootPath = info.absoluteFilePath();
+        addNode(NoNode, info.fileName().isEmpty() ? rootPath : info.fileName(), true);
+        endResetModel();
+    }
+
+    QString projectRoot() const {
+        return rootPath;
+    }
+
+    QModelIndex rootIndex() const {
+        return nodes.isEmpty() ? QModelIndex() : createIndex(0, 0, quintptr(0));
+    }
+
+    const DirectoryWatcher &directoryWatcher() const {
+        return dirWatcher;
+    }
+
+    bool isDir(const QModelIndex &index) const {
+        return index.isValid() && (nodes[nodeId(index)].flags & IsDir);
+    }
+
+    // Rebuilt from the parent chain on demand, so nodes do not store paths
+    QString filePath(const QModelIndex &index) const {
+        return index.isValid() ? pathOf(nodeId(index)) : QString();
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.nodes = nodes.size() - freeNodes.size();
+        s.directories = childLists.size() - freeChildLists.size();
+        s.uniqueNames = names.size();
+        s.appliedChanges = appliedChanges;
+        s.bytes = nodes.capacity() * qint64(sizeof(Node)) +
+                  (freeNodes.capacity() + freeChildLists.capacity()) * qint64(sizeof(quint32));
+        for (const QList<quint32> &children : childLists) {
+            s.bytes += sizeof(QList<quint32>) + children.capacity() * qint64(sizeof(quint32));
+        }
+        for (const QString &name : names) {
+            s.bytes += sizeof(QString) + 16 + name.capacity() * qint64(sizeof(QChar));
+        }
+        // Hash nodes: key, value and bucket overhead
+        s.bytes += nameIds.size() * qint64(sizeof(QString) + sizeof(quint32) + 2 * sizeof(void *));
+        return s;
+    }
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override {
+        if (column != 0 || row < 0) {
+            return QModelIndex();
+        }
+        if (!parent.isValid()) {
+            return row == 0 ? rootIndex() : QModelIndex();
+        }
+        const Node &node = nodes[nodeId(parent)];
+        if (node.children == NoNode || row >= childLists[node.children].size()) {
+            return QModelIndex();
+        }
+        return createIndex(row, 0, quintptr(childLists[node.children][row]));
+    }
+
+    QModelIndex parent(const QModelIndex &child) const override {
+        if (!child.isValid()) {
+            return QModelIndex();
+        }
+        const quint32 parentId = nodes[nodeId(child)].parent;
+        return parentId == NoNode ? QModelIndex() : indexOf(parentId);
+    }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override {
+        if (!parent.isValid()) {
+            return nodes.isEmpty() ? 0 : 1;
+        }
+        if (parent.column() != 0) {
+            return 0;
+        }
+        const Node &node = nodes[nodeId(parent)];
+        return node.children == NoNode ? 0 : int(childLists[node.children].size());
+    }
+
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override {
+        Q_UNUSED(parent);
+        return 1;
+    }
+
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override {
+        if (!parent.isValid()) {
+            return !nodes.isEmpty();
+        }
+        const Node &node = nodes[nodeId(parent)];
+        if (!(node.flags & IsDir)) {
+            return false;
+        }
+        return !(node.flags & Listed) || !childLists[node.children].isEmpty();
+    }
+
+    bool canFetchMore(const QModelIndex &parent) const override {
+        if (!parent.isValid()) {
+            return false;
+        }
+        const Node &node = nodes[nodeId(parent)];
+        return (node.flags & IsDir) && !(node.flags & (Listed | Listing));
+    }
+
+    void fetchMore(const QModelIndex &parent) override {
+        if (!canFetchMore(parent)) {
+            return;
+        }
+
+        const quint32 id = nodeId(parent);
+        nodes[id].flags |= Listing;
+
+        auto *watcher = new QFutureWatcher<QList<DirEntry>>(this);
+        listings.insert(id, watcher);
+        connect(watcher, &QFutureWatcher<QList<DirEntry>>::resultsReadyAt, this, [this, id, watcher](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                pendingBatches.enqueue({id, watcher->resultAt(i)});
+            }
+            insertTimer.start(0);
+        });
+        connect(watcher, &QFutureWatcher<QList<DirEntry>>::finished, this, [this, id, watcher]() {
+            listings.remove(id);
+            watcher->deleteLater();
+            pendingBatches.enqueue({id, QList<DirEntry>(), true});
+            insertTimer.start(0);
+        });
+
+        const QString path = pathOf(id);
+        watcher->setFuture(runInPool<QList<DirEntry>>([path](QPromise<QList<DirEntry>> &promise) {
+            DirectoryLister::run(path, promise);
+        }));
+    }
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override {
+        if (!index.isValid()) {
+            return QVariant();
+        }
+        const Node &node = nodes[nodeId(index)];
+        switch (role) {
+        case Qt::DisplayRole:
+            return names[node.name];
+        case Qt::DecorationRole:
+            return (node.flags & IsDir) ? dirIcon : fileIcon;
+        case Qt::ToolTipRole:
+            return pathOf(nodeId(index));
+        default:
+            return QVariant();
+        }
+    }
+
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override {
+        if (section == 0 && orientation == Qt::Horizontal && role == Qt::DisplayRole) {
+            return QString("Project Files");
+        }
+        return QVariant();
+    }
+
+    void setIcons(const QIcon &dir, const QIcon &file) {
+        dirIcon = dir;
+        fileIcon = file;
+    }
+
+private:
+    struct PendingBatch {
+        quint32 parent;
+        QList<DirEntry> entries;
+        bool last = false;
+    };
+
+    static constexpr int InsertBudgetMs = 8;
+
+    static quint32 nodeId(const QModelIndex &index) {
+        return quint32(index.internalId());
+    }
+
+    quint32 intern(const QString &name) {
+        auto it = nameIds.constFind(name);
+        if (it != nameIds.constEnd()) {
+            return it.value();
+        }
+        const quint32 id = quint32(names.size());
+        names.append(name);
+        nameIds.insert(name, id);
+        return id;
+    }
+
+    quint32 addNode(quint32 parent, const QString &name, bool isDir) {
+        Node node;
+        node.parent = parent;
+        node.name = intern(name);
+        node.children = NoNode;
+        node.flags = isDir ? IsDir : 0;
+        if (isDir) {
+            if (!freeChildLists.isEmpty()) {
+                node.children = freeChildLists.takeLast();
+            } else {
+                node.children = quint32(childLists.size());
+                childLists.append(QList<quint32>());
+            }
+        }
+        if (!freeNodes.isEmpty()) {
+            const quint32 id = freeNodes.takeLast();
+            nodes[id] = node;
+            return id;
+        }
+        nodes.append(node);
+        return quint32(nodes.size() - 1);
+    }
+
+    // Returns the node and its subtree to the free lists
+    void freeSubtree(quint32 id) {
+        Node &node = nodes[id];
+        if (node.flags & IsDir) {
+            for (quint32 child : std::as_const(childLists[node.children])) {
+                freeSubtree(child);
+            }
+            childLists[node.children] = QList<quint32>();
+            freeChildLists.append(node.children);
+            cancelListing(id);
+        }
+        node.flags = Free;
+        freeNodes.append(id);
+    }
+
+    DirEntry entryOf(quint32 id) const {
+        return {names[nodes[id].name], bool(nodes[id].flags & IsDir)};
+    }
+
+    bool lessThan(quint32 a, quint32 b) const {
+        return DirectoryLister::lessThan(entryOf(a), entryOf(b));
+    }
+
+    // Row of the child matching entry in the directory, or the row it would
+    // be inserted at when found is false
+    int findChild(quint32 parent, const DirEntry &entry, bool *found) const {
+        const QList<quint32> &children = childLists[nodes[parent].children];
+        auto it = std::lower_bound(children.cbegin(), children.cend(), entry,
+                                   [this](quint32 id, const DirEntry &probe) {
+                                       return DirectoryLister::lessThan(entryOf(id), probe);
+                                   });
+        *found = it != children.cend() && nodes[*it].name == nameIds.value(entry.name, NoNode) &&
+                 bool(nodes[*it].flags & IsDir) == entry.isDir;
+        return int(it - children.cbegin());
+    }
+
+    quint32 findPath(const QString &path) const {
+        if (nodes.isEmpty() || (path != rootPath && !path.startsWith(rootPath + '/'))) {
+            return NoNode;
+        }
+        quint32 id = 0;
+        const QStringList parts = path.mid(rootPath.size()).split('/', Qt::SkipEmptyParts);
+        for (const QString &part : parts) {
+            if (!(nodes[id].flags & IsDir)) {
+                return NoNode;
+            }
+            bool found;
+            const int row = findChild(id, {part, true}, &found);
+            if (!found) {
+                return NoNode;
+            }
+            id = childLists[nodes[id].children][row];
+        }
+        return id;
+    }
+
+    QModelIndex indexOf(quint32 id) const {
+        const quint32 parentId = nodes[id].parent;
+        if (parentId == NoNode) {
+            return rootIndex();
+        }
+        // Children are kept sorted, so the row is a binary search away
+        const QList<quint32> &siblings = childLists[nodes[parentId].children];
+        auto it = std::lower_bound(siblings.cbegin(), siblings.cend(), id,
+                                   [this](quint32 a, quint32 b) { return lessThan(a, b); });
+        if (it == siblings.cend() || *it != id) {
+            it = std::find(siblings.cbegin(), siblings.cend(), id);
+        }
+        return createIndex(int(it - siblings.cbegin()), 0, quintptr(id));
+    }
+
+    QString pathOf(quint32 id) const {
+        QStringList parts;
+        for (; nodes[id].parent != NoNode; id = nodes[id].parent) {
+            parts.prepend(names[nodes[id].name]);
+        }
+        parts.prepend(rootPath);
+        return parts.join('/');
+    }
+
+    void insertPendingBatches() {
+        QElapsedTimer timer;
+        timer.start();
+        while (!pendingBatches.isEmpty() && timer.elapsed() < InsertBudgetMs) {
+            const PendingBatch batch = pendingBatches.dequeue();
+            if (batch.last) {
+                Node &node = nodes[batch.parent];
+                const bool stale = node.flags & Stale;
+                node.flags = (node.flags & ~(Listing | Stale)) | Listed;
+                dirWatcher.addPath(pathOf(batch.parent));
+                if (stale) {
+                    startRescan(batch.parent);
+                }
+                if (childLists[node.children].isEmpty()) {
+                    // Let the view drop the expand arrow of an empty directory
+                    const QModelIndex index = indexOf(batch.parent);
+                    emit dataChanged(index, index);
+                }
+                continue;
+            }
+            if (batch.entries.isEmpty()) {
+                continue;
+            }
+
+            const QModelIndex parentIndex = indexOf(batch.parent);
+            const int first = int(childLists[nodes[batch.parent].children].size());
+            beginInsertRows(parentIndex, first, first + int(batch.entries.size()) - 1);
+            nodes.reserve(nodes.size() + batch.entries.size());
+            for (const DirEntry &entry : batch.entries) {
+                const quint32 id = addNode(batch.parent, entry.name, entry.isDir);
+                childLists[nodes[batch.parent].children].append(id);
+            }
+            endInsertRows();
+        }
+        if (!pendingBatches.isEmpty()) {
+            insertTimer.start(0);
+        }
+    }
+
+    void applyChanges(const QString &path, const DirChanges &changes) {
+        const quint32 id = findPath(path);
+        if (id == NoNode || !(nodes[id].flags & IsDir)) {
+            return;
+        }
+        if (nodes[id].flags & Listing) {
+            nodes[id].flags |= Stale;
+            return;
+        }
+        if (!(nodes[id].flags & Listed)) {
+            return;
+        }
+        if (changes.rescan) {
+            startRescan(id);
+            return;
+        }
+
+        for (const QString &name : changes.removed) {
+            removeChild(id, name);
+        }
+        for (const auto &[from, to] : changes.renamed) {
+            if (!renameChild(id, from, to)) {
+                insertChild(id, {to, QFileInfo(path + '/' + to).isDir()});
+            }
+        }
+        for (const DirEntry &entry : changes.added) {
+            insertChild(id, entry);
+        }
+    }
+
+    void insertChild(quint32 parent, const DirEntry &entry) {
+        bool found;
+        const int row = findChild(parent, entry, &found);
+        if (found) {
+            return;
+        }
+        beginInsertRows(indexOf(parent), row, row);
+        const quint32 id = addNode(parent, entry.name, entry.isDir);
+        childLists[nodes[parent].children].insert(row, id);
+        endInsertRows();
+        ++appliedChanges;
+    }
+
+    void removeChild(quint32 parent, const QString &name) {
+        // The event may not say whether the entry was a directory
+        for (bool isDir : {false, true}) {
+            bool found;
+            const int row = findChild(parent, {name, isDir}, &found);
+            if (found) {
+                removeChildRows(parent, row, 1);
+                return;
+            }
+        }
+    }
+
+    void removeChildRows(quint32 parent, int row, int count) {
+        QList<quint32> &children = childLists[nodes[parent].children];
+        beginRemoveRows(indexOf(parent), row, row + count - 1);
+        for (int i = row; i < row + count; ++i) {
+            if (nodes[children[i]].flags & IsDir) {
+                dirWatcher.removePath(pathOf(children[i]));
+            }
+            freeSubtree(children[i]);
+        }
+        children.remove(row, count);
+        endRemoveRows();
+        appliedChanges += count;
+    }
+
+    bool renameChild(quint32 parent, const QString &from, const QString &to) {
+        for (bool isDir : {false, true}) {
+            bool found;
+            const int row = findChild(parent, {from, isDir}, &found);
+            if (!found) {
+                continue;
+            }
+
+            QList<quint32> &children = childLists[nodes[parent].children];
+            const quint32 id = children[row];
+            children.removeAt(row);
+            bool exists;
+            const int target = findChild(parent, {to, isDir}, &exists);
+            children.insert(row, id);
+            if (exists) {
+                // Renamed over an existing entry
+                removeChildRows(parent, target >= row ? target + 1 : target, 1);
+                return renameChild(parent, from, to);
+            }
+
+            // beginMoveRows wants the destination in terms of the old rows
+            const QModelIndex parentIndex = indexOf(parent);
+            const int destination = target >= row ? target + 1 : target;
+            const bool moves = destination != row && destination != row + 1;
+            if (moves) {
+                beginMoveRows(parentIndex, row, row, parentIndex, destination);
+            }
+            nodes[id].name = intern(to);
+            children.removeAt(row);
+            children.insert(target, id);
+            if (moves) {
+                endMoveRows();
+            }
+            const QModelIndex index = createIndex(target, 0, quintptr(id));
+            emit dataChanged(index, index);
+            ++appliedChanges;
+            return true;
+        }
+        return false;
+    }
+
+    // Re-lists a directory and applies the difference against its rows
+    void startRescan(quint32 id) {
+        if (rescans.contains(id)) {
+            return;
+        }
+        auto *rescan = new QFutureWatcher<QList<DirEntry>>(this);
+        rescans.insert(id, rescan);
+        connect(rescan, &QFutureWatcher<QList<DirEntry>>::finished, this, [this, id, rescan]() {
+            rescans.remove(id);
+            rescan->deleteLater();
+            QList<DirEntry> entries;
+            const QList<QList<DirEntry>> batches = rescan->future().results();
+            for (const QList<DirEntry> &batch : batches) {
+                entries += batch;
+            }
+            applyListing(id, entries);
+        });
+
+        const QString path = pathOf(id);
+        rescan->setFuture(runInPool<QList<DirEntry>>([path](QPromise<QList<DirEntry>> &promise) {
+            DirectoryLister::run(path, promise);
+        }));
+    }
+
+    // Both sides are sorted the same way, so one merge pass finds the runs of
+    // rows to remove and to insert
+    void applyListing(quint32 parent, const QList<DirEntry> &entries) {
+        const QModelIndex parentIndex = indexOf(parent);
+        int row = 0;
+        qsizetype next = 0;
+        while (row < childLists[nodes[parent].children].size() || next < entries.size()) {
+            const QList<quint32> &children = childLists[nodes[parent].children];
+            int removeCount = 0;
+            while (row + removeCount < children.size() &&
+                   (next >= entries.size() ||
+                    DirectoryLister::lessThan(entryOf(children[row + removeCount]), entries[next]))) {
+                ++removeCount;
+            }
+            if (removeCount > 0) {
+                removeChildRows(parent, row, removeCount);
+                continue;
+            }
+
+            qsizetype insertEnd = next;
+            while (insertEnd < entries.size() &&
+                   (row >= children.size() || DirectoryLister::lessThan(entries[insertEnd], entryOf(children[row])))) {
+                ++insertEnd;
+            }
+            if (insertEnd > next) {
+                const int count = int(insertEnd - next);
+                beginInsertRows(parentIndex, row, row + count - 1);
+                QList<quint32> ids;
+                ids.reserve(count);
+                for (; next < insertEnd; ++next) {
+                    ids.append(addNode(parent, entries[next].name, entries[next].isDir));
+                }
+                QList<quint32> &target = childLists[nodes[parent].children];
+                target.insert(row, count, 0);
+                std::copy(ids.cbegin(), ids.cend(), target.begin() + row);
+                endInsertRows();
+                appliedChanges += count;
+                row += count;
+                continue;
+            }
+
+            // Same entry on both sides
+            ++row;
+            ++next;
+        }
+    }
+
+    void cancelListing(quint32 id) {
+        if (QFutureWatcher<QList<DirEntry>> *listing = listings.take(id)) {
+            listing->disconnect(this);
+            listing->cancel();
+            listing->deleteLater();
+        }
+        if (QFutureWatcher<QList<DirEntry>> *rescan = rescans.take(id)) {
+            rescan->disconnect(this);
+            rescan->cancel();
+            rescan->deleteLater();
+        }
+        pendingBatches.removeIf([id](const PendingBatch &batch) { return batch.parent == id; });
+    }
+
+    void cancelListings() {
+        for (QFutureWatcher<QList<DirEntry>> *watcher : std::as_const(listings)) {
+            watcher->disconnect(this);
+            watcher->cancel();
+            watcher->deleteLater();
+        }
+        for (QFutureWatcher<QList<DirEntry>> *watcher : std::as_const(rescans)) {
+            watcher->disconnect(this);
+            watcher->cancel();
+            watcher->deleteLater();
+        }
+        listings.clear();
+        rescans.clear();
+        pendingBatches.clear();
+    }
+
+    QString rootPath;
+    QList<Node> nodes;
+    QList<QList<quint32>> childLists;
+    QList<quint32> freeNodes;
+    QList<quint32> freeChildLists;
+    QList<QString> names;
+    QHash<QString, quint32> nameIds;
+    QIcon dirIcon;
+    QIcon fileIcon;
+    QHash<quint32, QFutureWatcher<QList<DirEntry>> *> listings;
+    QHash<quint32, QFutureWatcher<QList<DirEntry>> *> rescans;
+    QQueue<PendingBatch> pendingBatches;
+    QTimer insertTimer;
+    DirectoryWatcher dirWatcher;
+    qint64 appliedChanges = 0;
+};
+
+// File tree widget to display project structure, a QTreeView over ProjectModel
+class ProjectTreeWidget : public QTreeView {
+    Q_OBJECT
+public:
+    ProjectTreeWidget(QWidget *parent = nullptr) : QTreeView(parent) {
+        model = new ProjectModel(this);
+        model->setIcons(style()->standardIcon(QStyle::SP_DirIcon), style()->standardIcon(QStyle::SP_FileIcon));
+        setModel(model);
+        setUniformRowHeights(true);
+        
+        // Set style
+        setStyleSheet("QTreeView { background-color: #252526; color: #D4D4D4; border: none; }");
+        
+        // Connect signals
+        connect(this, &QTreeView::doubleClicked, this, &ProjectTreeWidget::onItemDoubleClicked);
+        connect(this, &QTreeView::expanded, model, &ProjectModel::fetchMore);
+    }
+
+    void setRootPath(const QString &path) {
+        model->setRootPath(path);
+        expand(model->rootIndex());
+    }
+
+    QString projectRoot() const {
+        return model->projectRoot();
+    }
+
+    ProjectModel *projectModel() const {
+        return model;
+    }
+
+signals:
+    void openFile(const QString &filePath);
+
+private slots:
+    void onItemDoubleClicked(const QModelIndex &index) {
+        // Ignore directories
+        if (!index.isValid() || model->isDir(index)) {
+            return;
+        }
+        
+        emit openFile(model->filePath(index));
+    }
+
+private:
+    ProjectModel *model;
+};
+
+// Walks a directory tree on several pool threads. Work items on a shared stack
+// are directories to list or groups of files to visit, so neither one deep
+// subtree nor one huge directory ends up on a single worker. Only regular files
+// are visited; symlinked directories and .git are not entered
+struct ParallelWalk {
+    struct Item {
+        QString dir;
+        QStringList files;  // Empty for a directory still to be listed
+    };
+
+    QString root;
+    int fileGroup = 0;  // Files per work item; 0 visits them while listing
+    std::function<bool(const QString &relative, bool isDir)> ignored;
+    QMutex mutex;
+    QWaitCondition wake;
+    QList<Item> items;
+    int busy = 0;
+    int running = 0;
+    std::atomic<bool> cancelled{false};
+
+    ParallelWalk(const QString &rootPath = QString()) : root(rootPath) {
+        items.append({QString(), QStringList()});
+    }
+
+    static QString join(const QString &dir, const QString &name) {
+        return dir.isEmpty() ? name : dir + '/' + name;
+    }
+
+    // Calls visit(relativePath) for files until the tree is exhausted
+    template <typename Visit>
+    void run(Visit &&visit) {
+        for (;;) {
+            Item item;
+            {
+                QMutexLocker locker(&mutex);
+                while (items.isEmpty() && busy > 0 && !cancelled)
+                    wake.wait(&mutex);
+                if (items.isEmpty() || cancelled) {
+                    wake.wakeAll();
+                    return;
+                }
+                item = items.takeLast();
+                ++busy;
+            }
+
+            QList<Item> produced;
+            if (!item.files.isEmpty()) {
+                for (const QString &name : std::as_const(item.files)) {
+                    if (cancelled)
+                        break;
+                    visit(join(item.dir, name));
+                }
+            } else {
+                QStringList group;
+                QDirIterator it(item.dir.isEmpty() ? root : root + '/' + item.dir,
+                                QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+                while (it.hasNext() && !cancelled) {
+                    it.next();
+                    const QFileInfo info = it.fileInfo();
+                    const QString relative = join(item.dir, info.fileName());
+                    if (info.isDir()) {
+                        if (!info.isSymLink() && info.fileName() != ".git" && !(ignored && ignored(relative, true)))
+                            produced.append({relative, QStringList()});
+                    } else if (info.isFile() && !(ignored && ignored(relative, false))) {
+                        if (fileGroup == 0) {
+                            visit(relative);
+                        } else {
+                            group.append(info.fileName());
+                            if (group.size() == fileGroup)
+                                produced.append({item.dir, std::exchange(group, QStringList())});
+                        }
+                    }
+                }
+                if (!group.isEmpty())
+                    produced.append({item.dir, group});
+            }
+
+            QMutexLocker locker(&mutex);
+            items += produced;
+            --busy;
+            if (!produced.isEmpty() || busy == 0)
+                wake.wakeAll();
+        }
+    }
+};
+
+// Builds a PathIndex on every pool thread at once; each worker indexes what it
+// walks and the last one to finish merges the parts
+struct PathIndexBuild {
+    ParallelWalk walk;
+    QList<PathIndex> parts;
+    QElapsedTimer timer;
+
+    using Callback = std::function<void(std::shared_ptr<const PathIndex>, qint64 msecs)>;
+
+    static std::shared_ptr<PathIndexBuild> start(const QString &root, std::shared_ptr<ResultReceiver> receiver,
+                                                 Callback done) {
+        auto build = std::make_shared<PathIndexBuild>();
+        build->walk.root = root;
+        build->walk.running = qMax(1, QThreadPool::globalInstance()->maxThreadCount() - 1);
+        build->timer.start();
+        for (int i = 0, workers = build->walk.running; i < workers; ++i) {
+            QThreadPool::globalInstance()->start([build, receiver, done]() {
+                if (!build->work())
+                    return;
+                auto index = std::make_shared<PathIndex>();
+                for (const PathIndex &part : std::as_const(build->parts))
+                    index->append(part);
+                build->parts.clear();
+                if (build->walk.cancelled)
+                    return;
+                const qint64 msecs = build->timer.elapsed();
+                receiver->post([done, index, msecs]() {
+                    done(index, msecs);
+                });
+            });
+        }
+        return build;
+    }
+
+    // Returns true for the last worker to finish
+    bool work() {
+        PathIndex local;
+        walk.run([&local](const QString &relative) {
+            local.append(relative.toUtf8());
+        });
+
+        QMutexLocker locker(&walk.mutex);
+        parts.append(std::move(local));
+        return --walk.running == 0;
+    }
+};
+
+// Ranked fuzzy match of a lowercase query over a PathIndex and its delta. The
+// paths are split into chunks that pool workers claim through an atomic
+// counter; each keeps its own top results and the last one merges them
+struct QuickOpenSearch {
+    static constexpr qsizetype ChunkPaths = 32768;
+    static constexpr int MaxResults = 50;
+
+    struct Match {
+        int score;
+        QByteArray path;
+    };
+
+    std::shared_ptr<const PathIndex> index;
+    std::shared_ptr<const PathDelta> delta;
+    PathQuery query;
+    std::atomic<qsizetype> nextChunk{0};
+    std::atomic<int> running{0};
+    std::atomic<bool> cancelled{false};
+    QMutex mutex;
+    QList<Match> matches;
+    QElapsedTimer timer;
+
+    using Callback = std::function<void(QList<Match>, qint64 usecs)>;
+
+    static bool better(const Match &a, const Match &b) {
+        if (a.score != b.score)
+            return a.score > b.score;
+        return a.path < b.path;
+    }
+
+    static std::shared_ptr<QuickOpenSearch> start(std::shared_ptr<const PathIndex> index,
+                                                  std::shared_ptr<const PathDelta> delta,
+                                                  const QString &text, std::shared_ptr<ResultReceiver> receiver,
+                                                  Callback done) {
+        auto search = std::make_shared<QuickOpenSearch>();
+        search->index = std::move(index);
+        search->delta = std::move(delta);
+        search->query = PathQuery(text);
+        search->timer.start();
+
+        const qsizetype chunks = search->index->size() / ChunkPaths + 1;
+        const int workers = int(qMin<qsizetype>(chunks, QThreadPool::globalInstance()->maxThreadCount()));
+        search->running = workers;
+        for (int i = 0; i < workers; ++i) {
+            QThreadPool::globalInstance()->start([search, receiver, done]() {
+                if (!search->work())
+                    return;
+                const qint64 usecs = search->timer.nsecsElapsed() / 1000;
+                receiver->post([done, search, usecs]() {
+                    done(search->matches, usecs);
+                });
+            });
+        }
+        return search;
+    }
+
+    void scan(const PathIndex &paths, qsizetype begin, qsizetype end, bool filterRemoved, QList<Match> &top) const {
+        const quint64 *pathMasks = paths.masks.constData();
+        for (qsizetype i = begin; i < end; ++i) {
+            if (!query.accepts(pathMasks[i]))
+                continue;
+            const QByteArrayView path = paths.path(i);
+            const int pathScore = query.score(path);
+            if (pathScore < 0 || (top.size() == MaxResults && pathScore <= top.front().score))
+                continue;
+            if (filterRemoved && delta->isRemoved(path))
+                continue;
+            // Min-heap on score keeps the best MaxResults
+            const auto worse = [](const Match &a, const Match &b) { return a.score > b.score; };
+            if (top.size() == MaxResults) {
+                std::pop_heap(top.begin(), top.end(), worse);
+                top.removeLast();
+            }
+            top.append({pathScore, path.toByteArray()});
+            std::push_heap(top.begin(), top.end(), worse);
+        }
+    }
+
+    // Returns true for the last worker to finish
+    bool work() {
+        QList<Match> top;
+        top.reserve(MaxResults);
+        const bool filterRemoved = !delta->removed.isEmpty();
+        const qsizetype chunks = index->size() / ChunkPaths + 1;
+        for (qsizetype chunk; !cancelled && (chunk = nextChunk++) <= chunks;) {
+            if (chunk == chunks) {
+                scan(delta->added, 0, delta->added.size(), filterRemoved, top);
+            } else {
+                const qsizetype begin = chunk * ChunkPaths;
+                scan(*index, begin, qMin(begin + ChunkPaths, index->size()), filterRemoved, top);
+            }
+        }
+
+        QMutexLocker locker(&mutex);
+        matches += top;
+        if (--running > 0 || cancelled)
+            return false;
+
+        std::sort(matches.begin(), matches.end(), better);
+        matches.erase(std::unique(matches.begin(), matches.end(),
+                                  [](const Match &a, const Match &b) { return a.path == b.path; }),
+                      matches.end());
+        if (matches.size() > MaxResults)
+            matches.resize(MaxResults);
+        return true;
+    }
+};
+
+// Ctrl+P palette over a PathIndex of the whole project. The index is built in
+// parallel when the root changes and kept current from watcher events
+class QuickOpenDialog : public QDialog {
+    Q_OBJECT
+public:
+    QuickOpenDialog(QWidget *parent = nullptr) : QDialog(parent, Qt::Popup) {
+        QVBoxLayout *layout = new QVBoxLayout(this);
+        layout->setContentsMargins(4, 4, 4, 4);
+
+        input = new QLineEdit(this);
+        input->setPlaceholderText("Go to file...");
+        resultList = new QListWidget(this);
+        resultList->setUniformItemSizes(true);
+        statusLabel = new QLabel(this);
+        statusLabel->setStyleSheet("color: #808080;");
+
+        layout->addWidget(input);
+        layout->addWidget(resultList);
+        layout->addWidget(statusLabel);
+        setStyleSheet("QDialog { background-color: #252526; } "
+                      "QLineEdit, QListWidget { background-color: #1E1E1E; color: #D4D4D4; }");
+        resize(600, 400);
+
+        input->installEventFilter(this);
+        connect(input, &QLineEdit::textChanged, this, &QuickOpenDialog::startSearch);
+        connect(input, &QLineEdit::returnPressed, this, &QuickOpenDialog::openCurrent);
+        connect(resultList, &QListWidget::itemActivated, this, &QuickOpenDialog::openCurrent);
+    }
+
+    ~QuickOpenDialog() {
+        receiver->detach();
+        if (build)
+            build->walk.cancelled = true;
+        if (search)
+            search->cancelled = true;
+    }
+
+    void setRootPath(const QString &path) {
+        root = QFileInfo(path).absoluteFilePath();
+        index = std::make_shared<PathIndex>();
+        delta = std::make_shared<PathDelta>();
+        rebuild();
+    }
+
+    void popup() {
+        if (stale)
+            rebuild();
+        QWidget *window = parentWidget() ? parentWidget()->window() : nullptr;
+        if (window)
+            move(window->geometry().center().x() - width() / 2, window->geometry().top() + 60);
+        {
+            // Searched for below whether or not the text was empty already
+            const QSignalBlocker blocker(input);
+            input->clear();
+        }
+        startSearch(QString());
+        show();
+        input->setFocus();
+    }
+
+    QString statistics() const {
+        return QString("indexed paths: %1 (+%2 / -%3 since build)\nindex memory: %4 KB\n"
+                       "last build: %5 ms\nlast query: %6 us")
+            .arg(index->size())
+            .arg(delta->added.size())
+            .arg(delta->removed.size())
+            .arg((index->data.capacity() + index->offsets.capacity() * qint64(sizeof(quint32)) +
+                  index->masks.capacity() * qint64(sizeof(quint64))) / 1024)
+            .arg(buildMsecs)
+            .arg(queryUsecs);
+    }
+
+    // Watcher events for directories the tree has listed
+    void applyChanges(const QString &dir, const DirChanges &changes) {
+        if (dir != root && !dir.startsWith(root + '/'))
+            return;
+        if (changes.rescan) {
+            stale = true;
+            return;
+        }
+        if (changes.added.isEmpty() && changes.removed.isEmpty() && changes.renamed.isEmpty())
+            return;  // Only writes, which do not change any path
+
+        const QString relativeDir = dir.mid(root.size() + 1);
+        const auto relative = [&](const QString &name) {
+            return (relativeDir.isEmpty() ? name : relativeDir + '/' + name).toUtf8();
+        };
+        auto updated = std::make_shared<PathDelta>(*delta);
+        const auto remove = [&](const QByteArray &path) {
+            updated->removed.append(path);
+            updated->removed.append(path + '/');
+        };
+        const auto add = [&](const QByteArray &path) {
+            updated->removed.removeAll(path);
+            updated->added.append(path);
+        };
+        for (const QString &name : changes.removed)
+            remove(relative(name));
+        for (const auto &[from, to] : changes.renamed) {
+            remove(relative(from));
+            if (QFileInfo(dir + '/' + to).isDir())
+                stale = true;  // Its contents are not known here
+            else
+                add(relative(to));
+        }
+        for (const DirEntry &entry : changes.added) {
+            if (entry.isDir)
+                stale = true;
+            else
+                add(relative(entry.name));
+        }
+        delta = std::move(updated);
+    }
+
+signals:
+    void openFile(const QString &filePath);
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override {
+        // Arrow keys in the input move the selection
+        if (watched == input && event->type() == QEvent::KeyPress) {
+            const int key = static_cast<QKeyEvent *>(event)->key();
+            if (key == Qt::Key_Down || key == Qt::Key_Up) {
+                const int row = resultList->currentRow() + (key == Qt::Key_Down ? 1 : -1);
+                resultList->setCurrentRow(qBound(0, row, resultList->count() - 1));
+                return true;
+            }
+        }
+        return QDialog::eventFilter(watched, event);
+    }
+
+private:
+    void rebuild() {
+        if (build)
+            build->walk.cancelled = true;
+        stale = false;
+        statusLabel->setText("Indexing...");
+        const int serial = ++buildSerial;
+        build = PathIndexBuild::start(root, receiver, [this, serial](std::shared_ptr<const PathIndex> built, qint64 msecs) {
+            if (serial != buildSerial)
+                return;
+            index = std::move(built);
+            delta = std::make_shared<PathDelta>();
+            build.reset();
+            buildMsecs = msecs;
+            if (isVisible())
+                startSearch(input->text());
+        });
+    }
+
+    void startSearch(const QString &text) {
+        if (search)
+            search->cancelled = true;
+        const int serial = ++searchSerial;
+        search = QuickOpenSearch::start(index, delta, text, receiver,
+                                        [this, serial](QList<QuickOpenSearch::Match> matches, qint64 usecs) {
+            if (serial != searchSerial)
+                return;
+            search.reset();
+            queryUsecs = usecs;
+            showMatches(matches);
+        });
+    }
+
+    void showMatches(const QList<QuickOpenSearch::Match> &matches) {
+        resultList->clear();
+        for (const QuickOpenSearch::Match &match : matches)
+            resultList->addItem(QString::fromUtf8(match.path));
+        resultList->setCurrentRow(0);
+
+        const QString indexState = build ? "indexing..." :
+            QString("%1 files indexed in %2 ms").arg(index->size() + delta->added.size()).arg(buildMsecs);
+        statusLabel->setText(QString("%1 matches in %2 ms, %3")
+                             .arg(matches.size())
+                             .arg(queryUsecs / 1000.0, 0, 'f', 2)
+                             .arg(indexState));
+    }
+
+    void openCurrent() {
+        QListWidgetItem *item = resultList->currentItem();
+        if (!item)
+            return;
+        hide();
+        emit openFile(root + '/' + item->text());
+    }
+
+    QLineEdit *input;
+    QListWidget *resultList;
+    QLabel *statusLabel;
+    QString root;
+    std::shared_ptr<const PathIndex> index = std::make_shared<PathIndex>();
+    std::shared_ptr<const PathDelta> delta = std::make_shared<PathDelta>();
+    std::shared_ptr<PathIndexBuild> build;
+    std::shared_ptr<QuickOpenSearch> search;
+    std::shared_ptr<ResultReceiver> receiver = std::make_shared<ResultReceiver>(this);
+    bool stale = false;
+    int buildSerial = 0;
+    int searchSerial = 0;
+    qint64 buildMsecs = 0;
+    qint64 queryUsecs = 0;
+};
+
+// Root .gitignore patterns, matched the simple way: no negation, a trailing
+// '/' limits a pattern to directories and any other '/' anchors it to the root
+struct IgnoreRules {
+    struct Rule {
+        QRegularExpression pattern;
+        bool dirOnly = false;
+        bool anchored = false;
+    };
+
+    QList<Rule> rules;
+
+    static IgnoreRules load(const QString &root) {
+        IgnoreRules result;
+        QFile file(root + "/.gitignore");
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+            return result;
+        while (!file.atEnd()) {
+            QString line = QString::fromUtf8(file.readLine()).trimmed();
+            if (line.isEmpty() || line.startsWith('#') || line.startsWith('!'))
+                continue;
+            Rule rule;
+            rule.dirOnly = line.endsWith('/');
+            if (rule.dirOnly)
+                line.chop(1);
+            rule.anchored = line.contains('/');
+            if (line.startsWith('/'))
+                line.remove(0, 1);
+            rule.pattern = QRegularExpression::fromWildcard(line, Qt::CaseSensitive);
+            if (rule.pattern.isValid())
+                result.rules.append(rule);
+        }
+        return result;
+    }
+
+    bool ignored(const QString &relative, bool isDir) const {
+        const QStringView name = QStringView(relative).mid(relative.lastIndexOf('/') + 1);
+        for (const Rule &rule : rules) {
+            if (rule.dirOnly && !isDir)
+                continue;
+            if (rule.pattern.matchView(rule.anchored ? QStringView(relative) : name).hasMatch())
+                return true;
+        }
+        return false;
+    }
+
+    // Whether a walk would skip relative: it or a directory above it is
+    // ignored, or it is inside .git
+    bool ignoredPath(const QString &relative, bool isDir) const {
+        for (qsizetype slash = relative.indexOf('/'); slash >= 0; slash = relative.indexOf('/', slash + 1)) {
+            const QString dir = relative.left(slash);
+            if (dir == ".git" || dir.endsWith("/.git") || ignored(dir, true))
+                return true;
+        }
+        return ignored(relative, isDir);
+    }
+};
+
+// Persistent trigram index of a project, mapped read-only. Layout:
+//   Header | FileEntry[fileCount] | postings | TrigramEntry[trigramCount] | paths
+// Trigrams are taken over ASCII-folded bytes and never span a newline; each
+// posting list is the varint-encoded deltas of ascending file ids
+class TrigramIndex {
+public:
+    static constexpr quint32 Magic = 0x58494754;  // "TGIX"
+    static constexpr quint32 Version = 1;
+    static constexpr qint64 MaxIndexedBytes = 16 * 1024 * 1024;
+
+    enum FileFlags : quint32 {
+        Binary = 1,
+        Unindexed = 2  // Too large; always searched directly
+    };
+
+    struct Header {
+        quint32 magic;
+        quint32 version;
+        quint32 fileCount;
+        quint32 trigramCount;
+        quint64 postingsOffset;
+        quint64 trigramsOffset;
+        quint64 pathsOffset;
+        quint64 reserved;
+    };
+
+    struct FileEntry {
+        qint64 mtime;
+        qint64 size;
+        quint32 pathOffset;
+        quint32 pathLength;
+        quint32 flags;
+        quint32 reserved;
+    };
+
+    struct TrigramEntry {
+        quint32 key;
+        quint32 count;
+        quint64 offset;
+    };
+
+    ~TrigramIndex() {
+        if (data)
+            file.unmap(const_cast<uchar *>(data));
+    }
+
+    static QString indexPath(const QString &root) {
+        const QByteArray id = QCryptographicHash::hash(root.toUtf8(), QCryptographicHash::Sha1).toHex();
+        return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/trigrams/" + id + ".idx";
+    }
+
+    static uchar fold(uchar c) {
+        return c >= 'A' && c <= 'Z' ? uchar(c + 'a' - 'A') : c;
+    }
+
+    static quint32 key(uchar a, uchar b, uchar c) {
+        return quint32(fold(a)) << 16 | quint32(fold(b)) << 8 | fold(c);
+    }
+
+    static void appendVarint(QByteArray &out, quint32 value) {
+        while (value >= 0x80) {
+            out.append(char(value | 0x80));
+            value >>= 7;
+        }
+        out.append(char(value));
+    }
+
+    // Stops at end, or after five bytes, on a varint that does not terminate
+    static quint32 readVarint(const uchar *&p, const uchar *end) {
+        quint32 value = 0;
+        for (int shift = 0; p < end && shift < 35; shift += 7) {
+            const uchar byte = *p++;
+            value |= quint32(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        return value;
+    }
+
+    // Distinct trigrams of a needle, sorted
+    static QList<quint32> keys(QByteArrayView needle) {
+        QList<quint32> keys;
+        for (qsizetype i = 2; i < needle.size(); ++i) {
+            if (needle[i] != '\n' && needle[i - 1] != '\n' && needle[i - 2] != '\n')
+                keys.append(key(needle[i - 2], needle[i - 1], needle[i]));
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    }
+
+    static std::shared_ptr<const TrigramIndex> open(const QString &root) {
+        auto index = std::make_shared<TrigramIndex>();
+        index->file.setFileName(indexPath(root));
+        if (!index->file.open(QIODevice::ReadOnly) || index->file.size() < qint64(sizeof(Header)))
+            return nullptr;
+        const qint64 size = index->file.size();
+        index->data = index->file.map(0, size);
+        if (!index->data)
+            return nullptr;
+
+        // Every offset in the file is checked against its section here, so a
+        // truncated or damaged index is dropped instead of read out of bounds
+        const Header &header = index->header();
+        if (header.magic != Magic || header.version != Version ||
+            header.postingsOffset > header.trigramsOffset || header.trigramsOffset > header.pathsOffset ||
+            header.pathsOffset > quint64(size) ||
+            sizeof(Header) + quint64(header.fileCount) * sizeof(FileEntry) > header.postingsOffset ||
+            header.trigramsOffset + quint64(header.trigramCount) * sizeof(TrigramEntry) > header.pathsOffset)
+            return nullptr;
+        const quint64 pathsSize = quint64(size) - header.pathsOffset;
+        for (quint32 id = 0; id < header.fileCount; ++id) {
+            const FileEntry &file = index->entry(id);
+            if (quint64(file.pathOffset) + file.pathLength > pathsSize)
+                return nullptr;
+        }
+        // A posting list holds at least a byte per file id; keys are sorted
+        const quint64 postingsSize = header.trigramsOffset - header.postingsOffset;
+        const TrigramEntry *table = index->trigrams();
+        for (quint32 i = 0; i < header.trigramCount; ++i) {
+            if (table[i].offset > postingsSize || table[i].count > postingsSize - table[i].offset ||
+                (i > 0 && table[i - 1].key >= table[i].key))
+                return nullptr;
+        }
+
+        index->ids.reserve(header.fileCount);
+        for (quint32 id = 0; id < header.fileCount; ++id)
+            index->ids.insert(index->path(id), id);
+        return index;
+    }
+
+    quint32 fileCount() const {
+        return header().fileCount;
+    }
+
+    qint64 sizeOnDisk() const {
+        return file.size();
+    }
+
+    int fileId(const QString &relative) const {
+        return int(ids.value(relative, -1));
+    }
+
+    const FileEntry &entry(quint32 id) const {
+        return reinterpret_cast<const FileEntry *>(data + sizeof(Header))[id];
+    }
+
+    QString path(quint32 id) const {
+        const FileEntry &file = entry(id);
+        return QString::fromUtf8(reinterpret_cast<const char *>(data + header().pathsOffset + file.pathOffset),
+                                 file.pathLength);
+    }
+
+    // Files that may contain the needle, or false when it is too short to narrow
+    bool candidates(QByteArrayView needle, QBitArray *result) const {
+        const QList<quint32> keys = TrigramIndex::keys(needle);
+        if (keys.isEmpty())
+            return false;
+
+        QList<const TrigramEntry *> entries;
+        const TrigramEntry *begin = trigrams();
+        const TrigramEntry *end = begin + header().trigramCount;
+        for (quint32 k : keys) {
+            const TrigramEntry *it = std::lower_bound(begin, end, k,
+                                                      [](const TrigramEntry &e, quint32 v) { return e.key < v; });
+            if (it == end || it->key != k) {
+                *result = QBitArray(int(fileCount()));
+                return true;
+            }
+            entries.append(it);
+        }
+        // Start from the rarest trigram so the intersection shrinks fastest
+        std::sort(entries.begin(), entries.end(),
+                  [](const TrigramEntry *a, const TrigramEntry *b) { return a->count < b->count; });
+
+        *result = decode(*entries[0]);
+        for (qsizetype i = 1; i < entries.size() && result->count(true) > 0; ++i)
+            *result &= decode(*entries[i]);
+        return true;
+    }
+
+    // Calls visit(key, ids) for every trigram with its ascending file ids
+    template <typename Visit>
+    void forEachTrigram(Visit &&visit) const {
+        const TrigramEntry *table = trigrams();
+        QList<quint32> ids;
+        for (quint32 i = 0; i < header().trigramCount; ++i) {
+            ids.clear();
+            postings(table[i], [&ids](quint32 id) {
+                ids.append(id);
+            });
+            visit(table[i].key, std::as_const(ids));
+        }
+    }
+
+private:
+    const Header &header() const {
+        return *reinterpret_cast<const Header *>(data);
+    }
+
+    const TrigramEntry *trigrams() const {
+        return reinterpret_cast<const TrigramEntry *>(data + header().trigramsOffset);
+    }
+
+    // Decodes a posting list, stopping at the end of the postings section or
+    // at an id that is out of range
+    template <typename Visit>
+    void postings(const TrigramEntry &trigram, Visit &&visit) const {
+        const uchar *p = data + header().postingsOffset + trigram.offset;
+        const uchar *end = data + header().trigramsOffset;
+        quint32 id = 0;
+        for (quint32 i = 0; i < trigram.count && p < end; ++i) {
+            id += readVarint(p, end);
+            if (id >= fileCount())
+                return;
+            visit(id);
+        }
+    }
+
+    QBitArray decode(const TrigramEntry &trigram) const {
+        QBitArray bits(int(fileCount()));
+        postings(trigram, [&bits](quint32 id) {
+            bits.setBit(int(id));
+        });
+        return bits;
+    }
+
+    QFile file;
+    const uchar *data = nullptr;
+    QHash<QString, quint32> ids;
+};
+
+// Files changed since the TrigramIndex was written, indexed again in memory
+// by path. A search consults it for files whose size or mtime no longer
+// match the index; once it grows large enough it is merged into the index
+// file. It is replaced as a whole on each update, so searches can share it
+struct TrigramDelta {
+    struct File {
+        qint64 mtime = 0;
+        qint64 size = 0;
+        quint32 flags = 0;
+        QList<quint32> trigrams;  // Sorted
+
+        bool containsAll(const QList<quint32> &keys) const {
+            return std::all_of(keys.cbegin(), keys.cend(), [this](quint32 k) {
+                return std::binary_search(trigrams.cbegin(), trigrams.cend(), k);
+            });
+        }
+    };
+
+    QHash<QString, File> files;
+};
+
+struct SearchHit {
+    QString path;  // Relative to the search root
+    qint64 line;
+    int column;
+    QString text;
+};
+
+// Find in files. Workers share a ParallelWalk in groups of files, map each
+// file, skip binaries and ignored paths, and look for a literal with a
+// vectorized first-byte scan before comparing; a regex is only run on lines
+// that contain its longest required literal. With a TrigramIndex there is no
+// walk: the workers share the files the index and its delta list as possible
+// matches, plus the changed files the delta does not cover yet. Each is
+// stat'ed first, and an indexed file whose size or mtime no longer matches
+// is searched all the same and listed in changedPaths. Hits are handed over
+// in batches through pendingHits
+struct TextSearch {
+    static constexpr int FileGroup = 32;
+    static constexpr qint64 BinaryProbeBytes = 8192;
+    static constexpr int MaxHits = 20000;
+    static constexpr int MaxLineChars = 240;
+
+    struct Candidate {
+        QString path;
+        qint64 mtime;
+        qint64 size;
+        bool indexed;  // False for changed files the delta does not cover yet
+    };
+
+    ParallelWalk walk;
+    IgnoreRules ignore;
+    QByteArray needle;  // UTF-8, ASCII-lowercased when !caseSensitive
+    bool caseSensitive = true;
+    QRegularExpression regex;
+    QList<Candidate> candidates;
+    std::atomic<qsizetype> nextCandidate{0};
+    bool narrowed = false;
+    QMutex hitsMutex;
+    QList<SearchHit> pendingHits;
+    QStringList changedPaths;
+    std::atomic<int> hitCount{0};
+    std::atomic<qint64> filesSearched{0};
+    std::atomic<qint64> bytesSearched{0};
+    std::atomic<qint64> filesSkipped{0};
+    std::atomic<qint64> changedFiles{0};
+    std::atomic<bool> truncated{false};
+    QElapsedTimer timer;
+
+    static char fold(char c) {
+        return c >= 'A' && c <= 'Z' ? char(c + 'a' - 'A') : c;
+    }
+
+    static char unfold(char c) {
+        return c >= 'a' && c <= 'z' ? char(c - 'a' + 'A') : c;
+    }
+
+    // changed lists files known to differ from the index and delta, whose
+    // update has not landed yet
+    static std::shared_ptr<TextSearch> start(const QString &root, const QString &pattern, bool caseSensitive,
+                                             bool useRegex, std::shared_ptr<const TrigramIndex> index,
+                                             std::shared_ptr<const TrigramDelta> delta, const QStringList &changed,
+                                             std::shared_ptr<ResultReceiver> receiver, std::function<void()> finished) {
+        auto search = std::make_shared<TextSearch>();
+        search->walk.root = root;
+        search->walk.fileGroup = FileGroup;
+        search->ignore = IgnoreRules::load(root);
+        search->walk.ignored = [rules = &search->ignore](const QString &relative, bool isDir) {
+            return rules->ignored(relative, isDir);
+        };
+        search->caseSensitive = caseSensitive;
+
+        const auto options = caseSensitive ? QRegularExpression::NoPatternOption
+                                           : QRegularExpression::CaseInsensitiveOption;
+        QString literal = pattern;
+        if (useRegex) {
+            search->regex = QRegularExpression(pattern, options);
+            if (!search->regex.isValid())
+                return search;
+            literal = requiredLiteral(pattern);
+        }
+        const QByteArray bytes = literal.toUtf8();
+        const bool ascii = std::all_of(bytes.cbegin(), bytes.cend(), [](char c) { return uchar(c) < 0x80; });
+        if (!caseSensitive && !ascii) {
+            // Byte folding is ASCII only; let the regex do the case folding
+            if (!useRegex)
+                search->regex = QRegularExpression(QRegularExpression::escape(pattern), options);
+        } else if (bytes.size() >= 2 || !useRegex) {
+            search->needle = caseSensitive ? bytes : bytes.toLower();
+        }
+        search->timer.start();
+        QBitArray matches;
+        if (index && delta && !search->needle.isEmpty() && index->candidates(search->needle, &matches)) {
+            search->narrowed = true;
+            search->listCandidates(*index, *delta, matches, changed);
+        }
+
+        const int workers = qMax(1, QThreadPool::globalInstance()->maxThreadCount() - 1);
+        search->walk.running = workers;
+        for (int i = 0; i < workers; ++i) {
+            QThreadPool::globalInstance()->start([search, receiver, finished]() {
+                if (search->narrowed) {
+                    for (qsizetype next = search->nextCandidate++;
+                         next < search->candidates.size() && !search->walk.cancelled;
+                         next = search->nextCandidate++) {
+                        search->searchCandidate(search->candidates[next]);
+                    }
+                } else {
+                    search->walk.run([&search](const QString &relative) {
+                        QList<SearchHit> hits;
+                        search->searchFile(relative, hits);
+                        search->addHits(hits);
+                    });
+                }
+                QMutexLocker locker(&search->walk.mutex);
+                if (--search->walk.running == 0)
+                    receiver->post(finished);
+            });
+        }
+        return search;
+    }
+
+    // Files the index or delta says may contain every trigram of the needle
+    // (or that are too large to have been indexed), then the changed ones
+    void listCandidates(const TrigramIndex &index, const TrigramDelta &delta, const QBitArray &matches,
+                        const QStringList &changed) {
+        const QSet<QString> pending(changed.cbegin(), changed.cend());
+        const QList<quint32> keys = TrigramIndex::keys(needle);
+        for (quint32 id = 0; id < index.fileCount(); ++id) {
+            const TrigramIndex::FileEntry &entry = index.entry(id);
+            if ((entry.flags & TrigramIndex::Binary) ||
+                (!(entry.flags & TrigramIndex::Unindexed) && !matches.testBit(id))) {
+                ++filesSkipped;
+                continue;
+            }
+            const QString path = index.path(id);
+            if (!delta.files.contains(path) && !pending.contains(path))
+                candidates.append({path, entry.mtime, entry.size, true});
+        }
+        for (auto it = delta.files.cbegin(); it != delta.files.cend(); ++it) {
+            if ((it->flags & TrigramIndex::Binary) ||
+                (!(it->flags & TrigramIndex::Unindexed) && !it->containsAll(keys))) {
+                ++filesSkipped;
+                continue;
+            }
+            if (!pending.contains(it.key()))
+                candidates.append({it.key(), it->mtime, it->size, true});
+        }
+        for (const QString &path : pending)
+            candidates.append({path, 0, 0, false});
+    }
+
+    // A stat decides whether the index can be trusted for this file; either
+    // way it is searched, since the index said it may match
+    void searchCandidate(const Candidate &candidate) {
+        const QFileInfo info(walk.root + '/' + candidate.path);
+        if (!info.isFile())
+            return;
+        if (!candidate.indexed || info.size() != candidate.size ||
+            info.lastModified().toMSecsSinceEpoch() != candidate.mtime) {
+            ++changedFiles;
+            if (candidate.indexed) {
+                QMutexLocker locker(&hitsMutex);
+                changedPaths.append(candidate.path);
+            }
+        }
+        QList<SearchHit> hits;
+        searchFile(candidate.path, hits);
+        addHits(hits);
+    }
+
+    void addHits(const QList<SearchHit> &hits) {
+        if (hits.isEmpty())
+            return;
+        QMutexLocker locker(&hitsMutex);
+        pendingHits += hits;
+    }
+
+    QList<SearchHit> takeHits() {
+        QMutexLocker locker(&hitsMutex);
+        return std::exchange(pendingHits, QList<SearchHit>());
+    }
+
+    QStringList takeChangedPaths() {
+        QMutexLocker locker(&hitsMutex);
+        return std::exchange(changedPaths, QStringList());
+    }
+
+    void cancel() {
+        QMutexLocker locker(&walk.mutex);
+        walk.cancelled = true;
+        walk.wake.wakeAll();
+    }
+
+    // Next offset in [from, end) holding the needle's first byte in either case
+    qint64 findFirstByte(const char *data, qint64 from, qint64 end) const {
+        const char first = needle[0];
+        const char alt = caseSensitive ? first : unfold(first);
+        if (first == alt) {
+            const void *hit = memchr(data + from, first, size_t(end - from));
+            return hit ? static_cast<const char *>(hit) - data : -1;
+        }
+        qint64 i = from;
+#if defined(__SSE2__)
+        const __m128i lower = _mm_set1_epi8(first);
+        const __m128i upper = _mm_set1_epi8(alt);
+        for (; i + 16 <= end; i += 16) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, lower), _mm_cmpeq_epi8(bytes, upper)));
+            if (mask)
+                return i + qCountTrailingZeroBits(quint32(mask));
+        }
+#endif
+        for (; i < end; ++i) {
+            if (data[i] == first || data[i] == alt)
+                return i;
+        }
+        return -1;
+    }
+
+    qint64 findNeedle(const char *data, qint64 size, qint64 from) const {
+        const qint64 end = size - needle.size() + 1;
+        while (from < end) {
+            const qint64 i = findFirstByte(data, from, end);
+            if (i < 0)
+                return -1;
+            if (caseSensitive) {
+                if (memcmp(data + i + 1, needle.constData() + 1, size_t(needle.size() - 1)) == 0)
+                    return i;
+            } else {
+                qsizetype k = 1;
+                while (k < needle.size() && fold(data[i + k]) == needle[k])
+                    ++k;
+                if (k == needle.size())
+                    return i;
+            }
+            from = i + 1;
+        }
+        return -1;
+    }
+
+    void searchFile(const QString &relative, QList<SearchHit> &hits) {
+        QFile file(walk.root + '/' + relative);
+        if (!file.open(QIODevice::ReadOnly) || file.size() == 0)
+            return;
+        const qint64 size = file.size();
+        const uchar *mapped = file.map(0, size);
+        if (!mapped)
+            return;
+        const char *data = reinterpret_cast<const char *>(mapped);
+        if (memchr(data, 0, size_t(qMin(size, BinaryProbeBytes)))) {
+            file.unmap(const_cast<uchar *>(mapped));
+            return;
+        }
+        ++filesSearched;
+        bytesSearched += size;
+
+        qint64 line = 0;
+        qint64 counted = 0;
+        qint64 pos = 0;
+        while (pos < size && !walk.cancelled) {
+            qint64 lineStart = pos;
+            qint64 match = pos;
+            if (!needle.isEmpty()) {
+                match = findNeedle(data, size, pos);
+                if (match < 0)
+                    break;
+                lineStart = match;
+                while (lineStart > pos && data[lineStart - 1] != '\n')
+                    --lineStart;
+            }
+            const void *newline = memchr(data + lineStart, '\n', size_t(size - lineStart));
+            const qint64 lineEnd = newline ? static_cast<const char *>(newline) - data : size;
+            line = scanNewlines(data + counted, lineStart - counted, 0, line, INT_MAX, [](qint64) {});
+            counted = lineStart;
+            pos = lineEnd + 1;
+
+            qint64 textEnd = lineEnd;
+            if (textEnd > lineStart && data[textEnd - 1] == '\r')
+                --textEnd;
+            const QString text = QString::fromUtf8(data + lineStart, textEnd - lineStart);
+            int column;
+            if (regex.isValid()) {
+                const QRegularExpressionMatch found = regex.matchView(text);
+                if (!found.hasMatch())
+                    continue;
+                column = int(found.capturedStart());
+            } else {
+                column = int(QString::fromUtf8(data + lineStart, match - lineStart).size());
+            }
+
+            hits.append({relative, line + 1, column, text.left(MaxLineChars)});
+            if (++hitCount >= MaxHits) {
+                truncated = true;
+                cancel();
+            }
+        }
+        file.unmap(const_cast<uchar *>(mapped));
+    }
+};
+
+// Builds a TrigramIndex with a ParallelWalk. Each worker keeps its own file
+// list and posting lists over local file ids; the last worker renumbers and
+// merges them and writes the index through QSaveFile. The same parts are
+// used to index changed files into a TrigramDelta and to fold a delta back
+// into the index file
+struct TrigramIndexBuild {
+    struct Posting {
+        QByteArray bytes;
+        quint32 last = 0;
+        quint32 count = 0;
+    };
+
+    struct Part {
+        QStringList paths;
+        QList<TrigramIndex::FileEntry> files;
+        QHash<quint32, Posting> postings;
+    };
+
+    ParallelWalk walk;
+    IgnoreRules ignore;
+    QList<Part> parts;
+    QElapsedTimer timer;
+    std::atomic<bool> ok{true};
+
+    using Callback = std::function<void(bool ok, qint64 msecs)>;
+
+    static std::shared_ptr<TrigramIndexBuild> start(const QString &root, std::shared_ptr<ResultReceiver> receiver,
+                                                    Callback done) {
+        auto build = std::make_shared<TrigramIndexBuild>();
+        build->walk.root = root;
+        build->walk.fileGroup = TextSearch::FileGroup;
+        build->ignore = IgnoreRules::load(root);
+        build->walk.ignored = [rules = &build->ignore](const QString &relative, bool isDir) {
+            return rules->ignored(relative, isDir);
+        };
+        build->walk.running = qMax(1, QThreadPool::globalInstance()->maxThreadCount() - 1);
+        build->timer.start();
+        for (int i = 0, workers = build->walk.running; i < workers; ++i) {
+            QThreadPool::globalInstance()->start([build, receiver, done]() {
+                if (!build->work())
+                    return;
+                const bool written = !build->walk.cancelled && build->write();
+                build->parts.clear();
+                if (build->walk.cancelled)
+                    return;
+                const qint64 msecs = build->timer.elapsed();
+                receiver->post([done, written, msecs]() {
+                    done(written, msecs);
+                });
+            });
+        }
+        return build;
+    }
+
+    // Reads one file and collects its distinct trigrams into keys; seen is a
+    // bit per trigram, left cleared. Empty when the file cannot be opened
+    static std::optional<TrigramIndex::FileEntry> scan(const QString &fileName, std::vector<quint64> &seen,
+                                                       std::vector<quint32> &keys) {
+        keys.clear();
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            return std::nullopt;
+        TrigramIndex::FileEntry entry{};
+        entry.mtime = file.fileTime(QFileDevice::FileModificationTime).toMSecsSinceEpoch();
+        entry.size = file.size();
+        if (entry.size > TrigramIndex::MaxIndexedBytes) {
+            entry.flags = TrigramIndex::Unindexed;
+        } else if (entry.size > 0) {
+            const uchar *data = file.map(0, entry.size);
+            if (!data) {
+                entry.flags = TrigramIndex::Unindexed;
+            } else if (memchr(data, 0, size_t(qMin(entry.size, TextSearch::BinaryProbeBytes)))) {
+                entry.flags = TrigramIndex::Binary;
+            } else {
+                for (qint64 i = 2; i < entry.size; ++i) {
+                    if (data[i] == '\n') {
+                        i += 2;
+                        continue;
+                    }
+                    if (data[i - 1] == '\n' || data[i - 2] == '\n')
+                        continue;
+                    const quint32 k = TrigramIndex::key(data[i - 2], data[i - 1], data[i]);
+                    quint64 &word = seen[k >> 6];
+                    if (word & (quint64(1) << (k & 63)))
+                        continue;
+                    word |= quint64(1) << (k & 63);
+                    keys.push_back(k);
+                }
+                for (quint32 k : keys)
+                    seen[k >> 6] = 0;
+            }
+            if (data)
+                file.unmap(const_cast<uchar *>(data));
+        }
+        return entry;
+    }
+
+    static void addPosting(Part &part, quint32 k, quint32 id) {
+        Posting &posting = part.postings[k];
+        TrigramIndex::appendVarint(posting.bytes, id - posting.last);
+        posting.last = id;
+        ++posting.count;
+    }
+
+    // Returns true for the last worker to finish
+    bool work() {
+        Part part;
+        std::vector<quint64> seen(size_t(1) << 18);  // One bit per trigram
+        std::vector<quint32> keys;
+        walk.run([&](const QString &relative) {
+            const std::optional<TrigramIndex::FileEntry> entry = scan(walk.root + '/' + relative, seen, keys);
+            if (!entry)
+                return;
+            const quint32 id = quint32(part.files.size());
+            for (quint32 k : keys)
+                addPosting(part, k, id);
+            part.paths.append(relative);
+            part.files.append(*entry);
+        });
+
+        QMutexLocker locker(&walk.mutex);
+        parts.append(std::move(part));
+        return --walk.running == 0;
+    }
+
+    bool write() {
+        const QString fileName = TrigramIndex::indexPath(walk.root);
+        QDir().mkpath(QFileInfo(fileName).absolutePath());
+        QSaveFile out(fileName);
+        if (!out.open(QIODevice::WriteOnly))
+            return false;
+
+        // Files and their path blob, renumbered part by part
+        QList<TrigramIndex::FileEntry> files;
+        QByteArray paths;
+        QList<quint32> bases;
+        for (const Part &part : std::as_const(parts)) {
+            bases.append(quint32(files.size()));
+            for (qsizetype i = 0; i < part.files.size(); ++i) {
+                TrigramIndex::FileEntry entry = part.files[i];
+                const QByteArray path = part.paths[i].toUtf8();
+                entry.pathOffset = quint32(paths.size());
+                entry.pathLength = quint32(path.size());
+                paths.append(path);
+                files.append(entry);
+            }
+        }
+
+        TrigramIndex::Header header{};
+        header.magic = TrigramIndex::Magic;
+        header.version = TrigramIndex::Version;
+        header.fileCount = quint32(files.size());
+        header.postingsOffset = sizeof(header) + files.size() * sizeof(TrigramIndex::FileEntry);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(files.constData()), files.size() * sizeof(TrigramIndex::FileEntry));
+
+        QList<quint32> keys;
+        for (const Part &part : std::as_const(parts)) {
+            for (auto it = part.postings.cbegin(); it != part.postings.cend(); ++it)
+                keys.append(it.key());
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        // Postings are streamed out; the trigram table follows them
+        QList<TrigramIndex::TrigramEntry> trigrams;
+        trigrams.reserve(keys.size());
+        quint64 offset = 0;
+        QByteArray bytes;
+        for (quint32 k : std::as_const(keys)) {
+            if (walk.cancelled)
+                return false;
+            bytes.clear();
+            quint32 last = 0;
+            quint32 count = 0;
+            for (qsizetype p = 0; p < parts.size(); ++p) {
+                auto it = parts[p].postings.constFind(k);
+                if (it == parts[p].postings.cend())
+                    continue;
+                const uchar *data = reinterpret_cast<const uchar *>(it->bytes.constData());
+                const uchar *end = data + it->bytes.size();
+                quint32 local = 0;
+                for (quint32 i = 0; i < it->count; ++i) {
+                    local += TrigramIndex::readVarint(data, end);
+                    const quint32 id = bases[p] + local;
+                    TrigramIndex::appendVarint(bytes, id - last);
+                    last = id;
+                }
+                count += it->count;
+            }
+            trigrams.append({k, count, offset});
+            offset += bytes.size();
+            out.write(bytes);
+        }
+
+        const QByteArray padding((8 - offset % 8) % 8, '\0');
+        out.write(padding);
+        header.trigramCount = quint32(trigrams.size());
+        header.trigramsOffset = header.postingsOffset + offset + padding.size();
+        header.pathsOffset = header.trigramsOffset + trigrams.size() * sizeof(TrigramIndex::TrigramEntry);
+        out.write(reinterpret_cast<const char *>(trigrams.constData()),
+                  trigrams.size() * sizeof(TrigramIndex::TrigramEntry));
+        out.write(paths);
+
+        out.seek(0);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        return out.commit();
+    }
+
+    // Runs on the worker: a copy of delta with the given files indexed again
+    static std::shared_ptr<const TrigramDelta> update(const QString &root, const TrigramDelta &delta,
+                                                      const QStringList &paths) {
+        auto updated = std::make_shared<TrigramDelta>(delta);
+        std::vector<quint64> seen(size_t(1) << 18);
+        std::vector<quint32> keys;
+        for (const QString &relative : paths) {
+            const std::optional<TrigramIndex::FileEntry> entry = scan(root + '/' + relative, seen, keys);
+            if (!entry) {
+                updated->files.remove(relative);
+                continue;
+            }
+            TrigramDelta::File &file = updated->files[relative];
+            file.mtime = entry->mtime;
+            file.size = entry->size;
+            file.flags = entry->flags;
+            file.trigrams = QList<quint32>(keys.cbegin(), keys.cend());
+            std::sort(file.trigrams.begin(), file.trigrams.end());
+        }
+        return updated;
+    }
+
+    // Runs on the worker: files under root whose size or mtime differ from
+    // what the delta, or else the index, recorded for them, and files neither
+    // knows. Only stats; changes made while no watcher was looking show up here
+    static QStringList staleFiles(const QString &root, const TrigramIndex &index, const TrigramDelta &delta,
+                                  QPromise<QStringList> &promise) {
+        ParallelWalk walk(root);
+        const IgnoreRules ignore = IgnoreRules::load(root);
+        walk.ignored = [&ignore](const QString &relative, bool isDir) {
+            return ignore.ignored(relative, isDir);
+        };
+        walk.running = 1;
+        QStringList stale;
+        walk.run([&](const QString &relative) {
+            if (promise.isCanceled()) {
+                walk.cancelled = true;
+                return;
+            }
+            const QFileInfo info(root + '/' + relative);
+            const qint64 mtime = info.lastModified().toMSecsSinceEpoch();
+            const auto changed = delta.files.constFind(relative);
+            if (changed != delta.files.cend()) {
+                if (changed->size == info.size() && changed->mtime == mtime)
+                    return;
+            } else if (const int id = index.fileId(relative); id >= 0) {
+                if (index.entry(id).size == info.size() && index.entry(id).mtime == mtime)
+                    return;
+            }
+            stale.append(relative);
+        });
+        return stale;
+    }
+
+    // Runs on the worker: writes base with delta folded in over the index
+    // file. Files the delta has are dropped from base and its posting lists
+    // renumbered; the delta's files follow as a second part
+    static bool merge(const QString &root, const TrigramIndex &base, const TrigramDelta &delta) {
+        TrigramIndexBuild build;
+        build.walk.root = root;
+        Part kept;
+        QList<qint64> renumbered(base.fileCount(), -1);
+        for (quint32 id = 0; id < base.fileCount(); ++id) {
+            const QString path = base.path(id);
+            if (delta.files.contains(path))
+                continue;
+            renumbered[id] = kept.files.size();
+            kept.paths.append(path);
+            kept.files.append(base.entry(id));
+        }
+        base.forEachTrigram([&](quint32 k, const QList<quint32> &ids) {
+            for (quint32 id : ids) {
+                if (renumbered[id] >= 0)
+                    addPosting(kept, k, quint32(renumbered[id]));
+            }
+        });
+
+        Part changed;
+        for (auto it = delta.files.cbegin(); it != delta.files.cend(); ++it) {
+            const quint32 id = quint32(changed.files.size());
+            for (quint32 k : it->trigrams)
+                addPosting(changed, k, id);
+            TrigramIndex::FileEntry entry{};
+            entry.mtime = it->mtime;
+            entry.size = it->size;
+            entry.flags = it->flags;
+            changed.paths.append(it.key());
+            changed.files.append(entry);
+        }
+
+        build.parts.append(std::move(kept));
+        build.parts.append(std::move(changed));
+        return build.write();
+    }
+};
+
+// Find in files panel; hits are grouped under their file as batches arrive
+class SearchPanel : public QWidget {
+    Q_OBJECT
+public:
+    SearchPanel(QWidget *parent = nullptr) : QWidget(parent) {
+        QVBoxLayout *layout = new QVBoxLayout(this);
+        layout->setContentsMargins(4, 4, 4, 4);
+
+        QHBoxLayout *inputLayout = new QHBoxLayout();
+        input = new QLineEdit(this);
+        input->setPlaceholderText("Search in files...");
+        caseBox = new QCheckBox("Match case", this);
+        regexBox = new QCheckBox("Regex", this);
+        indexBox = new QCheckBox("Index", this);
+        indexBox->setToolTip("Keep a trigram index of the project to skip files that cannot match");
+        indexBox->setChecked(QSettings("MyDevApp", "Search").value("useTrigramIndex", false).toBool());
+        searchButton = new QPushButton("Search", this);
+        inputLayout->addWidget(input);
+        inputLayout->addWidget(caseBox);
+        inputLayout->addWidget(regexBox);
+        inputLayout->addWidget(indexBox);
+        inputLayout->addWidget(searchButton);
+
+        results = new QTreeWidget(this);
+        results->setHeaderHidden(true);
+        results->setUniformRowHeights(true);
+        results->setStyleSheet("QTreeWidget { background-color: #1E1E1E; color: #D4D4D4; border: none; }");
+        statusLabel = new QLabel(this);
+
+        layout->addLayout(inputLayout);
+        layout->addWidget(results);
+        layout->addWidget(statusLabel);
+
+        drainTimer.setInterval(DrainIntervalMs);
+        connect(&drainTimer, &QTimer::timeout, this, &SearchPanel::drainHits);
+        connect(&deltaWatcher, &QFutureWatcher<std::shared_ptr<const TrigramDelta>>::finished,
+                this, &SearchPanel::finishDeltaUpdate);
+        connect(&mergeWatcher, &QFutureWatcher<bool>::finished, this, &SearchPanel::finishMerge);
+        connect(&staleWatcher, &QFutureWatcher<QStringList>::finished, this, &SearchPanel::finishStaleCheck);
+        connect(input, &QLineEdit::returnPressed, this, &SearchPanel::startSearch);
+        connect(indexBox, &QCheckBox::toggled, this, [this](bool checked) {
+            QSettings("MyDevApp", "Search").setValue("useTrigramIndex", checked);
+            if (checked) {
+                loadIndex();
+            } else {
+                dropIndex();
+            }
+        });
+        connect(searchButton, &QPushButton::clicked, this, [this]() {
+            if (search) {
+                cancelSearch();
+            } else {
+                startSearch();
+            }
+        });
+        connect(results, &QTreeWidget::itemActivated, this, [this](QTreeWidgetItem *item) {
+            if (item->parent()) {
+                emit openLocation(root + '/' + item->parent()->data(0, Qt::UserRole).toString(),
+                                  item->data(0, Qt::UserRole).toInt());
+            }
+        });
+    }
+
+    ~SearchPanel() {
+        receiver->detach();
+        if (search)
+            search->cancel();
+        dropIndex();
+    }
+
+    void setRootPath(const QString &path) {
+        cancelSearch();
+        dropIndex();
+        root = QFileInfo(path).absoluteFilePath();
+        ignore = IgnoreRules::load(root);
+        if (indexBox->isChecked())
+            loadIndex();
+    }
+
+    void focusInput() {
+        input->setFocus();
+        input->selectAll();
+    }
+
+    // Watcher events for directories the project tree has listed. Files
+    // created or written go into the delta right away; a new directory, or
+    // one that has to be rescanned, is left to a stale check
+    void applyChanges(const QString &dir, const DirChanges &changes) {
+        if (!trigramIndex || (dir != root && !dir.startsWith(root + '/')))
+            return;
+        if (changes.rescan) {
+            checkStale();
+            return;
+        }
+
+        const QString relativeDir = dir.mid(root.size() + 1);
+        QStringList paths;
+        bool newDirs = false;
+        const auto add = [&](const QString &name, bool isDir) {
+            const QString relative = relativeDir.isEmpty() ? name : relativeDir + '/' + name;
+            if (ignore.ignoredPath(relative, isDir))
+                return;
+            if (isDir)
+                newDirs = true;
+            else
+                paths.append(relative);
+        };
+        for (const DirEntry &entry : changes.added)
+            add(entry.name, entry.isDir);
+        for (const auto &[from, to] : changes.renamed)
+            add(to, QFileInfo(dir + '/' + to).isDir());
+        for (const QString &name : changes.modified)
+            add(name, false);
+        if (!paths.isEmpty())
+            indexChanged(paths);
+        if (newDirs)
+            checkStale();
+    }
+
+signals:
+    void openLocation(const QString &filePath, int line);
+
+private:
+    static constexpr int DrainIntervalMs = 50;
+    static constexpr qint64 MaxDeltaFiles = 100;
+    static constexpr qint64 StaleCheckIntervalMs = 60000;
+
+    void startSearch() {
+        cancelSearch();
+        results->clear();
+        fileItems.clear();
+        if (input->text().isEmpty())
+            return;
+
+        const int serial = ++searchSerial;
+        search = TextSearch::start(root, input->text(), caseBox->isChecked(), regexBox->isChecked(),
+                                   trigramIndex, trigramDelta, pendingChanged + updatingPaths, receiver,
+                                   [this, serial]() {
+            if (serial == searchSerial)
+                finishSearch();
+        });
+        if (regexBox->isChecked() && !search->regex.isValid()) {
+            cancelSearch();
+            statusLabel->setText("Invalid regular expression: " + search->regex.errorString());
+            return;
+        }
+        searchButton->setText("Cancel");
+        statusLabel->setText("Searching...");
+        drainTimer.start();
+    }
+
+    void cancelSearch() {
+        if (!search)
+            return;
+        search->cancel();
+        drainHits();
+        finishSearch();
+    }
+
+    void drainHits() {
+        if (!search)
+            return;
+        const QList<SearchHit> hits = search->takeHits();
+        if (hits.isEmpty())
+            return;
+
+        results->setUpdatesEnabled(false);
+        for (const SearchHit &hit : hits) {
+            QTreeWidgetItem *&fileItem = fileItems[hit.path];
+            if (!fileItem) {
+                fileItem = new QTreeWidgetItem(results, QStringList(hit.path));
+                fileItem->setData(0, Qt::UserRole, hit.path);
+                fileItem->setExpanded(true);
+            }
+            QTreeWidgetItem *item = new QTreeWidgetItem(fileItem, QStringList(
+                QString("%1: %2").arg(hit.line).arg(hit.text.trimmed())));
+            item->setData(0, Qt::UserRole, hit.line);
+        }
+        results->setUpdatesEnabled(true);
+        statusLabel->setText(QString("%1 hits in %2 files so far...").arg(search->hitCount.load()).arg(fileItems.size()));
+    }
+
+    void finishSearch() {
+        if (!search)
+            return;
+        drainHits();
+        drainTimer.stop();
+        searchButton->setText("Search");
+
+        const qint64 msecs = qMax<qint64>(1, search->timer.elapsed());
+        const double megabytes = search->bytesSearched / (1024.0 * 1024.0);
+        statusLabel->setText(QString("%1 hits in %2 files%3; searched %4 files, %5 MB in %6 ms (%7 MB/s)%8")
+                             .arg(search->hitCount.load())
+                             .arg(fileItems.size())
+                             .arg(search->truncated ? " (truncated)" : "")
+                             .arg(search->filesSearched.load())
+                             .arg(megabytes, 0, 'f', 1)
+                             .arg(msecs)
+                             .arg(megabytes * 1000.0 / msecs, 0, 'f', 1)
+                             .arg(search->walk.cancelled && !search->truncated ? ", cancelled" : ""));
+        if (search->narrowed) {
+            statusLabel->setText(statusLabel->text() + QString("; index skipped %1 files, %2 changed since indexing")
+                                 .arg(search->filesSkipped.load())
+                                 .arg(search->changedFiles.load()));
+            const QStringList changed = search->takeChangedPaths();
+            if (!changed.isEmpty())
+                indexChanged(changed);
+            // The watcher only sees directories the tree has listed
+            if (staleChecked.isValid() && staleChecked.elapsed() > StaleCheckIntervalMs)
+                checkStale();
+        }
+        search.reset();
+    }
+
+    void loadIndex() {
+        openIndex([this](std::shared_ptr<const TrigramIndex> index) {
+            trigramIndex = std::move(index);
+            if (trigramIndex)
+                checkStale();
+            else
+                rebuildIndex();
+        });
+    }
+
+    // Maps, validates and hashes the index file on a worker, then hands it to
+    // done here unless the index was dropped meanwhile. Delta updates and
+    // merges wait for it, so whatever done swaps in starts from a known delta
+    template <typename Done>
+    void openIndex(Done done) {
+        indexOpening = true;
+        const int serial = indexSerial;
+        runInPool<void>([this, dir = root, serial, done, receiver = receiver](QPromise<void> &) {
+            std::shared_ptr<const TrigramIndex> index = TrigramIndex::open(dir);
+            receiver->post([this, serial, done, index]() {
+                if (serial != indexSerial)
+                    return;
+                indexOpening = false;
+                done(index);
+            });
+        });
+    }
+
+    void rebuildIndex() {
+        if (indexBuild)
+            return;
+        const int serial = ++indexSerial;
+        indexBuild = TrigramIndexBuild::start(root, receiver, [this, serial](bool ok, qint64 msecs) {
+            if (serial != indexSerial)
+                return;
+            indexBuild.reset();
+            const auto built = [this, msecs](bool written, std::shared_ptr<const TrigramIndex> index) {
+                if (written)
+                    trigramIndex = std::move(index);
+                trigramDelta = std::make_shared<TrigramDelta>();
+                pendingChanged.clear();
+                checkStale();  // For what changed behind the walk
+                if (!search) {
+                    statusLabel->setText(trigramIndex
+                        ? QString("Indexed %1 files in %2 ms (%3 MB index)")
+                              .arg(trigramIndex->fileCount())
+                              .arg(msecs)
+                              .arg(trigramIndex->sizeOnDisk() / (1024.0 * 1024.0), 0, 'f', 1)
+                        : QString("Could not build the search index"));
+                }
+            };
+            if (ok) {
+                openIndex([built](std::shared_ptr<const TrigramIndex> index) {
+                    built(true, std::move(index));
+                });
+            } else {
+                built(false, nullptr);
+            }
+        });
+    }
+
+    // Changed files a search found go into the delta on a worker; when most
+    // of the tree has changed a full rebuild is cheaper
+    void indexChanged(const QStringList &paths) {
+        if (!trigramIndex)
+            return;
+        if (paths.size() > qMax<qint64>(MaxDeltaFiles, trigramIndex->fileCount() / 4)) {
+            rebuildIndex();
+            return;
+        }
+        pendingChanged += paths;
+        pendingChanged.removeDuplicates();
+        updateIndex();
+    }
+
+    // Stats the tree against the index on a worker, one check at a time
+    void checkStale() {
+        if (!trigramIndex || indexBuild)
+            return;
+        if (staleWatcher.isRunning()) {
+            staleRequested = true;
+            return;
+        }
+        staleChecked.start();
+        const QString dir = root;
+        const std::shared_ptr<const TrigramIndex> index = trigramIndex;
+        const std::shared_ptr<const TrigramDelta> delta = trigramDelta;
+        staleWatcher.setFuture(runInPool<QStringList>([dir, index, delta](QPromise<QStringList> &promise) {
+            promise.addResult(TrigramIndexBuild::staleFiles(dir, *index, *delta, promise));
+        }));
+    }
+
+    void finishStaleCheck() {
+        const QFuture<QStringList> future = staleWatcher.future();
+        if (!future.isCanceled() && future.resultCount() > 0 && !future.result().isEmpty())
+            indexChanged(future.result());
+        if (std::exchange(staleRequested, false))
+            checkStale();
+    }
+
+    // Starts a delta update when files are waiting for one, or else folds the
+    // delta into the index file once it holds more than MaxDeltaFiles or 1% of
+    // the indexed files. One job runs at a time, and none during a rebuild
+    void updateIndex() {
+        if (!trigramIndex || indexBuild || indexOpening || deltaWatcher.isRunning() || mergeWatcher.isRunning())
+            return;
+        const QString dir = root;
+        const std::shared_ptr<const TrigramDelta> delta = trigramDelta;
+        if (!pendingChanged.isEmpty()) {
+            const QStringList paths = std::exchange(pendingChanged, QStringList());
+            updatingPaths = paths;
+            deltaWatcher.setFuture(runInPool<std::shared_ptr<const TrigramDelta>>(
+                [dir, delta, paths](QPromise<std::shared_ptr<const TrigramDelta>> &promise) {
+                    promise.addResult(TrigramIndexBuild::update(dir, *delta, paths));
+                }));
+        } else if (delta->files.size() > qMax<qint64>(MaxDeltaFiles, trigramIndex->fileCount() / 100)) {
+            const std::shared_ptr<const TrigramIndex> index = trigramIndex;
+            mergeWatcher.setFuture(runInPool<bool>([dir, index, delta](QPromise<bool> &promise) {
+                promise.addResult(TrigramIndexBuild::merge(dir, *index, *delta));
+            }));
+        }
+    }
+
+    void finishDeltaUpdate() {
+        const QFuture<std::shared_ptr<const TrigramDelta>> future = deltaWatcher.future();
+        if (!future.isCanceled() && future.resultCount() > 0)
+            trigramDelta = future.result();
+        updatingPaths.clear();
+        updateIndex();
+    }
+
+    // The delta cannot change while a merge runs or the merged file is opened,
+    // so all of it is in the file
+    void finishMerge() {
+        const QFuture<bool> future = mergeWatcher.future();
+        if (!future.isCanceled() && future.resultCount() > 0 && future.result()) {
+            openIndex([this](std::shared_ptr<const TrigramIndex> merged) {
+                if (!merged) {
+                    rebuildIndex();
+                    return;
+                }
+                trigramIndex = std::move(merged);
+                trigramDelta = std::make_shared<TrigramDelta>();
+                updateIndex();
+            });
+            return;
+        }
+        updateIndex();
+    }
+
+    void dropIndex() {
+        ++indexSerial;
+        if (indexBuild) {
+            QMutexLocker locker(&indexBuild->walk.mutex);
+            indexBuild->walk.cancelled = true;
+            indexBuild->walk.wake.wakeAll();
+        }
+        indexBuild.reset();
+        deltaWatcher.cancel();
+        mergeWatcher.cancel();
+        staleWatcher.cancel();
+        indexOpening = false;
+        staleRequested = false;
+        staleChecked.invalidate();
+        pendingChanged.clear();
+        updatingPaths.clear();
+        trigramDelta = std::make_shared<TrigramDelta>();
+        trigramIndex.reset();
+    }
+
+    QLineEdit *input;
+    QCheckBox *caseBox;
+    QCheckBox *regexBox;
+    QCheckBox *indexBox;
+    QPushButton *searchButton;
+    QTreeWidget *results;
+    QLabel *statusLabel;
+    QTimer drainTimer;
+    QHash<QString, QTreeWidgetItem *> fileItems;
+    std::shared_ptr<TextSearch> search;
+    std::shared_ptr<ResultReceiver> receiver = std::make_shared<ResultReceiver>(this);
+    int searchSerial = 0;
+    std::shared_ptr<const TrigramIndex> trigramIndex;
+    std::shared_ptr<const TrigramDelta> trigramDelta = std::make_shared<TrigramDelta>();
+    QStringList pendingChanged;
+    QStringList updatingPaths;  // Being indexed into the next delta
+    QFutureWatcher<std::shared_ptr<const TrigramDelta>> deltaWatcher;
+    QFutureWatcher<bool> mergeWatcher;
+    QFutureWatcher<QStringList> staleWatcher;
+    bool staleRequested = false;
+    QElapsedTimer staleChecked;
+    IgnoreRules ignore;
+    std::shared_ptr<TrigramIndexBuild> indexBuild;
+    bool indexOpening = false;
+    int indexSerial = 0;
+    QString root;
+};
+
+// One compiler diagnostic as printed by GCC or Clang
+struct BuildDiagnostic {
+    enum Severity : quint8 {
+        Error,
+        Warning,
+        Note
+    };
+
+    QString file;
+    int line = 0;
+    int column = 0;
+    Severity severity = Error;
+    QString message;
+};
+
+// Splits build output into lines and picks out `file:line[:col]: severity:
+// message` diagnostics. Each chunk is scanned in place with memchr; only a
+// line split across chunks is copied, so the cost is one pass over the bytes
+class DiagnosticScanner {
+public:
+    static constexpr qsizetype MaxLineBytes = 64 * 1024;
+
+    template <typename Sink>
+    void feed(QByteArrayView chunk, Sink &&sink) {
+        const char *p = chunk.data();
+        const char *end = p + chunk.size();
+        if (!partial.isEmpty()) {
+            const char *newline = static_cast<const char *>(memchr(p, '\n', size_t(end - p)));
+            if (!newline) {
+                appendPartial(p, end);
+                return;
+            }
+            appendPartial(p, newline);
+            scanLine(partial, sink);
+            partial.clear();
+            p = newline + 1;
+        }
+        while (p < end) {
+            const char *newline = static_cast<const char *>(memchr(p, '\n', size_t(end - p)));
+            if (!newline) {
+                appendPartial(p, end);
+                break;
+            }
+            scanLine(QByteArrayView(p, newline - p), sink);
+            p = newline + 1;
+        }
+    }
+
+    template <typename Sink>
+    void finish(Sink &&sink) {
+        if (!partial.isEmpty()) {
+            scanLine(partial, sink);
+            partial.clear();
+        }
+    }
+
+    qint64 lineCount() const {
+        return lines;
+    }
+
+    void reset() {
+        partial.clear();
+        lines = 0;
+    }
+
+    static bool parse(QByteArrayView line, BuildDiagnostic &diagnostic) {
+        if (line.endsWith('\r')) {
+            line.chop(1);
+        }
+        // Coloured output is rare here; strip SGR sequences on a copy
+        QByteArray plain;
+        if (line.contains('\033')) {
+            static const QRegularExpression sgr("\033\\[[0-9;]*[mK]");
+            plain = QString::fromUtf8(line).remove(sgr).toUtf8();
+            line = plain;
+        }
+
+        // Skip a drive letter so C:\path:12:3 parses too
+        qsizetype from = line.size() > 2 && line[1] == ':' && (line[2] == '\\' || line[2] == '/') ? 2 : 0;
+        for (;;) {
+            const qsizetype colon = line.indexOf(':', from);
+            if (colon <= 0) {
+                return false;
+            }
+            qsizetype i = colon + 1;
+            const int lineNumber = parseNumber(line, i);
+            if (lineNumber <= 0) {
+                from = colon + 1;
+                continue;
+            }
+            int column = 0;
+            if (i < line.size() && line[i] == ':') {
+                qsizetype afterColumn = i + 1;
+                column = parseNumber(line, afterColumn);
+                if (column > 0) {
+                    i = afterColumn;
+                }
+            }
+            if (!line.sliced(i).startsWith(": ")) {
+                from = colon + 1;
+                continue;
+            }
+            i += 2;
+
+            const QByteArrayView rest = line.sliced(i);
+            qsizetype skip;
+            if (rest.startsWith("error: ")) {
+                diagnostic.severity = BuildDiagnostic::Error;
+                skip = 7;
+            } else if (rest.startsWith("fatal error: ")) {
+                diagnostic.severity = BuildDiagnostic::Error;
+                skip = 13;
+            } else if (rest.startsWith("warning: ")) {
+                diagnostic.severity = BuildDiagnostic::Warning;
+                skip = 9;
+            } else if (rest.startsWith("note: ")) {
+                diagnostic.severity = BuildDiagnostic::Note;
+                skip = 6;
+            } else {
+                return false;
+            }
+            diagnostic.file = QString::fromUtf8(line.first(colon));
+            diagnostic.line = lineNumber;
+            diagnostic.column = column;
+            diagnostic.message = QString::fromUtf8(rest.sliced(skip)).trimmed();
+            return true;
+        }
+    }
+
+private:
+    static int parseNumber(QByteArrayView line, qsizetype &i) {
+        int value = 0;
+        const qsizetype start = i;
+        while (i < line.size() && line[i] >= '0' && line[i] <= '9' && i - start < 9)
+            value = value * 10 + (line[i++] - '0');
+        return i > start ? value : 0;
+    }
+
+    // A single over-long line is truncated rather than buffered without bound
+    void appendPartial(const char *from, const char *to) {
+        partial.append(from, qMin<qsizetype>(to - from, MaxLineBytes - partial.size()));
+    }
+
+    template <typename Sink>
+    void scanLine(QByteArrayView line, Sink &sink) {
+        ++lines;
+        // Cheap reject: every diagnostic has ": " after the location
+        if (line.size() < 8 || !line.contains(": ")) {
+            return;
+        }
+        BuildDiagnostic diagnostic;
+        if (parse(line, diagnostic)) {
+            sink(std::move(diagnostic));
+        }
+    }
+
+    QByteArray partial;
+    qint64 lines = 0;
+};
+
+// Runs the project's build command and reports diagnostics as the output
+// streams in. The command is detected from the files in the project root
+// (Ninja, CMake or Make) unless one was saved for this project. On Unix the
+// shell leads its own process group, so stopping a build also stops the
+// compilers make and ninja started under it. Stopping never waits: the
+// build reports finished() once its shell has exited
+class BuildRunner : public QObject {
+    Q_OBJECT
+public:
+    static constexpr int StopGraceMs = 500;
+
+    struct Stats {
+        int errors = 0;
+        int warnings = 0;
+        int notes = 0;
+        qint64 bytes = 0;
+        qint64 lines = 0;
+        qint64 scanNsecs = 0;
+        qint64 firstErrorMs = -1;
+        qint64 elapsedMs = 0;
+    };
+
+    BuildRunner(QObject *parent = nullptr) : QObject(parent) {
+        process.setProcessChannelMode(QProcess::MergedChannels);
+#ifdef Q_OS_UNIX
+        process.setChildProcessModifier([]() {
+            setsid();
+        });
+#endif
+        connect(&process, &QProcess::readyRead, this, &BuildRunner::readOutput);
+        connect(&process, &QProcess::finished, this, &BuildRunner::processFinished);
+        connect(&process, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+            if (error == QProcess::FailedToStart) {
+                buildStats.elapsedMs = timer.elapsed();
+                emit outputReceived("Failed to start the build: " + process.errorString() + '\n');
+                emit finished(-1);
+            }
+        });
+        killTimer.setSingleShot(true);
+        killTimer.setInterval(StopGraceMs);
+        connect(&killTimer, &QTimer::timeout, this, &BuildRunner::killStopped);
+    }
+
+    // Nothing started by a build outlives the runner. QProcess would wait for
+    // the shell anyway, and report it to a half-destroyed runner
+    ~BuildRunner() {
+        disconnect(&process, nullptr, this, nullptr);
+        if (isRunning()) {
+            stoppedGroup = process.processId();
+        }
+        killStopped();
+        process.waitForFinished(1000);
+    }
+
+    static QString detectCommand(const QString &root) {
+        const QDir dir(root);
+        const QString jobs = QString::number(QThread::idealThreadCount());
+        if (dir.exists("build.ninja")) {
+            return "ninja";
+        }
+        if (dir.exists("CMakeLists.txt")) {
+            if (dir.exists("build/CMakeCache.txt")) {
+                return "cmake --build build --parallel " + jobs;
+            }
+            const QString generator = QStandardPaths::findExecutable("ninja").isEmpty() ? QString() : " -G Ninja";
+            return "cmake -S . -B build" + generator + " && cmake --build build --parallel " + jobs;
+        }
+        return "make -j" + jobs;
+    }
+
+    QString command(const QString &root) const {
+        const QString saved = QSettings("MyDevApp", "Build").value(settingsKey(root)).toString();
+        return saved.isEmpty() ? detectCommand(root) : saved;
+    }
+
+    // An empty command goes back to detection
+    void setCommand(const QString &root, const QString &command) {
+        QSettings settings("MyDevApp", "Build");
+        if (command.isEmpty() || command == detectCommand(root)) {
+            settings.remove(settingsKey(root));
+        } else {
+            settings.setValue(settingsKey(root), command);
+        }
+    }
+
+    bool isRunning() const {
+        return process.state() != QProcess::NotRunning;
+    }
+
+    const Stats &stats() const {
+        return buildStats;
+    }
+
+    // A build still running is stopped first; this one starts once that has
+    // finished
+    void start(const QString &root) {
+        if (isRunning()) {
+            queuedRoot = root;
+            terminate();
+            return;
+        }
+        projectRoot = root;
+        buildStats = Stats();
+        scanner.reset();
+        decoder.resetState();
+        resolvedFiles.clear();
+        timer.start();
+
+        const QString buildCommand = command(root);
+        emit started(buildCommand);
+        process.setWorkingDirectory(root);
+#ifdef Q_OS_WIN
+        process.start("cmd.exe", QStringList() << "/c" << buildCommand);
+#else
+        process.start("/bin/sh", QStringList() << "-c" << buildCommand);
+#endif
+    }
+
+    // Also drops a build queued behind the running one
+    void stop() {
+        queuedRoot.clear();
+        terminate();
+    }
+
+signals:
+    void started(const QString &command);
+    void outputReceived(const QString &text);
+    void diagnosticsFound(const QList<BuildDiagnostic> &diagnostics);
+    void finished(int exitCode);
+
+private slots:
+    void readOutput() {
+        const QByteArray bytes = process.readAll();
+        buildStats.bytes += bytes.size();
+
+        QList<BuildDiagnostic> found;
+        QElapsedTimer scanTimer;
+        scanTimer.start();
+        scanner.feed(bytes, [&found](BuildDiagnostic &&diagnostic) {
+            found.append(std::move(diagnostic));
+        });
+        buildStats.scanNsecs += scanTimer.nsecsElapsed();
+        buildStats.lines = scanner.lineCount();
+
+        emit outputReceived(decoder.decode(bytes));
+        report(found);
+    }
+
+    void processFinished(int exitCode) {
+        readOutput();
+        QList<BuildDiagnostic> found;
+        scanner.finish([&found](BuildDiagnostic &&diagnostic) {
+            found.append(std::move(diagnostic));
+        });
+        report(found);
+        buildStats.elapsedMs = timer.elapsed();
+        emit finished(process.exitStatus() == QProcess::NormalExit ? exitCode : -1);
+        if (!queuedRoot.isEmpty()) {
+            start(std::exchange(queuedRoot, QString()));
+        }
+    }
+
+    // SIGKILL to whatever is left of the stopped build's group, and to its
+    // shell if that is still the process running
+    void killStopped() {
+        killTimer.stop();
+#ifdef Q_OS_UNIX
+        if (stoppedGroup > 0) {
+            kill(-pid_t(stoppedGroup), SIGKILL);
+        }
+#endif
+        if (isRunning() && process.processId() == stoppedGroup) {
+            process.kill();
+        }
+        stoppedGroup = -1;
+    }
+
+private:
+    // SIGTERM to the whole group first so compilers can remove their
+    // half-written outputs; killStopped() follows after StopGraceMs. The
+    // group is remembered because the shell may exit before the compilers
+    void terminate() {
+        if (!isRunning() || process.processId() == stoppedGroup) {
+            return;
+        }
+        if (killTimer.isActive()) {
+            killStopped();  // The previous build's grace period is cut short
+        }
+        stoppedGroup = process.processId();
+#ifdef Q_OS_UNIX
+        if (stoppedGroup > 0) {
+            kill(-pid_t(stoppedGroup), SIGTERM);
+            killTimer.start();
+            return;
+        }
+#endif
+        process.kill();
+    }
+
+    static QString settingsKey(const QString &root) {
+        return "commands/" + QCryptographicHash::hash(QFileInfo(root).absoluteFilePath().toUtf8(),
+                                                      QCryptographicHash::Sha1).toHex();
+    }
+
+    // Relative paths are relative to whichever directory the compiler ran in:
+    // the project root for Make, the build directory for CMake builds
+    QString resolve(const QString &file) {
+        if (QDir::isAbsolutePath(file)) {
+            return QDir::cleanPath(file);
+        }
+        QString &resolved = resolvedFiles[file];
+        if (resolved.isEmpty()) {
+            resolved = QDir::cleanPath(projectRoot + '/' + file);
+            const QString inBuild = QDir::cleanPath(projectRoot + "/build/" + file);
+            if (!QFileInfo::exists(resolved) && QFileInfo::exists(inBuild)) {
+                resolved = inBuild;
+            }
+        }
+        return resolved;
+    }
+
+    void report(QList<BuildDiagnostic> &found) {
+        if (found.isEmpty()) {
+            return;
+        }
+        for (BuildDiagnostic &diagnostic : found) {
+            diagnostic.file = resolve(diagnostic.file);
+            switch (diagnostic.severity) {
+            case BuildDiagnostic::Error:
+                if (buildStats.errors++ == 0) {
+                    buildStats.firstErrorMs = timer.elapsed();
+                }
+                break;
+            case BuildDiagnostic::Warning:
+                ++buildStats.warnings;
+                break;
+            case BuildDiagnostic::Note:
+                ++buildStats.notes;
+                break;
+            }
+        }
+        emit diagnosticsFound(found);
+    }
+
+    QProcess process;
+    QTimer killTimer;
+    qint64 stoppedGroup = -1;  // Process group sent SIGTERM, until killStopped()
+    QString queuedRoot;        // Started when the build being stopped has finished
+    DiagnosticScanner scanner;
+    QStringDecoder decoder{QStringDecoder::System};
+    QHash<QString, QString> resolvedFiles;
+    QString projectRoot;
+    QElapsedTimer timer;
+    Stats buildStats;
+};
+
+// Problems dock: diagnostics from the running build, filled in as they are
+// parsed, with the raw build output on a second tab. Notes hang under the
+// error or warning they belong to
+class ProblemsPanel : public QWidget {
+    Q_OBJECT
+public:
+    ProblemsPanel(QWidget *parent = nullptr) : QWidget(parent) {
+        QVBoxLayout *layout = new QVBoxLayout(this);
+        layout->setContentsMargins(4, 4, 4, 4);
+
+        QHBoxLayout *topLayout = new QHBoxLayout();
+        statusLabel = new QLabel("No build run yet", this);
+        buildButton = new QPushButton("Build", this);
+        QPushButton *configureButton = new QPushButton("Configure...", this);
+        topLayout->addWidget(statusLabel, 1);
+        topLayout->addWidget(configureButton);
+        topLayout->addWidget(buildButton);
+
+        tabs = new QTabWidget(this);
+        tabs->setDocumentMode(true);
+        problems = new QTreeWidget(this);
+        problems->setHeaderHidden(true);
+        problems->setUniformRowHeights(true);
+        problems->setStyleSheet("QTreeWidget { background-color: #1E1E1E; color: #D4D4D4; border: none; }");
+        output = new QPlainTextEdit(this);
+        output->setReadOnly(true);
+        output->setUndoRedoEnabled(false);
+        output->setMaximumBlockCount(MaxOutputLines);
+        output->setStyleSheet("QPlainTextEdit { background-color: #1E1E1E; color: #D4D4D4; border: none; }");
+        tabs->addTab(problems, "Problems");
+        tabs->addTab(output, "Output");
+
+        layout->addLayout(topLayout);
+        layout->addWidget(tabs);
+
+        connect(buildButton, &QPushButton::clicked, this, [this]() {
+            if (runner.isRunning()) {
+                stopBuild();
+            } else {
+                startBuild();
+            }
+        });
+        connect(configureButton, &QPushButton::clicked, this, &ProblemsPanel::configure);
+        connect(problems, &QTreeWidget::itemActivated, this, [this](QTreeWidgetItem *item) {
+            const QString file = item->data(0, FileRole).toString();
+            if (!file.isEmpty()) {
+                emit openLocation(file, item->data(0, LineRole).toInt());
+            }
+        });
+        // A restart only gets here once the previous build has finished
+        connect(&runner, &BuildRunner::started, this, [this](const QString &command) {
+            problems->clear();
+            lastProblem = nullptr;
+            output->clear();
+            buildButton->setText("Stop");
+            statusLabel->setText("Building...");
+            output->appendPlainText("$ " + command);
+        });
+        connect(&runner, &BuildRunner::outputReceived, this, [this](const QString &text) {
+            QTextCursor cursor(output->document());
+            cursor.movePosition(QTextCursor::End);
+            cursor.insertText(text);
+        });
+        connect(&runner, &BuildRunner::diagnosticsFound, this, &ProblemsPanel::addDiagnostics);
+        connect(&runner, &BuildRunner::finished, this, &ProblemsPanel::finishBuild);
+    }
+
+    void setRootPath(const QString &path) {
+        root = QFileInfo(path).absoluteFilePath();
+    }
+
+    void startBuild() {
+        runner.start(root);
+    }
+
+    void stopBuild() {
+        if (runner.isRunning()) {
+            statusLabel->setText("Stopping...");
+            runner.stop();
+        }
+    }
+
+    void configure() {
+        bool ok;
+        const QString command = QInputDialog::getText(this, "Build Command",
+                                                      "Command run in " + root + "\n(leave empty to detect):",
+                                                      QLineEdit::Normal, runner.command(root), &ok);
+        if (ok) {
+            runner.setCommand(root, command.trimmed());
+        }
+    }
+
+    QString statistics() const {
+        const BuildRunner::Stats &stats = runner.stats();
+        return QString("command: %1\nerrors: %2, warnings: %3, notes: %4\n"
+                       "output: %5 KB, %6 lines, scanned in %7 ms\nfirst error after: %8\nbuild time: %9 ms")
+            .arg(runner.command(root))
+            .arg(stats.errors)
+            .arg(stats.warnings)
+            .arg(stats.notes)
+            .arg(stats.bytes / 1024)
+            .arg(stats.lines)
+            .arg(stats.scanNsecs / 1e6, 0, 'f', 2)
+            .arg(stats.firstErrorMs >= 0 ? QString::number(stats.firstErrorMs) + " ms" : QString("-"))
+            .arg(stats.elapsedMs);
+    }
+
+signals:
+    void openLocation(const QString &filePath, int line);
+    void buildFinished(const QString &summary);
+
+private:
+    static constexpr int MaxOutputLines = 20000;
+    static constexpr int FileRole = Qt::UserRole;
+    static constexpr int LineRole = Qt::UserRole + 1;
+
+    void addDiagnostics(const QList<BuildDiagnostic> &diagnostics) {
+        problems->setUpdatesEnabled(false);
+        for (const BuildDiagnostic &diagnostic : diagnostics) {
+            const QString location = diagnostic.column > 0
+                ? QString("%1:%2:%3").arg(QFileInfo(diagnostic.file).fileName()).arg(diagnostic.line).arg(diagnostic.column)
+                : QString("%1:%2").arg(QFileInfo(diagnostic.file).fileName()).arg(diagnostic.line);
+            const QStringList text(location + "  " + diagnostic.message);
+            QTreeWidgetItem *item;
+            if (diagnostic.severity == BuildDiagnostic::Note && lastProblem) {
+                item = new QTreeWidgetItem(lastProblem, text);
+                item->setIcon(0, style()->standardIcon(QStyle::SP_MessageBoxInformation));
+            } else {
+                item = new QTreeWidgetItem(problems, text);
+                item->setIcon(0, style()->standardIcon(diagnostic.severity == BuildDiagnostic::Error
+                                                           ? QStyle::SP_MessageBoxCritical
+                                                           : QStyle::SP_MessageBoxWarning));
+                lastProblem = item;
+            }
+            item->setToolTip(0, diagnostic.file);
+            item->setData(0, FileRole, diagnostic.file);
+            item->setData(0, LineRole, diagnostic.line);
+        }
+        problems->setUpdatesEnabled(true);
+
+        const BuildRunner::Stats &stats = runner.stats();
+        statusLabel->setText(QString("Building... %1 errors, %2 warnings").arg(stats.errors).arg(stats.warnings));
+    }
+
+    void finishBuild(int exitCode) {
+        buildButton->setText("Build");
+        const BuildRunner::Stats &stats = runner.stats();
+        QString text = QString("Build %1 in %2 s: %3 errors, %4 warnings")
+                           .arg(exitCode == 0 ? "succeeded" : "failed")
+                           .arg(stats.elapsedMs / 1000.0, 0, 'f', 1)
+                           .arg(stats.errors)
+                           .arg(stats.warnings);
+        if (stats.firstErrorMs >= 0) {
+            text += QString(" (first error after %1 s)").arg(stats.firstErrorMs / 1000.0, 0, 'f', 1);
+        }
+        statusLabel->setText(text);
+        if (exitCode != 0 && stats.errors == 0) {
+            tabs->setCurrentWidget(output);
+        }
+        emit buildFinished(text);
+    }
+
+    QLabel *statusLabel;
+    QPushButton *buildButton;
+    QTabWidget *tabs;
+    QTreeWidget *problems;
+    QPlainTextEdit *output;
+    QTreeWidgetItem *lastProblem = nullptr;
+    BuildRunner runner;
+    QString root;
+};
+
+// Read-only panel of internal counters. Each section is a callback that is only
+// polled while the panel is visible
+class DebugPanel : public QPlainTextEdit {
+public:
+    DebugPanel(QWidget *parent = nullptr) : QPlainTextEdit(parent) {
+        setReadOnly(true);
+        setFont(QFont("Monospace", 9));
+        setStyleSheet("QPlainTextEdit { background-color: #1E1E1E; color: #D4D4D4; }");
+
+        refreshTimer.setInterval(RefreshMs);
+        connect(&refreshTimer, &QTimer::timeout, this, &DebugPanel::refresh);
+    }
+
+    void addSection(const QString &title, std::function<QString()> report) {
+        sections.append({title, std::move(report)});
+    }
+
+protected:
+    void showEvent(QShowEvent *event) override {
+        QPlainTextEdit::showEvent(event);
+        refresh();
+        refreshTimer.start();
+    }
+
+    void hideEvent(QHideEvent *event) override {
+        refreshTimer.stop();
+        QPlainTextEdit::hideEvent(event);
+    }
+
+private:
+    static constexpr int RefreshMs = 1000;
+
+    void refresh() {
+        QString text;
+        for (const auto &section : std::as_const(sections)) {
+            text += "[" + section.first + "]\n" + section.second() + "\n\n";
+        }
+        setPlainText(text);
+    }
+
+    QList<QPair<QString, std::function<QString()>>> sections;
+    QTimer refreshTimer;
+};
+
+// Bounded ring of raw child output waiting to be displayed. If the view falls
+// more than Capacity bytes behind, the oldest chunks are dropped and counted,
+// so a runaway child cannot grow memory without bound
+class OutputRing {
+public:
+    enum Stream : quint8 {
+        Stdout,
+        Stderr,
+        Local  // The terminal's own messages, already UTF-8
+    };
+
+    struct Chunk {
+        Stream stream = Stdout;
+        QByteArray bytes;
+        qsizetype offset = 0;  // Leading bytes already taken from a queued chunk
+    };
+
+    static constexpr qint64 Capacity = 16 * 1024 * 1024;
+
+    OutputRing() : slots(16) {}
+
+    bool isEmpty() const {
+        return count == 0;
+    }
+
+    qint64 pendingBytes() const {
+        return pending;
+    }
+
+    void push(Stream stream, const QByteArray &bytes) {
+        if (bytes.isEmpty())
+            return;
+        if (count == slots.size()) {
+            // Grow, unrolling the ring so head is back at zero
+            QList<Chunk> grown(slots.size() * 2);
+            for (qsizetype i = 0; i < count; ++i)
+                grown[i] = std::move(slots[(head + i) % slots.size()]);
+            slots = std::move(grown);
+            head = 0;
+        }
+        slots[(head + count) % slots.size()] = {stream, bytes, 0};
+        ++count;
+        pending += bytes.size();
+
+        while (pending > Capacity && count > 1) {
+            const qsizetype left = slots[head].bytes.size() - slots[head].offset;
+            dropped += left;
+            pending -= left;
+            slots[head].bytes.clear();
+            slots[head].offset = 0;
+            head = (head + 1) % slots.size();
+            --count;
+        }
+    }
+
+    // Takes up to maxBytes from the front, merging chunks of the same stream.
+    // A chunk taken in parts only moves its offset, so draining a large one
+    // copies each byte once
+    Chunk take(qsizetype maxBytes) {
+        Chunk out;
+        out.stream = slots[head].stream;
+        while (count > 0 && slots[head].stream == out.stream && out.bytes.size() < maxBytes) {
+            Chunk &front = slots[head];
+            const qsizetype left = front.bytes.size() - front.offset;
+            const qsizetype n = qMin(maxBytes - out.bytes.size(), left);
+            if (n == left) {
+                if (out.bytes.isEmpty() && front.offset == 0)
+                    out.bytes = std::move(front.bytes);
+                else
+                    out.bytes.append(QByteArrayView(front.bytes).sliced(front.offset));
+                front.bytes.clear();
+                front.offset = 0;
+                head = (head + 1) % slots.size();
+                --count;
+            } else {
+                out.bytes.append(QByteArrayView(front.bytes).sliced(front.offset, n));
+                front.offset += n;
+            }
+            pending -= n;
+        }
+        return out;
+    }
+
+    qint64 takeDropped() {
+        return std::exchange(dropped, 0);
+    }
+
+    void clear() {
+        while (count > 0) {
+            slots[head].bytes.clear();
+            slots[head].offset = 0;
+            head = (head + 1) % slots.size();
+            --count;
+        }
+        pending = 0;
+        dropped = 0;
+    }
+
+private:
+    QList<Chunk> slots;
+    qsizetype head = 0;
+    qsizetype count = 0;
+    qint64 pending = 0;
+    qint64 dropped = 0;
+};
+
+// Terminal scrollback as UTF-8 lines packed into 64 KB chunks, with one
+// 12-byte record per line in a ring. Dropping the oldest line advances the
+// ring head and frees a chunk once no live line points into it, so memory
+// stays flat however long the session runs
+class ScrollbackStore {
+public:
+    // Lines carry the palette index of their leading colour, or NoColor
+    static constexpr quint8 NoColor = 0xff;
+
+    static constexpr qsizetype ChunkBytes = 64 * 1024;
+    static constexpr qsizetype MaxLineBytes = 1024 * 1024;
+
+    void setLimit(qint64 lines) {
+        limit = qMax<qint64>(1, lines);
+        while (count > limit)
+            dropOldest();
+        if (records.size() > 2 * limit)
+            reallocate(limit);
+    }
+
+    qint64 lineLimit() const {
+        return limit;
+    }
+
+    // Serial of the oldest line still stored; serials grow by one per line
+    qint64 firstLine() const {
+        return totalLines - count;
+    }
+
+    qint64 endLine() const {
+        return totalLines;
+    }
+
+    qint64 bytes() const {
+        qint64 total = records.capacity() * qint64(sizeof(Record));
+        for (const QByteArray &chunk : chunks)
+            total += chunk.capacity();
+        return total;
+    }
+
+    void append(QStringView text, quint8 color = NoColor) {
+        QByteArray utf8 = text.toUtf8();
+        if (utf8.size() > MaxLineBytes)
+            utf8.truncate(MaxLineBytes);
+
+        if (chunks.isEmpty() || chunks.last().size() + utf8.size() > chunks.last().capacity()) {
+            QByteArray chunk;
+            chunk.reserve(qMax(ChunkBytes, utf8.size()));
+            chunks.append(chunk);
+        }
+        QByteArray &chunk = chunks.last();
+        const Record record{quint32(firstChunk + chunks.size() - 1), quint32(chunk.size()),
+                            quint32(utf8.size()) | quint32(color) << 24};
+        chunk.append(utf8);
+
+        if (count == limit)
+            dropOldest();
+        if (count == records.size())
+            reallocate(qMin<qint64>(limit, qMax<qint64>(1024, records.size() * 2)));
+        records[(head + count) % records.size()] = record;
+        ++count;
+        ++totalLines;
+    }
+
+    QString line(qint64 serial, quint8 *color = nullptr) const {
+        const Record &record = records[(head + (serial - firstLine())) % records.size()];
+        if (color)
+            *color = quint8(record.lengthAndColor >> 24);
+        const QByteArray &chunk = chunks[record.chunk - firstChunk];
+        return QString::fromUtf8(chunk.constData() + record.offset, record.lengthAndColor & 0xffffff);
+    }
+
+    // Newest matches first
+    QList<qint64> find(const QString &needle, int maxResults) const {
+        QList<qint64> matches;
+        for (qint64 serial = endLine() - 1; serial >= firstLine() && matches.size() < maxResults; --serial) {
+            if (line(serial).contains(needle, Qt::CaseInsensitive))
+                matches.append(serial);
+        }
+        return matches;
+    }
+
+    void clear() {
+        records.clear();
+        firstChunk += chunks.size();
+        chunks.clear();
+        head = 0;
+        count = 0;
+    }
+
+private:
+    struct Record {
+        quint32 chunk;           // Serial of the chunk holding the line
+        quint32 offset;
+        quint32 lengthAndColor;  // length | color << 24
+    };
+
+    void dropOldest() {
+        head = (head + 1) % records.size();
+        --count;
+        // Free chunks that only held dropped lines
+        const quint32 oldestChunk = count > 0 ? records[head].chunk : quint32(firstChunk + chunks.size() - 1);
+        while (firstChunk < oldestChunk) {
+            chunks.removeFirst();
+            ++firstChunk;
+        }
+    }
+
+    void reallocate(qint64 capacity) {
+        QList<Record> resized(qMax<qint64>(capacity, count));
+        for (qint64 i = 0; i < count; ++i)
+            resized[i] = records[(head + i) % records.size()];
+        records = std::move(resized);
+        head = 0;
+    }
+
+    QList<Record> records;
+    QList<QByteArray> chunks;
+    quint32 firstChunk = 0;
+    qint64 head = 0;
+    qint64 count = 0;
+    qint64 totalLines = 0;
+    qint64 limit = 100000;
+};
+
+// Interactive shell on a pseudo-terminal. The master side is non-blocking;
+// reads come from a QSocketNotifier and writes that would block are queued
+// until the pty drains. Reading can be paused so a flood of output backs up
+// into the kernel instead of into our memory
+class PtySession : public QObject {
+    Q_OBJECT
+public:
+    PtySession(QObject *parent = nullptr) : QObject(parent) {}
+
+    ~PtySession() {
+        stop();
+    }
+
+    bool isRunning() const {
+        return child > 0;
+    }
+
+    qint64 processId() const {
+        return child;
+    }
+
+    // CPU seconds used by the live processes of a session (the shell on a
+    // pty leads its own session) or by a single process, plus the children
+    // its leader has reaped. Read from /proc, so Linux only; -1 elsewhere
+    static double cpuSeconds(qint64 leader) {
+#ifdef Q_OS_LINUX
+        if (leader <= 0) {
+            return -1;
+        }
+        qint64 ticks = 0;
+        QDirIterator it("/proc", QDir::Dirs | QDir::NoDotAndDotDot);
+        while (it.hasNext()) {
+            bool isPid;
+            it.next();
+            const qint64 pid = it.fileName().toLongLong(&isPid);
+            if (!isPid) {
+                continue;
+            }
+            QFile stat(it.filePath() + "/stat");
+            if (!stat.open(QIODevice::ReadOnly)) {
+                continue;
+            }
+            // The command name may contain spaces; fields resume after ')'
+            const QByteArray line = stat.readAll();
+            const QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+            if (fields.size() < 15) {
+                continue;
+            }
+            // fields[3] is the session; utime, stime, cutime, cstime from [11]
+            if (pid == leader || fields[3].toLongLong() == leader) {
+                ticks += fields[11].toLongLong() + fields[12].toLongLong();
+                if (pid == leader) {
+                    ticks += fields[13].toLongLong() + fields[14].toLongLong();
+                }
+            }
+        }
+        return double(ticks) / double(sysconf(_SC_CLK_TCK));
+#else
+        Q_UNUSED(leader);
+        return -1;
+#endif
+    }
+
+    bool start(int columns, int rows, const QString &workingDirectory) {
+#ifdef HAVE_FORKPTY
+        stop();
+
+        // Everything the child needs is prepared before forking; between fork
+        // and exec only async-signal-safe calls are allowed
+        const QByteArray shell = qEnvironmentVariableIsEmpty("SHELL") ? QByteArray("/bin/sh") : qgetenv("SHELL");
+        const QByteArray directory = QFile::encodeName(workingDirectory);
+        QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+        environment.insert("TERM", "xterm-256color");
+        environment.insert("COLORTERM", "truecolor");
+        QByteArrayList variables;
+        for (const QString &variable : environment.toStringList())
+            variables.append(variable.toLocal8Bit());
+        std::vector<char *> envp;
+        for (QByteArray &variable : variables)
+            envp.push_back(variable.data());
+        envp.push_back(nullptr);
+        char *argv[] = {const_cast<char *>(shell.constData()), nullptr};
+
+        struct winsize size = {};
+        size.ws_col = ushort(columns);
+        size.ws_row = ushort(rows);
+        int master = -1;
+        const pid_t pid = forkpty(&master, nullptr, nullptr, &size);
+        if (pid < 0) {
+            return false;
+        }
+        if (pid == 0) {
+            if (!directory.isEmpty() && chdir(directory.constData()) != 0) {
+                // Stay in the inherited directory
+            }
+            execve(shell.constData(), argv, envp.data());
+            _exit(127);
+        }
+
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+        fcntl(master, F_SETFD, FD_CLOEXEC);
+        fd = master;
+        child = pid;
+        readNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        connect(readNotifier, &QSocketNotifier::activated, this, &PtySession::readAvailable);
+        writeNotifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+        writeNotifier->setEnabled(false);
+        connect(writeNotifier, &QSocketNotifier::activated, this, &PtySession::flushWrites);
+        return true;
+#else
+        Q_UNUSED(columns);
+        Q_UNUSED(rows);
+        Q_UNUSED(workingDirectory);
+        return false;
+#endif
+    }
+
+    void write(const QByteArray &bytes) {
+        if (fd < 0) {
+            return;
+        }
+        pendingWrite += bytes;
+        flushWrites();
+    }
+
+    // The kernel delivers SIGWINCH to the foreground job
+    void resize(int columns, int rows) {
+#ifdef HAVE_FORKPTY
+        if (fd >= 0) {
+            struct winsize size = {};
+            size.ws_col = ushort(columns);
+            size.ws_row = ushort(rows);
+            ioctl(fd, TIOCSWINSZ, &size);
+        }
+#else
+        Q_UNUSED(columns);
+        Q_UNUSED(rows);
+#endif
+    }
+
+    void setReadingEnabled(bool enabled) {
+        if (readNotifier) {
+            readNotifier->setEnabled(enabled);
+        }
+    }
+
+    // Returns at once; the shell is reaped later by reapLater()
+    void stop() {
+#ifdef HAVE_FORKPTY
+        if (child > 0) {
+            kill(pid_t(child), SIGHUP);
+        }
+        closeMaster();
+        if (child > 0) {
+            reapLater(pid_t(std::exchange(child, -1)));
+        }
+#endif
+    }
+
+signals:
+    void dataReceived(const QByteArray &bytes);
+    void finished(int exitCode);
+
+private slots:
+    void readAvailable() {
+#ifdef HAVE_FORKPTY
+        char buffer[64 * 1024];
+        // Bounded so one chatty child cannot starve the event loop
+        for (int reads = 0; reads < MaxReadsPerWakeup; ++reads) {
+            const ssize_t n = ::read(fd, buffer, sizeof buffer);
+            if (n > 0) {
+                emit dataReceived(QByteArray(buffer, qsizetype(n)));
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                return;
+            }
+            // EOF, or EIO once the slave side has no more users
+            closeMaster();
+            int status = 0;
+            waitpid(pid_t(std::exchange(child, -1)), &status, 0);
+            emit finished(WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            return;
+        }
+#endif
+    }
+
+    void flushWrites() {
+#ifdef HAVE_FORKPTY
+        while (!pendingWrite.isEmpty()) {
+            const ssize_t n = ::write(fd, pendingWrite.constData(), size_t(pendingWrite.size()));
+            if (n > 0) {
+                pendingWrite.remove(0, qsizetype(n));
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                break;
+            }
+        }
+        writeNotifier->setEnabled(!pendingWrite.isEmpty());
+#endif
+    }
+
+private:
+    static constexpr int MaxReadsPerWakeup = 16;
+    static constexpr int StopGraceMs = 150;
+    static constexpr int ReapPollMs = 10;
+
+#ifdef HAVE_FORKPTY
+    // Gives a shell sent SIGHUP StopGraceMs to act on it, e.g. to save its
+    // history, then kills it outright. The polling timer belongs to no
+    // session and deletes itself once the shell is reaped, so neither the
+    // event loop nor a session being destroyed waits for the shell
+    static void reapLater(pid_t pid) {
+        QTimer *timer = new QTimer();
+        QElapsedTimer grace;
+        grace.start();
+        QObject::connect(timer, &QTimer::timeout, timer, [timer, pid, grace, killed = false]() mutable {
+            if (waitpid(pid, nullptr, WNOHANG) != 0) {
+                timer->deleteLater();  // Reaped, or no longer ours to wait for
+                return;
+            }
+            if (!killed && grace.elapsed() >= StopGraceMs) {
+                kill(pid, SIGKILL);
+                killed = true;
+            }
+        });
+        timer->start(ReapPollMs);
+    }
+#endif
+
+    void closeMaster() {
+        delete readNotifier;
+        readNotifier = nullptr;
+        delete writeNotifier;
+        writeNotifier = nullptr;
+        pendingWrite.clear();
+#ifdef HAVE_FORKPTY
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+        fd = -1;
+    }
+
+    int fd = -1;
+    qint64 child = -1;
+    QSocketNotifier *readNotifier = nullptr;
+    QSocketNotifier *writeNotifier = nullptr;
+    QByteArray pendingWrite;
+};
+
+// Character grid of a VT100/xterm screen. Rows are addressed through a row
+// map so scrolling a region rotates indices instead of moving cells, and each
+// row has a damage bit the view uses to repaint only what changed. Lines that
+// scroll off the top of the main screen are handed to `scrolledOff`. East
+// Asian wide characters and emoji take two cells, the second holding
+// WideTail, and zero-width characters are kept with the cell before them, so
+// the cursor moves the way the application expects
+class TerminalScreen {
+public:
+    enum CellFlags : quint8 {
+        Bold = 1,
+        Italic = 2,
+        Underline = 4,
+        Inverse = 8
+    };
+
+    // Colours: 0 is the default, otherwise kind in the top byte
+    static constexpr quint32 DefaultColor = 0;
+    static constexpr quint32 PaletteColor = 0x01000000;
+    static constexpr quint32 RgbColor = 0x02000000;
+
+    // Second cell of a double-width character
+    static constexpr char32_t WideTail = 0;
+
+    struct Cell {
+        char32_t ch = ' ';
+        char32_t mark = 0;  // First combining character on this cell, if any
+        quint32 fg = DefaultColor;
+        quint32 bg = DefaultColor;
+        quint8 flags = 0;
+    };
+
+    // Columns a character takes, as wcwidth() counts them: 0 for combining
+    // marks and format characters, 2 for East Asian wide and fullwidth
+    // characters and emoji presentation symbols, 1 otherwise
+    static int charWidth(char32_t ch) {
+        if (ch < 0x300)
+            return 1;
+        // Ranges of East Asian Width W and F
+        static constexpr std::pair<char32_t, char32_t> Wide[] = {
+            {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+            {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+            {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+            {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+            {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+            {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+            {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+            {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+            {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+            {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x17000, 0x18CFF}, {0x1AFF0, 0x1B2FF},
+            {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251},
+            {0x1F300, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA},
+            {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440},
+            {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A},
+            {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F}, {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC},
+            {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6D7}, {0x1F6DC, 0x1F6DF}, {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC},
+            {0x1F7E0, 0x1F7EB}, {0x1F7F0, 0x1F7F0}, {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF},
+            {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}};
+        const auto range = std::upper_bound(std::begin(Wide), std::end(Wide), ch,
+                                            [](char32_t c, const std::pair<char32_t, char32_t> &r) { return c < r.first; });
+        if (range != std::begin(Wide) && ch <= std::prev(range)->second)
+            return 2;
+        if ((ch >= 0x1160 && ch <= 0x11FF) || ch == 0x200B)
+            return 0;
+        switch (QChar::category(ch)) {
+        case QChar::Mark_NonSpacing:
+        case QChar::Mark_Enclosing:
+        case QChar::Other_Format:
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    std::function<void(const QString &text, quint8 color)> scrolledOff;
+
+    TerminalScreen(int columns = 80, int rows = 24) {
+        resize(columns, rows);
+    }
+
+    int columns() const {
+        return cols;
+    }
+
+    int rows() const {
+        return rowCount;
+    }
+
+    int cursorX() const {
+        return cx;
+    }
+
+    int cursorY() const {
+        return cy;
+    }
+
+    bool cursorVisible() const {
+        return cursorShown;
+    }
+
+    bool applicationCursorKeys() const {
+        return appCursorKeys;
+    }
+
+    bool bracketedPaste() const {
+        return pasteBrackets;
+    }
+
+    const QString &title() const {
+        return windowTitle;
+    }
+
+    const Cell *row(int y) const {
+        const Buffer &buffer = buffers[active];
+        return buffer.cells.constData() + qsizetype(buffer.rowMap[y]) * cols;
+    }
+
+    QString rowText(int y) const {
+        const Cell *cells = row(y);
+        int length = cols;
+        while (length > 0 && cells[length - 1].ch == ' ')
+            --length;
+        QVarLengthArray<char32_t, 256> text;
+        for (int x = 0; x < length; ++x) {
+            if (cells[x].ch == WideTail)
+                continue;
+            text.append(cells[x].ch);
+            if (cells[x].mark)
+                text.append(cells[x].mark);
+        }
+        return QString::fromUcs4(text.constData(), text.size());
+    }
+
+    bool isDirty(int y) const {
+        return damage[y];
+    }
+
+    void clearDamage() {
+        std::fill(damage.begin(), damage.end(), false);
+    }
+
+    // Replies owed to the application (device status, attributes)
+    QByteArray takeResponse() {
+        return std::exchange(response, QByteArray());
+    }
+
+    // LNM: line feed also returns the carriage, for output without a tty
+    void setNewlineMode(bool on) {
+        newlineMode = on;
+    }
+
+    void resize(int columns, int rows) {
+        columns = qMax(2, columns);
+        rows = qMax(2, rows);
+        if (columns == cols && rows == rowCount) {
+            return;
+        }
+        // Keep the cursor row on screen by scrolling the main screen up
+        if (active == 0 && cy >= rows) {
+            scrollUp(0, rowCount - 1, cy - rows + 1, true);
+            cy = rows - 1;
+        }
+        for (Buffer &buffer : buffers) {
+            QList<Cell> cells(qsizetype(columns) * rows);
+            const int keepRows = qMin(rows, rowCount);
+            const int keepColumns = qMin(columns, cols);
+            for (int y = 0; y < keepRows; ++y) {
+                const Cell *from = buffer.cells.constData() + qsizetype(buffer.rowMap[y]) * cols;
+                std::copy(from, from + keepColumns, cells.data() + qsizetype(y) * columns);
+            }
+            buffer.cells = std::move(cells);
+            buffer.rowMap.resize(rows);
+            for (int y = 0; y < rows; ++y)
+                buffer.rowMap[y] = y;
+        }
+        cols = columns;
+        rowCount = rows;
+        scrollTop = 0;
+        scrollBottom = rows - 1;
+        cx = qMin(cx, cols - 1);
+        cy = qMin(cy, rowCount - 1);
+        wrapPending = false;
+        for (SavedCursor &save : saved) {
+            save.x = qMin(save.x, cols - 1);
+            save.y = qMin(save.y, rowCount - 1);
+        }
+        damage.assign(size_t(rows), true);
+    }
+
+    void reset() {
+        for (Buffer &buffer : buffers) {
+            std::fill(buffer.cells.begin(), buffer.cells.end(), Cell());
+            for (int y = 0; y < rowCount; ++y)
+                buffer.rowMap[y] = y;
+        }
+        active = 0;
+        pen = Cell();
+        cx = cy = 0;
+        wrapPending = false;
+        scrollTop = 0;
+        scrollBottom = rowCount - 1;
+        autoWrap = cursorShown = true;
+        originMode = appCursorKeys = pasteBrackets = lineDrawing = false;
+        saved[0] = saved[1] = SavedCursor();
+        std::fill(damage.begin(), damage.end(), true);
+    }
+
+    // Parser interface
+
+    void printAscii(const char *text, qsizetype length) {
+        if (!autoWrap || lineDrawing) {
+            for (qsizetype i = 0; i < length; ++i)
+                print(uchar(text[i]));
+            return;
+        }
+        while (length > 0) {
+            if (wrapPending) {
+                cx = 0;
+                lineFeed();
+            }
+            const int n = int(qMin<qsizetype>(length, cols - cx));
+            splitWide(cx, cx + n);
+            Cell *cell = cellAt(cx, cy);
+            for (int i = 0; i < n; ++i) {
+                cell[i] = pen;
+                cell[i].ch = uchar(text[i]);
+            }
+            damage[cy] = true;
+            text += n;
+            length -= n;
+            cx += n;
+            if (cx == cols) {
+                cx = cols - 1;
+                wrapPending = true;
+            }
+        }
+    }
+
+    void print(char32_t ch) {
+        if (lineDrawing && ch >= 0x60 && ch <= 0x7e) {
+            ch = DecGraphics[ch - 0x60];
+        }
+        const int width = charWidth(ch);
+        if (width == 0) {
+            combine(ch);
+            return;
+        }
+        if (wrapPending && autoWrap) {
+            cx = 0;
+            lineFeed();
+        }
+        wrapPending = false;
+        // A wide character does not fit in the last column; it wraps first,
+        // or without autowrap overwrites the last two columns
+        if (width == 2 && cx == cols - 1) {
+            if (autoWrap) {
+                eraseCells(cy, cx, cols);
+                cx = 0;
+                lineFeed();
+            } else {
+                --cx;
+            }
+        }
+        splitWide(cx, cx + width);
+        Cell *cell = cellAt(cx, cy);
+        *cell = pen;
+        cell->ch = ch;
+        if (width == 2) {
+            cell[1] = pen;
+            cell[1].ch = WideTail;
+        }
+        damage[cy] = true;
+        if (cx + width >= cols) {
+            cx = cols - 1;
+            wrapPending = true;
+        } else {
+            cx += width;
+        }
+    }
+
+    void execute(uchar code) {
+        switch (code) {
+        case '\b':
+            moveCursor(cx - 1, cy);
+            break;
+        case '\t':
+            moveCursor(qMin(cols - 1, (cx / 8 + 1) * 8), cy);
+            break;
+        case '\n':
+        case '\v':
+        case '\f':
+            lineFeed();
+            if (newlineMode) {
+                moveCursor(0, cy);
+            }
+            break;
+        case '\r':
+            moveCursor(0, cy);
+            break;
+        case 0x0e:  // SO and SI switch between G1 and G0; only G0 is tracked
+        case 0x0f:
+        default:
+            break;
+        }
+    }
+
+    void escDispatch(QByteArrayView intermediates, uchar final) {
+        if (!intermediates.isEmpty()) {
+            if (intermediates[0] == '(') {
+                lineDrawing = final == '0';
+            }
+            return;
+        }
+        switch (final) {
+        case '7':
+            saveCursor();
+            break;
+        case '8':
+            restoreCursor();
+            break;
+        case 'D':
+            lineFeed();
+            break;
+        case 'E':
+            lineFeed();
+            moveCursor(0, cy);
+            break;
+        case 'M':
+            if (cy == scrollTop) {
+                scrollDown(scrollTop, scrollBottom, 1);
+            } else {
+                moveCursor(cx, cy - 1);
+            }
+            break;
+        case 'c':
+            reset();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void csiDispatch(const int *params, int count, QByteArrayView intermediates, uchar final) {
+        const auto param = [params, count](int i, int fallback) {
+            return i < count && params[i] > 0 ? params[i] : fallback;
+        };
+        const char marker = intermediates.isEmpty() ? 0 : intermediates[0];
+        if (marker == '?' && (final == 'h' || final == 'l')) {
+            setPrivateModes(params, count, final == 'h');
+            return;
+        }
+        if (marker) {
+            if (marker == '>' && final == 'c') {
+                response += "\033[>0;0;0c";
+            }
+            return;
+        }
+
+        switch (final) {
+        case '@':
+            insertCells(param(0, 1));
+            break;
+        case 'A':
+            moveCursor(cx, qMax(cy >= scrollTop ? scrollTop : 0, cy - param(0, 1)));
+            break;
+        case 'B':
+        case 'e':
+            moveCursor(cx, qMin(cy <= scrollBottom ? scrollBottom : rowCount - 1, cy + param(0, 1)));
+            break;
+        case 'C':
+        case 'a':
+            moveCursor(cx + param(0, 1), cy);
+            break;
+        case 'D':
+            moveCursor(cx - param(0, 1), cy);
+            break;
+        case 'E':
+            moveCursor(0, cy + param(0, 1));
+            break;
+        case 'F':
+            moveCursor(0, cy - param(0, 1));
+            break;
+        case 'G':
+        case '`':
+            moveCursor(param(0, 1) - 1, cy);
+            break;
+        case 'H':
+        case 'f':
+            moveCursor(param(1, 1) - 1, param(0, 1) - 1 + (originMode ? scrollTop : 0));
+            break;
+        case 'd':
+            moveCursor(cx, param(0, 1) - 1 + (originMode ? scrollTop : 0));
+            break;
+        case 'J':
+            eraseDisplay(count > 0 ? qMax(0, params[0]) : 0);
+            break;
+        case 'K':
+            eraseLine(count > 0 ? qMax(0, params[0]) : 0);
+            break;
+        case 'L':
+            if (cy >= scrollTop && cy <= scrollBottom) {
+                scrollDown(cy, scrollBottom, param(0, 1));
+            }
+            break;
+        case 'M':
+            if (cy >= scrollTop && cy <= scrollBottom) {
+                scrollUp(cy, scrollBottom, param(0, 1), false);
+            }
+            break;
+        case 'P':
+            deleteCells(param(0, 1));
+            break;
+        case 'X':
+            eraseCells(cy, cx, qMin(cols, cx + param(0, 1)));
+            break;
+        case 'S':
+            scrollUp(scrollTop, scrollBottom, param(0, 1), false);
+            break;
+        case 'T':
+            scrollDown(scrollTop, scrollBottom, param(0, 1));
+            break;
+        case 'm':
+            selectGraphicRendition(params, count);
+            break;
+        case 'h':
+        case 'l':
+            for (int i = 0; i < count; ++i) {
+                if (params[i] == 20) {
+                    newlineMode = final == 'h';
+                }
+            }
+            break;
+        case 'n':
+            if (param(0, 0) == 5) {
+                response += "\033[0n";
+            } else if (param(0, 0) == 6) {
+                response += QStringLiteral("\033[%1;%2R").arg(cy + 1).arg(cx + 1).toLatin1();
+            }
+            break;
+        case 'c':
+            response += "\033[?1;2c";
+            break;
+        case 'r': {
+            const int top = param(0, 1) - 1;
+            const int bottom = qMin(param(1, rowCount), rowCount) - 1;
+            if (top < bottom) {
+                scrollTop = top;
+                scrollBottom = bottom;
+                moveCursor(0, originMode ? scrollTop : 0);
+            }
+            break;
+        }
+        case 's':
+            saveCursor();
+            break;
+        case 'u':
+            restoreCursor();
+            break;
+        default:
+            break;
+        }
+    }
+
+    // OSC 0 and 2 set the window title; the rest are ignored
+    void oscDispatch(QByteArrayView data) {
+        if (data.startsWith("0;") || data.startsWith("2;")) {
+            windowTitle = QString::fromUtf8(data.sliced(2));
+        }
+    }
+
+private:
+    struct Buffer {
+        QList<Cell> cells;
+        QList<int> rowMap;
+    };
+
+    struct SavedCursor {
+        int x = 0;
+        int y = 0;
+        Cell pen;
+    };
+
+    // DEC special graphics for 0x60..0x7e, used for line drawing
+    static constexpr char32_t DecGraphics[31] = {
+        U'◆', U'▒', U'␉', U'␌', U'␍', U'␊', U'°', U'±', U'␤', U'␋', U'┘', U'┐', U'┌', U'└', U'┼', U'⎺',
+        U'⎻', U'─', U'⎼', U'⎽', U'├', U'┤', U'┴', U'┬', U'│', U'≤', U'≥', U'π', U'≠', U'£', U'·'};
+
+    Cell *cellAt(int x, int y) {
+        Buffer &buffer = buffers[active];
+        return buffer.cells.data() + qsizetype(buffer.rowMap[y]) * cols + x;
+    }
+
+    // About to overwrite columns from..to of the cursor row: a wide character
+    // cut in half at either edge is blanked whole
+    void splitWide(int from, int to) {
+        Cell *cells = cellAt(0, cy);
+        if (from > 0 && cells[from].ch == WideTail)
+            cells[from - 1] = blank();
+        if (to < cols && cells[to].ch == WideTail)
+            cells[to] = blank();
+    }
+
+    // A zero-width character joins the cell last printed to, or the head of
+    // the wide character there; only the first one on a cell is kept
+    void combine(char32_t ch) {
+        int x = wrapPending ? cx : cx - 1;
+        if (x < 0)
+            return;
+        Cell *cells = cellAt(0, cy);
+        if (cells[x].ch == WideTail && x > 0)
+            --x;
+        if (!cells[x].mark) {
+            cells[x].mark = ch;
+            damage[cy] = true;
+        }
+    }
+
+    // Erased cells take the current background colour, as xterm does
+    Cell blank() const {
+        Cell cell;
+        cell.bg = pen.bg;
+        return cell;
+    }
+
+    void moveCursor(int x, int y) {
+        damage[cy] = true;
+        cx = qBound(0, x, cols - 1);
+        cy = qBound(0, y, rowCount - 1);
+        wrapPending = false;
+        damage[cy] = true;
+    }
+
+    void lineFeed() {
+        if (cy == scrollBottom) {
+            scrollUp(scrollTop, scrollBottom, 1, true);
+            wrapPending = false;
+        } else {
+            moveCursor(cx, cy + 1);
+        }
+    }
+
+    void scrollUp(int top, int bottom, int n, bool keepInScrollback) {
+        n = qMin(n, bottom - top + 1);
+        Buffer &buffer = buffers[active];
+        if (keepInScrollback && active == 0 && top == 0 && scrolledOff) {
+            for (int y = 0; y < n; ++y)
+                scrolledOff(rowText(y), leadingColor(y));
+        }
+        std::rotate(buffer.rowMap.begin() + top, buffer.rowMap.begin() + top + n, buffer.rowMap.begin() + bottom + 1);
+        for (int y = bottom - n + 1; y <= bottom; ++y)
+            eraseCells(y, 0, cols);
+        std::fill(damage.begin() + top, damage.begin() + bottom + 1, true);
+    }
+
+    void scrollDown(int top, int bottom, int n) {
+        n = qMin(n, bottom - top + 1);
+        Buffer &buffer = buffers[active];
+        std::rotate(buffer.rowMap.begin() + top, buffer.rowMap.begin() + bottom + 1 - n, buffer.rowMap.begin() + bottom + 1);
+        for (int y = top; y < top + n; ++y)
+            eraseCells(y, 0, cols);
+        std::fill(damage.begin() + top, damage.begin() + bottom + 1, true);
+    }
+
+    quint8 leadingColor(int y) const {
+        const Cell *cells = row(y);
+        for (int x = 0; x < cols; ++x) {
+            if (cells[x].ch != ' ') {
+                return (cells[x].fg & 0xff000000) == PaletteColor ? quint8(cells[x].fg) : ScrollbackStore::NoColor;
+            }
+        }
+        return ScrollbackStore::NoColor;
+    }
+
+    void eraseCells(int y, int from, int to) {
+        if (from >= to) {
+            return;
+        }
+        Cell *cells = cellAt(0, y);
+        std::fill(cells + from, cells + to, blank());
+        damage[y] = true;
+    }
+
+    void eraseDisplay(int mode) {
+        if (mode == 0) {
+            eraseCells(cy, cx, cols);
+            for (int y = cy + 1; y < rowCount; ++y)
+                eraseCells(y, 0, cols);
+        } else if (mode == 1) {
+            for (int y = 0; y < cy; ++y)
+                eraseCells(y, 0, cols);
+            eraseCells(cy, 0, cx + 1);
+        } else {
+            for (int y = 0; y < rowCount; ++y)
+                eraseCells(y, 0, cols);
+        }
+    }
+
+    void eraseLine(int mode) {
+        if (mode == 0) {
+            eraseCells(cy, cx, cols);
+        } else if (mode == 1) {
+            eraseCells(cy, 0, cx + 1);
+        } else {
+            eraseCells(cy, 0, cols);
+        }
+    }
+
+    void insertCells(int n) {
+        Cell *cells = cellAt(0, cy);
+        n = qMin(n, cols - cx);
+        std::move_backward(cells + cx, cells + cols - n, cells + cols);
+        std::fill(cells + cx, cells + cx + n, blank());
+        damage[cy] = true;
+    }
+
+    void deleteCells(int n) {
+        Cell *cells = cellAt(0, cy);
+        n = qMin(n, cols - cx);
+        std::move(cells + cx + n, cells + cols, cells + cx);
+        std::fill(cells + cols - n, cells + cols, blank());
+        damage[cy] = true;
+    }
+
+    void saveCursor() {
+        saved[active] = {cx, cy, pen};
+    }
+
+    void restoreCursor() {
+        pen = saved[active].pen;
+        moveCursor(saved[active].x, saved[active].y);
+    }
+
+    void switchBuffer(int index, bool clearOnEnter) {
+        if (index == active) {
+            return;
+        }
+        active = index;
+        if (index == 1 && clearOnEnter) {
+            for (int y = 0; y < rowCount; ++y)
+                eraseCells(y, 0, cols);
+        }
+        std::fill(damage.begin(), damage.end(), true);
+    }
+
+    void setPrivateModes(const int *params, int count, bool on) {
+        for (int i = 0; i < count; ++i) {
+            switch (params[i]) {
+            case 1:
+                appCursorKeys = on;
+                break;
+            case 6:
+                originMode = on;
+                moveCursor(0, on ? scrollTop : 0);
+                break;
+            case 7:
+                autoWrap = on;
+                break;
+            case 25:
+                cursorShown = on;
+                damage[cy] = true;
+                break;
+            case 47:
+            case 1047:
+                switchBuffer(on ? 1 : 0, on);
+                break;
+            case 1049:
+                if (on) {
+                    saveCursor();
+                    switchBuffer(1, true);
+                } else {
+                    switchBuffer(0, false);
+                    restoreCursor();
+                }
+                break;
+            case 2004:
+                pasteBrackets = on;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    void selectGraphicRendition(const int *params, int count) {
+        if (count == 0) {
+            pen = Cell();
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            const int p = qMax(0, params[i]);
+            if (p == 0) {
+                pen = Cell();
+            } else if (p == 1) {
+                pen.flags |= Bold;
+            } else if (p == 3) {
+                pen.flags |= Italic;
+            } else if (p == 4) {
+                pen.flags |= Underline;
+            } else if (p == 7) {
+                pen.flags |= Inverse;
+            } else if (p == 22) {
+                pen.flags &= ~Bold;
+            } else if (p == 23) {
+                pen.flags &= ~Italic;
+            } else if (p == 24) {
+                pen.flags &= ~Underline;
+            } else if (p == 27) {
+                pen.flags &= ~Inverse;
+            } else if (p >= 30 && p <= 37) {
+                pen.fg = PaletteColor | quint32(p - 30);
+            } else if (p >= 40 && p <= 47) {
+                pen.bg = PaletteColor | quint32(p - 40);
+            } else if (p >= 90 && p <= 97) {
+                pen.fg = PaletteColor | quint32(p - 90 + 8);
+            } else if (p >= 100 && p <= 107) {
+                pen.bg = PaletteColor | quint32(p - 100 + 8);
+            } else if (p == 39) {
+                pen.fg = DefaultColor;
+            } else if (p == 49) {
+                pen.bg = DefaultColor;
+            } else if ((p == 38 || p == 48) && i + 1 < count) {
+                quint32 color = DefaultColor;
+                if (params[i + 1] == 5 && i + 2 < count) {
+                    color = PaletteColor | quint32(qBound(0, params[i + 2], 255));
+                    i += 2;
+                } else if (params[i + 1] == 2 && i + 4 < count) {
+                    color = RgbColor | quint32(qBound(0, params[i + 2], 255)) << 16
+                            | quint32(qBound(0, params[i + 3], 255)) << 8 | quint32(qBound(0, params[i + 4], 255));
+                    i += 4;
+                } else {
+                    break;
+                }
+                (p == 38 ? pen.fg : pen.bg) = color;
+            }
+        }
+    }
+
+    Buffer buffers[2];
+    int active = 0;
+    int cols = 0;
+    int rowCount = 0;
+    int cx = 0;
+    int cy = 0;
+    bool wrapPending = false;
+    Cell pen;
+    int scrollTop = 0;
+    int scrollBottom = 0;
+    SavedCursor saved[2];
+    bool autoWrap = true;
+    bool originMode = false;
+    bool cursorShown = true;
+    bool appCursorKeys = false;
+    bool pasteBrackets = false;
+    bool newlineMode = false;
+    bool lineDrawing = false;
+    std::vector<bool> damage;
+    QByteArray response;
+    QString windowTitle;
+};
+
+// Table-driven VT500-style escape sequence parser (after Paul Williams'
+// state machine). Each byte is one lookup giving an action and the next
+// state; runs of printable ASCII in the ground state skip the table and go
+// to the screen in one call. UTF-8 is assembled here for Print
+class VtParser {
+public:
+    void feed(QByteArrayView data, TerminalScreen &screen) {
+        const Table &transitions = table();
+        const char *p = data.data();
+        const char *end = p + data.size();
+        while (p < end) {
+            if (state == Ground && utf8Remaining == 0) {
+                const char *run = p;
+                while (p < end && uchar(*p) >= 0x20 && uchar(*p) < 0x7f)
+                    ++p;
+                if (p > run) {
+                    screen.printAscii(run, p - run);
+                    continue;
+                }
+            }
+            const uchar byte = uchar(*p++);
+            const quint8 entry = transitions[state][byte];
+            perform(Action(entry & 0x0f), byte, screen);
+            state = State(entry >> 4);
+        }
+    }
+
+    void reset() {
+        state = Ground;
+        utf8Remaining = 0;
+    }
+
+private:
+    enum State : quint8 {
+        Ground,
+        Escape,
+        EscapeIntermediate,
+        CsiEntry,
+        CsiParam,
+        CsiIntermediate,
+        CsiIgnore,
+        OscString,
+        IgnoreString,
+        StateCount
+    };
+
+    enum Action : quint8 {
+        None,
+        Print,
+        Execute,
+        Clear,
+        Collect,
+        Param,
+        EscDispatch,
+        CsiDispatch,
+        OscPut,
+        OscEnd
+    };
+
+    // Entry is action | next state << 4
+    using Table = std::array<std::array<quint8, 256>, StateCount>;
+
+    static constexpr int MaxParams = 16;
+    static constexpr qsizetype MaxOscBytes = 4096;
+
+    static const Table &table() {
+        static const Table transitions = [] {
+            Table t;
+            const auto set = [&t](State state, int from, int to, Action action, State next) {
+                for (int byte = from; byte <= to; ++byte)
+                    t[state][byte] = quint8(action | next << 4);
+            };
+            for (int s = 0; s < StateCount; ++s) {
+                const State state = State(s);
+                const bool isString = state == OscString || state == IgnoreString;
+                set(state, 0x00, 0xff, None, state);
+                if (!isString) {
+                    set(state, 0x00, 0x17, Execute, state);
+                    set(state, 0x19, 0x19, Execute, state);
+                    set(state, 0x1c, 0x1f, Execute, state);
+                }
+                // CAN and SUB abort a sequence; ESC starts a new one from anywhere
+                set(state, 0x18, 0x18, Execute, Ground);
+                set(state, 0x1a, 0x1a, Execute, Ground);
+                set(state, 0x1b, 0x1b, state == OscString ? OscEnd : Clear, Escape);
+            }
+            set(Ground, 0x20, 0x7e, Print, Ground);
+            set(Ground, 0x80, 0xff, Print, Ground);
+
+            set(Escape, 0x20, 0x2f, Collect, EscapeIntermediate);
+            set(Escape, 0x30, 0x7e, EscDispatch, Ground);
+            set(Escape, '[', '[', Clear, CsiEntry);
+            set(Escape, ']', ']', Clear, OscString);
+            set(Escape, 'P', 'P', None, IgnoreString);
+            set(Escape, 'X', 'X', None, IgnoreString);
+            set(Escape, '^', '_', None, IgnoreString);
+            set(EscapeIntermediate, 0x20, 0x2f, Collect, EscapeIntermediate);
+            set(EscapeIntermediate, 0x30, 0x7e, EscDispatch, Ground);
+
+            set(CsiEntry, 0x20, 0x2f, Collect, CsiIntermediate);
+            set(CsiEntry, 0x30, 0x3b, Param, CsiParam);
+            set(CsiEntry, 0x3c, 0x3f, Collect, CsiParam);
+            set(CsiEntry, 0x40, 0x7e, CsiDispatch, Ground);
+            set(CsiParam, 0x30, 0x3b, Param, CsiParam);
+            set(CsiParam, 0x3c, 0x3f, None, CsiIgnore);
+            set(CsiParam, 0x20, 0x2f, Collect, CsiIntermediate);
+            set(CsiParam, 0x40, 0x7e, CsiDispatch, Ground);
+            set(CsiIntermediate, 0x20, 0x2f, Collect, CsiIntermediate);
+            set(CsiIntermediate, 0x30, 0x3f, None, CsiIgnore);
+            set(CsiIntermediate, 0x40, 0x7e, CsiDispatch, Ground);
+            set(CsiIgnore, 0x40, 0x7e, None, Ground);
+
+            set(OscString, 0x07, 0x07, OscEnd, Ground);
+            set(OscString, 0x20, 0xff, OscPut, OscString);
+            set(IgnoreString, 0x07, 0x07, None, Ground);
+            return t;
+        }();
+        return transitions;
+    }
+
+    void perform(Action action, uchar byte, TerminalScreen &screen) {
+        switch (action) {
+        case Print:
+            printUtf8(byte, screen);
+            break;
+        case Execute:
+            screen.execute(byte);
+            break;
+        case Clear:
+            paramCount = 0;
+            intermediates.clear();
+            osc.clear();
+            break;
+        case Collect:
+            if (intermediates.size() < 4) {
+                intermediates.append(char(byte));
+            }
+            break;
+        case Param:
+            if (paramCount == 0) {
+                params[0] = -1;
+                paramCount = 1;
+            }
+            if (byte == ';' || byte == ':') {
+                if (paramCount < MaxParams) {
+                    params[paramCount++] = -1;
+                }
+            } else {
+                int &value = params[paramCount - 1];
+                value = qMin((value < 0 ? 0 : value) * 10 + (byte - '0'), 65535);
+            }
+            break;
+        case EscDispatch:
+            screen.escDispatch(intermediates, byte);
+            break;
+        case CsiDispatch:
+            screen.csiDispatch(params, paramCount, intermediates, byte);
+            break;
+        case OscPut:
+            if (osc.size() < MaxOscBytes) {
+                osc.append(char(byte));
+            }
+            break;
+        case OscEnd:
+            screen.oscDispatch(osc);
+            osc.clear();
+            break;
+        case None:
+            break;
+        }
+    }
+
+    void printUtf8(uchar byte, TerminalScreen &screen) {
+        if (byte < 0x80) {
+            if (utf8Remaining > 0) {
+                utf8Remaining = 0;
+                screen.print(QChar::ReplacementCharacter);
+            }
+            screen.print(byte);
+        } else if ((byte & 0xc0) == 0x80) {
+            if (utf8Remaining == 0) {
+                screen.print(QChar::ReplacementCharacter);
+                return;
+            }
+            codePoint = codePoint << 6 | (byte & 0x3f);
+            if (--utf8Remaining == 0) {
+                screen.print(codePoint);
+            }
+        } else {
+            if (utf8Remaining > 0) {
+                screen.print(QChar::ReplacementCharacter);
+            }
+            if ((byte & 0xe0) == 0xc0) {
+                utf8Remaining = 1;
+                codePoint = byte & 0x1f;
+            } else if ((byte & 0xf0) == 0xe0) {
+                utf8Remaining = 2;
+                codePoint = byte & 0x0f;
+            } else if ((byte & 0xf8) == 0xf0) {
+                utf8Remaining = 3;
+                codePoint = byte & 0x07;
+            } else {
+                utf8Remaining = 0;
+                screen.print(QChar::ReplacementCharacter);
+            }
+        }
+    }
+
+    State state = Ground;
+    int params[MaxParams];
+    int paramCount = 0;
+    QByteArray intermediates;
+    QByteArray osc;
+    int utf8Remaining = 0;
+    char32_t codePoint = 0;
+};
+
+// Paints a TerminalScreen with the ScrollbackStore above it. After output is
+// fed, updateDamage() asks for repaints of the damaged rows only; the
+// scroll bar moves back through the stored scrollback. Keys are encoded as
+// xterm would and emitted as bytes for the pty
+class TerminalView : public QAbstractScrollArea {
+    Q_OBJECT
+public:
+    TerminalView(TerminalScreen *screen, ScrollbackStore *scrollback, QWidget *parent = nullptr)
+        : QAbstractScrollArea(parent), screen(screen), scrollback(scrollback) {
+        QFont font("Cascadia Code", 10);
+        if (!QFontInfo(font).fixedPitch()) {
+            font.setFamily("Consolas");
+            if (!QFontInfo(font).fixedPitch()) {
+                font.setFamily("Courier New");
+            }
+        }
+        font.setFixedPitch(true);
+        setFont(font);
+        const QFontMetrics metrics(font);
+        cellWidth = qMax(1, metrics.horizontalAdvance(QLatin1Char('M')));
+        cellHeight = qMax(1, metrics.height());
+        ascent = metrics.ascent();
+
+        setFrameShape(QFrame::NoFrame);
+        setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+        setFocusPolicy(Qt::StrongFocus);
+        setAttribute(Qt::WA_OpaquePaintEvent);
+        viewport()->setAttribute(Qt::WA_OpaquePaintEvent);
+        viewport()->setCursor(Qt::IBeamCursor);
+
+        for (int i = 0; i < 256; ++i)
+            palette256[i] = paletteColor(i);
+    }
+
+    // Repaints the rows the screen marked as damaged, plus the cursor
+    void updateDamage() {
+        QScrollBar *bar = verticalScrollBar();
+        const int lines = int(qMin<qint64>(scrollback->endLine() - scrollback->firstLine(), INT_MAX));
+        const bool live = bar->value() == bar->maximum();
+        bar->setPageStep(screen->rows());
+        if (bar->maximum() != lines) {
+            bar->setRange(0, lines);
+        }
+        if (live) {
+            bar->setValue(lines);
+        }
+
+        if (bar->value() != lines) {
+            // Scrolled back: new lines shift the whole picture
+            viewport()->update();
+        } else {
+            const int rows = screen->rows();
+            if (paintedCursorRow < rows) {
+                viewport()->update(rowRect(paintedCursorRow, 1));
+            }
+            for (int y = 0; y < rows;) {
+                if (!screen->isDirty(y)) {
+                    ++y;
+                    continue;
+                }
+                const int first = y;
+                while (y < rows && screen->isDirty(y))
+                    ++y;
+                viewport()->update(rowRect(first, y - first));
+            }
+            viewport()->update(rowRect(screen->cursorY(), 1));
+        }
+        screen->clearDamage();
+    }
+
+    // Scrolls so that an absolute line (scrollback serial, or endLine() plus
+    // a screen row) is in view and selects it
+    void showLine(qint64 line) {
+        const qint64 first = scrollback->firstLine();
+        const qint64 value = qBound<qint64>(0, line - first - screen->rows() / 2, verticalScrollBar()->maximum());
+        verticalScrollBar()->setValue(int(value));
+        selectionAnchor = {line, 0};
+        selectionEnd = {line, screen->columns()};
+        viewport()->update();
+    }
+
+    void clearSelection() {
+        if (selectionAnchor != selectionEnd) {
+            selectionAnchor = selectionEnd = {};
+            viewport()->update();
+        }
+    }
+
+    QString selectedText() const {
+        const auto [from, to] = orderedSelection();
+        QStringList lines;
+        for (qint64 line = from.line; line <= to.line; ++line) {
+            const QString text = lineText(line);
+            const int start = line == from.line ? from.column : 0;
+            const int end = line == to.line ? to.column : int(text.size());
+            lines.append(text.mid(start, qMax(0, end - start)));
+        }
+        return lines.join('\n');
+    }
+
+signals:
+    void input(const QByteArray &bytes);
+    void gridSizeChanged(int columns, int rows);
+
+protected:
+    void paintEvent(QPaintEvent *event) override {
+        QPainter painter(viewport());
+        painter.fillRect(event->rect(), QColor(DefaultBackground));
+
+        const qint64 scrollbackLines = scrollback->endLine() - scrollback->firstLine();
+        const qint64 top = verticalScrollBar()->value();
+        const int first = event->rect().top() / cellHeight;
+        const int last = qMin(screen->rows() - 1, event->rect().bottom() / cellHeight);
+        const auto [from, to] = orderedSelection();
+
+        for (int y = first; y <= last; ++y) {
+            const qint64 index = top + y;
+            const qint64 line = scrollback->firstLine() + index;
+            int selectFrom = 0;
+            int selectTo = 0;
+            if (line >= from.line && line <= to.line && from != to) {
+                selectFrom = line == from.line ? from.column : 0;
+                selectTo = line == to.line ? to.column : INT_MAX;
+            }
+            if (index < scrollbackLines) {
+                quint8 color;
+                const QString text = scrollback->line(line, &color);
+                if (selectTo > selectFrom) {
+                    const int right = int(qMin<qint64>(selectTo, qMax(text.size(), qsizetype(screen->columns()))));
+                    painter.fillRect(QRect(selectFrom * cellWidth, y * cellHeight, (right - selectFrom) * cellWidth,
+                                           cellHeight), QColor(SelectionBackground));
+                }
+                painter.setPen(QColor(color == ScrollbackStore::NoColor ? DefaultForeground : palette256[color]));
+                painter.drawText(0, y * cellHeight + ascent, text);
+            } else if (index - scrollbackLines < screen->rows()) {
+                paintRow(painter, y, int(index - scrollbackLines), selectFrom, selectTo);
+            }
+        }
+
+        if (top == verticalScrollBar()->maximum() && screen->cursorVisible()) {
+            const QRect cursor(screen->cursorX() * cellWidth, screen->cursorY() * cellHeight, cellWidth, cellHeight);
+            if (hasFocus()) {
+                painter.fillRect(cursor, QColor(CursorColor));
+                const TerminalScreen::Cell &cell = screen->row(screen->cursorY())[screen->cursorX()];
+                if (cell.ch != TerminalScreen::WideTail) {
+                    painter.setPen(QColor(DefaultBackground));
+                    painter.drawText(cursor.left(), cursor.top() + ascent, QString::fromUcs4(&cell.ch, 1));
+                }
+            } else {
+                painter.setPen(QColor(CursorColor));
+                painter.drawRect(cursor.adjusted(0, 0, -1, -1));
+            }
+            paintedCursorRow = screen->cursorY();
+        }
+    }
+
+    // Keys the shell needs win over window shortcuts while the terminal has
+    // focus; other Ctrl combinations stay with the application
+    bool event(QEvent *event) override {
+        if (event->type() == QEvent::ShortcutOverride) {
+            QKeyEvent *keyEvent = static_cast<QKeyEvent *>(event);
+            const Qt::KeyboardModifiers modifiers = keyEvent->modifiers() & ~(Qt::ShiftModifier | Qt::KeypadModifier);
+            static const QList<int> shellKeys = {Qt::Key_A, Qt::Key_C, Qt::Key_D, Qt::Key_E, Qt::Key_K,
+                                                 Qt::Key_L, Qt::Key_R, Qt::Key_U, Qt::Key_W, Qt::Key_Z};
+            if (modifiers == Qt::NoModifier
+                || (modifiers == Qt::ControlModifier && !(keyEvent->modifiers() & Qt::ShiftModifier)
+                    && shellKeys.contains(keyEvent->key()))) {
+                event->accept();
+                return true;
+            }
+        }
+        return QAbstractScrollArea::event(event);
+    }
+
+    void resizeEvent(QResizeEvent *event) override {
+        QAbstractScrollArea::resizeEvent(event);
+        const int columns = qMax(2, viewport()->width() / cellWidth);
+        const int rows = qMax(2, viewport()->height() / cellHeight);
+        if (columns != screen->columns() || rows != screen->rows()) {
+            emit gridSizeChanged(columns, rows);
+        }
+    }
+
+    void scrollContentsBy(int dx, int dy) override {
+        Q_UNUSED(dx);
+        Q_UNUSED(dy);
+        viewport()->update();
+    }
+
+    // Tab belongs to the shell, not to focus navigation
+    bool focusNextPrevChild(bool next) override {
+        Q_UNUSED(next);
+        return false;
+    }
+
+    void focusInEvent(QFocusEvent *event) override {
+        QAbstractScrollArea::focusInEvent(event);
+        viewport()->update(rowRect(screen->cursorY(), 1));
+    }
+
+    void focusOutEvent(QFocusEvent *event) override {
+        QAbstractScrollArea::focusOutEvent(event);
+        viewport()->update(rowRect(screen->cursorY(), 1));
+    }
+
+    void keyPressEvent(QKeyEvent *event) override {
+        const Qt::KeyboardModifiers modifiers = event->modifiers();
+        const bool ctrlShift = (modifiers & Qt::ControlModifier) && (modifiers & Qt::ShiftModifier);
+        if (ctrlShift && event->key() == Qt::Key_C) {
+            QApplication::clipboard()->setText(selectedText());
+            return;
+        }
+        if (ctrlShift && event->key() == Qt::Key_V) {
+            QByteArray text = QApplication::clipboard()->text().toUtf8();
+            text.replace('\n', '\r');
+            if (screen->bracketedPaste()) {
+                text = "\033[200~" + text + "\033[201~";
+            }
+            sendInput(text);
+            return;
+        }
+        if (modifiers == Qt::ShiftModifier && (event->key() == Qt::Key_PageUp || event->key() == Qt::Key_PageDown)) {
+            verticalScrollBar()->triggerAction(event->key() == Qt::Key_PageUp ? QAbstractSlider::SliderPageStepSub
+                                                                              : QAbstractSlider::SliderPageStepAdd);
+            return;
+        }
+
+        const QByteArray bytes = encodeKey(event);
+        if (bytes.isEmpty()) {
+            QAbstractScrollArea::keyPressEvent(event);
+            return;
+        }
+        sendInput(bytes);
+    }
+
+    void mousePressEvent(QMouseEvent *event) override {
+        setFocus();
+        if (event->button() == Qt::LeftButton) {
+            selectionAnchor = selectionEnd = positionAt(event->position().toPoint());
+            viewport()->update();
+        }
+    }
+
+    void mouseMoveEvent(QMouseEvent *event) override {
+        if (event->buttons() & Qt::LeftButton) {
+            selectionEnd = positionAt(event->position().toPoint());
+            viewport()->update();
+        }
+    }
+
+    void mouseReleaseEvent(QMouseEvent *event) override {
+        if (event->button() == Qt::LeftButton && selectionAnchor != selectionEnd
+            && QApplication::clipboard()->supportsSelection()) {
+            QApplication::clipboard()->setText(selectedText(), QClipboard::Selection);
+        }
+    }
+
+private:
+    struct Position {
+        qint64 line = 0;
+        int column = 0;
+        bool operator==(const Position &other) const { return line == other.line && column == other.column; }
+        bool operator!=(const Position &other) const { return !(*this == other); }
+        bool operator<(const Position &other) const {
+            return line < other.line || (line == other.line && column < other.column);
+        }
+    };
+
+    static constexpr QRgb DefaultForeground = 0xffd4d4d4;
+    static constexpr QRgb DefaultBackground = 0xff1e1e1e;
+    static constexpr QRgb CursorColor = 0xffaeafad;
+    static constexpr QRgb SelectionBackground = 0xff264f78;
+
+    static QRgb paletteColor(int index) {
+        static const QRgb base[16] = {0xff000000, 0xffcd3131, 0xff0dbc79, 0xffe5e510, 0xff2472c8, 0xffbc3fbc,
+                                      0xff11a8cd, 0xffe5e5e5, 0xff666666, 0xfff14c4c, 0xff23d18b, 0xfff5f543,
+                                      0xff3b8eea, 0xffd670d6, 0xff29b8db, 0xffffffff};
+        if (index < 16) {
+            return base[index];
+        }
+        if (index < 232) {
+            static const int levels[6] = {0, 95, 135, 175, 215, 255};
+            index -= 16;
+            return qRgb(levels[index / 36], levels[index / 6 % 6], levels[index % 6]);
+        }
+        const int gray = 8 + (index - 232) * 10;
+        return qRgb(gray, gray, gray);
+    }
+
+    QColor resolve(quint32 color, QRgb fallback) const {
+        switch (color & 0xff000000) {
+        case TerminalScreen::PaletteColor:
+            return QColor(palette256[color & 0xff]);
+        case TerminalScreen::RgbColor:
+            return QColor(QRgb(0xff000000 | (color & 0xffffff)));
+        default:
+            return QColor(fallback);
+        }
+    }
+
+    QRect rowRect(int row, int count) const {
+        return QRect(0, row * cellHeight, viewport()->width(), count * cellHeight);
+    }
+
+    // Paints one screen row as runs of cells sharing colours and flags
+    void paintRow(QPainter &painter, int y, int row, int selectFrom, int selectTo) {
+        const TerminalScreen::Cell *cells = screen->row(row);
+        const int columns = screen->columns();
+        QVarLengthArray<char32_t, 256> run;
+        for (int x = 0; x < columns;) {
+            const TerminalScreen::Cell &first = cells[x];
+            const bool selected = x >= selectFrom && x < selectTo;
+            int end = x + 1;
+            while (end < columns && cells[end].fg == first.fg && cells[end].bg == first.bg
+                   && cells[end].flags == first.flags && (end >= selectFrom && end < selectTo) == selected)
+                ++end;
+
+            QColor foreground = resolve(first.fg, DefaultForeground);
+            QColor background = resolve(first.bg, DefaultBackground);
+            if (first.flags & TerminalScreen::Inverse) {
+                std::swap(foreground, background);
+            }
+            if (selected) {
+                background = QColor(SelectionBackground);
+            }
+            const QRect rect(x * cellWidth, y * cellHeight, (end - x) * cellWidth, cellHeight);
+            if (background.rgb() != DefaultBackground) {
+                painter.fillRect(rect, background);
+            }
+
+            // Wide characters are drawn on their own at their cell, so a
+            // fallback font's advance cannot shift the cells after them
+            bool styled = false;
+            int runStart = x;
+            const auto drawRun = [&]() {
+                const bool blank = std::all_of(run.cbegin(), run.cend(), [](char32_t c) { return c == ' '; });
+                if (!blank) {
+                    if (!styled) {
+                        QFont runFont = font();
+                        runFont.setBold(first.flags & TerminalScreen::Bold);
+                        runFont.setItalic(first.flags & TerminalScreen::Italic);
+                        runFont.setUnderline(first.flags & TerminalScreen::Underline);
+                        painter.setFont(runFont);
+                        painter.setPen(foreground);
+                        styled = true;
+                    }
+                    painter.drawText(runStart * cellWidth, rect.top() + ascent, QString::fromUcs4(run.constData(), run.size()));
+                }
+                run.clear();
+            };
+            for (int i = x; i < end; ++i) {
+                if (cells[i].ch == TerminalScreen::WideTail) {
+                    drawRun();
+                    runStart = i + 1;
+                    continue;
+                }
+                const bool wide = i + 1 < columns && cells[i + 1].ch == TerminalScreen::WideTail;
+                if (wide) {
+                    drawRun();
+                    runStart = i;
+                }
+                run.append(cells[i].ch);
+                if (cells[i].mark)
+                    run.append(cells[i].mark);
+                if (wide) {
+                    drawRun();
+                    runStart = i + 2;
+                }
+            }
+            drawRun();
+            x = end;
+        }
+        painter.setFont(font());
+    }
+
+    QString lineText(qint64 line) const {
+        if (line < scrollback->firstLine()) {
+            return QString();
+        }
+        if (line < scrollback->endLine()) {
+            return scrollback->line(line);
+        }
+        const qint64 row = line - scrollback->endLine();
+        return row < screen->rows() ? screen->rowText(int(row)) : QString();
+    }
+
+    Position positionAt(const QPoint &point) const {
+        const int row = qBound(0, point.y() / cellHeight, screen->rows() - 1);
+        const int column = qBound(0, (point.x() + cellWidth / 2) / cellWidth, screen->columns());
+        return {scrollback->firstLine() + verticalScrollBar()->value() + row, column};
+    }
+
+    std::pair<Position, Position> orderedSelection() const {
+        return selectionEnd < selectionAnchor ? std::make_pair(selectionEnd, selectionAnchor)
+                                              : std::make_pair(selectionAnchor, selectionEnd);
+    }
+
+    void sendInput(const QByteArray &bytes) {
+        verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+        clearSelection();
+        emit input(bytes);
+    }
+
+    QByteArray encodeKey(QKeyEvent *event) const {
+        const Qt::KeyboardModifiers modifiers = event->modifiers();
+        const bool application = screen->applicationCursorKeys();
+        switch (event->key()) {
+        case Qt::Key_Return:
+        case Qt::Key_Enter:
+            return "\r";
+        case Qt::Key_Backspace:
+            return "\x7f";
+        case Qt::Key_Tab:
+            return "\t";
+        case Qt::Key_Backtab:
+            return "\033[Z";
+        case Qt::Key_Escape:
+            return "\033";
+        case Qt::Key_Up:
+            return application ? "\033OA" : "\033[A";
+        case Qt::Key_Down:
+            return application ? "\033OB" : "\033[B";
+        case Qt::Key_Right:
+            return application ? "\033OC" : "\033[C";
+        case Qt::Key_Left:
+            return application ? "\033OD" : "\033[D";
+        case Qt::Key_Home:
+            return application ? "\033OH" : "\033[H";
+        case Qt::Key_End:
+            return application ? "\033OF" : "\033[F";
+        case Qt::Key_Insert:
+            return "\033[2~";
+        case Qt::Key_Delete:
+            return "\033[3~";
+        case Qt::Key_PageUp:
+            return "\033[5~";
+        case Qt::Key_PageDown:
+            return "\033[6~";
+        case Qt::Key_F1:
+            return "\033OP";
+        case Qt::Key_F2:
+            return "\033OQ";
+        case Qt::Key_F3:
+            return "\033OR";
+        case Qt::Key_F4:
+            return "\033OS";
+        default:
+            break;
+        }
+        if (event->key() >= Qt::Key_F5 && event->key() <= Qt::Key_F12) {
+            static const char *const functionKeys[] = {"15", "17", "18", "19", "20", "21", "23", "24"};
+            return QByteArray("\033[") + functionKeys[event->key() - Qt::Key_F5] + '~';
+        }
+        if ((modifiers & Qt::ControlModifier) && event->key() >= Qt::Key_A && event->key() <= Qt::Key_Z) {
+            return QByteArray(1, char(event->key() - Qt::Key_A + 1));
+        }
+        if ((modifiers & Qt::ControlModifier) && event->key() == Qt::Key_Space) {
+            return QByteArray(1, '\0');
+        }
+        QByteArray text = event->text().toUtf8();
+        if (!text.isEmpty() && (modifiers & Qt::AltModifier)) {
+            text.prepend('\033');
+        }
+        return text;
+    }
+
+    TerminalScreen *screen;
+    ScrollbackStore *scrollback;
+    QRgb palette256[256];
+    int cellWidth = 1;
+    int cellHeight = 1;
+    int ascent = 0;
+    int paintedCursorRow = 0;
+    Position selectionAnchor;
+    Position selectionEnd;
+};
+
+// One terminal session: a persistent shell on a pty where forkpty is
+// available, otherwise one QProcess per command. Output is queued in an
+// OutputRing and fed through the VT parser into a TerminalScreen at most
+// once per frame. Each tab of the TerminalWidget is a session
+class TerminalSession : public QWidget {
+    Q_OBJECT
+public:
+    static constexpr const char *InfoColor = "\033[38;2;86;156;214m";
+    static constexpr const char *CommandColor = "\033[38;2;220;220;170m";
+    static constexpr const char *ErrorColor = "\033[38;2;241;76;76m";
+
+    TerminalSession(qint64 scrollbackLines, QWidget *parent = nullptr) : QWidget(parent) {
+        QVBoxLayout *layout = new QVBoxLayout(this);
+        layout->setContentsMargins(0, 0, 0, 0);
+
+        // Terminal screen; rows scrolled off the top go to the scrollback
+        scrollback.setLimit(scrollbackLines);
+        screen.scrolledOff = [this](const QString &text, quint8 color) {
+            scrollback.append(text, color);
+        };
+        view = new TerminalView(&screen, &scrollback, this);
+        connect(view, &TerminalView::gridSizeChanged, this, &TerminalSession::resizeScreen);
+        layout->addWidget(view);
+        setFocusProxy(view);
+
+        // Persistent shell on a pty, or one process per command
+        pty = new PtySession(this);
+        connect(pty, &PtySession::dataReceived, this, [this](const QByteArray &bytes) {
+            queueOutput(OutputRing::Stdout, bytes);
+        });
+        connect(pty, &PtySession::finished, this, &TerminalSession::shellFinished);
+        connect(view, &TerminalView::input, pty, &PtySession::write);
+        if (!pty->start(screen.columns(), screen.rows(), QDir::currentPath())) {
+            delete pty;
+            pty = nullptr;
+            screen.setNewlineMode(true);
+            process = new QProcess(this);
+            connect(process, &QProcess::readyReadStandardOutput, this, &TerminalSession::readOutput);
+            connect(process, &QProcess::readyReadStandardError, this, &TerminalSession::readError);
+            connect(view, &TerminalView::input, process, [this](const QByteArray &bytes) {
+                if (process->state() == QProcess::Running) {
+                    process->write(bytes);
+                }
+            });
+        }
+
+        flushTimer.setSingleShot(true);
+        connect(&flushTimer, &QTimer::timeout, this, &TerminalSession::flushOutput);
+    }
+
+    bool hasPty() const {
+        return pty != nullptr;
+    }
+
+    QFont terminalFont() const {
+        return view->font();
+    }
+
+    QString title() const {
+        return screen.title();
+    }
+
+    qint64 bytesRead() const {
+        return totalRead;
+    }
+
+    double cpuSeconds() const {
+        if (pty) {
+            return PtySession::cpuSeconds(pty->processId());
+        }
+        return process->state() == QProcess::Running ? PtySession::cpuSeconds(process->processId()) : -1;
+    }
+
+    qint64 scrollbackLimit() const {
+        return scrollback.lineLimit();
+    }
+
+    void setScrollbackLimit(qint64 lines) {
+        scrollback.setLimit(lines);
+        view->updateDamage();
+    }
+
+    // Sessions in background tabs get a smaller share of each frame
+    void setBackground(bool background) {
+        flushBudgetMs = background ? BackgroundFlushBudgetMs : FlushBudgetMs;
+    }
+
+    QString statistics() const {
+        return QString("scrollback lines: %1 (limit %2), %3 KB\nscreen: %4x%5%6, %7 KB read")
+            .arg(scrollback.endLine() - scrollback.firstLine())
+            .arg(scrollback.lineLimit())
+            .arg(scrollback.bytes() / 1024)
+            .arg(screen.columns())
+            .arg(screen.rows())
+            .arg(pty ? ", pty" : ", no pty")
+            .arg(totalRead / 1024);
+    }
+
+    // Runs a line typed into the command bar; the shell echoes it itself
+    void runCommand(const QString &command) {
+        if (pty) {
+            if (!pty->isRunning()) {
+                parser.reset();
+                pty->start(screen.columns(), screen.rows(), QDir::currentPath());
+            }
+            pty->write(command.toUtf8() + '\r');
+            return;
+        }
+
+        // Without a pty, a line typed while a command runs is its input
+        if (process->state() != QProcess::NotRunning) {
+            process->write(command.toUtf8() + '\n');
+            return;
+        }
+
+        writeLine("> " + command, CommandColor);
+        if (command.startsWith("echo ")) {
+            writeLine(command.mid(5));
+            return;
+        }
+
+        // Execute external command
+        stdoutDecoder.resetState();
+        stderrDecoder.resetState();
+#ifdef Q_OS_WIN
+        process->start("cmd.exe", QStringList() << "/c" << command);
+#else
+        process->start("/bin/sh", QStringList() << "-c" << command);
+#endif
+    }
+
+    void clear() {
+        pendingOutput.clear();
+        screen.reset();
+        scrollback.clear();
+        view->clearSelection();
+        view->updateDamage();
+        // Let the shell redraw its prompt
+        if (pty) {
+            pty->write("\x0c");
+        }
+    }
+
+    // Local messages go on a line of their own after any pending output.
+    // While output is still queued they are queued behind it, to be shown
+    // by the frame that reaches them, instead of draining it all here
+    void writeLine(const QString &text, const char *color = nullptr, const QString &rest = QString()) {
+        QByteArray bytes;
+        if (color) {
+            bytes += color + text.toUtf8() + "\033[39m";
+        } else {
+            bytes += text.toUtf8();
+        }
+        bytes += rest.toUtf8() + "\r\n";
+        if (!pendingOutput.isEmpty()) {
+            pendingOutput.push(OutputRing::Local, bytes);
+            if (!flushTimer.isActive()) {
+                flushTimer.start(FrameMs);
+            }
+            return;
+        }
+        feedLocal(bytes);
+        view->updateDamage();
+    }
+
+    // Searches the whole scrollback and the screen, newest first
+    void searchScrollback(const QString &needle) {
+        QDialog dialog(this);
+        dialog.setWindowTitle("Scrollback matches for \"" + needle + "\"");
+        dialog.resize(700, 400);
+        QVBoxLayout *layout = new QVBoxLayout(&dialog);
+        QListWidget *matchList = new QListWidget(&dialog);
+        matchList->setFont(view->font());
+        matchList->setUniformItemSizes(true);
+        layout->addWidget(matchList);
+
+        const auto addMatch = [matchList](qint64 line, const QString &text) {
+            QListWidgetItem *item = new QListWidgetItem(QString("%1: %2").arg(line + 1).arg(text), matchList);
+            item->setData(Qt::UserRole, line);
+        };
+        for (int row = screen.rows() - 1; row >= 0 && matchList->count() < MaxSearchResults; --row) {
+            const QString text = screen.rowText(row);
+            if (text.contains(needle, Qt::CaseInsensitive)) {
+                addMatch(scrollback.endLine() + row, text);
+            }
+        }
+        for (qint64 serial : scrollback.find(needle, MaxSearchResults - matchList->count())) {
+            addMatch(serial, scrollback.line(serial));
+        }
+        if (matchList->count() == 0) {
+            matchList->addItem("No matches in the last " + QString::number(scrollback.endLine() - scrollback.firstLine()) + " lines");
+        }
+        connect(matchList, &QListWidget::itemActivated, &dialog, [this, &dialog](QListWidgetItem *item) {
+            if (item->data(Qt::UserRole).isValid()) {
+                view->showLine(item->data(Qt::UserRole).toLongLong());
+            }
+            dialog.accept();
+        });
+        dialog.exec();
+    }
+
+signals:
+    void titleChanged(const QString &title);
+
+private slots:
+    void readOutput() {
+        queueOutput(OutputRing::Stdout, process->readAllStandardOutput());
+    }
+
+    void readError() {
+        queueOutput(OutputRing::Stderr, process->readAllStandardError());
+    }
+
+    void queueOutput(OutputRing::Stream stream, const QByteArray &bytes) {
+        totalRead += bytes.size();
+        pendingOutput.push(stream, bytes);
+        // Backpressure: stop reading the pty until the screen catches up
+        if (pty && pendingOutput.pendingBytes() > PauseBytes) {
+            pty->setReadingEnabled(false);
+        }
+        if (!flushTimer.isActive()) {
+            flushTimer.start(FrameMs);
+        }
+    }
+
+    // Feeds queued output to the screen for at most flushBudgetMs, leaving
+    // the rest for the next frame, then repaints only the damaged rows
+    void flushOutput() {
+        QElapsedTimer timer;
+        timer.start();
+        bool fed = false;
+        while (!pendingOutput.isEmpty() && timer.elapsed() < flushBudgetMs) {
+            if (const qint64 dropped = pendingOutput.takeDropped()) {
+                parser.feed(QString("\r\n[... %1 bytes of output skipped ...]\r\n").arg(dropped).toUtf8(), screen);
+            }
+            const OutputRing::Chunk chunk = pendingOutput.take(FlushChunkBytes);
+            if (chunk.stream == OutputRing::Local) {
+                feedLocal(chunk.bytes);
+            } else if (pty) {
+                parser.feed(chunk.bytes, screen);
+            } else {
+                // Output without a tty is in the system codec; stderr is coloured here
+                const bool isError = chunk.stream == OutputRing::Stderr;
+                const QByteArray utf8 = (isError ? stderrDecoder : stdoutDecoder).decode(chunk.bytes).toUtf8();
+                parser.feed(isError ? QByteArray(ErrorColor) + utf8 + "\033[39m" : utf8, screen);
+            }
+            fed = true;
+        }
+        if (fed) {
+            view->clearSelection();
+        }
+        view->updateDamage();
 
-signals:
-    void openFile(const QString &filePath);
+        if (pty) {
+            const QByteArray response = screen.takeResponse();
+            if (!response.isEmpty()) {
+                pty->write(response);
+            }
+            if (pendingOutput.pendingBytes() < ResumeBytes) {
+                pty->setReadingEnabled(true);
+            }
+        }
+        if (screen.title() != lastTitle) {
+            lastTitle = screen.title();
+            emit titleChanged(lastTitle);
+        }
+        if (!pendingOutput.isEmpty()) {
+            flushTimer.start(FrameMs);
+        }
+    }
 
-private slots:
-    void onItemDoubleClicked(QTreeWidgetItem *item, int column) {
-        // Ignore directories
-        if (!item || item->childCount() > 0) {
-            return;
+    void resizeScreen(int columns, int rows) {
+        screen.resize(columns, rows);
+        if (pty) {
+            pty->resize(columns, rows);
         }
-        
-        // Get full path - in a real app, you'd build this from the actual file system
-        QString filePath = getItemPath(item);
-        emit openFile(filePath);
+        view->updateDamage();
     }
-    
+
+    void shellFinished(int exitCode) {
+        writeLine(QString("[shell exited with code %1; run a command to start a new one]").arg(exitCode), InfoColor);
+    }
+
 private:
-    QString getItemPath(QTreeWidgetItem *item) {
-        if (!item) {
-            return QString();
-        }
-        
-        QString path = item->text(0);
-        QTreeWidgetItem *parent = item->parent();
-        
-        while (parent) {
-            path = parent->text(0) + "/" + path;
-            parent = parent->parent();
+    void feedLocal(QByteArrayView bytes) {
+        if (screen.cursorX() != 0) {
+            parser.feed("\r\n", screen);
         }
-        
-        return path;
+        parser.feed(bytes, screen);
     }
+
+    static constexpr int FrameMs = 16;
+    static constexpr int FlushBudgetMs = 8;
+    static constexpr int BackgroundFlushBudgetMs = 2;
+    static constexpr qsizetype FlushChunkBytes = 64 * 1024;
+    static constexpr qint64 PauseBytes = 4 * 1024 * 1024;
+    static constexpr qint64 ResumeBytes = 1024 * 1024;
+    static constexpr int MaxSearchResults = 1000;
+
+    TerminalView *view;
+    PtySession *pty = nullptr;
+    QProcess *process = nullptr;
+    OutputRing pendingOutput;
+    QTimer flushTimer;
+    int flushBudgetMs = FlushBudgetMs;
+    qint64 totalRead = 0;
+    QStringDecoder stdoutDecoder{QStringDecoder::System};
+    QStringDecoder stderrDecoder{QStringDecoder::System};
+    ScrollbackStore scrollback;
+    TerminalScreen screen;
+    VtParser parser;
+    QString lastTitle;
 };
 
-// Enhanced terminal widget with better styling and features
+// Enhanced terminal widget with better styling and features: a tab per
+// TerminalSession, with a shared command bar and history that act on the
+// current tab. Each session runs independently, so a build, a test watcher
+// and a log tail can run side by side. Up/Down walk the persistent history
+// filtered by what is already typed; Ctrl+R searches it like readline
 class TerminalWidget : public QWidget {
     Q_OBJECT
 public:
@@ -592,266 +7528,1153 @@ public:
         QVBoxLayout *layout = new QVBoxLayout(this);
         layout->setContentsMargins(0, 0, 0, 0);
         layout->setSpacing(0);
-        
-        // Command history
-        commandHistory = QStringList();
-        historyIndex = -1;
-        
+
         // Terminal toolbar
         QHBoxLayout *toolbarLayout = new QHBoxLayout();
         toolbarLayout->setContentsMargins(5, 5, 5, 5);
-        
+
         QLabel *termLabel = new QLabel("Terminal", this);
         termLabel->setStyleSheet("color: #BBBBBB; font-weight: bold;");
-        
+
+        QToolButton *newButton = new QToolButton(this);
+        newButton->setIcon(style()->standardIcon(QStyle::SP_FileDialogNewFolder));
+        newButton->setToolTip("New Terminal (Ctrl+Shift+T)");
+        connect(newButton, &QToolButton::clicked, this, &TerminalWidget::newSession);
+
         clearButton = new QToolButton(this);
         clearButton->setIcon(style()->standardIcon(QStyle::SP_DialogResetButton));
         clearButton->setToolTip("Clear Terminal");
         connect(clearButton, &QToolButton::clicked, this, &TerminalWidget::clearTerminal);
-        
+
+        QToolButton *searchButton = new QToolButton(this);
+        searchButton->setIcon(style()->standardIcon(QStyle::SP_FileDialogContentsView));
+        searchButton->setToolTip("Search Scrollback");
+        connect(searchButton, &QToolButton::clicked, this, &TerminalWidget::searchScrollback);
+
         QToolButton *configButton = new QToolButton(this);
         configButton->setIcon(style()->standardIcon(QStyle::SP_FileDialogDetailedView));
         configButton->setToolTip("Terminal Settings");
-        
+        connect(configButton, &QToolButton::clicked, this, &TerminalWidget::configure);
+
         toolbarLayout->addWidget(termLabel);
         toolbarLayout->addStretch();
+        toolbarLayout->addWidget(newButton);
         toolbarLayout->addWidget(clearButton);
+        toolbarLayout->addWidget(searchButton);
         toolbarLayout->addWidget(configButton);
-        
-        // Terminal output display
-        outputDisplay = new QPlainTextEdit(this);
-        outputDisplay->setReadOnly(true);
-        QFont font("Cascadia Code", 10);
-        if (!QFontInfo(font).fixedPitch()) {
-            font.setFamily("Consolas");
-            if (!QFontInfo(font).fixedPitch()) {
-                font.setFamily("Courier New");
-            }
-        }
-        font.setFixedPitch(true);
-        outputDisplay->setFont(font);
-        outputDisplay->setStyleSheet("QPlainTextEdit { background-color: #1E1E1E; color: #D4D4D4; border: none; }");
-        
+
+        // One tab per session; the tooltip is filled in when it is shown
+        tabs = new QTabWidget(this);
+        tabs->setTabsClosable(true);
+        tabs->setMovable(true);
+        tabs->setDocumentMode(true);
+        tabs->tabBar()->installEventFilter(this);
+        connect(tabs, &QTabWidget::tabCloseRequested, this, &TerminalWidget::closeSession);
+        connect(tabs, &QTabWidget::currentChanged, this, &TerminalWidget::currentSessionChanged);
+
         // Command prompt layout
         QHBoxLayout *promptLayout = new QHBoxLayout();
         promptLayout->setContentsMargins(5, 5, 5, 5);
-        
+
         // Prompt label
-        QLabel *promptLabel = new QLabel(">", this);
+        promptLabel = new QLabel(">", this);
         promptLabel->setStyleSheet("color: #569CD6; font-weight: bold;");
-        
+
         // Command input
         commandInput = new QLineEdit(this);
         commandInput->setStyleSheet("QLineEdit { background-color: #1E1E1E; color: #D4D4D4; border: none; }");
-        commandInput->setFont(font);
-        
+        commandInput->installEventFilter(this);
+
+        // Reverse search shows its current match next to the query
+        searchMatchLabel = new QLabel(this);
+        searchMatchLabel->setStyleSheet("color: #D4D4D4;");
+        searchMatchLabel->hide();
+
         promptLayout->addWidget(promptLabel);
         promptLayout->addWidget(commandInput);
-        
+        promptLayout->addWidget(searchMatchLabel, 1);
+
         // Add all components to main layout
         layout->addLayout(toolbarLayout);
-        layout->addWidget(outputDisplay);
+        layout->addWidget(tabs);
         layout->addLayout(promptLayout);
-        
-        // Set up process
-        process = new QProcess(this);
-        connect(process, &QProcess::readyReadStandardOutput, this, &TerminalWidget::readOutput);
-        connect(process, &QProcess::readyReadStandardError, this, &TerminalWidget::readError);
-        
+
         // Connect command input
         connect(commandInput, &QLineEdit::returnPressed, this, &TerminalWidget::executeCommand);
-        
+
         // Set up keyboard shortcuts for history navigation
         QShortcut *upShortcut = new QShortcut(Qt::Key_Up, commandInput);
         connect(upShortcut, &QShortcut::activated, this, &TerminalWidget::navigateHistoryUp);
-        
+
         QShortcut *downShortcut = new QShortcut(Qt::Key_Down, commandInput);
         connect(downShortcut, &QShortcut::activated, this, &TerminalWidget::navigateHistoryDown);
-        
+
+        QShortcut *searchShortcut = new QShortcut(QKeySequence("Ctrl+R"), commandInput);
+        searchShortcut->setContext(Qt::WidgetShortcut);
+        connect(searchShortcut, &QShortcut::activated, this, &TerminalWidget::searchHistory);
+
+        // Typing starts a new walk through history, or a new reverse search
+        connect(commandInput, &QLineEdit::textEdited, this, &TerminalWidget::historyInputEdited);
+
+        QShortcut *newShortcut = new QShortcut(QKeySequence("Ctrl+Shift+T"), this);
+        newShortcut->setContext(Qt::WidgetWithChildrenShortcut);
+        connect(newShortcut, &QShortcut::activated, this, &TerminalWidget::newSession);
+
+        newSession();
+        commandInput->setFont(currentSession()->terminalFont());
+
         // Welcome message
-        outputDisplay->appendHtml("<span style='color: #569CD6;'>Terminal Ready</span>");
-        outputDisplay->appendPlainText("Type 'help' for available commands");
-        outputDisplay->appendPlainText("-------------------------------------");
+        currentSession()->writeLine("Terminal Ready", TerminalSession::InfoColor);
+        currentSession()->writeLine("Type 'help' for available commands");
+        currentSession()->writeLine("-------------------------------------");
+    }
+
+    QString scrollbackStatistics() {
+        QStringList lines;
+        for (int i = 0; i < tabs->count(); ++i) {
+            TerminalSession *session = sessionAt(i);
+            lines.append(tabs->tabText(i) + ": " + session->statistics().replace('\n', "; "));
+        }
+        lines.append(history.statistics());
+        return lines.join('\n');
+    }
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override {
+        if (watched == tabs->tabBar() && event->type() == QEvent::ToolTip) {
+            const QPoint position = static_cast<QHelpEvent *>(event)->pos();
+            const int index = tabs->tabBar()->tabAt(position);
+            if (index >= 0) {
+                tabs->setTabToolTip(index, sessionToolTip(sessionAt(index)));
+            }
+        }
+        if (watched == commandInput && searching && event->type() == QEvent::KeyPress) {
+            QKeyEvent *keyEvent = static_cast<QKeyEvent *>(event);
+            switch (keyEvent->key()) {
+            case Qt::Key_Return:
+            case Qt::Key_Enter:
+                // The line edit goes on to emit returnPressed with the match
+                finishHistorySearch(true);
+                return false;
+            case Qt::Key_Escape:
+                finishHistorySearch(false);
+                return true;
+            case Qt::Key_G:
+                if (keyEvent->modifiers() & Qt::ControlModifier) {
+                    finishHistorySearch(false);
+                    return true;
+                }
+                break;
+            case Qt::Key_Tab:
+                finishHistorySearch(true);
+                return true;
+            case Qt::Key_Left:
+            case Qt::Key_Right:
+            case Qt::Key_Home:
+            case Qt::Key_End:
+                finishHistorySearch(true);
+                return false;
+            }
+        }
+        return QWidget::eventFilter(watched, event);
+    }
+
+private slots:
+    void executeCommand() {
+        QString command = commandInput->text().trimmed();
+        if (command.isEmpty()) {
+            return;
+        }
+
+        history.append(command);
+        historyPosition = -1;
+
+        // Clear input
+        commandInput->clear();
+
+        // Handle built-in commands
+        if (command == "clear" || command == "cls") {
+            clearTerminal();
+            return;
+        } else if (command == "help") {
+            showHelp();
+            return;
+        }
+
+        currentSession()->runCommand(command);
+    }
+
+    void newSession() {
+        const qint64 lines = QSettings("MyDevApp", "Terminal").value("scrollbackLines", DefaultScrollbackLines).toLongLong();
+        TerminalSession *session = new TerminalSession(lines, tabs);
+        const QString name = QString("Shell %1").arg(++sessionCounter);
+        connect(session, &TerminalSession::titleChanged, this, [this, session, name](const QString &title) {
+            const int index = tabs->indexOf(session);
+            if (index >= 0) {
+                tabs->setTabText(index, title.isEmpty() ? name : QFontMetrics(tabs->font()).elidedText(title, Qt::ElideMiddle, 200));
+            }
+        });
+        tabs->setCurrentIndex(tabs->addTab(session, name));
+        session->setFocus();
+    }
+
+    // Closing a tab hangs up its shell; there is always at least one tab
+    void closeSession(int index) {
+        TerminalSession *session = sessionAt(index);
+        tabs->removeTab(index);
+        delete session;
+        if (tabs->count() == 0) {
+            newSession();
+        }
+    }
+
+    void currentSessionChanged(int current) {
+        for (int i = 0; i < tabs->count(); ++i)
+            sessionAt(i)->setBackground(i != current);
+    }
+
+    void clearTerminal() {
+        currentSession()->clear();
+    }
+
+    void showHelp() {
+        TerminalSession *session = currentSession();
+        session->writeLine("Available Commands:", TerminalSession::InfoColor);
+        session->writeLine("clear/cls", TerminalSession::CommandColor, " - Clear terminal output");
+        if (!session->hasPty()) {
+            session->writeLine("echo [text]", TerminalSession::CommandColor, " - Display text");
+        }
+        session->writeLine("help", TerminalSession::CommandColor, " - Show this help message");
+        session->writeLine("Any other command will be executed in the system shell");
+        if (session->hasPty()) {
+            session->writeLine("Click the terminal to type into the shell directly; Ctrl+Shift+C/V copy and paste");
+        }
+        session->writeLine("Ctrl+Shift+T opens another terminal tab; each tab runs its own shell");
+        session->writeLine("Up/Down recall commands starting with what is typed; Ctrl+R searches all history");
+    }
+
+    void searchScrollback() {
+        bool ok;
+        const QString needle = QInputDialog::getText(this, "Search Scrollback", "Find:", QLineEdit::Normal,
+                                                     lastScrollbackSearch, &ok);
+        if (!ok || needle.isEmpty()) {
+            return;
+        }
+        lastScrollbackSearch = needle;
+        currentSession()->searchScrollback(needle);
+    }
+
+    void configure() {
+        bool ok;
+        const int lines = QInputDialog::getInt(this, "Terminal Settings", "Scrollback lines:",
+                                               int(currentSession()->scrollbackLimit()), 1000, 10000000, 1000, &ok);
+        if (ok) {
+            for (int i = 0; i < tabs->count(); ++i)
+                sessionAt(i)->setScrollbackLimit(lines);
+            QSettings("MyDevApp", "Terminal").setValue("scrollbackLines", lines);
+        }
+    }
+
+    // The first Up remembers the typed text and only offers commands that
+    // start with it, newest first, each distinct command once
+    void navigateHistoryUp() {
+        if (searching) {
+            finishHistorySearch(true);
+        }
+        if (historyPosition < 0) {
+            history.refresh();
+            currentInput = commandInput->text();
+            historyPrefix = currentInput;
+            historyPosition = history.size();
+        }
+        const qsizetype previous = history.previousWithPrefix(historyPrefix, historyPosition);
+        if (previous >= 0) {
+            historyPosition = previous;
+            commandInput->setText(history.at(previous));
+        }
+    }
+
+    void navigateHistoryDown() {
+        if (searching) {
+            finishHistorySearch(true);
+        }
+        if (historyPosition < 0) {
+            return;
+        }
+        const qsizetype next = history.nextWithPrefix(historyPrefix, historyPosition);
+        if (next >= 0) {
+            historyPosition = next;
+            commandInput->setText(history.at(next));
+        } else {
+            historyPosition = -1;
+            commandInput->setText(currentInput);
+        }
+    }
+
+    // Ctrl+R starts a reverse search with the typed text as the query; again
+    // it steps to the next older match that differs from the current one
+    void searchHistory() {
+        if (!searching) {
+            history.refresh();
+            searching = true;
+            currentInput = commandInput->text();
+            searchMatch = history.searchBackward(currentInput, history.size());
+            promptLabel->setText("(reverse-i-search)");
+            searchMatchLabel->show();
+        } else if (searchMatch > 0) {
+            const QString current = history.at(searchMatch);
+            qsizetype older = searchMatch;
+            do {
+                older = history.searchBackward(commandInput->text(), older);
+            } while (older >= 0 && history.at(older) == current);
+            if (older >= 0) {
+                searchMatch = older;
+            }
+        }
+        showHistoryMatch();
+    }
+
+    void historyInputEdited(const QString &text) {
+        historyPosition = -1;
+        if (searching) {
+            searchMatch = history.searchBackward(text, history.size());
+            showHistoryMatch();
+        }
+    }
+
+private:
+    static constexpr qint64 DefaultScrollbackLines = 100000;
+
+    void showHistoryMatch() {
+        if (searchMatch >= 0) {
+            searchMatchLabel->setText(history.at(searchMatch));
+        } else {
+            searchMatchLabel->setText(commandInput->text().isEmpty() ? QString() : QString("(no match)"));
+        }
+    }
+
+    // Accepting puts the match in the line for editing or running; otherwise
+    // the text from before Ctrl+R comes back
+    void finishHistorySearch(bool accept) {
+        searching = false;
+        promptLabel->setText(">");
+        searchMatchLabel->hide();
+        searchMatchLabel->clear();
+        if (accept && searchMatch >= 0) {
+            commandInput->setText(history.at(searchMatch));
+        } else if (!accept) {
+            commandInput->setText(currentInput);
+        }
+        searchMatch = -1;
+    }
+
+    TerminalSession *sessionAt(int index) const {
+        return static_cast<TerminalSession *>(tabs->widget(index));
+    }
+
+    TerminalSession *currentSession() const {
+        return static_cast<TerminalSession *>(tabs->currentWidget());
+    }
+
+    static QString sessionToolTip(const TerminalSession *session) {
+        const double cpu = session->cpuSeconds();
+        return QString("%1CPU time: %2\nRead: %3")
+            .arg(session->title().isEmpty() ? QString() : session->title() + '\n')
+            .arg(cpu < 0 ? QString("n/a") : QString::number(cpu, 'f', 2) + " s")
+            .arg(QLocale().formattedDataSize(session->bytesRead()));
+    }
+
+    QTabWidget *tabs;
+    QLineEdit *commandInput;
+    QToolButton *clearButton;
+    int sessionCounter = 0;
+    QString lastScrollbackSearch;
+    QLabel *promptLabel;
+    QLabel *searchMatchLabel;
+    CommandHistory history;
+    qsizetype historyPosition = -1;
+    QString historyPrefix;
+    QString currentInput;
+    bool searching = false;
+    qsizetype searchMatch = -1;
+};
+
+// Ghost-text completion for a CodeEditor through the shared GeminiClient.
+// A request goes out once typing pauses for DebounceMs; moving the cursor,
+// leaving the editor or typing something else cancels whatever is in
+// flight. Typing the start of the shown suggestion only shortens it, and
+// suggestions are remembered per context, so deleting a word and typing it
+// again does not ask twice. Keys only restart a timer; nothing here waits
+class InlineCompleter : public QObject {
+    Q_OBJECT
+public:
+    static constexpr int DebounceMs = 300;
+    static constexpr int PrefixChars = 3000;
+    static constexpr int SuffixChars = 1000;
+    static constexpr int MaxCached = 256;
+
+    InlineCompleter(CodeEditor *editor, GeminiClient *client, QObject *parent = nullptr)
+        : QObject(parent), editor(editor), client(client) {
+        debounce.setSingleShot(true);
+        debounce.setInterval(DebounceMs);
+        connect(&debounce, &QTimer::timeout, this, &InlineCompleter::request);
+        suggestions.setMaxCost(MaxCached);
+
+        connect(editor->document(), &QTextDocument::contentsChange, this, &InlineCompleter::contentsChanged);
+        connect(editor, &CodeEditor::cursorPositionChanged, this, &InlineCompleter::cursorMoved);
+        connect(editor, &CodeEditor::ghostTextAccepted, this, [this]() {
+            ++counters.accepted;
+            reset();
+        });
+        connect(editor, &CodeEditor::ghostTextDismissed, this, [this]() {
+            ++counters.dismissed;
+            reset();
+        });
+        connect(client, &GeminiClient::textReceived, this, &InlineCompleter::received);
+        connect(client, &GeminiClient::finished, this, &InlineCompleter::finished);
+
+        enabled = QSettings("MyDevApp", "Editor").value("inlineCompletion", true).toBool();
+    }
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    void setEnabled(bool on) {
+        enabled = on;
+        QSettings("MyDevApp", "Editor").setValue("inlineCompletion", on);
+        if (!on) {
+            reset();
+        }
+    }
+
+    QString statistics() const {
+        return QString("requests: %1 (%2 cancelled, %3 failed)\nserved from cache: %4, by typing ahead: %5\n"
+                       "accepted: %6, dismissed: %7\nkeystroke to suggestion: %8")
+            .arg(counters.requests)
+            .arg(counters.cancelled)
+            .arg(counters.failed)
+            .arg(counters.cacheHits)
+            .arg(counters.typedAhead)
+            .arg(counters.accepted)
+            .arg(counters.dismissed)
+            .arg(latency.format());
+    }
+
+private slots:
+    void contentsChanged(int from, int charsRemoved, int charsAdded) {
+        // Highlighting marks blocks dirty without changing the text
+        QTextDocument *document = editor->document();
+        if (document->revision() == lastRevision) {
+            return;
+        }
+        lastRevision = document->revision();
+        if (!enabled || editor->isLoading() || editor->isReadOnly()) {
+            reset();
+            return;
+        }
+        // The cursor lands here after the edit; anywhere else is a move
+        expectedCursor = from + charsAdded;
+        keystroke.start();
+
+        // Typing what the suggestion says next consumes it instead of asking again
+        if (!suggestion.isEmpty() && charsRemoved == 0 && from == anchor + consumed) {
+            const QString typed = text(from, from + charsAdded);
+            if (CompletionText::continues(suggestion, consumed, typed)) {
+                consumed += charsAdded;
+                ++counters.typedAhead;
+                return;
+            }
+        }
+        reset();
+        debounce.start();
+    }
+
+    // Runs after contentsChanged for typed text, alone for plain movement
+    void cursorMoved() {
+        const int expected = expectedCursor;
+        expectedCursor = -1;
+        if (editor->textCursor().position() == expected) {
+            if (!suggestion.isEmpty()) {
+                if (consumed < suggestion.size()) {
+                    editor->setGhostText(suggestion.mid(consumed));
+                } else {
+                    reset();
+                }
+            }
+            return;
+        }
+        reset();
+    }
+
+    void request() {
+        if (!enabled || !client->hasApiKey() || editor->isViewingLargeFile() || editor->textCursor().hasSelection()) {
+            return;
+        }
+        const int position = editor->textCursor().position();
+        const int end = editor->document()->characterCount() - 1;
+        const QString prefix = text(qMax(0, position - PrefixChars), position);
+        const QString suffix = text(position, qMin(end, position + SuffixChars));
+
+        requestKey = CompletionText::key(prefix, suffix);
+        requestPosition = position;
+        requestRevision = editor->document()->revision();
+
+        if (const QString *cached = suggestions.object(requestKey)) {
+            ++counters.cacheHits;
+            show(*cached);
+            return;
+        }
+
+        const QString name = editor->fileName().isEmpty() ? QString("untitled") : QFileInfo(editor->fileName()).fileName();
+        const QString prompt = "You are a code completion engine. Reply with only the text to insert at <CURSOR>, "
+                               "without explanations or code fences. Reply with nothing if no completion fits.\n\n"
+                               "File: " + name + "\n" + prefix + "<CURSOR>" + suffix;
+        QJsonObject body;
+        body["contents"] = QJsonArray{QJsonObject{{"role", "user"}, {"parts", QJsonArray{QJsonObject{{"text", prompt}}}}}};
+        body["generationConfig"] = QJsonObject{{"maxOutputTokens", 128}, {"temperature", 0.2}};
+
+        const QString model = QSettings("MyDevApp", "GeminiAPI").value("model", "gemini-pro").toString();
+        pending.clear();
+        requestId = client->generate(model, body, false);
+        ++counters.requests;
+    }
+
+    void received(quint64 id, const QString &text) {
+        if (id == requestId) {
+            pending += text;
+        }
+    }
+
+    void finished(quint64 id, const QString &error) {
+        if (id != requestId) {
+            return;
+        }
+        requestId = 0;
+        if (!error.isEmpty()) {
+            ++counters.failed;
+            return;
+        }
+        const QTextCursor cursor = editor->textCursor();
+        const QString completion = CompletionText::clean(pending, cursor.block().text().left(cursor.positionInBlock()));
+        pending.clear();
+        suggestions.insert(requestKey, new QString(completion));
+        // Anything typed or moved since was already cancelled; this is a guard
+        if (editor->textCursor().position() == requestPosition && editor->document()->revision() == requestRevision) {
+            show(completion);
+        }
+    }
+
+private:
+    struct Counters {
+        qint64 requests = 0;
+        qint64 cancelled = 0;
+        qint64 failed = 0;
+        qint64 cacheHits = 0;
+        qint64 typedAhead = 0;
+        qint64 accepted = 0;
+        qint64 dismissed = 0;
+    };
+
+    QString text(int from, int to) const {
+        QTextCursor cursor(editor->document());
+        cursor.setPosition(from);
+        cursor.setPosition(to, QTextCursor::KeepAnchor);
+        return cursor.selectedText().replace(QChar::ParagraphSeparator, '\n');
+    }
+
+    void show(const QString &completion) {
+        if (completion.isEmpty()) {
+            return;
+        }
+        suggestion = completion;
+        anchor = editor->textCursor().position();
+        consumed = 0;
+        editor->setGhostText(completion);
+        latency.add(keystroke.elapsed());
+    }
+
+    void reset() {
+        debounce.stop();
+        if (requestId) {
+            client->cancel(requestId);
+            requestId = 0;
+            ++counters.cancelled;
+        }
+        pending.clear();
+        suggestion.clear();
+        consumed = 0;
+        editor->clearGhostText();
+    }
+
+    CodeEditor *editor;
+    GeminiClient *client;
+    bool enabled = true;
+    QTimer debounce;
+    QElapsedTimer keystroke;
+    int lastRevision = -1;
+    int expectedCursor = -1;
+
+    quint64 requestId = 0;
+    QByteArray requestKey;
+    int requestPosition = -1;
+    int requestRevision = -1;
+    QString pending;
+
+    QString suggestion;  // Offered at anchor; the first consumed characters have been typed since
+    int anchor = -1;
+    int consumed = 0;
+
+    QCache<QByteArray, QString> suggestions;
+    Counters counters;
+    LatencyHistogram latency;
+};
+
+// One entry of the Gemini chat. revision changes with the text so views
+// can tell a cached layout is stale
+struct ChatMessage {
+    enum Kind : quint8 {
+        User,
+        Assistant,
+        Notice,
+        Error
+    };
+
+    quint64 id = 0;
+    Kind kind = Notice;
+    QString text;
+    QString note;  // Shown next to the sender, e.g. what context was sent
+    int revision = 0;
+};
+
+// The chat transcript as a flat list of messages. Appending touches one row,
+// and streamed text changes only the row it belongs to
+class ChatModel : public QAbstractListModel {
+    Q_OBJECT
+public:
+    using QAbstractListModel::QAbstractListModel;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override {
+        return parent.isValid() ? 0 : int(messages.size());
+    }
+
+    QVariant data(const QModelIndex &index, int role) const override {
+        if (!index.isValid() || index.row() >= messages.size()) {
+            return QVariant();
+        }
+        if (role == Qt::DisplayRole) {
+            return messages[index.row()].text;
+        }
+        return QVariant();
     }
 
-private slots:
-    void executeCommand() {
-        QString command = commandInput->text().trimmed();
-        if (command.isEmpty()) {
-            return;
+    const ChatMessage &message(int row) const {
+        return messages[row];
+    }
+
+    int append(ChatMessage::Kind kind, const QString &text, const QString &note = QString()) {
+        const int row = int(messages.size());
+        beginInsertRows(QModelIndex(), row, row);
+        messages.append({++lastId, kind, text, note, 0});
+        endInsertRows();
+        return row;
+    }
+
+    void appendText(int row, const QString &text) {
+        messages[row].text += text;
+        changed(row);
+    }
+
+    void replace(int row, ChatMessage::Kind kind, const QString &text) {
+        messages[row].kind = kind;
+        messages[row].text = text;
+        changed(row);
+    }
+
+    void clear() {
+        beginResetModel();
+        messages.clear();
+        endResetModel();
+    }
+
+private:
+    void changed(int row) {
+        ++messages[row].revision;
+        const QModelIndex changedIndex = index(row);
+        emit dataChanged(changedIndex, changedIndex, {Qt::DisplayRole});
+    }
+
+    QList<ChatMessage> messages;
+    quint64 lastId = 0;
+};
+
+// Paints chat messages. Gemini's answers are markdown and go through a
+// QTextDocument, but only once a message is actually painted: rows
+// offscreen are sized from an estimate, and the real height replaces it
+// after the first paint, for the view to pick up through rowHeight().
+// Laid-out documents are kept for the most recently painted MaxDocuments
+// messages; their heights are kept for all of them
+class ChatDelegate : public QStyledItemDelegate {
+public:
+    static constexpr int MaxDocuments = 64;
+    static constexpr int Margin = 6;
+
+    ChatDelegate(const ChatModel *model, QAbstractScrollArea *view)
+        : QStyledItemDelegate(view), model(model), view(view) {
+        documents.setMaxCost(MaxDocuments);
+    }
+
+    int rowHeight(int row) const {
+        const ChatMessage &message = model->message(row);
+        const int width = textWidth();
+        Height &height = heights[message.id];
+        if (height.revision != message.revision || (!height.exact && height.width != width)) {
+            height = {message.revision, width, estimateHeight(message, width), false};
         }
-        
-        // Add to history
-        addToHistory(command);
-        
-        // Clear input
-        commandInput->clear();
-        
-        outputDisplay->appendHtml("<span style='color: #DCDCAA;'>> " + command.toHtmlEscaped() + "</span>");
-        
-        // Handle built-in commands
-        if (command == "clear" || command == "cls") {
-            clearTerminal();
-            return;
-        } else if (command == "help") {
-            showHelp();
-            return;
-        } else if (command.startsWith("echo ")) {
-            outputDisplay->appendPlainText(command.mid(5));
-            return;
+        return height.value;
+    }
+
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override {
+        Q_UNUSED(option);
+        return QSize(view->viewport()->width(), rowHeight(index.row()));
+    }
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override {
+        const ChatMessage &message = model->message(index.row());
+        painter->save();
+        if (option.state & QStyle::State_Selected) {
+            painter->fillRect(option.rect, option.palette.color(QPalette::Highlight).darker(250));
+        } else if (message.kind == ChatMessage::User) {
+            painter->fillRect(option.rect, option.palette.color(QPalette::AlternateBase));
         }
-        
-        // Execute external command
-#ifdef Q_OS_WIN
-        process->start("cmd.exe", QStringList() << "/c" << command);
-#else
-        process->start("/bin/sh", QStringList() << "-c" << command);
-#endif
+
+        int top = option.rect.top() + Margin;
+        if (hasHeader(message)) {
+            QFont bold = view->font();
+            bold.setBold(true);
+            painter->setFont(bold);
+            painter->setPen(option.palette.color(QPalette::Text));
+            const QString sender = message.kind == ChatMessage::User ? "You" : "Gemini";
+            const QRect header(option.rect.left() + Margin, top, option.rect.width() - 2 * Margin, headerHeight());
+            painter->drawText(header, Qt::AlignLeft | Qt::AlignVCenter, sender);
+            if (!message.note.isEmpty()) {
+                painter->setFont(view->font());
+                painter->setPen(QColor("#808080"));
+                const int senderWidth = QFontMetrics(bold).horizontalAdvance(sender + ' ');
+                painter->drawText(header.adjusted(senderWidth, 0, 0, 0), Qt::AlignLeft | Qt::AlignVCenter,
+                                  QFontMetrics(view->font()).elidedText(message.note, Qt::ElideRight, header.width() - senderWidth));
+            }
+            top += headerHeight();
+        }
+
+        QTextDocument *document = layout(message, textWidth());
+        painter->translate(option.rect.left() + Margin, top);
+        QAbstractTextDocumentLayout::PaintContext context;
+        context.palette = option.palette;
+        context.palette.setColor(QPalette::Text, textColor(message, option.palette));
+        context.clip = QRectF(0, 0, option.rect.width(), option.rect.bottom() - top);
+        document->documentLayout()->draw(painter, context);
+        painter->restore();
+
+        heights[message.id] = {message.revision, textWidth(), top - option.rect.top() + int(std::ceil(document->size().height())) + Margin, true};
     }
-    
-    void clearTerminal() {
-        outputDisplay->clear();
+
+    void forget() {
+        documents.clear();
+        heights.clear();
     }
-    
-    void showHelp() {
-        outputDisplay->appendHtml("<span style='color: #569CD6;'>Available Commands:</span>");
-        outputDisplay->appendHtml("<span style='color: #DCDCAA;'>clear/cls</span> - Clear terminal output");
-        outputDisplay->appendHtml("<span style='color: #DCDCAA;'>echo [text]</span> - Display text");
-        outputDisplay->appendHtml("<span style='color: #DCDCAA;'>help</span> - Show this help message");
-        outputDisplay->appendPlainText("Any other command will be executed in the system shell");
+
+    QString statistics() const {
+        return QString("transcript: %1 messages, %2 laid out, %3 markdown parses (last %4 us)")
+            .arg(model->rowCount())
+            .arg(documents.size())
+            .arg(parses)
+            .arg(lastParseNsecs / 1000.0, 0, 'f', 1);
     }
-    
-    void readOutput() {
-        QByteArray output = process->readAllStandardOutput();
-        outputDisplay->appendPlainText(QString::fromLocal8Bit(output));
+
+private:
+    struct Height {
+        int revision = -1;
+        int width = -1;
+        int value = 0;
+        bool exact = false;
+    };
+
+    struct Layout {
+        QTextDocument document;
+        int revision = -1;
+    };
+
+    static bool hasHeader(const ChatMessage &message) {
+        return message.kind == ChatMessage::User || message.kind == ChatMessage::Assistant;
     }
-    
-    void readError() {
-        QByteArray error = process->readAllStandardError();
-        outputDisplay->appendHtml("<span style='color: #F14C4C;'>" + 
-                                  QString::fromLocal8Bit(error).toHtmlEscaped() + "</span>");
+
+    static QColor textColor(const ChatMessage &message, const QPalette &palette) {
+        switch (message.kind) {
+        case ChatMessage::Notice:
+            return QColor("#808080");
+        case ChatMessage::Error:
+            return QColor("#F44747");
+        default:
+            return palette.color(QPalette::Text);
+        }
     }
-    
-    void addToHistory(const QString &command) {
-        // Don't add duplicates consecutively
-        if (!commandHistory.isEmpty() && commandHistory.last() == command) {
-            historyIndex = commandHistory.size();
-            return;
+
+    int headerHeight() const {
+        return QFontMetrics(view->font()).height() + 2;
+    }
+
+    int textWidth() const {
+        return qMax(50, view->viewport()->width() - 2 * Margin);
+    }
+
+    // Counts wrapped lines at the average character width; close enough for
+    // rows nobody is looking at
+    int estimateHeight(const ChatMessage &message, int width) const {
+        const QFontMetrics metrics(view->font());
+        const int perLine = qMax(1, width / qMax(1, metrics.averageCharWidth()));
+        qsizetype lines = 0;
+        for (qsizetype start = 0; start <= message.text.size();) {
+            qsizetype end = message.text.indexOf('\n', start);
+            if (end < 0)
+                end = message.text.size();
+            lines += 1 + (end - start) / perLine;
+            start = end + 1;
         }
-        
-        commandHistory.append(command);
-        historyIndex = commandHistory.size();
-        
-        // Limit history size
-        if (commandHistory.size() > 50) {
-            commandHistory.removeFirst();
+        return Margin * 2 + (hasHeader(message) ? headerHeight() : 0) + int(lines) * metrics.lineSpacing();
+    }
+
+    // The message's document, parsed again only when its text changed
+    QTextDocument *layout(const ChatMessage &message, int width) const {
+        Layout *entry = documents.object(message.id);
+        if (!entry) {
+            entry = new Layout;
+            entry->document.setDocumentMargin(0);
+            documents.insert(message.id, entry);
+        }
+        QTextDocument &document = entry->document;
+        if (entry->revision != message.revision) {
+            QElapsedTimer timer;
+            timer.start();
+            document.setDefaultFont(view->font());
+            if (message.kind == ChatMessage::Assistant) {
+                document.setMarkdown(message.text);
+                shadeCodeBlocks(document);
+                ++parses;
+                lastParseNsecs = timer.nsecsElapsed();
+            } else {
+                document.setPlainText(message.text);
+            }
+            entry->revision = message.revision;
         }
+        if (document.textWidth() != width) {
+            document.setTextWidth(width);
+        }
+        return &document;
     }
-    
-    void navigateHistoryUp() {
-        if (commandHistory.isEmpty() || historyIndex <= 0) {
+
+    static void shadeCodeBlocks(QTextDocument &document) {
+        QTextBlockFormat code;
+        code.setBackground(QColor("#2D2D2D"));
+        for (QTextBlock block = document.begin(); block.isValid(); block = block.next()) {
+            if (block.blockFormat().hasProperty(QTextFormat::BlockCodeFence)) {
+                QTextCursor(block).mergeBlockFormat(code);
+            }
+        }
+    }
+
+    const ChatModel *model;
+    QAbstractScrollArea *view;
+    mutable QCache<quint64, Layout> documents;
+    mutable QHash<quint64, Height> heights;
+    mutable qint64 parses = 0;
+    mutable qint64 lastParseNsecs = 0;
+};
+
+// Scrolling list of the messages in a ChatModel. Rows are placed through
+// RowHeights, so appending a message, streaming into the last one or a row
+// replacing its estimated height once painted moves the rows below it by
+// one tree update instead of laying out the whole transcript again. Only
+// a width change re-estimates every row. The view stays pinned to the
+// newest message while it is scrolled to the bottom. Click, Ctrl+click and
+// Shift+click select messages; Ctrl+C copies them
+class ChatView : public QAbstractScrollArea {
+public:
+    ChatView(ChatModel *model, QWidget *parent = nullptr)
+        : QAbstractScrollArea(parent), model(model), delegate(new ChatDelegate(model, this)),
+          selection(new QItemSelectionModel(model, this)) {
+        setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+        setFocusPolicy(Qt::StrongFocus);
+        viewport()->setBackgroundRole(QPalette::Base);
+        connect(model, &ChatModel::rowsInserted, this, [this](const QModelIndex &, int first, int last) {
+            if (first != heights.size()) {
+                relayout();
+                return;
+            }
+            for (int row = first; row <= last; ++row)
+                heights.append(delegate->rowHeight(row));
+            updateScrollBar();
+            viewport()->update();
+        });
+        connect(model, &ChatModel::dataChanged, this, [this](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+            for (int row = topLeft.row(); row <= bottomRight.row() && row < heights.size(); ++row)
+                heights.set(row, delegate->rowHeight(row));
+            updateScrollBar();
+            viewport()->update();
+        });
+        connect(model, &ChatModel::modelReset, this, [this]() {
+            delegate->forget();
+            anchorRow = -1;
+            relayout();
+        });
+        connect(selection, &QItemSelectionModel::selectionChanged, this, [this]() {
+            viewport()->update();
+        });
+        connect(verticalScrollBar(), &QScrollBar::rangeChanged, this, [this](int, int maximum) {
+            if (following)
+                verticalScrollBar()->setValue(maximum);
+        });
+        connect(verticalScrollBar(), &QScrollBar::valueChanged, this, [this](int value) {
+            following = value >= verticalScrollBar()->maximum();
+        });
+        relayout();
+    }
+
+    QString statistics() const {
+        return delegate->statistics() + QString("\ntranscript layout: %1 px over %2 rows, %3 full relayouts")
+                                            .arg(heights.total())
+                                            .arg(heights.size())
+                                            .arg(relayouts);
+    }
+
+protected:
+    // Painting a row lays it out; a height that differs from the estimate
+    // goes into the tree and the rows after it are painted where they now are
+    void paintEvent(QPaintEvent *event) override {
+        QPainter painter(viewport());
+        const int top = verticalScrollBar()->value();
+        const QRect area = event->rect();
+        QStyleOptionViewItem option;
+        option.initFrom(this);
+        bool resized = false;
+        int row = heights.rowAt(top + area.top());
+        for (qint64 y = heights.offset(row) - top; row < heights.size() && y <= area.bottom(); ++row) {
+            const QModelIndex index = model->index(row);
+            option.rect = QRect(0, int(y), viewport()->width(), heights.height(row));
+            option.state.setFlag(QStyle::State_Selected, selection->isSelected(index));
+            delegate->paint(&painter, option, index);
+            const int exact = delegate->rowHeight(row);
+            if (exact != heights.height(row)) {
+                heights.set(row, exact);
+                resized = true;
+            }
+            y += exact;
+        }
+        if (resized) {
+            updateScrollBar();
+            viewport()->update();
+        }
+    }
+
+    void scrollContentsBy(int dx, int dy) override {
+        Q_UNUSED(dx);
+        Q_UNUSED(dy);
+        viewport()->update();
+    }
+
+    void resizeEvent(QResizeEvent *event) override {
+        QAbstractScrollArea::resizeEvent(event);
+        if (viewport()->width() != laidOutWidth) {
+            relayout();
+        } else {
+            updateScrollBar();
+        }
+    }
+
+    void mousePressEvent(QMouseEvent *event) override {
+        if (event->button() != Qt::LeftButton) {
+            QAbstractScrollArea::mousePressEvent(event);
             return;
         }
-        
-        // Store current input if at end of history
-        if (historyIndex == commandHistory.size()) {
-            currentInput = commandInput->text();
+        setFocus();
+        const int row = heights.rowAt(verticalScrollBar()->value() + int(event->position().y()));
+        if (row >= heights.size()) {
+            selection->clearSelection();
+            anchorRow = -1;
+            return;
         }
-        
-        historyIndex--;
-        commandInput->setText(commandHistory.at(historyIndex));
+        const QModelIndex index = model->index(row);
+        if ((event->modifiers() & Qt::ShiftModifier) && anchorRow >= 0) {
+            const QItemSelection range(model->index(qMin(anchorRow, row)), model->index(qMax(anchorRow, row)));
+            selection->select(range, (event->modifiers() & Qt::ControlModifier) ? QItemSelectionModel::Select
+                                                                                : QItemSelectionModel::ClearAndSelect);
+            return;
+        }
+        selection->select(index, (event->modifiers() & Qt::ControlModifier) ? QItemSelectionModel::Toggle
+                                                                           : QItemSelectionModel::ClearAndSelect);
+        anchorRow = row;
     }
-    
-    void navigateHistoryDown() {
-        if (historyIndex >= commandHistory.size()) {
+
+    void keyPressEvent(QKeyEvent *event) override {
+        if (event->matches(QKeySequence::Copy)) {
+            QModelIndexList selected = selection->selectedIndexes();
+            std::sort(selected.begin(), selected.end(), [](const QModelIndex &a, const QModelIndex &b) {
+                return a.row() < b.row();
+            });
+            QStringList texts;
+            for (const QModelIndex &index : std::as_const(selected))
+                texts.append(index.data().toString());
+            QApplication::clipboard()->setText(texts.join("\n\n"));
             return;
         }
-        
-        historyIndex++;
-        
-        if (historyIndex == commandHistory.size()) {
-            commandInput->setText(currentInput);
-        } else {
-            commandInput->setText(commandHistory.at(historyIndex));
+        if (event->matches(QKeySequence::SelectAll)) {
+            if (model->rowCount() > 0)
+                selection->select(QItemSelection(model->index(0), model->index(model->rowCount() - 1)),
+                                  QItemSelectionModel::ClearAndSelect);
+            return;
         }
+        QAbstractScrollArea::keyPressEvent(event);
     }
 
 private:
-    QPlainTextEdit *outputDisplay;
-    QLineEdit *commandInput;
-    QToolButton *clearButton;
-    QProcess *process;
-    QStringList commandHistory;
-    int historyIndex;
-    QString currentInput;
+    // Estimates every row again for the current width
+    void relayout() {
+        laidOutWidth = viewport()->width();
+        heights.clear();
+        for (int row = 0; row < model->rowCount(); ++row)
+            heights.append(delegate->rowHeight(row));
+        ++relayouts;
+        updateScrollBar();
+        viewport()->update();
+    }
+
+    void updateScrollBar() {
+        const int page = viewport()->height();
+        verticalScrollBar()->setPageStep(page);
+        verticalScrollBar()->setSingleStep(3 * fontMetrics().lineSpacing());
+        verticalScrollBar()->setRange(0, int(qMin<qint64>(INT_MAX, qMax<qint64>(0, heights.total() - page))));
+    }
+
+    ChatModel *model;
+    ChatDelegate *delegate;
+    QItemSelectionModel *selection;
+    RowHeights heights;
+    int laidOutWidth = -1;
+    int anchorRow = -1;
+    qint64 relayouts = 0;
+    bool following = true;
 };
 
-// Gemini API client widget
+// Gemini API client widget. Replies stream in through GeminiClient, so
+// text is appended to the chat as each server-sent event arrives instead of
+// after the whole answer. The endpoint base is configurable, which also
+// lets the panel run against a local server replaying canned streams. With
+// "Include editor context" on, each question carries what the code editor
+// shows, packed by an EditorContextBuilder. The transcript is a ChatModel
+// shown by a ChatView, so a long session costs no more to append to than a
+// short one
 class GeminiWidget : public QWidget {
     Q_OBJECT
 public:
-    GeminiWidget(QWidget *parent = nullptr) : QWidget(parent) {
+    GeminiWidget(GeminiClient *client, QWidget *parent = nullptr) : QWidget(parent), client(client) {
         QVBoxLayout *layout = new QVBoxLayout(this);
-        
+
         // API key configuration
         QGroupBox *configGroup = new QGroupBox("Gemini API Configuration", this);
         QFormLayout *configLayout = new QFormLayout(configGroup);
-        
+
         apiKeyInput = new QLineEdit(this);
         apiKeyInput->setEchoMode(QLineEdit::Password);
         apiKeyInput->setPlaceholderText("Enter your Gemini API key");
         configLayout->addRow("API Key:", apiKeyInput);
-        
+
         modelSelector = new QComboBox(this);
         modelSelector->addItems({"gemini-pro", "gemini-ultra"});
         configLayout->addRow("Model:", modelSelector);
-        
+
+        endpointInput = new QLineEdit(this);
+        endpointInput->setPlaceholderText(GeminiClient::DefaultEndpoint);
+        configLayout->addRow("Endpoint:", endpointInput);
+
+        cacheHoursInput = new QSpinBox(this);
+        cacheHoursInput->setRange(0, 24 * 30);
+        cacheHoursInput->setSuffix(" h");
+        cacheHoursInput->setSpecialValueText("Off");
+        cacheHoursInput->setToolTip("How long identical prompts are answered from the response cache");
+        configLayout->addRow("Cache replies:", cacheHoursInput);
+
         saveConfigButton = new QPushButton("Save Configuration", this);
         connect(saveConfigButton, &QPushButton::clicked, this, &GeminiWidget::saveConfig);
         configLayout->addRow("", saveConfigButton);
-        
+
         // Chat interface
         QGroupBox *chatGroup = new QGroupBox("Gemini Chat", this);
         QVBoxLayout *chatLayout = new QVBoxLayout(chatGroup);
-        
-        chatOutput = new QTextEdit(this);
-        chatOutput->setReadOnly(true);
-        chatLayout->addWidget(chatOutput);
-        
+
+        transcript = new ChatModel(this);
+        chatView = new ChatView(transcript, this);
+        chatLayout->addWidget(chatView);
+
         chatInput = new QTextEdit(this);
         chatInput->setPlaceholderText("Type your message to Gemini...");
         chatInput->setMaximumHeight(100);
         chatLayout->addWidget(chatInput);
-        
+
+        includeContextBox = new QCheckBox("Include editor context", this);
+        includeContextBox->setToolTip("Send the selection, the function around the cursor and nearby code with each message");
+        includeContextBox->setChecked(QSettings("MyDevApp", "GeminiAPI").value("includeContext", true).toBool());
+        connect(includeContextBox, &QCheckBox::toggled, this, [](bool checked) {
+            QSettings("MyDevApp", "GeminiAPI").setValue("includeContext", checked);
+        });
+        chatLayout->addWidget(includeContextBox);
+
         QPushButton *sendButton = new QPushButton("Send", this);
         connect(sendButton, &QPushButton::clicked, this, &GeminiWidget::sendMessage);
         chatLayout->addWidget(sendButton);
-        
+
         // Add all components to main layout
         layout->addWidget(configGroup);
         layout->addWidget(chatGroup);
-        
-        // Set up network manager for API requests
-        //networkManager = new QNetworkAccessManager(this);
-        //connect(networkManager, &QNetworkAccessManager::finished, this, &GeminiWidget::handleApiResponse);
-        
+
+        // Replies for other requests on the shared client are ignored
+        connect(client, &GeminiClient::textReceived, this, &GeminiWidget::appendAnswer);
+        connect(client, &GeminiClient::retrying, this, &GeminiWidget::showRetry);
+        connect(client, &GeminiClient::finished, this, &GeminiWidget::finishAnswer);
+
         // Load saved configuration
         loadConfig();
     }
 
+    void setContextEditor(CodeEditor *editor) {
+        contextEditor = editor;
+    }
+
+    QString statistics() const {
+        return contextBuilder.statistics() + '\n' + chatView->statistics();
+    }
+
 private slots:
     void saveConfig() {
         QSettings settings("MyDevApp", "GeminiAPI");
         settings.setValue("apiKey", apiKeyInput->text());
         settings.setValue("model", modelSelector->currentText());
-        
-        chatOutput->append("<i>Configuration saved.</i>");
+        settings.setValue("endpoint", endpointInput->text().trimmed());
+        settings.setValue("cacheTtlHours", cacheHoursInput->value());
+        client->responseCache().setTtlHours(cacheHoursInput->value());
+        client->setApiKey(apiKeyInput->text());
+        client->setEndpoint(endpointInput->text());
+
+        transcript->append(ChatMessage::Notice, "Configuration saved.");
     }
-    
+
     void loadConfig() {
         QSettings settings("MyDevApp", "GeminiAPI");
         apiKeyInput->setText(settings.value("apiKey").toString());
-        
+        endpointInput->setText(settings.value("endpoint").toString());
+        cacheHoursInput->setValue(client->responseCache().ttlHours());
+        client->setApiKey(apiKeyInput->text());
+        client->setEndpoint(endpointInput->text());
+
         QString savedModel = settings.value("model").toString();
         if (!savedModel.isEmpty()) {
             int index = modelSelector->findText(savedModel);
@@ -860,82 +8683,110 @@ private slots:
             }
         }
     }
-    
+
     void sendMessage() {
         QString message = chatInput->toPlainText().trimmed();
         if (message.isEmpty()) return;
-        
-        chatOutput->append("<b>You:</b> " + message);
+
+        QString summary;
+        QString context;
+        if (contextEditor && includeContextBox->isChecked()) {
+            const int budget = QSettings("MyDevApp", "GeminiAPI")
+                                   .value("contextTokens", EditorContextBuilder::DefaultTokenBudget).toInt();
+            context = contextBuilder.build(contextEditor->contextSource(), budget, &summary);
+        }
+
+        transcript->append(ChatMessage::User, message, summary.isEmpty() ? QString() : "+ " + summary);
         chatInput->clear();
-        
+
         // Create API request
         QString apiKey = apiKeyInput->text();
         if (apiKey.isEmpty()) {
-            chatOutput->append("<span style='color: red;'>Error: API key is required!</span>");
+            transcript->append(ChatMessage::Error, "Error: API key is required!");
             return;
         }
-        
-        QString model = modelSelector->currentText();
-        QString endpoint = "https://generativelanguage.googleapis.com/v1/models/" + model + ":generateContent?key=" + apiKey;
-        
-        QNetworkRequest request(QUrl(endpoint));
-        request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-        
+
+        // A new question supersedes an answer still streaming
+        if (client->isActive(currentRequest)) {
+            client->cancel(currentRequest);
+            if (!answerStarted) {
+                transcript->replace(replyRow, ChatMessage::Notice, "Cancelled.");
+            }
+        }
+        client->setApiKey(apiKey);
+        client->setEndpoint(endpointInput->text());
+
         QJsonObject requestBody;
         QJsonArray contents;
         QJsonObject content;
         content["role"] = "user";
-        content["parts"] = QJsonArray{QJsonObject{{"text", message}}};
+        QJsonArray parts;
+        if (!context.isEmpty()) {
+            parts.append(QJsonObject{{"text", context}});
+        }
+        parts.append(QJsonObject{{"text", message}});
+        content["parts"] = parts;
         contents.append(content);
         requestBody["contents"] = contents;
-        
-        QJsonDocument doc(requestBody);
-        
-        chatOutput->append("<i>Waiting for Gemini response...</i>");
-        networkManager->post(request, doc.toJson());
+
+        // The reply takes over this row when its first text arrives
+        replyRow = transcript->append(ChatMessage::Notice, "Waiting for Gemini response...");
+        answerStarted = false;
+        currentRequest = client->generate(modelSelector->currentText(), requestBody);
     }
-    
-    void handleApiResponse(QNetworkReply *reply) {
-        if (reply->error() != QNetworkReply::NoError) {
-            chatOutput->append("<span style='color: red;'>Error: " + reply->errorString() + "</span>");
-            reply->deleteLater();
+
+    void appendAnswer(quint64 id, const QString &text) {
+        if (id != currentRequest) {
             return;
         }
-        
-        QByteArray responseData = reply->readAll();
-        QJsonDocument doc = QJsonDocument::fromJson(responseData);
-        
-        if (doc.isObject()) {
-            QJsonObject obj = doc.object();
-            
-            if (obj.contains("candidates")) {
-                QJsonArray candidates = obj["candidates"].toArray();
-                if (!candidates.isEmpty()) {
-                    QJsonObject candidate = candidates.first().toObject();
-                    QJsonObject content = candidate["content"].toObject();
-                    QJsonArray parts = content["parts"].toArray();
-                    if (!parts.isEmpty()) {
-                        QString text = parts.first().toObject()["text"].toString();
-                        chatOutput->append("<b>Gemini:</b> " + text);
-                    }
-                }
-            } else if (obj.contains("error")) {
-                QJsonObject error = obj["error"].toObject();
-                chatOutput->append("<span style='color: red;'>API Error: " + 
-                                  error["message"].toString() + "</span>");
-            }
+        if (!answerStarted) {
+            answerStarted = true;
+            transcript->replace(replyRow, ChatMessage::Assistant, text);
+        } else {
+            transcript->appendText(replyRow, text);
+        }
+    }
+
+    void showRetry(quint64 id, int attempt, int delayMs) {
+        if (id == currentRequest && !answerStarted) {
+            transcript->replace(replyRow, ChatMessage::Notice,
+                                QString("Gemini is busy; retrying in %1 s (attempt %2 of %3)...")
+                                    .arg(delayMs / 1000.0, 0, 'f', 1)
+                                    .arg(attempt)
+                                    .arg(GeminiClient::MaxAttempts));
+        }
+    }
+
+    void finishAnswer(quint64 id, const QString &error) {
+        if (id != currentRequest) {
+            return;
+        }
+        if (!error.isEmpty() && answerStarted) {
+            transcript->append(ChatMessage::Error, error);
+        } else if (!error.isEmpty()) {
+            transcript->replace(replyRow, ChatMessage::Error, error);
+        } else if (!answerStarted) {
+            transcript->replace(replyRow, ChatMessage::Notice, "Gemini returned no text.");
         }
-        
-        reply->deleteLater();
     }
 
 private:
+    GeminiClient *client;
     QLineEdit *apiKeyInput;
     QComboBox *modelSelector;
+    QLineEdit *endpointInput;
+    QSpinBox *cacheHoursInput;
     QPushButton *saveConfigButton;
-    QTextEdit *chatOutput;
+    ChatModel *transcript;
+    ChatView *chatView;
     QTextEdit *chatInput;
-    QNetworkAccessManager *networkManager;
+    QCheckBox *includeContextBox;
+    CodeEditor *contextEditor = nullptr;
+    EditorContextBuilder contextBuilder;
+
+    quint64 currentRequest = 0;
+    int replyRow = -1;
+    bool answerStarted = false;
 };
 
 // Main application window
@@ -958,7 +8809,7 @@ public:
         QLabel *ideTitle = new QLabel("Code Editor", this);
         ideTitle->setStyleSheet("font-weight: bold; font-size: 14px;");
         
-        CodeEditor *codeEditor = new CodeEditor(this);
+        codeEditor = new CodeEditor(this);
         codeEditor->setPlaceholderText("Write your code here...");
         
         ideLayout->addWidget(ideTitle);
@@ -971,7 +8822,10 @@ public:
         QLabel *geminiTitle = new QLabel("Gemini AI", this);
         geminiTitle->setStyleSheet("font-weight: bold; font-size: 14px;");
         
-        GeminiWidget *geminiWidget = new GeminiWidget(this);
+        geminiClient = new GeminiClient(this);
+        GeminiWidget *geminiWidget = new GeminiWidget(geminiClient, this);
+        geminiWidget->setContextEditor(codeEditor);
+        inlineCompleter = new InlineCompleter(codeEditor, geminiClient, this);
         
         geminiLayout->addWidget(geminiTitle);
         geminiLayout->addWidget(geminiWidget);
@@ -996,15 +8850,162 @@ public:
         
         mainLayout->addWidget(mainSplitter);
         setCentralWidget(centralWidget);
+
+        // Project tree
+        QDockWidget *projectDock = new QDockWidget("Project", this);
+        projectTree = new ProjectTreeWidget(projectDock);
+        projectTree->setRootPath(QDir::currentPath());
+        projectDock->setWidget(projectTree);
+        addDockWidget(Qt::LeftDockWidgetArea, projectDock);
+        connect(projectTree, &ProjectTreeWidget::openFile, this, &MainWindow::openFile);
+
+        // Quick open palette over the same root, kept current by the tree's watcher
+        quickOpen = new QuickOpenDialog(this);
+        quickOpen->setRootPath(projectTree->projectRoot());
+        connect(quickOpen, &QuickOpenDialog::openFile, this, &MainWindow::openFile);
+        connect(&projectTree->projectModel()->directoryWatcher(), &DirectoryWatcher::directoryChanged,
+                quickOpen, &QuickOpenDialog::applyChanges);
+
+        // Find in files; the watcher also keeps its index current
+        searchDock = new QDockWidget("Search", this);
+        searchPanel = new SearchPanel(searchDock);
+        searchPanel->setRootPath(projectTree->projectRoot());
+        connect(&projectTree->projectModel()->directoryWatcher(), &DirectoryWatcher::directoryChanged,
+                searchPanel, &SearchPanel::applyChanges);
+        searchDock->setWidget(searchPanel);
+        addDockWidget(Qt::BottomDockWidgetArea, searchDock);
+        searchDock->hide();
+        connect(searchPanel, &SearchPanel::openLocation, this, &MainWindow::openFileAt);
+
+        // Build runner and its problems list
+        problemsDock = new QDockWidget("Problems", this);
+        problemsPanel = new ProblemsPanel(problemsDock);
+        problemsPanel->setRootPath(projectTree->projectRoot());
+        problemsDock->setWidget(problemsPanel);
+        addDockWidget(Qt::BottomDockWidgetArea, problemsDock);
+        problemsDock->hide();
+        connect(problemsPanel, &ProblemsPanel::openLocation, this, &MainWindow::openFileAt);
+        connect(problemsPanel, &ProblemsPanel::buildFinished, this, [this](const QString &summary) {
+            statusBar()->showMessage(summary);
+        });
+
+        // Debug panel, hidden until toggled from the View menu
+        debugDock = new QDockWidget("Debug", this);
+        debugPanel = new DebugPanel(debugDock);
+        debugDock->setWidget(debugPanel);
+        addDockWidget(Qt::BottomDockWidgetArea, debugDock);
+        debugDock->hide();
+
+        ProjectModel *projectModel = projectTree->projectModel();
+        debugPanel->addSection("Project tree", [projectModel]() {
+            const ProjectModel::Stats stats = projectModel->stats();
+            return QString("nodes: %1\ndirectories: %2\nunique names: %3\nmemory: %4 KB (%5 bytes/node)")
+                .arg(stats.nodes)
+                .arg(stats.directories)
+                .arg(stats.uniqueNames)
+                .arg(stats.bytes / 1024)
+                .arg(stats.nodes > 0 ? double(stats.bytes) / stats.nodes : 0.0, 0, 'f', 1);
+        });
+        debugPanel->addSection("File watcher", [projectModel]() {
+            const DirectoryWatcher::Counters &counters = projectModel->directoryWatcher().counters();
+            return QString("events received: %1\nevents coalesced: %2\nchanges applied: %3\n"
+                           "rescans: %4\nwatches: %5\npolled directories: %6")
+                .arg(counters.received)
+                .arg(counters.coalesced)
+                .arg(projectModel->stats().appliedChanges)
+                .arg(counters.rescans)
+                .arg(counters.watches)
+                .arg(counters.polled);
+        });
+        debugPanel->addSection("Quick open", [this]() {
+            return quickOpen->statistics();
+        });
+        debugPanel->addSection("Terminal", [terminal]() {
+            return terminal->scrollbackStatistics();
+        });
+        debugPanel->addSection("Build", [this]() {
+            return problemsPanel->statistics();
+        });
+        debugPanel->addSection("Gemini", [this, geminiWidget]() {
+            return geminiClient->statistics() + '\n' + geminiWidget->statistics();
+        });
+        debugPanel->addSection("Inline completion", [this]() {
+            return inlineCompleter->statistics();
+        });
         
         // Create menu bar
         setupMenus();
         
         // Create status bar
         statusBar()->showMessage("Ready");
+
+        loadProgressBar = new QProgressBar(this);
+        loadProgressBar->setRange(0, 1000);
+        loadProgressBar->setMaximumWidth(200);
+        loadProgressBar->hide();
+        statusBar()->addPermanentWidget(loadProgressBar);
+
+        connect(codeEditor, &CodeEditor::loadProgress, this, [this](qint64 bytesRead, qint64 totalBytes) {
+            loadProgressBar->setValue(totalBytes > 0 ? int(bytesRead * 1000 / totalBytes) : 0);
+            loadProgressBar->show();
+        });
+        connect(codeEditor, &CodeEditor::loadFinished, this, [this](bool ok) {
+            loadProgressBar->hide();
+            statusBar()->showMessage((ok ? "Opened " : "Failed to open ") + currentFile);
+            if (ok && pendingLine > 0) {
+                codeEditor->goToLine(pendingLine);
+            }
+            pendingLine = 0;
+        });
+        connect(codeEditor, &CodeEditor::saveFinished, this,
+                [this](bool ok, qint64 bytes, qint64 msecs, const QString &error) {
+            if (!ok) {
+                statusBar()->showMessage("Failed to save " + currentFile + ": " + error);
+                return;
+            }
+            const double megabytes = bytes / (1024.0 * 1024.0);
+            const double rate = megabytes * 1000.0 / qMax<qint64>(1, msecs);
+            statusBar()->showMessage(QString("Saved %1 (%2 MB in %3 ms, %4 MB/s)")
+                                     .arg(currentFile)
+                                     .arg(megabytes, 0, 'f', 2)
+                                     .arg(msecs)
+                                     .arg(rate, 0, 'f', 1));
+        });
     }
 
 private:
+    void openFile(const QString &fileName) {
+        if (!codeEditor->load(fileName)) {
+            QMessageBox::warning(this, "Open File", "Cannot open " + fileName);
+            pendingLine = 0;
+            return;
+        }
+        currentFile = fileName;
+        statusBar()->showMessage("Loading " + fileName + "...");
+    }
+
+    void openFileAt(const QString &fileName, int line) {
+        if (fileName == currentFile && !codeEditor->isLoading()) {
+            codeEditor->goToLine(line);
+            return;
+        }
+        pendingLine = line;
+        openFile(fileName);
+    }
+
+    void saveFile() {
+        if (currentFile.isEmpty()) {
+            const QString fileName = QFileDialog::getSaveFileName(this, "Save File");
+            if (fileName.isEmpty()) {
+                return;
+            }
+            currentFile = fileName;
+        }
+        if (codeEditor->save(currentFile)) {
+            statusBar()->showMessage("Saving " + currentFile + "...");
+        }
+    }
+
     void setupMenus() {
         // File menu
         QMenu *fileMenu = menuBar()->addMenu("&File");
@@ -1014,9 +9015,31 @@ private:
         
         QAction *openAction = fileMenu->addAction("&Open");
         openAction->setShortcut(QKeySequence::Open);
+        connect(openAction, &QAction::triggered, this, [this]() {
+            const QString fileName = QFileDialog::getOpenFileName(this, "Open File");
+            if (!fileName.isEmpty()) {
+                openFile(fileName);
+            }
+        });
+
+        QAction *quickOpenAction = fileMenu->addAction("&Quick Open...");
+        quickOpenAction->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_P));
+        connect(quickOpenAction, &QAction::triggered, quickOpen, &QuickOpenDialog::popup);
+
+        QAction *openFolderAction = fileMenu->addAction("Open &Folder...");
+        connect(openFolderAction, &QAction::triggered, this, [this]() {
+            const QString path = QFileDialog::getExistingDirectory(this, "Open Folder", projectTree->projectRoot());
+            if (!path.isEmpty()) {
+                projectTree->setRootPath(path);
+                quickOpen->setRootPath(projectTree->projectRoot());
+                searchPanel->setRootPath(projectTree->projectRoot());
+                problemsPanel->setRootPath(projectTree->projectRoot());
+            }
+        });
         
         QAction *saveAction = fileMenu->addAction("&Save");
         saveAction->setShortcut(QKeySequence::Save);
+        connect(saveAction, &QAction::triggered, this, &MainWindow::saveFile);
         
         fileMenu->addSeparator();
         
@@ -1043,6 +9066,44 @@ private:
         
         QAction *pasteAction = editMenu->addAction("&Paste");
         pasteAction->setShortcut(QKeySequence::Paste);
+
+        editMenu->addSeparator();
+
+        QAction *findAction = editMenu->addAction("&Find...");
+        findAction->setShortcut(QKeySequence::Find);
+        connect(findAction, &QAction::triggered, this, [this]() {
+            bool ok;
+            const QString text = QInputDialog::getText(this, "Find", "Find:", QLineEdit::Normal, lastSearch, &ok);
+            if (ok && !text.isEmpty()) {
+                lastSearch = text;
+                codeEditor->findText(text);
+            }
+        });
+
+        QAction *gotoLineAction = editMenu->addAction("&Go to Line...");
+        gotoLineAction->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_G));
+        connect(gotoLineAction, &QAction::triggered, this, [this]() {
+            bool ok;
+            const int line = QInputDialog::getInt(this, "Go to Line", "Line:", 1, 1, INT_MAX, 1, &ok);
+            if (ok) {
+                codeEditor->goToLine(line);
+            }
+        });
+
+        QAction *findInFilesAction = editMenu->addAction("Find in F&iles...");
+        findInFilesAction->setShortcut(QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_F));
+        connect(findInFilesAction, &QAction::triggered, this, [this]() {
+            searchDock->show();
+            searchDock->raise();
+            searchPanel->focusInput();
+        });
+
+        editMenu->addSeparator();
+
+        QAction *inlineCompletionAction = editMenu->addAction("&Inline AI Completion");
+        inlineCompletionAction->setCheckable(true);
+        inlineCompletionAction->setChecked(inlineCompleter->isEnabled());
+        connect(inlineCompletionAction, &QAction::toggled, inlineCompleter, &InlineCompleter::setEnabled);
         
         // View menu
         QMenu *viewMenu = menuBar()->addMenu("&View");
@@ -1054,7 +9115,54 @@ private:
         QAction *toggleGeminiAction = viewMenu->addAction("Toggle &Gemini Panel");
         toggleGeminiAction->setCheckable(true);
         toggleGeminiAction->setChecked(true);
+
+        viewMenu->addSeparator();
+
+        QAction *backgroundHighlightAction = viewMenu->addAction("&Background Highlighting");
+        backgroundHighlightAction->setCheckable(true);
+        backgroundHighlightAction->setChecked(false);
+        connect(backgroundHighlightAction, &QAction::triggered, codeEditor, &CodeEditor::toggleBackgroundHighlighting);
+
+        viewMenu->addAction(searchDock->toggleViewAction());
+        viewMenu->addAction(problemsDock->toggleViewAction());
+        viewMenu->addAction(debugDock->toggleViewAction());
+
+        // Build menu
+        QMenu *buildMenu = menuBar()->addMenu("&Build");
+
+        QAction *buildAction = buildMenu->addAction("&Build Project");
+        buildAction->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_B));
+        connect(buildAction, &QAction::triggered, this, [this]() {
+            problemsDock->show();
+            problemsDock->raise();
+            problemsPanel->startBuild();
+            statusBar()->showMessage("Building...");
+        });
+
+        QAction *stopBuildAction = buildMenu->addAction("&Stop Build");
+        connect(stopBuildAction, &QAction::triggered, problemsPanel, &ProblemsPanel::stopBuild);
+
+        buildMenu->addSeparator();
+
+        QAction *configureBuildAction = buildMenu->addAction("&Configure Build Command...");
+        connect(configureBuildAction, &QAction::triggered, problemsPanel, &ProblemsPanel::configure);
     }
+
+    CodeEditor *codeEditor;
+    ProjectTreeWidget *projectTree;
+    QuickOpenDialog *quickOpen;
+    QDockWidget *searchDock;
+    SearchPanel *searchPanel;
+    QDockWidget *problemsDock;
+    ProblemsPanel *problemsPanel;
+    GeminiClient *geminiClient;
+    InlineCompleter *inlineCompleter;
+    QDockWidget *debugDock;
+    DebugPanel *debugPanel;
+    QProgressBar *loadProgressBar;
+    QString currentFile;
+    QString lastSearch;
+    int pendingLine = 0;
 };
 
 int main(int argc, char *argv[])
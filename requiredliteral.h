@@ -0,0 +1,106 @@
+#ifndef REQUIREDLITERAL_H
+#define REQUIREDLITERAL_H
+
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+
+// Index of the last character of the escape whose letter or digit is at i:
+// \xHH, \x{...}, \uHHHH, \cX, octal and back references, \o{...}, \p{...},
+// \N{...}, \g{...} and \k<...> take an operand; \d, \b and the like do not
+inline qsizetype regexEscapeEnd(const QString &pattern, qsizetype i) {
+    const qsizetype size = pattern.size();
+    const auto skipWhile = [&](qsizetype max, auto accept) {
+        for (; max > 0 && i + 1 < size && accept(pattern[i + 1]); --max)
+            ++i;
+    };
+    const auto isHex = [](QChar c) {
+        return (c >= u'0' && c <= u'9') || (c >= u'a' && c <= u'f') || (c >= u'A' && c <= u'F');
+    };
+    const auto isOctal = [](QChar c) {
+        return c >= u'0' && c <= u'7';
+    };
+    // Skips a {...}, <...> or '...' operand if one follows
+    const auto skipBracketed = [&]() {
+        if (i + 1 >= size)
+            return false;
+        const QChar open = pattern[i + 1];
+        const QChar close = open == u'{' ? u'}' : open == u'<' ? u'>' : open == u'\'' ? u'\'' : QChar();
+        if (close.isNull())
+            return false;
+        const qsizetype end = pattern.indexOf(close, i + 2);
+        i = end < 0 ? size - 1 : end;
+        return true;
+    };
+
+    const QChar letter = pattern[i];
+    if (letter == u'x') {
+        if (!skipBracketed())
+            skipWhile(2, isHex);
+    } else if (letter == u'u') {
+        skipWhile(4, isHex);
+    } else if (letter == u'c') {
+        skipWhile(1, [](QChar) { return true; });
+    } else if (letter == u'0') {
+        skipWhile(2, isOctal);
+    } else if (letter >= u'1' && letter <= u'9') {
+        skipWhile(2, [](QChar c) { return c.isDigit(); });
+    } else if (letter == u'o' || letter == u'N' || letter == u'g' || letter == u'k') {
+        skipBracketed();
+    } else if (letter == u'p' || letter == u'P') {
+        if (!skipBracketed())
+            skipWhile(1, [](QChar) { return true; });
+    }
+    return i;
+}
+
+// Longest run of plain characters that every match of a regex contains; the
+// project search looks it up in the trigram index to skip files that cannot
+// match. Runs inside a group that may match zero times do not count; groups
+// records the best run seen before each open group
+inline QString requiredLiteral(const QString &pattern) {
+    if (pattern.contains('|') || pattern.contains("(?"))
+        return QString();
+    QString best;
+    QString run;
+    QStringList groups;
+    for (qsizetype i = 0; i < pattern.size(); ++i) {
+        const QChar c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size() && !pattern[i + 1].isLetterOrNumber()) {
+            run += pattern[++i];
+            continue;
+        }
+        if (c == '\\') {
+            // Whatever the escape matches, it is not its own spelling
+            if (i + 1 < pattern.size())
+                i = regexEscapeEnd(pattern, i + 1);
+        } else if (c == '[') {
+            while (i + 1 < pattern.size() && pattern[++i] != ']') {
+                if (pattern[i] == '\\')
+                    ++i;
+            }
+        } else if (c == '*' || c == '?' || c == '{') {
+            if (!run.isEmpty())
+                run.chop(1);  // The quantified character is optional
+            while (c == '{' && i + 1 < pattern.size() && pattern[++i] != '}') {
+            }
+        } else if (!QStringView(u"()+.^$").contains(c)) {
+            run += c;
+            continue;
+        }
+        if (run.size() > best.size())
+            best = run;
+        run.clear();
+        if (c == '(') {
+            groups.append(best);
+        } else if (c == ')' && !groups.isEmpty()) {
+            const QString outer = groups.takeLast();
+            const QStringView next = QStringView(pattern).sliced(i + 1);
+            if (next.startsWith(u'?') || next.startsWith(u'*') || next.startsWith(u"{0"))
+                best = outer;
+        }
+    }
+    return run.size() > best.size() ? run : best;
+}
+
+#endif // REQUIREDLITERAL_H
@@ -0,0 +1,73 @@
+#ifndef ROWHEIGHTS_H
+#define ROWHEIGHTS_H
+
+#include <QList>
+
+// Heights of a list of rows with their prefix sums in a Fenwick tree: the
+// offset of a row, the row at a given y, appending a row and changing one
+// row's height each cost O(log n) however long the list is
+class RowHeights {
+public:
+    int size() const {
+        return int(heights.size());
+    }
+
+    int height(int row) const {
+        return heights[row];
+    }
+
+    qint64 total() const {
+        return offset(size());
+    }
+
+    void clear() {
+        heights.clear();
+        tree.clear();
+    }
+
+    // Node i (stored at i - 1) sums the rows (i - lowbit(i), i]
+    void append(int height) {
+        heights.append(height);
+        const int node = size();
+        qint64 sum = height;
+        for (int i = node - 1, stop = node - (node & -node); i > stop; i -= i & -i)
+            sum += tree[i - 1];
+        tree.append(sum);
+    }
+
+    void set(int row, int height) {
+        const qint64 delta = height - heights[row];
+        heights[row] = height;
+        for (int i = row + 1; i <= size(); i += i & -i)
+            tree[i - 1] += delta;
+    }
+
+    // Total height of the rows above row
+    qint64 offset(int row) const {
+        qint64 sum = 0;
+        for (int i = row; i > 0; i -= i & -i)
+            sum += tree[i - 1];
+        return sum;
+    }
+
+    // The row covering y, or size() below the last one
+    int rowAt(qint64 y) const {
+        int row = 0;
+        int step = 1;
+        while (step * 2 <= size())
+            step *= 2;
+        for (; step > 0; step /= 2) {
+            if (row + step <= size() && tree[row + step - 1] <= y) {
+                row += step;
+                y -= tree[row - 1];
+            }
+        }
+        return row;
+    }
+
+private:
+    QList<int> heights;
+    QList<qint64> tree;
+};
+
+#endif // ROWHEIGHTS_H
@@ -5,7 +5,16 @@
 
 QT = core gui widgets
 
-HEADERS =
+HEADERS = \
+   $$PWD/commandhistory.h \
+   $$PWD/completiontext.h \
+   $$PWD/cpplexer.h \
+   $$PWD/editorcontext.h \
+   $$PWD/geminiclient.h \
+   $$PWD/pathindex.h \
+   $$PWD/requiredliteral.h \
+   $$PWD/rowheights.h \
+   $$PWD/threadpool.h
 
 SOURCES = \
    $$PWD/qt6-project-file-three-panel.cpp \
@@ -13,5 +22,7 @@ SOURCES = \
 
 INCLUDEPATH =
 
+unix:!macx: LIBS += -lutil
+
 #DEFINES = 
 
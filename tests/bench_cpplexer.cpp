@@ -0,0 +1,96 @@
+#include <QtTest>
+
+#include "cpplexer.h"
+
+// The QRegularExpression rule list CppLexer replaced, run the way
+// highlightBlock ran it: every rule over every line, then the block
+// comment scan. Only the patterns matter here; formats are not applied
+struct RuleList {
+    QList<QRegularExpression> rules;
+
+    RuleList() {
+        const QStringList keywords = {
+            "class", "const", "enum", "explicit", "friend", "inline", "namespace", "operator",
+            "private", "protected", "public", "signals", "slots", "static", "template", "typedef",
+            "typename", "union", "virtual", "volatile", "break", "case", "catch", "continue",
+            "default", "delete", "do", "else", "for", "if", "new", "return",
+            "switch", "throw", "try", "while", "auto", "bool", "char", "double",
+            "float", "int", "long", "short", "signed", "struct", "unsigned", "void",
+            "include", "define", "ifdef", "ifndef", "endif", "undef", "pragma"
+        };
+        for (const QString &keyword : keywords)
+            rules.append(QRegularExpression("\\b" + keyword + "\\b"));
+        rules.append(QRegularExpression("\\b[A-Za-z0-9_]+::[A-Za-z0-9_]+\\b"));
+        rules.append(QRegularExpression("\\bQ[A-Za-z]+\\b"));
+        rules.append(QRegularExpression("\\b[A-Za-z0-9_]+(?=\\()"));
+        rules.append(QRegularExpression("//[^\n]*"));
+        rules.append(QRegularExpression("\".*\""));
+        rules.append(QRegularExpression("\\b[0-9]+\\b"));
+        rules.append(QRegularExpression("#[^\n]*"));
+    }
+
+    int highlight(const QString &text, int previousState, int *state) const {
+        int spans = 0;
+        for (const QRegularExpression &rule : rules) {
+            QRegularExpressionMatchIterator it = rule.globalMatch(text);
+            while (it.hasNext()) {
+                it.next();
+                ++spans;
+            }
+        }
+        *state = 0;
+        qsizetype start = previousState == 1 ? 0 : text.indexOf("/*");
+        while (start >= 0) {
+            const QRegularExpressionMatch match = QRegularExpression("\\*/").match(text, start);
+            qsizetype length;
+            if (match.capturedStart() == -1) {
+                *state = 1;
+                length = text.size() - start;
+            } else {
+                length = match.capturedStart() - start + match.capturedLength();
+            }
+            ++spans;
+            start = text.indexOf("/*", start + length);
+        }
+        return spans;
+    }
+};
+
+class BenchCppLexer : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase() {
+        // The application's own source is a realistic, large C++ file
+        QFile file(QFINDTESTDATA("../qt6-three-panel-app.cpp"));
+        if (!file.open(QIODevice::ReadOnly))
+            QSKIP("qt6-three-panel-app.cpp not found");
+        lines = QString::fromUtf8(file.readAll()).split('\n');
+    }
+
+    void lexer() {
+        qint64 spans = 0;
+        QBENCHMARK {
+            int state = CppLexer::Normal;
+            for (const QString &line : std::as_const(lines))
+                state = CppLexer::lex(line, state, [&spans](int, int, TokenKind) { ++spans; });
+        }
+        QVERIFY(spans > 0);
+    }
+
+    void ruleList() {
+        const RuleList rules;
+        qint64 spans = 0;
+        QBENCHMARK {
+            int state = 0;
+            for (const QString &line : std::as_const(lines))
+                spans += rules.highlight(line, state, &state);
+        }
+        QVERIFY(spans > 0);
+    }
+
+private:
+    QStringList lines;
+};
+
+QTEST_GUILESS_MAIN(BenchCppLexer)
+#include "bench_cpplexer.moc"
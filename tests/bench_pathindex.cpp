@@ -0,0 +1,93 @@
+#include <QtTest>
+
+#include "pathindex.h"
+
+// Deterministic project-like paths: nested directories of source files
+static QList<QByteArray> makePaths(int count) {
+    static const char *const dirs[] = {"src", "include", "tests", "third_party", "docs", "tools",
+                                       "core", "gui", "net", "widgets", "platform", "util"};
+    static const char *const names[] = {"main", "window", "model", "view", "parser", "lexer",
+                                        "socket", "buffer", "index", "search", "config", "theme"};
+    static const char *const suffixes[] = {".cpp", ".h", ".txt", ".json", ".md", ".py"};
+    QList<QByteArray> paths;
+    paths.reserve(count);
+    quint32 seed = 1;
+    const auto next = [&seed](int bound) {
+        seed = seed * 1664525u + 1013904223u;
+        return int((seed >> 16) % quint32(bound));
+    };
+    for (int i = 0; i < count; ++i) {
+        QByteArray path;
+        for (int depth = 1 + next(4); depth > 0; --depth)
+            path += QByteArray(dirs[next(12)]) + '/';
+        path += names[next(12)] + ('_' + QByteArray::number(i % 97)) + suffixes[next(6)];
+        paths.append(path);
+    }
+    return paths;
+}
+
+class BenchPathIndex : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase() {
+        paths = makePaths(PathCount);
+        for (const QByteArray &path : std::as_const(paths))
+            index.append(path);
+    }
+
+    void build() {
+        QBENCHMARK {
+            PathIndex built;
+            for (const QByteArray &path : std::as_const(paths))
+                built.append(path);
+        }
+    }
+
+    void query_data() {
+        QTest::addColumn<QString>("query");
+
+        QTest::newRow("file name") << "main";
+        QTest::newRow("scattered") << "srcwinh";
+        QTest::newRow("words") << "gui view cpp";
+        QTest::newRow("rejected by mask") << "zzz";
+    }
+
+    // One pass over the whole index, as one QuickOpenSearch worker does per chunk
+    void query() {
+        QFETCH(QString, query);
+        const PathQuery parsed(query);
+        int best = -1;
+        QBENCHMARK {
+            for (qsizetype i = 0; i < index.size(); ++i) {
+                if (parsed.accepts(index.masks[i]))
+                    best = qMax(best, parsed.score(index.path(i)));
+            }
+        }
+        Q_UNUSED(best);
+    }
+
+    // The same pass without the mask, to show what it saves
+    void queryUnmasked_data() {
+        query_data();
+    }
+
+    void queryUnmasked() {
+        QFETCH(QString, query);
+        const PathQuery parsed(query);
+        int best = -1;
+        QBENCHMARK {
+            for (qsizetype i = 0; i < index.size(); ++i)
+                best = qMax(best, parsed.score(index.path(i)));
+        }
+        Q_UNUSED(best);
+    }
+
+private:
+    static constexpr int PathCount = 200000;
+
+    QList<QByteArray> paths;
+    PathIndex index;
+};
+
+QTEST_GUILESS_MAIN(BenchPathIndex)
+#include "bench_pathindex.moc"
@@ -0,0 +1,157 @@
+#include <QtTest>
+
+#include "commandhistory.h"
+
+static void writeLines(const QString &fileName, const QStringList &lines) {
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    for (const QString &line : lines)
+        file.write(line.toUtf8() + '\n');
+}
+
+static qsizetype lineCount(const QString &fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+    return file.readAll().count('\n');
+}
+
+class TestCommandHistory : public QObject {
+    Q_OBJECT
+private slots:
+    void init() {
+        QVERIFY(dir.isValid());
+        fileName = dir.filePath(QString("history_%1").arg(++files));
+        writeLines(fileName, {"git status", "make -j8", "git commit -m x", "ls", "git status", "make test"});
+    }
+
+    void previousWithPrefix_data() {
+        QTest::addColumn<QString>("prefix");
+        QTest::addColumn<qsizetype>("before");
+        QTest::addColumn<qsizetype>("found");
+
+        // One entry per distinct command: the older "git status" at 0 is never returned
+        QTest::newRow("newest") << "git" << qsizetype(6) << qsizetype(4);
+        QTest::newRow("older") << "git" << qsizetype(4) << qsizetype(2);
+        QTest::newRow("oldest reached") << "git" << qsizetype(2) << qsizetype(-1);
+        QTest::newRow("other prefix") << "make" << qsizetype(5) << qsizetype(1);
+        QTest::newRow("whole command") << "make test" << qsizetype(6) << qsizetype(5);
+        QTest::newRow("empty prefix") << "" << qsizetype(6) << qsizetype(5);
+        QTest::newRow("no match") << "x" << qsizetype(6) << qsizetype(-1);
+        QTest::newRow("longer than any") << "git status --short" << qsizetype(6) << qsizetype(-1);
+    }
+
+    void previousWithPrefix() {
+        QFETCH(QString, prefix);
+        QFETCH(qsizetype, before);
+        QFETCH(qsizetype, found);
+
+        CommandHistory history(fileName);
+        QCOMPARE(history.previousWithPrefix(prefix, before), found);
+    }
+
+    void nextWithPrefix_data() {
+        QTest::addColumn<QString>("prefix");
+        QTest::addColumn<qsizetype>("after");
+        QTest::addColumn<qsizetype>("found");
+
+        QTest::newRow("oldest") << "git" << qsizetype(-1) << qsizetype(2);
+        QTest::newRow("newer") << "git" << qsizetype(2) << qsizetype(4);
+        QTest::newRow("newest reached") << "git" << qsizetype(4) << qsizetype(-1);
+        QTest::newRow("other prefix") << "make" << qsizetype(1) << qsizetype(5);
+    }
+
+    void nextWithPrefix() {
+        QFETCH(QString, prefix);
+        QFETCH(qsizetype, after);
+        QFETCH(qsizetype, found);
+
+        CommandHistory history(fileName);
+        QCOMPARE(history.nextWithPrefix(prefix, after), found);
+    }
+
+    void searchBackward_data() {
+        QTest::addColumn<QString>("needle");
+        QTest::addColumn<qsizetype>("before");
+        QTest::addColumn<qsizetype>("found");
+
+        QTest::newRow("newest") << "status" << qsizetype(6) << qsizetype(4);
+        QTest::newRow("older") << "status" << qsizetype(4) << qsizetype(0);
+        QTest::newRow("inside an entry") << "it c" << qsizetype(6) << qsizetype(2);
+        QTest::newRow("first entry") << "git" << qsizetype(1) << qsizetype(0);
+        QTest::newRow("before clamped") << "ls" << qsizetype(100) << qsizetype(3);
+        QTest::newRow("nothing before") << "git" << qsizetype(0) << qsizetype(-1);
+        QTest::newRow("empty needle") << "" << qsizetype(6) << qsizetype(-1);
+        QTest::newRow("no match") << "zzz" << qsizetype(6) << qsizetype(-1);
+    }
+
+    void searchBackward() {
+        QFETCH(QString, needle);
+        QFETCH(qsizetype, before);
+        QFETCH(qsizetype, found);
+
+        CommandHistory history(fileName);
+        QCOMPARE(history.searchBackward(needle, before), found);
+    }
+
+    void append() {
+        CommandHistory history(fileName);
+        QCOMPARE(history.size(), qsizetype(6));
+
+        history.append("make test");  // Repeat of the newest entry
+        QCOMPARE(history.size(), qsizetype(6));
+        history.append("echo a\necho b");
+        QCOMPARE(history.size(), qsizetype(7));
+        QCOMPARE(history.at(6), QString("echo a echo b"));
+        QCOMPARE(history.previousWithPrefix("echo", 7), qsizetype(6));
+        QCOMPARE(lineCount(fileName), qsizetype(7));
+    }
+
+    void otherInstance() {
+        CommandHistory first(fileName);
+        CommandHistory second(fileName);
+        QCOMPARE(first.size(), qsizetype(6));
+        QCOMPARE(second.size(), qsizetype(6));
+
+        first.append("cargo build");
+        second.refresh();
+        QCOMPARE(second.size(), qsizetype(7));
+        QCOMPARE(second.previousWithPrefix("cargo", 7), qsizetype(6));
+        // A newer copy of a known command moves its distinct entry
+        second.append("ls");
+        first.refresh();
+        QCOMPARE(first.previousWithPrefix("ls", 8), qsizetype(7));
+    }
+
+    void compaction() {
+        QStringList lines;
+        for (qsizetype i = 0; i < 2 * CommandHistory::MaxEntries; ++i)
+            lines.append(QString("cmd %1").arg(i));
+        writeLines(fileName, lines);
+
+        // At the limit nothing is cut; the next line takes the file past it
+        CommandHistory before(fileName);
+        QCOMPARE(before.size(), 2 * CommandHistory::MaxEntries);
+        before.append(QString("cmd %1").arg(2 * CommandHistory::MaxEntries));
+        QCOMPARE(before.size(), 2 * CommandHistory::MaxEntries + 1);
+
+        CommandHistory history(fileName);
+        QCOMPARE(history.size(), CommandHistory::MaxEntries);
+        QCOMPARE(history.at(0), QString("cmd %1").arg(CommandHistory::MaxEntries + 1));
+        QCOMPARE(history.at(history.size() - 1), QString("cmd %1").arg(2 * CommandHistory::MaxEntries));
+        QCOMPARE(lineCount(fileName), CommandHistory::MaxEntries);
+        QCOMPARE(history.searchBackward("cmd 1", history.size()), history.size() - 2);  // cmd 199999
+
+        // The shorter file makes the other instance read it again
+        before.refresh();
+        QCOMPARE(before.size(), CommandHistory::MaxEntries);
+    }
+
+private:
+    QTemporaryDir dir;
+    QString fileName;
+    int files = 0;
+};
+
+QTEST_GUILESS_MAIN(TestCommandHistory)
+#include "tst_commandhistory.moc"
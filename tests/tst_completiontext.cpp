@@ -0,0 +1,65 @@
+#include <QtTest>
+
+#include "completiontext.h"
+
+class TestCompletionText : public QObject {
+    Q_OBJECT
+private slots:
+    void clean_data() {
+        QTest::addColumn<QString>("reply");
+        QTest::addColumn<QString>("linePrefix");
+        QTest::addColumn<QString>("expected");
+
+        QTest::newRow("plain") << "foo()" << "" << "foo()";
+        QTest::newRow("trailing whitespace") << "foo()\n\n  " << "" << "foo()";
+        QTest::newRow("multi-line") << "a\nb\n" << "" << "a\nb";
+        QTest::newRow("leading whitespace kept") << " = 1;" << "int x" << " = 1;";
+        QTest::newRow("fenced") << "```cpp\nfoo();\n```" << "" << "foo();";
+        QTest::newRow("fence left open") << "```\nfoo();" << "" << "foo();";
+        // Models often restate the line; only what follows the cursor is inserted
+        QTest::newRow("line repeated") << "int x = 42;" << "    int x" << " = 42;";
+        QTest::newRow("line repeated, indented") << "  return a;" << "return" << " a;";
+        QTest::newRow("line not repeated") << "42;" << "int x = " << "42;";
+        QTest::newRow("fenced and repeated") << "```\nint x = 42;\n```\n" << "int x =" << " 42;";
+    }
+
+    void clean() {
+        QFETCH(QString, reply);
+        QFETCH(QString, linePrefix);
+        QFETCH(QString, expected);
+
+        QCOMPARE(CompletionText::clean(reply, linePrefix), expected);
+    }
+
+    void continues_data() {
+        QTest::addColumn<qsizetype>("consumed");
+        QTest::addColumn<QString>("typed");
+        QTest::addColumn<bool>("continues");
+
+        QTest::newRow("first characters") << qsizetype(0) << "he" << true;
+        QTest::newRow("after consumed") << qsizetype(2) << "llo" << true;
+        QTest::newRow("different") << qsizetype(2) << "x" << false;
+        QTest::newRow("past the end") << qsizetype(5) << "();" << false;
+        QTest::newRow("rest exactly") << qsizetype(5) << "()" << true;
+    }
+
+    void continues() {
+        QFETCH(qsizetype, consumed);
+        QFETCH(QString, typed);
+        QFETCH(bool, continues);
+
+        QCOMPARE(CompletionText::continues(u"hello()", consumed, typed), continues);
+    }
+
+    void key() {
+        const QByteArray key = CompletionText::key("int main() {", "}");
+        QCOMPARE(key.size(), qsizetype(20));  // SHA-1
+        QCOMPARE(CompletionText::key("int main() {", "}"), key);
+        QVERIFY(CompletionText::key("int main() {\n", "}") != key);
+        // Moving text across the cursor is another request
+        QVERIFY(CompletionText::key("ab", "c") != CompletionText::key("a", "bc"));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestCompletionText)
+#include "tst_completiontext.moc"
@@ -0,0 +1,104 @@
+#include <QtTest>
+
+#include "cpplexer.h"
+
+struct Token {
+    int start;
+    int length;
+    TokenKind kind;
+};
+
+static QList<Token> lexLine(const QString &text, int state = CppLexer::Normal, int *endState = nullptr) {
+    QList<Token> tokens;
+    const int end = CppLexer::lex(text, state, [&](int start, int length, TokenKind kind) {
+        tokens.append({start, length, kind});
+    });
+    if (endState)
+        *endState = end;
+    return tokens;
+}
+
+static QList<int> starts(const QList<Token> &tokens, TokenKind kind) {
+    QList<int> result;
+    for (const Token &token : tokens) {
+        if (token.kind == kind)
+            result.append(token.start);
+    }
+    return result;
+}
+
+class TestCppLexer : public QObject {
+    Q_OBJECT
+private slots:
+    void directive_data() {
+        QTest::addColumn<QString>("line");
+        QTest::addColumn<QList<int>>("brackets");
+        QTest::addColumn<int>("comment");  // Start of the comment, or -1
+
+        QTest::newRow("function-like macro") << "#define F(x) ((x) + 1)" << QList<int>{9, 11, 13, 14, 16, 21} << -1;
+        QTest::newRow("char literal") << "#define LP '('" << QList<int>() << -1;
+        QTest::newRow("escaped quote in char") << R"(#define Q '\'' (x))" << QList<int>{15, 17} << -1;
+        QTest::newRow("quoted include") << "#include \"f(x).h\"" << QList<int>() << -1;
+        QTest::newRow("slashes in a string") << "#define URL \"http://x\"" << QList<int>() << -1;
+        QTest::newRow("comment after a string") << "#define S \"(\" // (x)" << QList<int>() << 14;
+        QTest::newRow("block comment after a string") << "#define S \"//\" /* ( */ [" << QList<int>{23} << 15;
+        QTest::newRow("digit separator") << "#if X > 1'000 && (Y)" << QList<int>{17, 19} << -1;
+        QTest::newRow("prefixed char") << "#define C u8'(' (z)" << QList<int>{16, 18} << -1;
+        QTest::newRow("unterminated string") << "#define S \"(abc" << QList<int>() << -1;
+    }
+
+    void directive() {
+        QFETCH(QString, line);
+        QFETCH(QList<int>, brackets);
+        QFETCH(int, comment);
+
+        const QList<Token> tokens = lexLine(line);
+        QCOMPARE(starts(tokens, TokenKind::Bracket), brackets);
+        const QList<int> comments = starts(tokens, TokenKind::Comment);
+        QCOMPARE(comments.isEmpty() ? -1 : comments.front(), comment);
+        QVERIFY(!starts(tokens, TokenKind::Preprocessor).isEmpty());
+        QVERIFY(starts(tokens, TokenKind::String).isEmpty());
+    }
+
+    void continuedDirective() {
+        int state = 0;
+        QList<Token> tokens = lexLine("#define A \"(\" \\", CppLexer::Normal, &state);
+        QVERIFY(starts(tokens, TokenKind::Bracket).isEmpty());
+        QCOMPARE(state, CppLexer::Directive | CppLexer::DirectiveFlag);
+
+        tokens = lexLine("    ')' (b)", state, &state);
+        QCOMPARE(starts(tokens, TokenKind::Bracket), (QList<int>{8, 10}));
+        QCOMPARE(state, int(CppLexer::Normal));
+    }
+
+    void code_data() {
+        QTest::addColumn<QString>("line");
+        QTest::addColumn<QList<int>>("brackets");
+        QTest::addColumn<QList<int>>("strings");
+
+        QTest::newRow("call") << "f(a[1]);" << QList<int>{1, 3, 5, 6} << QList<int>();
+        QTest::newRow("bracket in a string") << "g(\"(\");" << QList<int>{1, 5} << QList<int>{2};
+        QTest::newRow("bracket in a char") << "h('{')" << QList<int>{1, 5} << QList<int>{2};
+        QTest::newRow("raw string") << "R\"x(a)b)x\" [0]" << QList<int>{11, 13} << QList<int>{0};
+    }
+
+    void code() {
+        QFETCH(QString, line);
+        QFETCH(QList<int>, brackets);
+        QFETCH(QList<int>, strings);
+
+        const QList<Token> tokens = lexLine(line);
+        QCOMPARE(starts(tokens, TokenKind::Bracket), brackets);
+        QCOMPARE(starts(tokens, TokenKind::String), strings);
+    }
+
+    void keywords() {
+        QVERIFY(CppKeywords::contains(u"constexpr"));
+        QVERIFY(CppKeywords::contains(u"reinterpret_cast"));
+        QVERIFY(!CppKeywords::contains(u"constexp"));
+        QVERIFY(!CppKeywords::contains(u"Q_OBJECT"));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestCppLexer)
+#include "tst_cpplexer.moc"
@@ -0,0 +1,179 @@
+#include <QtTest>
+
+#include "editorcontext.h"
+
+// count lines "line 0000" .. , ten characters each with the newline, so a
+// chunk serialises to 320 characters and 81 tokens
+static void fill(QTextDocument *document, int count) {
+    QStringList lines;
+    for (int i = 0; i < count; ++i)
+        lines.append(QString("line %1").arg(i, 4, 10, QChar('0')));
+    document->setPlainText(lines.join('\n'));
+}
+
+// Titles of the sections in a built context, in order
+static QStringList titles(const QString &context) {
+    static const QRegularExpression title(R"(^(.+, lines \d+-\d+):$)", QRegularExpression::MultilineOption);
+    QStringList result;
+    for (QRegularExpressionMatchIterator it = title.globalMatch(context); it.hasNext();)
+        result.append(it.next().captured(1));
+    return result;
+}
+
+static void replaceLine(QTextDocument *document, int line, const QString &text) {
+    QTextCursor cursor(document->findBlockByNumber(line));
+    cursor.movePosition(QTextCursor::EndOfBlock, QTextCursor::KeepAnchor);
+    cursor.insertText(text);
+}
+
+class TestEditorContext : public QObject {
+    Q_OBJECT
+private slots:
+    void sections_data() {
+        QTest::addColumn<int>("budget");
+        QTest::addColumn<int>("cursorLine");
+        QTest::addColumn<int>("selectionLast");  // Selected from cursorLine through this line, or -1
+        QTest::addColumn<int>("functionFirst");
+        QTest::addColumn<int>("functionLast");
+        QTest::addColumn<QStringList>("expected");
+        QTest::addColumn<QString>("summary");
+
+        QTest::newRow("everything") << 8000 << 100 << -1 << -1 << -1 << QStringList{"file.cpp, lines 1-320"}
+                                    << "10 chunks, ~810 tokens";
+        // The cursor's chunk, then the one above; the one below no longer fits
+        QTest::newRow("two chunks") << 200 << 100 << -1 << -1 << -1 << QStringList{"file.cpp, lines 65-128"}
+                                    << "2 chunks, ~162 tokens";
+        QTest::newRow("one chunk") << 100 << 100 << -1 << -1 << -1 << QStringList{"file.cpp, lines 97-128"}
+                                   << "1 chunk, ~81 tokens";
+        QTest::newRow("nothing fits") << 50 << 100 << -1 << -1 << -1 << QStringList() << QString();
+        QTest::newRow("end of file") << 200 << 319 << -1 << -1 << -1 << QStringList{"file.cpp, lines 257-320"}
+                                     << "2 chunks, ~162 tokens";
+        QTest::newRow("selection and function")
+            << 8000 << 10 << 11 << 5 << 20
+            << QStringList{"Selected in file.cpp, lines 11-12", "Function around the cursor in file.cpp, lines 6-21",
+                           "file.cpp, lines 1-320"}
+            << "selection, function, 10 chunks, ~856 tokens";
+        // A chunk the function already shows is not sent twice
+        QTest::newRow("function covers a chunk")
+            << 8000 << 40 << -1 << 32 << 63
+            << QStringList{"Function around the cursor in file.cpp, lines 33-64", "file.cpp, lines 1-32",
+                           "file.cpp, lines 65-320"}
+            << "function, 9 chunks, ~810 tokens";
+        // A function longer than the budget is cut to the lines around the cursor
+        QTest::newRow("function trimmed") << 100 << 100 << -1 << 0 << 319
+                                          << QStringList{"Function around the cursor in file.cpp, lines 91-110"}
+                                          << "function, ~51 tokens";
+    }
+
+    void sections() {
+        QFETCH(int, budget);
+        QFETCH(int, cursorLine);
+        QFETCH(int, selectionLast);
+        QFETCH(int, functionFirst);
+        QFETCH(int, functionLast);
+        QFETCH(QStringList, expected);
+        QFETCH(QString, summary);
+
+        QTextDocument document;
+        fill(&document, 320);
+        EditorContextBuilder::Source source;
+        source.document = &document;
+        source.cursor = QTextCursor(document.findBlockByNumber(cursorLine));
+        if (selectionLast >= 0) {
+            const QTextBlock last = document.findBlockByNumber(selectionLast);
+            source.cursor.setPosition(last.position() + last.length() - 1, QTextCursor::KeepAnchor);
+        }
+        source.fileName = "/src/file.cpp";
+        source.functionFirst = functionFirst;
+        source.functionLast = functionLast;
+
+        EditorContextBuilder builder;
+        QString built;
+        const QString context = builder.build(source, budget, &built);
+        QCOMPARE(titles(context), expected);
+        QCOMPARE(built, summary);
+        QCOMPARE(context.isEmpty(), expected.isEmpty());
+        QVERIFY(builder.lastStats().tokens <= budget);
+    }
+
+    void chunkReuse_data() {
+        QTest::addColumn<int>("line");
+        QTest::addColumn<QString>("text");
+        QTest::addColumn<int>("serialized");
+
+        QTest::newRow("unchanged") << -1 << QString() << 0;
+        QTest::newRow("same length") << 40 << "LINE 0040" << 1;
+        // Chunks below a longer line start at other positions
+        QTest::newRow("longer line") << 40 << "line 0040 changed" << 9;
+        QTest::newRow("last chunk") << 300 << "line 0300 changed" << 1;
+        QTest::newRow("first line") << 0 << "line 0000 changed" << 10;
+    }
+
+    void chunkReuse() {
+        QFETCH(int, line);
+        QFETCH(QString, text);
+        QFETCH(int, serialized);
+
+        QTextDocument document;
+        fill(&document, 320);
+        EditorContextBuilder::Source source;
+        source.document = &document;
+        source.cursor = QTextCursor(&document);
+        source.fileName = "/src/file.cpp";
+
+        EditorContextBuilder builder;
+        QString summary;
+        builder.build(source, 8000, &summary);
+        QCOMPARE(builder.lastStats().chunksSerialized, 10);
+        QCOMPARE(builder.lastStats().chunksReused, 0);
+
+        if (line >= 0)
+            replaceLine(&document, line, text);
+        const QString context = builder.build(source, 8000, &summary);
+        QCOMPARE(builder.lastStats().chunksSerialized, serialized);
+        QCOMPARE(builder.lastStats().chunksReused, 10 - serialized);
+        // Entries for chunks no longer in the document are dropped
+        QCOMPARE(builder.lastStats().cachedChunks, 10);
+        if (line >= 0)
+            QVERIFY(context.contains(text + '\n'));
+    }
+
+    void otherFileStartsOver() {
+        QTextDocument document;
+        fill(&document, 64);
+        EditorContextBuilder::Source source;
+        source.document = &document;
+        source.cursor = QTextCursor(&document);
+        source.fileName = "/src/a.cpp";
+
+        EditorContextBuilder builder;
+        QString summary;
+        builder.build(source, 8000, &summary);
+        source.fileName = "/src/b.cpp";
+        const QString context = builder.build(source, 8000, &summary);
+        QCOMPARE(builder.lastStats().chunksReused, 0);
+        QCOMPARE(builder.lastStats().chunksSerialized, 2);
+        QCOMPARE(titles(context), QStringList{"b.cpp, lines 1-64"});
+    }
+
+    void nothingToSend() {
+        EditorContextBuilder builder;
+        QString summary = "stale";
+        QVERIFY(builder.build(EditorContextBuilder::Source(), 8000, &summary).isEmpty());
+        QVERIFY(summary.isEmpty());
+
+        QTextDocument document;
+        EditorContextBuilder::Source source;
+        source.document = &document;
+        source.cursor = QTextCursor(&document);
+        QVERIFY(builder.build(source, 8000, &summary).isEmpty());
+    }
+
+    void estimateTokens() {
+        QCOMPARE(EditorContextBuilder::estimateTokens(0), 1);
+        QCOMPARE(EditorContextBuilder::estimateTokens(320), 81);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestEditorContext)
+#include "tst_editorcontext.moc"
@@ -0,0 +1,403 @@
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "geminiclient.h"
+
+// HTTP/1.1 server on the loopback interface that answers each request with
+// the next queued reply. A reply is written in pieces with a pause between
+// them, so the client reads them separately; the connection closes after
+// the last one, which ends a reply sent without Content-Length
+class StubServer : public QObject {
+    Q_OBJECT
+public:
+    struct Reply {
+        QList<QByteArray> pieces;
+        int pauseMs = 20;
+    };
+
+    StubServer() {
+        server.listen(QHostAddress::LocalHost);
+        connect(&server, &QTcpServer::newConnection, this, &StubServer::accept);
+    }
+
+    QString endpoint() const {
+        return QString("http://127.0.0.1:%1/v1").arg(server.serverPort());
+    }
+
+    void enqueue(const Reply &reply) {
+        replies.append(reply);
+    }
+
+    static QByteArray head(int status, const QByteArray &headers = QByteArray()) {
+        return "HTTP/1.1 " + QByteArray::number(status) + (status == 200 ? " OK" : " Error")
+               + "\r\nConnection: close\r\n" + headers + "\r\n";
+    }
+
+    static QByteArray sseEvent(const QString &text) {
+        const QJsonObject part{{"text", text}};
+        const QJsonObject candidate{{"content", QJsonObject{{"parts", QJsonArray{part}}}}};
+        return "data: " + QJsonDocument(QJsonObject{{"candidates", QJsonArray{candidate}}}).toJson(QJsonDocument::Compact)
+               + "\r\n\r\n";
+    }
+
+    QList<QByteArray> paths;  // Request targets in arrival order
+    int piecesWritten = 0;
+
+signals:
+    void requestReceived(const QByteArray &path);
+
+private:
+    void accept() {
+        while (QTcpSocket *socket = server.nextPendingConnection()) {
+            connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+                read(socket);
+            });
+            connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        }
+    }
+
+    void read(QTcpSocket *socket) {
+        QByteArray &buffer = buffers[socket];
+        buffer += socket->readAll();
+        const qsizetype headerEnd = buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0) {
+            return;
+        }
+        qsizetype length = 0;
+        for (const QByteArray &line : buffer.first(headerEnd).split('\n')) {
+            if (line.toLower().startsWith("content-length:"))
+                length = line.mid(15).trimmed().toLongLong();
+        }
+        if (buffer.size() < headerEnd + 4 + length) {
+            return;
+        }
+        const QByteArray path = buffer.first(buffer.indexOf('\r')).split(' ').value(1);
+        buffers.remove(socket);
+        paths.append(path);
+        emit requestReceived(path);
+        write(socket, replies.isEmpty() ? Reply{{head(500)}} : replies.takeFirst(), 0);
+    }
+
+    void write(QTcpSocket *socket, const Reply &reply, int piece) {
+        if (piece == reply.pieces.size()) {
+            socket->disconnectFromHost();
+            return;
+        }
+        socket->write(reply.pieces[piece]);
+        socket->flush();
+        ++piecesWritten;
+        QTimer::singleShot(reply.pauseMs, socket, [this, socket, reply, piece]() {
+            write(socket, reply, piece + 1);
+        });
+    }
+
+    QTcpServer server;
+    QList<Reply> replies;
+    QHash<QTcpSocket *, QByteArray> buffers;
+};
+
+class TestGeminiClient : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase() {
+        QStandardPaths::setTestModeEnabled(true);
+        QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/gemini").removeRecursively();
+    }
+
+    // Every way of cutting the stream in two, and byte by byte, yields the
+    // same events as feeding it whole
+    void sseChunkBoundaries() {
+        const QByteArray stream = ": keep-alive\r\n"
+                                  "data: first\r\n\r\n"
+                                  "event: message\n"
+                                  "data:second\n"
+                                  "data: line\n\n"
+                                  "id: 7\r\n"
+                                  "data: third\r\n\r\n";
+        const QList<QByteArray> expected{"first", "second\nline", "third"};
+
+        for (qsizetype cut = 0; cut <= stream.size(); ++cut) {
+            SseParser parser;
+            QList<QByteArray> events = parser.feed(QByteArrayView(stream).first(cut));
+            events += parser.feed(QByteArrayView(stream).sliced(cut));
+            events += parser.finish();
+            QCOMPARE(events, expected);
+        }
+
+        SseParser parser;
+        QList<QByteArray> events;
+        for (const char c : stream)
+            events += parser.feed(QByteArrayView(&c, 1));
+        QCOMPARE(events, expected);
+        QVERIFY(parser.finish().isEmpty());
+    }
+
+    void sseUnterminatedLastEvent() {
+        SseParser parser;
+        QVERIFY(parser.feed("data: partial").isEmpty());
+        QCOMPARE(parser.finish(), QList<QByteArray>{"partial"});
+        // finish() leaves the parser ready for the next stream
+        QCOMPARE(parser.feed("data: next\n\n"), QList<QByteArray>{"next"});
+    }
+
+    // Text arrives per event while the stream is still open, including
+    // events whose lines and CRLFs are split across network reads
+    void streamingDeliversEachEvent() {
+        StubServer stub;
+        const QByteArray first = StubServer::sseEvent("Hel");
+        const QByteArray second = StubServer::sseEvent("lo");
+        stub.enqueue({{StubServer::head(200, "Content-Type: text/event-stream\r\n") + first.first(10),
+                       first.sliced(10, first.size() - 11), first.last(1) + second.first(second.size() - 2),
+                       second.last(2)},
+                      100});
+
+        GeminiClient client;
+        prepare(client, stub);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        QStringList texts;
+        int piecesAtFirstText = -1;
+        connect(&client, &GeminiClient::textReceived, this, [&](quint64, const QString &text) {
+            if (texts.isEmpty())
+                piecesAtFirstText = stub.piecesWritten;
+            texts.append(text);
+        });
+
+        const quint64 id = client.generate("test-model", QJsonObject{{"contents", QJsonArray()}});
+        QVERIFY(finished.wait(5000));
+        QCOMPARE(finished.first().at(0).toULongLong(), id);
+        QCOMPARE(finished.first().at(1).toString(), QString());
+        QCOMPARE(texts, (QStringList{"Hel", "lo"}));
+        QVERIFY2(piecesAtFirstText < 4, "first text only arrived with the whole stream");
+        QCOMPARE(stub.paths, QList<QByteArray>{"/v1/models/test-model:streamGenerateContent?alt=sse"});
+        QVERIFY(!client.isActive(id));
+    }
+
+    // An error event inside a 200 stream fails the request
+    void streamErrorEvent() {
+        StubServer stub;
+        stub.enqueue({{StubServer::head(200) + StubServer::sseEvent("partial")
+                       + "data: {\"error\":{\"message\":\"overloaded\"}}\n\n"}});
+
+        GeminiClient client;
+        prepare(client, stub);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        client.generate("test-model", QJsonObject());
+        QVERIFY(finished.wait(5000));
+        QCOMPARE(finished.first().at(1).toString(), QString("API Error: overloaded"));
+    }
+
+    // 503 without a hint backs off with jitter, 429 with Retry-After: 0
+    // goes again at once, and the third attempt succeeds
+    void retriesTransientErrors() {
+        StubServer stub;
+        stub.enqueue({{StubServer::head(503, "Content-Length: 0\r\n")}});
+        stub.enqueue({{StubServer::head(429, "Retry-After: 0\r\nContent-Length: 0\r\n")}});
+        stub.enqueue({{StubServer::head(200) + answer("ok")}});
+
+        GeminiClient client;
+        prepare(client, stub);
+        QSignalSpy retrying(&client, &GeminiClient::retrying);
+        QSignalSpy received(&client, &GeminiClient::textReceived);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        client.generate("test-model", QJsonObject(), false);
+        QVERIFY(finished.wait(5000));
+
+        QCOMPARE(finished.first().at(1).toString(), QString());
+        QCOMPARE(received.size(), 1);
+        QCOMPARE(received.first().at(1).toString(), QString("ok"));
+        QCOMPARE(stub.paths.size(), 3);
+        QCOMPARE(retrying.size(), 2);
+        QCOMPARE(retrying[0].at(1).toInt(), 2);
+        const int backoff = retrying[0].at(2).toInt();
+        QVERIFY2(backoff >= 250 && backoff <= 500, qPrintable(QString::number(backoff)));
+        QCOMPARE(retrying[1].at(1).toInt(), 3);
+        QCOMPARE(retrying[1].at(2).toInt(), 0);
+    }
+
+    void retryAfterSeconds() {
+        StubServer stub;
+        stub.enqueue({{StubServer::head(429, "Retry-After: 2\r\nContent-Length: 0\r\n")}});
+
+        GeminiClient client;
+        prepare(client, stub);
+        QSignalSpy retrying(&client, &GeminiClient::retrying);
+        const quint64 id = client.generate("test-model", QJsonObject(), false);
+        QVERIFY(retrying.wait(5000));
+        QCOMPARE(retrying.first().at(2).toInt(), 2000);
+        client.cancel(id);
+    }
+
+    // Attempts stop at MaxAttempts and the API's message is reported
+    void givesUpAfterMaxAttempts() {
+        StubServer stub;
+        const QByteArray body = R"({"error":{"message":"quota exhausted"}})";
+        for (int i = 0; i < GeminiClient::MaxAttempts; ++i) {
+            stub.enqueue({{StubServer::head(429, "Retry-After: 0\r\nContent-Length: " + QByteArray::number(body.size())
+                                                     + "\r\n") + body}});
+        }
+
+        GeminiClient client;
+        prepare(client, stub);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        client.generate("test-model", QJsonObject(), false);
+        QVERIFY(finished.wait(5000));
+        QCOMPARE(finished.first().at(1).toString(), QString("API Error: quota exhausted"));
+        QCOMPARE(stub.paths.size(), GeminiClient::MaxAttempts);
+    }
+
+    // A request cancelled while it waits to retry is not sent again and
+    // reports nothing
+    void cancelDuringBackoff() {
+        StubServer stub;
+        stub.enqueue({{StubServer::head(429, "Retry-After: 1\r\nContent-Length: 0\r\n")}});
+        stub.enqueue({{StubServer::head(200) + answer("late")}});
+
+        GeminiClient client;
+        prepare(client, stub);
+        QSignalSpy retrying(&client, &GeminiClient::retrying);
+        QSignalSpy received(&client, &GeminiClient::textReceived);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        const quint64 id = client.generate("test-model", QJsonObject(), false);
+        QVERIFY(retrying.wait(5000));
+        client.cancel(id);
+        QVERIFY(!client.isActive(id));
+
+        QTest::qWait(1500);
+        QCOMPARE(stub.paths.size(), 1);
+        QCOMPARE(received.size(), 0);
+        QCOMPARE(finished.size(), 0);
+    }
+
+    void latencyHistogram() {
+        LatencyHistogram histogram;
+        QCOMPARE(histogram.format(), QString("no samples"));
+        for (const qint64 ms : {3, 3, 100})
+            histogram.add(ms);
+        QCOMPARE(histogram.count(), 3);
+        QCOMPARE(histogram.percentile(0.5), 4);
+        QCOMPARE(histogram.percentile(0.95), 100);
+    }
+
+    // The request InlineCompleter sends once typing pauses: non-streaming,
+    // delivered whole however the reply is split. The time from sending to
+    // the text is what the user waits for after the debounce
+    void completionRoundTrip() {
+        StubServer stub;
+        const QByteArray body = answer("return a + b;");
+        stub.enqueue({{StubServer::head(200) + body.first(12), body.sliced(12)}, 50});
+
+        GeminiClient client;
+        prepare(client, stub);
+        QSignalSpy received(&client, &GeminiClient::textReceived);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        LatencyHistogram latency;
+        QElapsedTimer timer;
+        timer.start();
+        client.generate("test-model", completionBody(), false);
+        QVERIFY(finished.wait(5000));
+        latency.add(timer.elapsed());
+
+        QCOMPARE(received.size(), 1);
+        QCOMPARE(received.first().at(1).toString(), QString("return a + b;"));
+        QCOMPARE(stub.paths, QList<QByteArray>{"/v1/models/test-model:generateContent"});
+        qInfo("request to suggestion: %s", qPrintable(latency.format()));
+        QVERIFY(latency.percentile(1.0) < 1000);
+    }
+
+    // Asking again for the same context is answered from the cache, after
+    // generate() has returned the id and without a request
+    void completionFromCache() {
+        StubServer stub;
+        stub.enqueue({{StubServer::head(200) + answer("cached")}});
+
+        GeminiClient client;
+        prepare(client, stub);
+        client.responseCache().setTtlHours(1);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        client.generate("test-model", completionBody(), false);
+        QVERIFY(finished.wait(5000));
+
+        QSignalSpy received(&client, &GeminiClient::textReceived);
+        const quint64 id = client.generate("test-model", completionBody(), false);
+        QCOMPARE(received.size(), 0);
+        QVERIFY(finished.wait(1000));
+        QCOMPARE(received.size(), 1);
+        QCOMPARE(received.first().at(0).toULongLong(), id);
+        QCOMPARE(received.first().at(1).toString(), QString("cached"));
+        QCOMPARE(stub.paths.size(), 1);
+    }
+
+    // An answer cached from one server is not served for another
+    void cacheKeyedByEndpoint() {
+        StubServer first;
+        first.enqueue({{StubServer::head(200) + answer("first")}});
+        StubServer second;
+        second.enqueue({{StubServer::head(200) + answer("second")}});
+
+        GeminiClient client;
+        prepare(client, first);
+        client.responseCache().setTtlHours(1);
+        QSignalSpy received(&client, &GeminiClient::textReceived);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        const QJsonObject body = completionBody();
+        client.generate("test-model", body, false);
+        QVERIFY(finished.wait(5000));
+
+        client.setEndpoint(second.endpoint() + "/");
+        client.generate("test-model", body, false);
+        QVERIFY(finished.wait(5000));
+        QCOMPARE(second.paths.size(), 1);
+        QCOMPARE(received.last().at(1).toString(), QString("second"));
+
+        // Back on the first server, its answer is still cached
+        client.setEndpoint(first.endpoint());
+        client.generate("test-model", body, false);
+        QVERIFY(finished.wait(1000));
+        QCOMPARE(first.paths.size(), 1);
+        QCOMPARE(received.last().at(1).toString(), QString("first"));
+    }
+
+    // Moving the cursor cancels the completion in flight; nothing arrives
+    void cancelCompletionInFlight() {
+        StubServer stub;
+        stub.enqueue({{StubServer::head(200), answer("too late")}, 500});
+
+        GeminiClient client;
+        prepare(client, stub);
+        QSignalSpy requested(&stub, &StubServer::requestReceived);
+        QSignalSpy received(&client, &GeminiClient::textReceived);
+        QSignalSpy finished(&client, &GeminiClient::finished);
+        const quint64 id = client.generate("test-model", completionBody(), false);
+        QVERIFY(requested.wait(5000));
+        client.cancel(id);
+
+        QTest::qWait(800);
+        QCOMPARE(received.size(), 0);
+        QCOMPARE(finished.size(), 0);
+        QVERIFY(!client.isActive(id));
+    }
+
+private:
+    // A generateContent reply body carrying text
+    static QByteArray answer(const QString &text) {
+        const QJsonObject part{{"text", text}};
+        const QJsonObject candidate{{"content", QJsonObject{{"parts", QJsonArray{part}}}}};
+        return QJsonDocument(QJsonObject{{"candidates", QJsonArray{candidate}}}).toJson(QJsonDocument::Compact);
+    }
+
+    static QJsonObject completionBody() {
+        const QJsonObject part{{"text", "int add(int a, int b) { <CURSOR> }"}};
+        return QJsonObject{{"contents", QJsonArray{QJsonObject{{"role", "user"}, {"parts", QJsonArray{part}}}}},
+                           {"generationConfig", QJsonObject{{"maxOutputTokens", 128}, {"temperature", 0.2}}}};
+    }
+
+    static void prepare(GeminiClient &client, const StubServer &stub) {
+        client.responseCache().setTtlHours(0);
+        client.setEndpoint(stub.endpoint());
+        client.setApiKey("test-key");
+    }
+};
+
+QTEST_GUILESS_MAIN(TestGeminiClient)
+#include "tst_geminiclient.moc"
@@ -0,0 +1,93 @@
+#include <QtTest>
+
+#include "pathindex.h"
+
+class TestPathIndex : public QObject {
+    Q_OBJECT
+private slots:
+    void match_data() {
+        QTest::addColumn<QString>("query");
+        QTest::addColumn<QByteArray>("path");
+        QTest::addColumn<bool>("matches");
+
+        QTest::newRow("subsequence") << "mcpp" << QByteArray("src/main.cpp") << true;
+        QTest::newRow("case folded") << "MAIN" << QByteArray("src/Main.cpp") << true;
+        QTest::newRow("out of order") << "cppmain" << QByteArray("src/main.cpp") << false;
+        QTest::newRow("missing character") << "mainz" << QByteArray("src/main.cpp") << false;
+        // Whitespace separates words; the path needs no space
+        QTest::newRow("two words") << "main cpp" << QByteArray("src/main.cpp") << true;
+        QTest::newRow("trailing space") << "main " << QByteArray("src/main.cpp") << true;
+        QTest::newRow("leading space") << " main" << QByteArray("src/main.cpp") << true;
+        QTest::newRow("tab") << "src\tmain" << QByteArray("src/main.cpp") << true;
+        QTest::newRow("words out of order") << "cpp main" << QByteArray("src/main.cpp") << false;
+        QTest::newRow("path with a space") << "my file" << QByteArray("docs/my file.txt") << true;
+        QTest::newRow("only spaces") << "  " << QByteArray("src/main.cpp") << true;
+    }
+
+    void match() {
+        QFETCH(QString, query);
+        QFETCH(QByteArray, path);
+        QFETCH(bool, matches);
+
+        const PathQuery parsed(query);
+        const bool accepted = parsed.accepts(PathIndex::maskOf(path)) && parsed.score(path) >= 0;
+        QCOMPARE(accepted, matches);
+    }
+
+    void maskRejectsMissingCharacters() {
+        const quint64 mask = PathIndex::maskOf("src/main.cpp");
+        QVERIFY(PathQuery("main").accepts(mask));
+        QVERIFY(PathQuery("main cpp").accepts(mask));
+        QVERIFY(!PathQuery("mainz").accepts(mask));
+    }
+
+    void ranking_data() {
+        QTest::addColumn<QString>("query");
+        QTest::addColumn<QByteArray>("better");
+        QTest::addColumn<QByteArray>("worse");
+
+        QTest::newRow("file name over directory") << "main" << QByteArray("src/main.cpp")
+                                                  << QByteArray("main/other.cpp");
+        QTest::newRow("run over scattered") << "main" << QByteArray("src/main.cpp")
+                                            << QByteArray("src/mountain.cpp");
+        QTest::newRow("shorter path") << "main" << QByteArray("main.cpp") << QByteArray("src/deep/tree/main.cpp");
+        QTest::newRow("words as one run") << "main cpp" << QByteArray("src/main.cpp")
+                                          << QByteArray("src/main/c/p/p.h");
+    }
+
+    void ranking() {
+        QFETCH(QString, query);
+        QFETCH(QByteArray, better);
+        QFETCH(QByteArray, worse);
+
+        const PathQuery parsed(query);
+        QVERIFY(parsed.score(better) > parsed.score(worse));
+    }
+
+    void appendAndMerge() {
+        PathIndex index;
+        index.append("a/b.cpp");
+        index.append("c.h");
+        PathIndex other;
+        other.append("d/e.txt");
+        index.append(other);
+
+        QCOMPARE(index.size(), 3);
+        QCOMPARE(index.path(0), QByteArrayView("a/b.cpp"));
+        QCOMPARE(index.path(1), QByteArrayView("c.h"));
+        QCOMPARE(index.path(2), QByteArrayView("d/e.txt"));
+        QCOMPARE(index.masks[2], PathIndex::maskOf("d/e.txt"));
+    }
+
+    void removedPaths() {
+        PathDelta delta;
+        delta.removed = {"src/old.cpp", "build/"};
+        QVERIFY(delta.isRemoved("src/old.cpp"));
+        QVERIFY(delta.isRemoved("build/out/main.o"));
+        QVERIFY(!delta.isRemoved("src/old.cpp.orig"));
+        QVERIFY(!delta.isRemoved("buildtools/x"));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestPathIndex)
+#include "tst_pathindex.moc"
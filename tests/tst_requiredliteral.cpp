@@ -0,0 +1,54 @@
+#include <QtTest>
+
+#include "requiredliteral.h"
+
+class TestRequiredLiteral : public QObject {
+    Q_OBJECT
+private slots:
+    void literal_data() {
+        QTest::addColumn<QString>("pattern");
+        QTest::addColumn<QString>("literal");
+
+        QTest::newRow("plain") << "foobar" << "foobar";
+        QTest::newRow("escaped") << R"(\.cpp$)" << ".cpp";
+        QTest::newRow("word boundaries") << R"(\bword\b)" << "word";
+        QTest::newRow("optional character") << "colou?r" << "colo";
+        QTest::newRow("starred character") << "ab*cd" << "cd";
+        QTest::newRow("class") << "a[bc]defg" << "defg";
+        QTest::newRow("required group") << "(abcd)+x" << "abcd";
+        QTest::newRow("optional group") << "(foo)?bar" << "bar";
+        QTest::newRow("optional group longer than the rest") << "(foobar)?ba" << "ba";
+        QTest::newRow("starred group") << "(abc)*de" << "de";
+        QTest::newRow("group repeated from zero") << "(abc){0,2}de" << "de";
+        QTest::newRow("optional group nested") << "(ab(cdef)?)gh" << "ab";
+        QTest::newRow("group inside an optional group") << "((abcd)x)?y" << "y";
+        QTest::newRow("only optional") << "(abc)?" << "";
+        // The operand of an escape is not literal text: each of these
+        // matches "Abc" somewhere in a line
+        QTest::newRow("hex escape") << R"(\x41bc)" << "bc";
+        QTest::newRow("braced hex escape") << R"(\x{41}bc)" << "bc";
+        QTest::newRow("unicode escape") << R"(\u0041bc)" << "bc";
+        QTest::newRow("control escape") << R"(\cAbc)" << "bc";
+        QTest::newRow("octal escape") << R"(\101bc)" << "bc";
+        QTest::newRow("null octal escape") << R"(\012bc)" << "bc";
+        QTest::newRow("braced octal escape") << R"(\o{101}bc)" << "bc";
+        QTest::newRow("property") << R"(\p{Lu}bc)" << "bc";
+        QTest::newRow("short property") << R"(\pLbc)" << "bc";
+        QTest::newRow("named character") << R"(\N{U+0041}bc)" << "bc";
+        QTest::newRow("back reference") << R"((ab)\g{1}cd)" << "ab";
+        QTest::newRow("class escape") << R"(\dfoo)" << "foo";
+        QTest::newRow("escape ends the run") << R"(abc\x41de)" << "abc";
+        QTest::newRow("alternation") << "foo|bar" << "";
+        QTest::newRow("inline options") << "(?i)foo" << "";
+    }
+
+    // Whatever comes back must occur in every match of the pattern
+    void literal() {
+        QFETCH(QString, pattern);
+        QFETCH(QString, literal);
+        QCOMPARE(requiredLiteral(pattern), literal);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestRequiredLiteral)
+#include "tst_requiredliteral.moc"
@@ -0,0 +1,224 @@
+#include <QtTest>
+
+#include "geminiclient.h"
+
+static QJsonObject prompt(const QString &text, const QJsonObject &config = QJsonObject()) {
+    QJsonObject body{{"contents", QJsonArray{QJsonObject{{"parts", QJsonArray{QJsonObject{{"text", text}}}}}}}};
+    if (!config.isEmpty())
+        body.insert("generationConfig", config);
+    return body;
+}
+
+static QStringList storedFiles(const QString &directory) {
+    QStringList files;
+    QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+        files.append(it.next());
+    return files;
+}
+
+static const QString Endpoint = "https://generativelanguage.googleapis.com/v1";
+
+class TestResponseCache : public QObject {
+    Q_OBJECT
+private slots:
+    void init() {
+        dir.reset(new QTemporaryDir);
+        QVERIFY(dir->isValid());
+    }
+
+    void key_data() {
+        QTest::addColumn<QString>("endpoint");
+        QTest::addColumn<QString>("model");
+        QTest::addColumn<QJsonObject>("body");
+        QTest::addColumn<QString>("otherEndpoint");
+        QTest::addColumn<QString>("otherModel");
+        QTest::addColumn<QJsonObject>("otherBody");
+        QTest::addColumn<bool>("same");
+
+        const QJsonObject config{{"temperature", 0.2}, {"maxOutputTokens", 256}};
+        QTest::newRow("identical") << Endpoint << "gemini-pro" << prompt("hi") << Endpoint << "gemini-pro" << prompt("hi") << true;
+        QTest::newRow("surrounding whitespace") << Endpoint << "gemini-pro" << prompt("  hi\n") << Endpoint << "gemini-pro" << prompt("hi")
+                                                << true;
+        QTest::newRow("line endings") << Endpoint << "gemini-pro" << prompt("a\r\nb") << Endpoint << "gemini-pro" << prompt("a\nb") << true;
+        QTest::newRow("key order")
+            << Endpoint << "gemini-pro" << prompt("hi", config) << Endpoint << "gemini-pro"
+            << prompt("hi", QJsonObject{{"maxOutputTokens", 256}, {"temperature", 0.2}}) << true;
+        QTest::newRow("inner whitespace") << Endpoint << "gemini-pro" << prompt("a b") << Endpoint << "gemini-pro" << prompt("a  b") << false;
+        QTest::newRow("model") << Endpoint << "gemini-pro" << prompt("hi") << Endpoint << "gemini-flash" << prompt("hi") << false;
+        QTest::newRow("config") << Endpoint << "gemini-pro" << prompt("hi", config) << Endpoint << "gemini-pro"
+                                << prompt("hi", QJsonObject{{"temperature", 0.9}, {"maxOutputTokens", 256}}) << false;
+        // Only the prompt text is trimmed; other strings are taken as they are
+        QTest::newRow("other strings") << Endpoint << "gemini-pro" << prompt("hi", QJsonObject{{"stop", " x"}})
+                                       << Endpoint << "gemini-pro" << prompt("hi", QJsonObject{{"stop", "x"}}) << false;
+        // The same prompt sent to another server, or another API version, is another answer
+        QTest::newRow("endpoint host") << Endpoint << "gemini-pro" << prompt("hi")
+                                       << "http://127.0.0.1:8080/v1" << "gemini-pro" << prompt("hi") << false;
+        QTest::newRow("endpoint version") << Endpoint << "gemini-pro" << prompt("hi")
+                                          << "https://generativelanguage.googleapis.com/v1beta" << "gemini-pro"
+                                          << prompt("hi") << false;
+        // Concatenating endpoint and model must not be enough to collide
+        QTest::newRow("endpoint and model boundary") << "http://a/v1" << "gemini-pro" << prompt("hi")
+                                                     << "http://a/v1gemini" << "-pro" << prompt("hi") << false;
+    }
+
+    void key() {
+        QFETCH(QString, endpoint);
+        QFETCH(QString, model);
+        QFETCH(QJsonObject, body);
+        QFETCH(QString, otherEndpoint);
+        QFETCH(QString, otherModel);
+        QFETCH(QJsonObject, otherBody);
+        QFETCH(bool, same);
+
+        const QByteArray first = ResponseCache::key(endpoint, model, body);
+        QCOMPARE(first.size(), qsizetype(64));  // Hex SHA-256
+        QCOMPARE(first == ResponseCache::key(otherEndpoint, otherModel, otherBody), same);
+    }
+
+    void memoryAndDiskHits() {
+        const QByteArray key = ResponseCache::key(Endpoint, "gemini-pro", prompt("question"));
+        ResponseCache cache(dir->path());
+        cache.setTtlHours(1);
+        QString text;
+        QVERIFY(!cache.lookup(key, &text));
+        cache.store(key, "answer");
+        QVERIFY(cache.lookup(key, &text));
+        QCOMPARE(text, QString("answer"));
+        QCOMPARE(cache.counters().misses, qint64(1));
+        QCOMPARE(cache.counters().stores, qint64(1));
+        QCOMPARE(cache.counters().memoryHits, qint64(1));
+        QCOMPARE(storedFiles(dir->path()).size(), qsizetype(1));
+
+        // A new instance, as after a restart, reads the file once
+        ResponseCache restarted(dir->path());
+        restarted.setTtlHours(1);
+        text.clear();
+        QVERIFY(restarted.lookup(key, &text));
+        QCOMPARE(text, QString("answer"));
+        QVERIFY(restarted.lookup(key, &text));
+        QCOMPARE(restarted.counters().diskHits, qint64(1));
+        QCOMPARE(restarted.counters().memoryHits, qint64(1));
+    }
+
+    void largeAnswerRoundTrip() {
+        QString answer;
+        for (int i = 0; i < 5000; ++i)
+            answer += QString("line %1 é中\n").arg(i);
+        const QByteArray key = ResponseCache::key(Endpoint, "gemini-pro", prompt("long"));
+        ResponseCache(dir->path()).store(key, answer);
+
+        ResponseCache cache(dir->path());
+        cache.setTtlHours(1);
+        QString text;
+        QVERIFY(cache.lookup(key, &text));
+        QCOMPARE(text, answer);
+        // Stored compressed
+        const QStringList files = storedFiles(dir->path());
+        QCOMPARE(files.size(), qsizetype(1));
+        QVERIFY(QFileInfo(files.first()).size() < answer.toUtf8().size() / 4);
+    }
+
+    void damagedFileIsAMiss() {
+        const QByteArray key = ResponseCache::key(Endpoint, "gemini-pro", prompt("question"));
+        ResponseCache(dir->path()).store(key, "answer");
+        const QStringList files = storedFiles(dir->path());
+        QCOMPARE(files.size(), qsizetype(1));
+        QFile file(files.first());
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        file.write("not a cache entry");
+        file.close();
+
+        ResponseCache cache(dir->path());
+        cache.setTtlHours(1);
+        QString text;
+        QVERIFY(!cache.lookup(key, &text));
+        QCOMPARE(cache.counters().misses, qint64(1));
+    }
+
+    void expiredInMemory() {
+        const QByteArray key = ResponseCache::key(Endpoint, "gemini-pro", prompt("question"));
+        ResponseCache cache(dir->path());
+        cache.setTtlHours(1);
+        cache.store(key, "answer");
+        QTest::qWait(30);
+        cache.setTtlMs(10);
+
+        QString text;
+        QVERIFY(!cache.lookup(key, &text));
+        QCOMPARE(cache.counters().expired, qint64(1));
+        QCOMPARE(cache.counters().misses, qint64(1));
+        QThreadPool::globalInstance()->waitForDone();
+        QVERIFY(storedFiles(dir->path()).isEmpty());
+    }
+
+    // Lookups go by the time stored in the entry, pruning by the file's mtime
+    void expiredOnDisk() {
+        const QByteArray key = ResponseCache::key(Endpoint, "gemini-pro", prompt("question"));
+        ResponseCache(dir->path()).store(key, "answer");
+        QTest::qWait(30);
+        const QStringList files = storedFiles(dir->path());
+        QCOMPARE(files.size(), qsizetype(1));
+        QFile file(files.first());
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.setFileTime(QDateTime::currentDateTimeUtc().addSecs(3600), QFileDevice::FileModificationTime));
+        file.close();
+
+        ResponseCache cache(dir->path());
+        cache.setTtlMs(10);
+        QThreadPool::globalInstance()->waitForDone();
+        QCOMPARE(storedFiles(dir->path()).size(), qsizetype(1));
+        QString text;
+        QVERIFY(!cache.lookup(key, &text));
+        QCOMPARE(cache.counters().expired, qint64(1));
+        QVERIFY(storedFiles(dir->path()).isEmpty());
+    }
+
+    void prune() {
+        const QByteArray oldKey = ResponseCache::key(Endpoint, "gemini-pro", prompt("old"));
+        const QByteArray newKey = ResponseCache::key(Endpoint, "gemini-pro", prompt("new"));
+        {
+            ResponseCache cache(dir->path());
+            cache.setTtlHours(1);
+            cache.store(oldKey, "old answer");
+        }
+        QStringList files = storedFiles(dir->path());
+        QCOMPARE(files.size(), qsizetype(1));
+        QFile file(files.first());
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.setFileTime(QDateTime::currentDateTimeUtc().addSecs(-2 * 3600), QFileDevice::FileModificationTime));
+        file.close();
+
+        ResponseCache cache(dir->path());
+        cache.setTtlHours(24);
+        QThreadPool::globalInstance()->waitForDone();
+        cache.store(newKey, "new answer");
+        QCOMPARE(storedFiles(dir->path()).size(), qsizetype(2));
+
+        cache.setTtlHours(1);
+        QThreadPool::globalInstance()->waitForDone();
+        files = storedFiles(dir->path());
+        QCOMPARE(files.size(), qsizetype(1));
+        QVERIFY(files.first().endsWith(QString::fromLatin1(newKey)));
+    }
+
+    void disabled() {
+        ResponseCache cache(dir->path());
+        cache.setTtlHours(0);
+        QVERIFY(!cache.isEnabled());
+        cache.setTtlHours(2);
+        QVERIFY(cache.isEnabled());
+        QCOMPARE(cache.ttlHours(), 2);
+    }
+
+    void cleanup() {
+        // Prunes still running would race the next test's directory
+        QThreadPool::globalInstance()->waitForDone();
+    }
+
+private:
+    std::unique_ptr<QTemporaryDir> dir;
+};
+
+QTEST_GUILESS_MAIN(TestResponseCache)
+#include "tst_responsecache.moc"
@@ -0,0 +1,140 @@
+#include <QtTest>
+
+#include "rowheights.h"
+
+// The row covering y by a linear scan, or heights.size() below the last one
+static int scanRowAt(const QList<int> &heights, qint64 y) {
+    qint64 top = 0;
+    for (int row = 0; row < heights.size(); ++row) {
+        if (y < top + heights[row] && y >= top)
+            return row;
+        top += heights[row];
+    }
+    return int(heights.size());
+}
+
+static RowHeights fromList(const QList<int> &heights) {
+    RowHeights rows;
+    for (const int height : heights)
+        rows.append(height);
+    return rows;
+}
+
+// Every offset, and the row at every y from the top to just below the
+// last row, agree with a linear scan
+static void verifyAgainstScan(const RowHeights &rows, const QList<int> &heights) {
+    QCOMPARE(rows.size(), int(heights.size()));
+    qint64 top = 0;
+    for (int row = 0; row < heights.size(); ++row) {
+        QCOMPARE(rows.offset(row), top);
+        QCOMPARE(rows.height(row), heights[row]);
+        top += heights[row];
+    }
+    QCOMPARE(rows.total(), top);
+    for (qint64 y = 0; y <= top + 1; ++y)
+        QCOMPARE(rows.rowAt(y), scanRowAt(heights, y));
+}
+
+class TestRowHeights : public QObject {
+    Q_OBJECT
+private slots:
+    void rowAt_data() {
+        QTest::addColumn<QList<int>>("heights");
+        QTest::addColumn<qint64>("y");
+        QTest::addColumn<int>("row");
+
+        const QList<int> rows{10, 20, 30};
+        QTest::newRow("top of the first") << rows << qint64(0) << 0;
+        QTest::newRow("bottom of the first") << rows << qint64(9) << 0;
+        QTest::newRow("top of the second") << rows << qint64(10) << 1;
+        QTest::newRow("inside the last") << rows << qint64(45) << 2;
+        QTest::newRow("bottom of the last") << rows << qint64(59) << 2;
+        QTest::newRow("below the last") << rows << qint64(60) << 3;
+        QTest::newRow("above the first") << rows << qint64(-5) << 0;
+        QTest::newRow("empty") << QList<int>() << qint64(0) << 0;
+        // Rows of height zero, as for a message not yet laid out, cover nothing
+        QTest::newRow("zero height skipped") << QList<int>{10, 0, 0, 5} << qint64(10) << 3;
+        QTest::newRow("zero height first") << QList<int>{0, 7} << qint64(0) << 1;
+        // Not a power of two, so the search starts below size()
+        QTest::newRow("seven rows") << QList<int>{1, 2, 3, 4, 5, 6, 7} << qint64(21) << 6;
+    }
+
+    void rowAt() {
+        QFETCH(QList<int>, heights);
+        QFETCH(qint64, y);
+        QFETCH(int, row);
+
+        QCOMPARE(fromList(heights).rowAt(y), row);
+    }
+
+    void appendKeepsSums() {
+        QList<int> heights;
+        RowHeights rows;
+        for (int i = 0; i < 70; ++i) {
+            heights.append(i % 5 == 0 ? 0 : 3 + i % 11);
+            rows.append(heights.last());
+            verifyAgainstScan(rows, heights);
+        }
+    }
+
+    void set_data() {
+        QTest::addColumn<int>("row");
+        QTest::addColumn<int>("height");
+
+        QTest::newRow("first grows") << 0 << 50;
+        QTest::newRow("middle shrinks") << 16 << 1;
+        QTest::newRow("to zero") << 31 << 0;
+        QTest::newRow("last grows") << 36 << 400;
+        QTest::newRow("unchanged") << 8 << 9;
+    }
+
+    void set() {
+        QFETCH(int, row);
+        QFETCH(int, height);
+
+        QList<int> heights;
+        for (int i = 0; i < 37; ++i)
+            heights.append(1 + i % 17);
+        RowHeights rows = fromList(heights);
+        rows.set(row, height);
+        heights[row] = height;
+        verifyAgainstScan(rows, heights);
+
+        // Rows appended after the change build on the new sums
+        for (int i = 0; i < 5; ++i) {
+            heights.append(4);
+            rows.append(4);
+        }
+        verifyAgainstScan(rows, heights);
+    }
+
+    void randomEdits() {
+        QRandomGenerator random(2024);
+        QList<int> heights;
+        RowHeights rows;
+        for (int i = 0; i < 2000; ++i) {
+            if (heights.isEmpty() || random.bounded(3) == 0) {
+                heights.append(random.bounded(60));
+                rows.append(heights.last());
+            } else {
+                const int row = random.bounded(int(heights.size()));
+                heights[row] = random.bounded(60);
+                rows.set(row, heights[row]);
+            }
+        }
+        verifyAgainstScan(rows, heights);
+    }
+
+    void clear() {
+        RowHeights rows = fromList({5, 6});
+        rows.clear();
+        QCOMPARE(rows.size(), 0);
+        QCOMPARE(rows.total(), qint64(0));
+        rows.append(8);
+        QCOMPARE(rows.rowAt(7), 0);
+        QCOMPARE(rows.rowAt(8), 1);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestRowHeights)
+#include "tst_rowheights.moc"
@@ -0,0 +1,52 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <QFuture>
+#include <QMetaObject>
+#include <QMutex>
+#include <QObject>
+#include <QPromise>
+#include <QThreadPool>
+#include <memory>
+
+// Runs `work` on the global thread pool. The returned future finishes once the
+// work returns; work that runs long should poll promise.isCanceled()
+template <typename T, typename Work>
+QFuture<T> runInPool(Work work) {
+    auto promise = std::make_shared<QPromise<T>>();
+    QFuture<T> future = promise->future();
+    promise->start();
+    QThreadPool::globalInstance()->start([promise, work]() mutable {
+        if (!promise->isCanceled())
+            work(*promise);
+        promise->finish();
+    });
+    return future;
+}
+
+// Lets pool workers hand results back to a QObject that may be destroyed while
+// they run. The owner detaches from its destructor; post() queues under the
+// same lock, so a callback is either queued before the owner goes away, and
+// then discarded with it by Qt, or not queued at all
+class ResultReceiver {
+public:
+    explicit ResultReceiver(QObject *context) : context(context) {}
+
+    void detach() {
+        QMutexLocker locker(&mutex);
+        context = nullptr;
+    }
+
+    template <typename Function>
+    void post(Function &&function) {
+        QMutexLocker locker(&mutex);
+        if (context)
+            QMetaObject::invokeMethod(context, std::forward<Function>(function), Qt::QueuedConnection);
+    }
+
+private:
+    QMutex mutex;
+    QObject *context;
+};
+
+#endif // THREADPOOL_H